@@ -0,0 +1,15 @@
+// This file is auto-generated by mconfig-gen.cc.
+
+#ifndef DINIT_MCONFIG_H
+#define DINIT_MCONFIG_H 1
+
+// Defines
+
+// Constants
+
+constexpr static char DINIT_VERSION[] = "0.12.0";
+constexpr static char SYSCONTROLSOCKET[] = "/run/dinitctl";
+constexpr static char SBINDIR[] = "/sbin";
+constexpr static char SHUTDOWN_PREFIX[] = "";
+
+#endif // DINIT_MCONFIG_H
@@ -756,6 +756,13 @@ class event_loop
         return loop_mech.get_reaper_lock();
     }
 
+    // Get the process file descriptor for a watched child process, or -1 if there is none. Call with
+    // the reaper lock held.
+    int get_child_pidfd(pid_watch_handle_t &handle) noexcept
+    {
+        return loop_mech.get_child_pidfd(handle);
+    }
+
     void register_signal(base_signal_watcher *callBack, int signo)
     {
         std::lock_guard<mutex_t> guard(loop_mech.lock);
@@ -2050,14 +2057,21 @@ class child_proc_watcher : private dprivate::base_child_watcher
     // already terminated.
     int send_signal(event_loop_t &loop, int signo) noexcept
     {
-        auto reaper_mutex = loop.get_reaper_mutex();
-        std::lock_guard<decltype(reaper_mutex)> guard(reaper_mutex);
+        auto &reaper_mutex = loop.get_reaper_lock();
+        std::lock_guard<typename std::remove_reference<decltype(reaper_mutex)>::type> guard(reaper_mutex);
 
         if (this->child_termd) {
             errno = ESRCH;
             return -1;
         }
 
+#if DASYNQ_HAVE_PIDFD
+        int pidfd = loop.get_child_pidfd(this->watch_handle);
+        if (pidfd != -1) {
+            return syscall(SYS_pidfd_send_signal, pidfd, signo, nullptr, 0);
+        }
+#endif
+
         return kill(this->watch_pid, signo);
     }
 
@@ -5,9 +5,20 @@
 #include <sys/wait.h>
 
 #include <csignal>
+#include <tuple>
 
+#include "config.h"
 #include "btree_set.h"
 
+#if DASYNQ_HAVE_PIDFD
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+#endif
+
 namespace dasynq {
 
 namespace dprivate {
@@ -16,7 +27,14 @@ namespace dprivate {
 // be later added with no danger of allocator exhaustion (bad_alloc).
 class pid_map
 {
-    using bmap_t = btree_set<void *, pid_t>;
+    // Data for each mapping: the user data, and a process file descriptor for the process (or -1)
+    struct pid_data
+    {
+        void *val;
+        int pidfd;
+    };
+
+    using bmap_t = btree_set<pid_data, pid_t>;
     bmap_t b_map;
     
     public:
@@ -31,7 +49,7 @@ class pid_map
         if (it == nullptr) {
             return entry(false, nullptr);
         }
-        return entry(true, b_map.node_data(*it));
+        return entry(true, b_map.node_data(*it).val);
     }
     
     entry remove(pid_t key) noexcept
@@ -41,10 +59,31 @@ class pid_map
             return entry(false, nullptr);
         }
         b_map.remove(*it);
-        return entry(true, b_map.node_data(*it));
+        return entry(true, b_map.node_data(*it).val);
+    }
+
+    // Find the handle for a key; returns nullptr if not present
+    pid_handle_t *find(pid_t key) noexcept
+    {
+        return b_map.find(key);
+    }
+
+    void *get_val(pid_handle_t &hndl) noexcept
+    {
+        return b_map.node_data(hndl).val;
+    }
+
+    int &pidfd(pid_handle_t &hndl) noexcept
+    {
+        return b_map.node_data(hndl).pidfd;
+    }
+
+    bool is_present(pid_handle_t &hndl) noexcept
+    {
+        return b_map.is_queued(hndl);
     }
     
-    void remove(pid_handle_t &hndl)
+    void remove(pid_handle_t &hndl) noexcept
     {
         if (b_map.is_queued(hndl)) {
             b_map.remove(hndl);
@@ -54,7 +93,7 @@ class pid_map
     // Throws bad_alloc on reservation failure
     void reserve(pid_handle_t &hndl)
     {
-        b_map.allocate(hndl);
+        b_map.allocate(hndl, pid_data {nullptr, -1});
     }
     
     void unreserve(pid_handle_t &hndl) noexcept
@@ -65,13 +104,13 @@ class pid_map
     void add(pid_handle_t &hndl, pid_t key, void *val) // throws std::bad_alloc
     {
         reserve(hndl);
-        b_map.node_data(hndl) = val;
+        b_map.node_data(hndl).val = val;
         b_map.insert(hndl, key);
     }
     
     void add_from_reserve(pid_handle_t &hndl, pid_t key, void *val) noexcept
     {
-        b_map.node_data(hndl) = val;
+        b_map.node_data(hndl).val = val;
         b_map.insert(hndl, key);
     }
 };
@@ -85,6 +124,24 @@ inline void sigchld_handler(int signum)
     // hurt in any case).
 }
 
+#if DASYNQ_HAVE_PIDFD
+
+// Convert the status reported by waitid() into a status as would be reported by waitpid() (using
+// the Linux encoding).
+inline int wait_status_from_siginfo(const siginfo_t &info) noexcept
+{
+    switch (info.si_code) {
+    case CLD_EXITED:
+        return (info.si_status & 0xff) << 8;
+    case CLD_DUMPED:
+        return info.si_status | 0x80;
+    default: // CLD_KILLED
+        return info.si_status;
+    }
+}
+
+#endif
+
 } // namespace dprivate
 
 using pid_watch_handle_t = dprivate::pid_map::pid_handle_t;
@@ -103,7 +160,143 @@ template <class Base> class child_proc_events : public Base
     private:
     dprivate::pid_map child_waiters;
     reaper_mutex_t reaper_lock; // used to prevent reaping while trying to signal a process
-    
+
+#if DASYNQ_HAVE_PIDFD
+    // Where supported, each watched child has a process file descriptor (pidfd), which is watched
+    // by the loop mechanism (as an ordinary file descriptor) and used to reap the child. This avoids
+    // any possibility of a process id being re-used while it is still being referred to. SIGCHLD is
+    // still handled, for children which cannot be watched this way (and for reaping unwatched
+    // children).
+
+    // The loop mechanism (which derives from this class) and functions to add/remove fd watches:
+    void *loop_mech_p = nullptr;
+    void (*add_pidfd_watch_f)(void *, int, void *) = nullptr;
+    void (*remove_pidfd_watch_f)(void *, int) = nullptr;
+
+    template <typename T> static void add_pidfd_watch(void *loop_mech, int fd, void *userdata)
+    {
+        static_cast<T *>(loop_mech)->add_fd_watch(fd, userdata, IN_EVENTS);
+    }
+
+    template <typename T> static void remove_pidfd_watch(void *loop_mech, int fd) noexcept
+    {
+        static_cast<T *>(loop_mech)->remove_fd_watch_nolock(fd, IN_EVENTS);
+    }
+
+    // The user data for a pidfd watch is the address of the pid handle, tagged by setting the low
+    // bit (which distinguishes it from the user data for other watches, which are aligned pointers).
+    static void *pidfd_userdata(pid_watch_handle_t &handle) noexcept
+    {
+        return reinterpret_cast<char *>(&handle) + 1;
+    }
+
+    static bool is_pidfd_userdata(void *userdata) noexcept
+    {
+        return (reinterpret_cast<uintptr_t>(userdata) & 1) != 0;
+    }
+
+    static pid_watch_handle_t &handle_from_userdata(void *userdata) noexcept
+    {
+        return *reinterpret_cast<pid_watch_handle_t *>(static_cast<char *>(userdata) - 1);
+    }
+
+    // Open and watch a pidfd for a newly watched child. On failure (eg if the kernel doesn't support
+    // pidfds), the child is tracked via SIGCHLD only.
+    void attach_pidfd(pid_watch_handle_t &handle, pid_t child) noexcept
+    {
+        if (loop_mech_p == nullptr) return;
+
+        int fd = syscall(SYS_pidfd_open, child, 0);
+        if (fd == -1) return;
+
+        try {
+            add_pidfd_watch_f(loop_mech_p, fd, pidfd_userdata(handle));
+        }
+        catch (...) {
+            close(fd);
+            return;
+        }
+
+        child_waiters.pidfd(handle) = fd;
+    }
+
+    void detach_pidfd(pid_watch_handle_t &handle) noexcept
+    {
+        int &fd = child_waiters.pidfd(handle);
+        if (fd != -1) {
+            remove_pidfd_watch_f(loop_mech_p, fd);
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    // Reap a watched child via its pidfd, if it has terminated. Returns true if reaped.
+    bool reap_via_pidfd(pid_watch_handle_t &handle) noexcept
+    {
+        siginfo_t info;
+        info.si_pid = 0;
+        if (waitid((idtype_t) P_PIDFD, child_waiters.pidfd(handle), &info, WEXITED | WNOHANG) == -1
+                || info.si_pid == 0) {
+            return false;
+        }
+
+        detach_pidfd(handle);
+        child_waiters.remove(handle);
+        Base::receive_child_stat(info.si_pid, dprivate::wait_status_from_siginfo(info),
+                child_waiters.get_val(handle));
+        return true;
+    }
+
+    void reap_children() noexcept
+    {
+        // Find each terminated child (without reaping it), and then reap it via its pidfd if it
+        // has one:
+        while (true) {
+            siginfo_t info;
+            info.si_pid = 0;
+            if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) == -1 || info.si_pid == 0) {
+                break;
+            }
+
+            pid_t child = info.si_pid;
+            auto handle_p = child_waiters.find(child);
+            if (handle_p != nullptr && child_waiters.pidfd(*handle_p) != -1) {
+                if (reap_via_pidfd(*handle_p)) {
+                    continue;
+                }
+            }
+
+            int status;
+            if (waitpid(child, &status, WNOHANG) <= 0) {
+                break;
+            }
+            if (handle_p != nullptr) {
+                detach_pidfd(*handle_p);
+                child_waiters.remove(*handle_p);
+                Base::receive_child_stat(child, status, child_waiters.get_val(*handle_p));
+            }
+        }
+    }
+
+#else
+
+    void attach_pidfd(pid_watch_handle_t &handle, pid_t child) noexcept { }
+    void detach_pidfd(pid_watch_handle_t &handle) noexcept { }
+
+    void reap_children() noexcept
+    {
+        int status;
+        pid_t child;
+        while ((child = waitpid(-1, &status, WNOHANG)) > 0) {
+            auto ent = child_waiters.remove(child);
+            if (ent.first) {
+                Base::receive_child_stat(child, status, ent.second);
+            }
+        }
+    }
+
+#endif
+
     protected:
     using sigdata_t = typename traits_t::sigdata_t;
     
@@ -111,15 +304,8 @@ template <class Base> class child_proc_events : public Base
     bool receive_signal(T & loop_mech, sigdata_t &siginfo, void *userdata)
     {
         if (siginfo.get_signo() == SIGCHLD) {
-            int status;
-            pid_t child;
             reaper_lock.lock();
-            while ((child = waitpid(-1, &status, WNOHANG)) > 0) {
-                auto ent = child_waiters.remove(child);
-                if (ent.first) {
-                    Base::receive_child_stat(child, status, ent.second);
-                }
-            }
+            reap_children();
             reaper_lock.unlock();
             return false; // leave signal watch enabled
         }
@@ -127,7 +313,31 @@ template <class Base> class child_proc_events : public Base
             return Base::receive_signal(loop_mech, siginfo, userdata);
         }
     }
-    
+
+#if DASYNQ_HAVE_PIDFD
+    template <typename T>
+    std::tuple<int, typename traits_t::fd_s>
+    receive_fd_event(T &loop_mech, typename traits_t::fd_r fd_r_a, void * userdata, int flags)
+    {
+        if (is_pidfd_userdata(userdata)) {
+            // A pidfd becomes readable when the process terminates
+            pid_watch_handle_t &handle = handle_from_userdata(userdata);
+            int fd = child_waiters.pidfd(handle);
+            if (fd == -1) {
+                // Already reaped (via SIGCHLD), and the watch removed
+                return std::make_tuple(0, typename traits_t::fd_s(fd));
+            }
+            reaper_lock.lock();
+            bool reaped = reap_via_pidfd(handle);
+            reaper_lock.unlock();
+            return std::make_tuple(reaped ? 0 : IN_EVENTS, typename traits_t::fd_s(fd));
+        }
+        else {
+            return Base::receive_fd_event(loop_mech, fd_r_a, userdata, flags);
+        }
+    }
+#endif
+
     public:
     void reserve_child_watch_nolock(pid_watch_handle_t &handle)
     {
@@ -148,24 +358,29 @@ template <class Base> class child_proc_events : public Base
     void add_child_watch_nolock(pid_watch_handle_t &handle, pid_t child, void *val)
     {
         child_waiters.add(handle, child, val);
+        attach_pidfd(handle, child);
     }
     
     void add_reserved_child_watch(pid_watch_handle_t &handle, pid_t child, void *val) noexcept
     {
         std::lock_guard<decltype(Base::lock)> guard(Base::lock);
-        child_waiters.add_from_reserve(handle, child, val);
+        add_reserved_child_watch_nolock(handle, child, val);
     }
 
     void add_reserved_child_watch_nolock(pid_watch_handle_t &handle, pid_t child, void *val) noexcept
     {
         child_waiters.add_from_reserve(handle, child, val);
+        attach_pidfd(handle, child);
     }
     
     // Stop watching a child, but retain watch reservation
     void stop_child_watch(pid_watch_handle_t &handle) noexcept
     {
         std::lock_guard<decltype(Base::lock)> guard(Base::lock);
-        child_waiters.remove(handle);
+        if (child_waiters.is_present(handle)) {
+            detach_pidfd(handle);
+            child_waiters.remove(handle);
+        }
     }
 
     void remove_child_watch(pid_watch_handle_t &handle) noexcept
@@ -176,9 +391,22 @@ template <class Base> class child_proc_events : public Base
 
     void remove_child_watch_nolock(pid_watch_handle_t &handle) noexcept
     {
-        child_waiters.remove(handle);
+        if (child_waiters.is_present(handle)) {
+            detach_pidfd(handle);
+            child_waiters.remove(handle);
+        }
         child_waiters.unreserve(handle);
     }
+
+    // Get the process file descriptor for a watched child, or -1 if it has none (if the child has
+    // terminated, or pidfds are not supported). Call with the reaper lock held.
+    int get_child_pidfd(pid_watch_handle_t &handle) noexcept
+    {
+        if (!child_waiters.is_present(handle)) {
+            return -1;
+        }
+        return child_waiters.pidfd(handle);
+    }
     
     // Get the reaper lock, which can be used to ensure that a process is not reaped while attempting to
     // signal it.
@@ -206,6 +434,12 @@ template <class Base> class child_proc_events : public Base
         // Specify a dummy user data value - sigchld_handler
         loop_mech->add_signal_watch(SIGCHLD, (void *) dprivate::sigchld_handler);
         Base::init(loop_mech);
+
+#if DASYNQ_HAVE_PIDFD
+        loop_mech_p = loop_mech;
+        add_pidfd_watch_f = add_pidfd_watch<T>;
+        remove_pidfd_watch_f = remove_pidfd_watch<T>;
+#endif
     }
 };
 
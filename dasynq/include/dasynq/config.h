@@ -83,6 +83,16 @@
 #endif
 #endif
 
+#if !defined(DASYNQ_HAVE_PIDFD)
+#if defined(__linux__)
+#include <sys/syscall.h>
+#if defined(SYS_pidfd_open) && defined(SYS_pidfd_send_signal)
+// Child processes are tracked via process file descriptors, where the kernel supports them (Linux 5.3+):
+#define DASYNQ_HAVE_PIDFD 1
+#endif
+#endif
+#endif
+
 // General feature availability
 
 #if (defined(__OpenBSD__) || defined(__linux__)) && ! defined(HAVE_PIPE2)
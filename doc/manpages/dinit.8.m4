@@ -9,7 +9,10 @@ dinit \- supervise processes and manage services
 .B dinit
 [\fB\-s\fR|\fB\-\-system\fR|\fB\-u\fR|\fB\-\-user\fR] [\fB\-d\fR|\fB\-\-services\-dir\fR \fIdir\fR]
 [\fB\-p\fR|\fB\-\-socket\-path\fR \fIpath\fR] [\fB\-e\fR|\fB\-\-env\-file\fR \fIpath\fR]
-[\fB\-l\fR|\fB\-\-log\-file\fR \fIpath\fR]
+[\fB\-l\fR|\fB\-\-log\-file\fR \fIpath\fR] [\fB\-\-service\-cache\fR \fIfile\fR] [\fB\-\-preload\fR]
+[\fB\-\-auto\-reload\fR]
+[\fB\-\-control\-output\-limit\fR \fIbytes\fR] [\fB\-\-control\-total\-output\-limit\fR \fIbytes\fR]
+[\fB\-\-start\-limit\fR \fIcount\fR]
 [\fIservice-name\fR...]
 .\"
 .SH DESCRIPTION
@@ -89,6 +92,48 @@ the \fBshutdown\fR program.
 Run with no output to the terminal/console. This disables service status messages
 and sets the log level for the console log to \fBNONE\fR.
 .TP
+\fB\-\-service\-cache\fR \fIfile\fP
+Use the pre-parsed service descriptions in \fIfile\fP, as written by \fBdinitcheck\fR(8) with
+its \fB\-\-write\-cache\fR option, to avoid parsing service description files when services are
+loaded. A cache record is only used if the corresponding service description file has not been
+modified since the cache was written; the whole cache is ignored if it was written for a different
+set of service directories, or if the user or group database has since changed. Services are
+always re-read from their description files when reloaded.
+.TP
+\fB\-\-preload\fR
+At startup, before starting any services, load all service descriptions found in the service
+directories (see \fBpreload\fR in \fBdinitctl\fR(8)). Services which cannot be loaded are reported
+together, along with the time taken to load all services.
+.TP
+\fB\-\-auto\-reload\fR
+Watch the service directories for changes (Linux only) and, shortly after a service description
+file is modified or replaced, reload the corresponding service if it is loaded (as per \fBreload\fR
+in \fBdinitctl\fR(8)). Changes to dependency directories (such as those specified via
+\fBwaits-for.d\fR) are not detected. A service which is currently in use by a control connection
+will not be reloaded.
+.TP
+\fB\-\-control\-output\-limit\fR \fIbytes\fR
+Set the limit (the default is 256 KiB) on output queued for a single control connection, i.e.
+replies and notifications which the client has not yet read. A connection which exceeds the limit
+is not served further requests until its queued output has drained to half the limit. A client
+that does not read service event notifications, so that they accumulate beyond twice the limit,
+is disconnected.
+.TP
+\fB\-\-control\-total\-output\-limit\fR \fIbytes\fR
+Set the limit (the default is 4 MiB) on the output queued for all control connections together.
+While this limit is exceeded, connections which have output queued are not served further
+requests, as above.
+.TP
+\fB\-\-start\-limit\fR \fIcount\fR
+Limit the number of services (of the \fBprocess\fR, \fBbgprocess\fR and \fBscripted\fR types) which
+may be starting at the same time, counting from when a service's process is launched until the
+service has started (including any wait for readiness notification) or has stopped. Once its
+dependencies have started, a service which would exceed the limit waits until another service
+finishes starting; waiting services are started in order of the length of the chain of other
+services waiting for them, longest first. This can reduce contention at boot on machines with
+limited CPU or I/O capacity. A service which does not finish starting (and has no start timeout)
+holds its place indefinitely. The default, 0, is no limit.
+.TP
 \fB\-\-help\fR
 Display brief help text and then exit.
 \fB\-\-version\fR
@@ -145,6 +190,14 @@ existence of an already-active socket first, and will refuse to start if one
 exists. Unfortunately, this check cannot be done atomically, and should not be
 relied upon generally as a means to avoid starting two instances of dinit.
 
+Alongside the control socket, Dinit creates a status page: a file (with the
+same path as the control socket, but with \fI.status\fR appended) holding a
+record of the state of each loaded service, which Dinit updates as service
+states change. Like the control socket, the status page is accessible only to
+the user running Dinit. Monitoring programs can map this file into memory and read
+service status without communicating with Dinit (see \fBdinitctl list
+\-\-fast\fR). The status page is removed when Dinit terminates.
+
 Process-based services are monitored and, if the process terminates, the
 service may be stopped or the process may be re-started, according to the
 configuration in the service description.
@@ -8,6 +8,7 @@ dinitcheck \- check service configuration
 .HP \w'\ 'u
 .B dinitcheck
 [\fB\-d\fR|\fB\-\-services\-dir\fR \fIdir\fR]
+[\fB\-\-write\-cache\fR \fIfile\fR|\fB\-\-verify\-cache\fR \fIfile\fR]
 [\fIservice-name\fR...]
 .\"
 .SH DESCRIPTION
@@ -39,6 +40,16 @@ If not specified, the default is \fI$HOME/dinit.d\fR or, for the
 system service manager, each of \fI/etc/dinit.d/fR, \fI/usr/local/lib/dinit.d\fR,
 and \fI/lib/dinit.d\fR (searched in that order).
 .TP
+\fB\-\-write\-cache\fR \fIfile\fP
+Write the parsed descriptions of the checked services to \fIfile\fP, for use by \fBdinit\fR via its
+\fB\-\-service\-cache\fR option. Services with errors in their description are not included in
+the cache. The cache should be regenerated whenever service descriptions are modified (though
+\fBdinit\fR will ignore stale records).
+.TP
+\fB\-\-verify\-cache\fR \fIfile\fP
+Check that the service cache in \fIfile\fP is usable and up-to-date for each of the checked
+services, and report an error for any that are not.
+.TP
 \fB\-\-help\fR
 Display brief help text and then exit.
 .TP
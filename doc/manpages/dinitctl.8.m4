@@ -6,19 +6,19 @@ dinitctl \- control services supervised by Dinit
 .SH SYNOPSIS
 .\"
 .B dinitctl
-[\fIoptions\fR] \fBstart\fR [\fB\-\-no\-wait\fR] [\fB\-\-pin\fR] \fIservice-name\fR
+[\fIoptions\fR] \fBstart\fR [\fB\-\-no\-wait\fR] [\fB\-\-pin\fR] \fIservice-name\fR...
 .br
 .B dinitctl
-[\fIoptions\fR] \fBstop\fR [\fB\-\-no\-wait\fR] [\fB\-\-pin\fR] [\fB\-\-ignore\-unstarted\fR] \fIservice-name\fR
+[\fIoptions\fR] \fBstop\fR [\fB\-\-no\-wait\fR] [\fB\-\-pin\fR] [\fB\-\-ignore\-unstarted\fR] \fIservice-name\fR...
 .br
 .B dinitctl
-[\fIoptions\fR] \fBrestart\fR [\fB\-\-no\-wait\fR] [\fB\-\-ignore\-unstarted\fR] \fIservice-name\fR
+[\fIoptions\fR] \fBrestart\fR [\fB\-\-no\-wait\fR] [\fB\-\-ignore\-unstarted\fR] \fIservice-name\fR...
 .br
 .B dinitctl
-[\fIoptions\fR] \fBwake\fR [\fB\-\-no\-wait\fR] \fIservice-name\fR
+[\fIoptions\fR] \fBwake\fR [\fB\-\-no\-wait\fR] \fIservice-name\fR...
 .br
 .B dinitctl
-[\fIoptions\fR] \fBrelease\fR [\fB\-\-ignore\-unstarted\fR] \fIservice-name\fR
+[\fIoptions\fR] \fBrelease\fR [\fB\-\-ignore\-unstarted\fR] \fIservice-name\fR...
 .br
 .B dinitctl
 [\fIoptions\fR] \fBunpin\fR \fIservice-name\fR
@@ -30,7 +30,7 @@ dinitctl \- control services supervised by Dinit
 [\fIoptions\fR] \fBreload\fR \fIservice-name\fR
 .br
 .B dinitctl
-[\fIoptions\fR] \fBlist\fR
+[\fIoptions\fR] \fBlist\fR [\fB\-\-fast\fR] [\fB\-\-state\fR \fIstate\fR] [\fB\-\-target\fR \fIstate\fR] [\fB\-\-type\fR \fItype\fR] [\fB\-\-prefix\fR \fIname-prefix\fR]
 .br
 .B dinitctl
 [\fIoptions\fR] \fBshutdown\fR
@@ -46,6 +46,21 @@ dinitctl \- control services supervised by Dinit
 .br
 .B dinitctl
 [\fIoptions\fR] \fBdisable\fR [\fB\-\-from\fR \fIfrom-service\fR] \fIto-service\fR
+.br
+.B dinitctl
+[\fIoptions\fR] \fBpreload\fR
+.br
+.B dinitctl
+[\fIoptions\fR] \fBevents\fR
+.br
+.B dinitctl
+[\fIoptions\fR] \fBstatus\fR \fIservice-name\fR...
+.br
+.B dinitctl
+[\fIoptions\fR] \fBanalyze\fR [\fIservice-name\fR]
+.br
+.B dinitctl
+[\fIoptions\fR] \fBtrace dump\fR
 .\"
 .SH DESCRIPTION
 .\"
@@ -107,7 +122,11 @@ If the service is not started or doesn't exist, ignore the command and return an
 success.
 .TP
 \fIservice-name\fR
-Specifies the name of the service to which the command applies.
+Specifies the name of the service to which the command applies. The \fBstart\fR, \fBstop\fR,
+\fBrestart\fR, \fBwake\fR, \fBrelease\fR and \fBstatus\fR commands accept several service names,
+and apply to each of the named services. The requests for all services are sent to the daemon
+together, and (unless \fB\-\-no\-wait\fR is specified) all services are waited for at once; the
+exit status indicates failure if the command failed for any of the services.
 .TP
 \fBstart\fR
 Start the specified service. The service is marked as explicitly activated and will not be stopped
@@ -182,6 +201,29 @@ service process unexpectedly terminated with an error status or signal while run
 
 Additional information, if available, will be printed after the service name: whether the service owns,
 or is waiting to acquire, the console; the process ID; the exit status or signal that caused termination.
+
+The listing can be restricted using the following options (which are applied by the \fBdinit\fR
+daemon, and require a daemon of the same version as \fBdinitctl\fR):
+.TP
+\fB\-\-state\fR \fIstate\fR, \fB\-\-target\fR \fIstate\fR
+List only services currently in (or with a target state of) the specified state, one of
+\fBstarted\fR, \fBstopped\fR, \fBstarting\fR or \fBstopping\fR.
+.TP
+\fB\-\-type\fR \fItype\fR
+List only services of the specified type, one of \fBprocess\fR, \fBbgprocess\fR, \fBscripted\fR
+or \fBinternal\fR.
+.TP
+\fB\-\-prefix\fR \fIname-prefix\fR
+List only services with a name beginning with the specified prefix.
+.TP
+\fB\-\-fast\fR
+Read service status from the status page published by the daemon (a file alongside the control
+socket, with \fI.status\fR appended to the socket path) rather than querying the daemon via the
+control socket. This requires no processing by the daemon, but only reflects the status of services
+at the time the status page was read, and service names longer than 84 characters are shown
+truncated. The filtering options above may be used, and are applied by \fBdinitctl\fR. If the
+status of any service could not be read (for example because the daemon terminated while updating
+it), this is reported and \fBdinitctl\fR exits with a failure status.
 .RE
 .TP
 \fBshutdown\fR
@@ -216,6 +258,45 @@ Permanently disable a \fBwaits-for\fR dependency between two services. This is t
 Note that the \fBdisable\fR command affects only the dependency specified (or implied). It has no
 other effect, and a service that is "disabled" may still be started if it is a dependency of
 another started service.
+.TP
+\fBpreload\fR
+Load every service description found in the service directories (and their dependencies), without
+starting any service. Any services which fail to load are reported in the \fBdinit\fR log; this
+makes it possible to find all problems, such as dependency cycles, at once. The number of services
+loaded and the time taken is displayed, and the exit status is non-zero if any service failed to
+load. Executable files and files whose names begin with a dot are not considered to be service
+descriptions.
+.TP
+\fBevents\fR
+Report events (service started, stopped, failed to start, or start or stop cancelled) for all
+services as they occur, one per line, with the time of the event and the service name. This
+continues until the daemon closes the connection (for example, when it exits), or until interrupted.
+.TP
+\fBstatus\fR
+Display the full status of a loaded service: its type, current and target state, how long it has
+been in the current state, the reason it last stopped, its process ID, the time since a process was
+last launched for it and that process's exit status, the execution stage and error of the most recent
+failure to launch a process, the number of times it has been restarted (in total and within the
+current restart interval), and the total time it has spent in each state since it was loaded.
+.TP
+\fBanalyze\fR
+Analyse service startup, using the timeline of service state transitions recorded by the daemon.
+Displays the time at which the specified service (or, if none is specified, the service which was
+last to start) started, relative to when the daemon started; the time each service took to start once
+its dependencies had started, and the time it spent waiting for its dependencies, longest first; and
+the \fIcritical chain\fR: the chain of dependencies, each the last to start of the dependencies of the
+service above it, which determined when the service started. Only the first start of each service is
+considered (except in the critical chain). The timeline has a bounded size; if earlier events have
+been discarded, this is noted.
+.TP
+\fBtrace dump\fR
+Write the timeline of service state transitions recorded by the daemon to standard output, in the
+Chrome trace event (JSON) format, suitable for viewing with \fIchrome://tracing\fR or Perfetto. Each
+service appears as a separate track, with a span for each start and stop of the service; within a
+start, nested spans show the time spent waiting for dependencies, waiting for the console, waiting
+for a start slot (see \fB\-\-start\-limit\fR in \fBdinit\fR(8)), launching the service process
+("exec"), and waiting for the service to become ready. Spans still in progress are shown as ending
+at the time of the dump.
 .\"
 .SH SERVICE OPERATION
 .\"
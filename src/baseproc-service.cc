@@ -11,6 +11,7 @@
 #include "dinit-log.h"
 #include "dinit-socket.h"
 #include "proc-service.h"
+#include "env-file.h"
 
 #include "baseproc-sys.h"
 
@@ -20,6 +21,26 @@
  * See proc-service.h for interface documentation.
  */
 
+extern char **environ;
+
+// Stack for a child process created via vfork_spawn. Only one such child exists at a time (since
+// we are suspended until it execs), so a single stack suffices.
+alignas(16) static char vfork_stack[64 * 1024];
+
+// Arguments for base_process_service::vfork_child
+struct vfork_child_args
+{
+    base_process_service *service;
+    run_proc_params *params;
+};
+
+int base_process_service::vfork_child(void *arg) noexcept
+{
+    vfork_child_args *args = static_cast<vfork_child_args *>(arg);
+    args->service->run_child_proc(*args->params);
+    return 0; // not reached
+}
+
 void base_process_service::do_smooth_recovery() noexcept
 {
     if (! restart_ps_process()) {
@@ -95,6 +116,8 @@ bool base_process_service::start_ps_process(const std::vector<const char *> &cmd
     // is written to the pipe, and the parent can read it.
 
     event_loop.get_time(last_start_time, clock_type::MONOTONIC);
+    have_start_time = true;
+    services->record_timeline(this, timeline_event_t::EXEC);
 
     int pipefd[2];
     if (bp_sys::pipe2(pipefd, O_CLOEXEC)) {
@@ -116,6 +139,9 @@ bool base_process_service::start_ps_process(const std::vector<const char *> &cmd
     ready_notify_watcher * rwatcher = have_notify ? get_ready_watcher() : nullptr;
     bool ready_watcher_registered = false;
 
+    std::vector<const char *> child_envp;
+    std::vector<char> notify_var_buf;
+
     if (onstart_flags.pass_cs_fd) {
         if (dinit_socketpair(AF_UNIX, SOCK_STREAM, /* protocol */ 0, control_socket, SOCK_NONBLOCK)) {
             log(loglevel_t::ERROR, get_name(), ": can't create control socket: ", strerror(errno));
@@ -156,30 +182,39 @@ bool base_process_service::start_ps_process(const std::vector<const char *> &cmd
         }
     }
 
-    // Set up complete, now fork and exec:
-
-    pid_t forkpid;
-
+    // Prepare the environment for the child (reserving slots for the variables that it sets):
     try {
-        child_status_listener.add_watch(event_loop, pipefd[0], dasynq::IN_EVENTS);
-        child_status_registered = true;
-
-        // We specify a high priority (i.e. low priority value) so that process termination is
-        // handled early. This means we have always recorded that the process is terminated by the
-        // time that we handle events that might otherwise cause us to signal the process, so we
-        // avoid sending a signal to an invalid (and possibly recycled) process ID.
-        forkpid = child_listener.fork(event_loop, reserved_child_watch, dasynq::DEFAULT_PRIORITY - 10);
-        reserved_child_watch = true;
-    }
-    catch (std::exception &e) {
-        log(loglevel_t::ERROR, get_name(), ": could not fork: ", e.what());
+        const std::vector<std::string> *env_vars = nullptr;
+        if (!env_file.empty()) {
+            env_vars = &get_env_file_vars(env_file.c_str());
+        }
+        build_child_env(child_envp, env_vars, 4);
+
+        if (!notification_var.empty()) {
+            // variable name, '=', value (an int), and nul terminator:
+            notify_var_buf.resize(notification_var.length() + 1 + ((CHAR_BIT * sizeof(int) - 1 + 2) / 3) + 1);
+        }
+    }
+    catch (std::system_error &sys_err) {
+        log(loglevel_t::ERROR, get_name(), ": can't read environment file: ", sys_err.code().message());
+        // Report as for a failure in the child (which is where the file used to be read):
+        exec_err_info = { exec_stage::READ_ENV_FILE, sys_err.code().value() };
+        have_exec_err = true;
+        if (get_state() == service_state_t::STARTING) {
+            stop_reason = stopped_reason_t::EXECFAILED;
+        }
+        goto out_cs_h;
+    }
+    catch (std::bad_alloc &) {
+        log(loglevel_t::ERROR, get_name(), ": can't launch process; out of memory");
         goto out_cs_h;
     }
 
-    if (forkpid == 0) {
+    // Set up complete, now fork and exec:
+
+    {
         const char * working_dir_c = nullptr;
         if (! working_dir.empty()) working_dir_c = working_dir.c_str();
-        after_fork(getpid());
         run_proc_params run_params{cmd.data(), working_dir_c, logfile, pipefd[1], run_as_uid, run_as_gid, rlimits};
         run_params.on_console = on_console;
         run_params.in_foreground = !onstart_flags.shares_console;
@@ -188,12 +223,70 @@ bool base_process_service::start_ps_process(const std::vector<const char *> &cmd
         run_params.notify_fd = notify_pipe[1];
         run_params.force_notify_fd = force_notification_fd;
         run_params.notify_var = notification_var.c_str();
-        run_params.env_file = env_file.c_str();
-        run_child_proc(run_params);
-    }
-    else {
+        run_params.envp = &child_envp;
+        run_params.notify_var_buf = notify_var_buf.data();
+        run_params.notify_var_bufsz = notify_var_buf.size();
+
+        pid_t forkpid;
+
+        try {
+            child_status_listener.add_watch(event_loop, pipefd[0], dasynq::IN_EVENTS);
+            child_status_registered = true;
+
+            if (can_vfork(on_console)) {
+                // Launch via vfork_spawn, avoiding the cost of fork (which must copy page tables,
+                // significant if we are large). The child shares our memory until it execs, and
+                // we are suspended until then.
+                if (!reserved_child_watch) {
+                    child_listener.reserve_watch(event_loop);
+                    reserved_child_watch = true;
+                }
+
+                // Block all signals so that no signal handler runs in the child (which would use
+                // our memory); run_child_proc sets the original mask before exec. Since the child
+                // may also modify the environment pointer before exec, we restore it afterwards.
+                sigset_t sigall_set;
+                sigset_t orig_sigmask;
+                sigfillset(&sigall_set);
+                sigprocmask(SIG_SETMASK, &sigall_set, &orig_sigmask);
+                run_params.signal_mask = &orig_sigmask;
+
+                char **orig_environ = environ;
+                vfork_child_args child_args { this, &run_params };
+                forkpid = bp_sys::vfork_spawn(vfork_child, &child_args, vfork_stack, sizeof(vfork_stack));
+                int spawn_errno = errno;
+                environ = orig_environ;
+                sigprocmask(SIG_SETMASK, &orig_sigmask, nullptr);
+
+                if (forkpid == -1) {
+                    throw std::system_error(spawn_errno, std::system_category());
+                }
+
+                // Priority as for fork (below):
+                child_listener.add_reserved(event_loop, forkpid, dasynq::DEFAULT_PRIORITY - 10);
+            }
+            else {
+                // We specify a high priority (i.e. low priority value) so that process termination is
+                // handled early. This means we have always recorded that the process is terminated by the
+                // time that we handle events that might otherwise cause us to signal the process, so we
+                // avoid sending a signal to an invalid (and possibly recycled) process ID.
+                forkpid = child_listener.fork(event_loop, reserved_child_watch, dasynq::DEFAULT_PRIORITY - 10);
+                reserved_child_watch = true;
+            }
+        }
+        catch (std::exception &e) {
+            log(loglevel_t::ERROR, get_name(), ": could not fork: ", e.what());
+            goto out_cs_h;
+        }
+
+        if (forkpid == 0) {
+            after_fork(getpid());
+            run_child_proc(run_params);
+        }
+
         // Parent process
         pid = forkpid;
+        status_changed();
 
         bp_sys::close(pipefd[1]); // close the 'other end' fd
         if (control_socket[1] != -1) bp_sys::close(control_socket[1]);
@@ -255,6 +348,8 @@ base_process_service::base_process_service(service_set *sset, string name,
     waiting_stopstart_timer = false;
     reserved_child_watch = false;
     tracking_child = false;
+    have_start_time = false;
+    have_exec_err = false;
 }
 
 void base_process_service::do_restart() noexcept
@@ -265,6 +360,10 @@ void base_process_service::do_restart() noexcept
     waiting_restart_timer = false;
     restart_interval_count++;
     auto service_state = get_state();
+    if (service_state == service_state_t::STARTED) {
+        // smooth recovery (a regular restart was counted when the service stopped)
+        restart_count++;
+    }
 
     if (! start_ps_process(exec_arg_parts, have_console || onstart_flags.shares_console)) {
         if (service_state == service_state_t::STARTING) {
@@ -352,7 +451,15 @@ void base_process_service::kill_with_fire() noexcept
 void base_process_service::kill_pg(int signo) noexcept
 {
     if (onstart_flags.signal_process_only) {
-        bp_sys::kill(pid, signo);
+        if (get_type() != service_type_t::BGPROCESS || tracking_child) {
+            // The process is our child, being watched; signalling via the watcher avoids
+            // signalling the wrong process should the pid have been re-used (it uses a process
+            // file descriptor, where supported):
+            child_listener.send_signal(event_loop, signo);
+        }
+        else {
+            bp_sys::kill(pid, signo);
+        }
     }
     else {
         pid_t pgid = bp_sys::getpgid(pid);
@@ -384,6 +491,7 @@ void base_process_service::timer_expired() noexcept
         interrupt_start();
         stop_reason = stopped_reason_t::TIMEDOUT;
         failed_to_start(false, false);
+        services->process_queues();
     }
     else {
         // STARTING / STARTED, and we have no pid: must be restarting (smooth recovery if STARTED)
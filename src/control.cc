@@ -8,13 +8,15 @@
 // Server-side control protocol implementation. This implements the functionality that allows
 // clients (such as dinitctl) to query service state and issue commands to control services.
 
+control_output_budget cp_output_budget;
+
 namespace {
     constexpr auto OUT_EVENTS = dasynq::OUT_EVENTS;
     constexpr auto IN_EVENTS = dasynq::IN_EVENTS;
 
     // Control protocol minimum compatible version and current version:
     constexpr uint16_t min_compat_version = 1;
-    constexpr uint16_t cp_version = 1;
+    constexpr uint16_t cp_version = 9;
 
     // check for value in a set
     template <typename T, int N, typename U>
@@ -23,6 +25,76 @@ namespace {
         return std::find_if(std::begin(v), std::end(v),
                 [=](T p){ return i == static_cast<U>(p); }) != std::end(v);
     }
+
+    // Size of the process ID / exit status field in DINIT_RP_SVCINFO/DINIT_RP_SVCINFO2
+    constexpr int pid_status_size = (sizeof(int) > sizeof(pid_t)) ? sizeof(int) : sizeof(pid_t);
+
+    // Flags reported for a service in DINIT_RP_SVCINFO/DINIT_RP_SVCINFO2
+    char service_info_flags(service_record *service) noexcept
+    {
+        char flags = service->is_waiting_for_console() ? 1 : 0;
+        flags |= service->has_console() ? 2 : 0;
+        flags |= service->was_start_skipped() ? 4 : 0;
+        flags |= service->is_marked_active() ? 8 : 0;
+        return flags;
+    }
+
+    // Store either the process ID (if the service is not stopped) or the exit status, as reported in
+    // DINIT_RP_SVCINFO/DINIT_RP_SVCINFO2
+    void fill_pid_or_status(char *buf, service_record *service) noexcept
+    {
+        if (service->get_state() != service_state_t::STOPPED) {
+            pid_t proc_pid = service->get_pid();
+            memcpy(buf, &proc_pid, sizeof(proc_pid));
+        }
+        else {
+            int exit_status = service->get_exit_status();
+            memcpy(buf, &exit_status, sizeof(exit_status));
+        }
+    }
+
+    // Check whether a service has dependents which will be affected by stopping it.
+    bool has_active_dependents(service_record *service) noexcept
+    {
+        for (service_dep *dep : service->get_dependents()) {
+            if (dep->dep_type == dependency_type::REGULAR && dep->holding_acq) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Determine the reply to a start/stop/wake/release command after the service queues have been
+    // processed, given the reply from issuing the command: if the service has reached the
+    // requested state, the reply is DINIT_RP_ALREADYSS.
+    int start_stop_result(service_record *service, int pktType, int flags, int reply) noexcept
+    {
+        switch (pktType) {
+        case DINIT_CP_STARTSERVICE:
+            if (reply == DINIT_RP_ACK && service->get_state() == service_state_t::STARTED) {
+                return DINIT_RP_ALREADYSS;
+            }
+            break;
+        case DINIT_CP_STOPSERVICE:
+            if (reply == DINIT_RP_ACK && (flags & 4) == 0
+                    && service->get_state() == service_state_t::STOPPED) {
+                return DINIT_RP_ALREADYSS;
+            }
+            break;
+        case DINIT_CP_WAKESERVICE:
+            if ((reply == DINIT_RP_ACK || reply == DINIT_RP_NAK)
+                    && service->get_state() == service_state_t::STARTED) {
+                return DINIT_RP_ALREADYSS;
+            }
+            break;
+        case DINIT_CP_RELEASESERVICE:
+            if (reply == DINIT_RP_ACK && service->get_state() == service_state_t::STOPPED) {
+                return DINIT_RP_ALREADYSS;
+            }
+            break;
+        }
+        return reply;
+    }
 }
 
 bool control_conn_t::process_packet()
@@ -86,6 +158,9 @@ bool control_conn_t::process_packet()
     if (pktType == DINIT_CP_LISTSERVICES) {
         return list_services();
     }
+    if (pktType == DINIT_CP_LISTSERVICES2) {
+        return list_services2();
+    }
     if (pktType == DINIT_CP_ADD_DEP) {
         return add_service_dep();
     }
@@ -101,6 +176,27 @@ bool control_conn_t::process_packet()
     if (pktType == DINIT_CP_QUERYSERVICENAME) {
         return process_query_name();
     }
+    if (pktType == DINIT_CP_PRELOADSERVICES) {
+        return process_preload();
+    }
+    if (pktType == DINIT_CP_BATCH) {
+        return process_batch();
+    }
+    if (pktType == DINIT_CP_SUBSCRIBEALL) {
+        return process_subscribe_all();
+    }
+    if (pktType == DINIT_CP_QUERYCONNSTATS) {
+        return process_query_conn_stats();
+    }
+    if (pktType == DINIT_CP_SERVICESTATUS) {
+        return process_service_status();
+    }
+    if (pktType == DINIT_CP_QUERYTIMELINE) {
+        return process_query_timeline();
+    }
+    if (pktType == DINIT_CP_QUERYSTARTHISTORY) {
+        return process_query_start_history();
+    }
 
     // Unrecognized: give error response
     char outbuf[] = { DINIT_RP_BADREQ };
@@ -143,8 +239,12 @@ bool control_conn_t::process_find_load(int pktType)
     string serviceName = rbuf.extract_string(3, svcSize);
     
     if (pktType == DINIT_CP_LOADSERVICE) {
-        // LOADSERVICE
+        // LOADSERVICE. If the service is not yet loaded, its description may have been added
+        // since the service directories were last read.
         try {
+            if (services->find_service(serviceName) == nullptr) {
+                invalidate_dir_listings(services);
+            }
             record = services->load_service(serviceName.c_str());
         }
         catch (service_load_exc &slexc) {
@@ -229,7 +329,6 @@ bool control_conn_t::process_start_stop(int pktType)
     // 1 byte: flags eg. pin in requested state (0 = no pin, 1 = pin)
     // 4 bytes: service handle
     
-    bool do_pin = ((rbuf[1] & 1) == 1);
     handle_t handle;
     rbuf.extract((char *) &handle, 2, sizeof(handle));
     
@@ -243,118 +342,246 @@ bool control_conn_t::process_start_stop(int pktType)
         return true;
     }
     else {
-        char ack_buf[1] = { DINIT_RP_ACK };
-        
-        switch (pktType) {
-        case DINIT_CP_STARTSERVICE:
-            // start service, mark as required
-            if (services->is_shutting_down()) {
-                ack_buf[0] = DINIT_RP_SHUTTINGDOWN;
-                break;
-            }
-            if ((service->get_state() == service_state_t::STOPPED
-                    || service->get_state() == service_state_t::STOPPING)
-                    && service->is_stop_pinned()) {
-                ack_buf[0] = DINIT_RP_PINNEDSTOPPED;
-                break;
-            }
-            if (do_pin) service->pin_start();
-            service->start();
-            services->process_queues();
-            if (service->get_state() == service_state_t::STARTED) ack_buf[0] = DINIT_RP_ALREADYSS;
-            break;
-        case DINIT_CP_STOPSERVICE:
-        {
-            // force service to stop
-            bool do_restart = ((rbuf[1] & 4) == 4);
-            bool gentle = ((rbuf[1] & 2) == 2) || do_restart;  // restart is always "gentle"
-            if (do_restart && services->is_shutting_down()) {
-                ack_buf[0] = DINIT_RP_SHUTTINGDOWN;
-                break;
-            }
-            if ((service->get_state() == service_state_t::STARTED
-                    || service->get_state() == service_state_t::STARTING)
-                    && service->is_start_pinned()) {
-                ack_buf[0] = DINIT_RP_PINNEDSTARTED;
-                break;
-            }
-            if (gentle) {
-                // Check dependents; return appropriate response if any will be affected
-                bool has_dependents;
-                if (! check_dependents(service, has_dependents)) {
-                    return false;
-                }
-                if (has_dependents) {
-                    // Reply packet has already been sent
-                    goto clear_out;
-                }
-            }
-            service_state_t wanted_state;
-            if (do_restart) {
-                if (! service->restart()) {
-                    ack_buf[0] = DINIT_RP_NAK;
-                    break;
-                }
-                wanted_state = service_state_t::STARTED;
-            }
-            else {
-                if (do_pin) service->pin_stop();
-                service->stop(true);
-                service->forced_stop();
-                wanted_state = service_state_t::STOPPED;
+        int flags = rbuf[1];
+        char ack_buf[1] = { (char) issue_start_stop(service, pktType, flags) };
+        if (ack_buf[0] == DINIT_RP_DEPENDENTS) {
+            // Reply with the dependents that prevent stopping the service:
+            bool has_dependents;
+            if (! check_dependents(service, has_dependents)) {
+                return false;
             }
+        }
+        else {
             services->process_queues();
-            if (service->get_state() == wanted_state && !do_restart) ack_buf[0] = DINIT_RP_ALREADYSS;
-            break;
+            ack_buf[0] = start_stop_result(service, pktType, flags, ack_buf[0]);
+            if (! queue_packet(ack_buf, 1)) return false;
         }
-        case DINIT_CP_WAKESERVICE:
-        {
-            // re-attach a service to its (started) dependents, causing it to start.
-            if (services->is_shutting_down()) {
-                ack_buf[0] = DINIT_RP_SHUTTINGDOWN;
-                break;
-            }
-            if ((service->get_state() == service_state_t::STOPPED
-                    || service->get_state() == service_state_t::STOPPING)
-                    && service->is_stop_pinned()) {
-                ack_buf[0] = DINIT_RP_PINNEDSTOPPED;
-                break;
+    }
+    
+    // Clear the packet from the buffer
+    rbuf.consume(pkt_size);
+    chklen = 0;
+    return true;
+}
+
+int control_conn_t::issue_start_stop(service_record *service, int pktType, int flags)
+{
+    bool do_pin = ((flags & 1) == 1);
+
+    switch (pktType) {
+    case DINIT_CP_STARTSERVICE:
+        // start service, mark as required
+        if (services->is_shutting_down()) {
+            return DINIT_RP_SHUTTINGDOWN;
+        }
+        if ((service->get_state() == service_state_t::STOPPED
+                || service->get_state() == service_state_t::STOPPING)
+                && service->is_stop_pinned()) {
+            return DINIT_RP_PINNEDSTOPPED;
+        }
+        if (do_pin) service->pin_start();
+        service->start();
+        return DINIT_RP_ACK;
+    case DINIT_CP_STOPSERVICE:
+    {
+        // force service to stop
+        bool do_restart = ((flags & 4) == 4);
+        bool gentle = ((flags & 2) == 2) || do_restart;  // restart is always "gentle"
+        if (do_restart && services->is_shutting_down()) {
+            return DINIT_RP_SHUTTINGDOWN;
+        }
+        if ((service->get_state() == service_state_t::STARTED
+                || service->get_state() == service_state_t::STARTING)
+                && service->is_start_pinned()) {
+            return DINIT_RP_PINNEDSTARTED;
+        }
+        if (gentle && has_active_dependents(service)) {
+            return DINIT_RP_DEPENDENTS;
+        }
+        if (do_restart) {
+            if (! service->restart()) {
+                return DINIT_RP_NAK;
             }
-            bool found_dpt = false;
-            for (auto dpt : service->get_dependents()) {
-                auto from = dpt->get_from();
-                auto from_state = from->get_state();
-                if (from_state == service_state_t::STARTED || from_state == service_state_t::STARTING) {
-                    found_dpt = true;
-                    if (! dpt->holding_acq) {
-                        dpt->get_from()->start_dep(*dpt);
-                    }
+        }
+        else {
+            if (do_pin) service->pin_stop();
+            service->stop(true);
+            service->forced_stop();
+        }
+        return DINIT_RP_ACK;
+    }
+    case DINIT_CP_WAKESERVICE:
+    {
+        // re-attach a service to its (started) dependents, causing it to start.
+        if (services->is_shutting_down()) {
+            return DINIT_RP_SHUTTINGDOWN;
+        }
+        if ((service->get_state() == service_state_t::STOPPED
+                || service->get_state() == service_state_t::STOPPING)
+                && service->is_stop_pinned()) {
+            return DINIT_RP_PINNEDSTOPPED;
+        }
+        bool found_dpt = false;
+        for (auto dpt : service->get_dependents()) {
+            auto from = dpt->get_from();
+            auto from_state = from->get_state();
+            if (from_state == service_state_t::STARTED || from_state == service_state_t::STARTING) {
+                found_dpt = true;
+                if (! dpt->holding_acq) {
+                    dpt->get_from()->start_dep(*dpt);
                 }
             }
-            if (! found_dpt) {
-                ack_buf[0] = DINIT_RP_NAK;
-            }
+        }
 
-            if (do_pin) service->pin_start();
-            services->process_queues();
-            if (service->get_state() == service_state_t::STARTED) ack_buf[0] = DINIT_RP_ALREADYSS;
+        if (do_pin) service->pin_start();
+        return found_dpt ? DINIT_RP_ACK : DINIT_RP_NAK;
+    }
+    case DINIT_CP_RELEASESERVICE:
+        // remove required mark, stop if not required by dependents
+        if (do_pin) service->pin_stop();
+        service->stop(false);
+        return DINIT_RP_ACK;
+    }
+
+    return DINIT_RP_NAK;
+}
+
+bool control_conn_t::process_batch()
+{
+    // 1 byte: packet type
+    // 2 bytes: packet length (including all fields)
+    // 2 bytes: number of commands, N
+    // N * command:
+    //   1 byte: command (DINIT_CP_STARTSERVICE/STOPSERVICE/WAKESERVICE/RELEASESERVICE)
+    //   1 byte: flags (as for the individual command)
+    //   2 bytes: service name length
+    //   M bytes: service name (without nul terminator)
+
+    constexpr int hdr_size = 5;
+    constexpr int cmd_hdr_size = 4;
+
+    if (rbuf.get_length() < hdr_size) {
+        chklen = hdr_size;
+        return true;
+    }
+
+    uint16_t pkt_len;
+    uint16_t num_cmds;
+    rbuf.extract((char *)&pkt_len, 1, 2);
+    rbuf.extract((char *)&num_cmds, 3, 2);
+
+    if (pkt_len < hdr_size || pkt_len > rbuf.get_size()) {
+        char badreq_rep[] = { DINIT_RP_BADREQ };
+        if (! queue_packet(badreq_rep, 1)) return false;
+        bad_conn_close = true;
+        iob.set_watches(OUT_EVENTS);
+        return true;
+    }
+
+    chklen = pkt_len;
+    if (rbuf.get_length() < chklen) {
+        // packet not complete yet; read more
+        return true;
+    }
+
+    struct batch_cmd
+    {
+        int command;
+        int flags;
+        std::string name;
+        service_record *service = nullptr;
+        handle_t handle = -1;
+        int result = DINIT_RP_NOSERVICE;
+    };
+
+    // Check that the packet is well-formed before acting on any command:
+    std::vector<batch_cmd> cmds;
+    cmds.reserve(num_cmds);
+    int pos = hdr_size;
+    bool good = true;
+    for (unsigned i = 0; i < num_cmds; ++i) {
+        if (pos + cmd_hdr_size > pkt_len) {
+            good = false;
             break;
         }
-        case DINIT_CP_RELEASESERVICE:
-            // remove required mark, stop if not required by dependents
-            if (do_pin) service->pin_stop();
-            service->stop(false);
-            services->process_queues();
-            if (service->get_state() == service_state_t::STOPPED) ack_buf[0] = DINIT_RP_ALREADYSS;
+        int command = rbuf[pos];
+        uint16_t name_len;
+        rbuf.extract((char *)&name_len, pos + 2, 2);
+        if (name_len == 0 || pos + cmd_hdr_size + name_len > pkt_len
+                || !contains({DINIT_CP_STARTSERVICE, DINIT_CP_STOPSERVICE, DINIT_CP_WAKESERVICE,
+                        DINIT_CP_RELEASESERVICE}, command)) {
+            good = false;
             break;
         }
-        
-        if (! queue_packet(ack_buf, 1)) return false;
+        cmds.emplace_back();
+        cmds.back().command = command;
+        cmds.back().flags = rbuf[pos + 1];
+        cmds.back().name = rbuf.extract_string(pos + cmd_hdr_size, name_len);
+        pos += cmd_hdr_size + name_len;
     }
-    
-    clear_out:
+
+    if (!good || pos != pkt_len) {
+        char badreq_rep[] = { DINIT_RP_BADREQ };
+        if (! queue_packet(badreq_rep, 1)) return false;
+        bad_conn_close = true;
+        iob.set_watches(OUT_EVENTS);
+        return true;
+    }
+
+    // Load all the services, then issue all the commands, and process the resulting state changes
+    // together. (As for LOADSERVICE, a service which is not yet loaded may have been added since
+    // the service directories were last read).
+    bool listings_invalidated = false;
+    for (batch_cmd &cmd : cmds) {
+        try {
+            if (!listings_invalidated && services->find_service(cmd.name) == nullptr) {
+                invalidate_dir_listings(services);
+                listings_invalidated = true;
+            }
+            cmd.service = services->load_service(cmd.name.c_str());
+            // Use the existing handle for the service, if there is one, so that repeated batches
+            // don't accumulate handles:
+            auto existing = service_key_map.find(cmd.service);
+            cmd.handle = (existing != service_key_map.end()) ? existing->second
+                    : allocate_service_handle(cmd.service);
+        }
+        catch (service_load_exc &slexc) {
+            log(loglevel_t::ERROR, "Could not load service ", slexc.service_name, ": ",
+                    slexc.exc_description);
+        }
+    }
+
+    for (batch_cmd &cmd : cmds) {
+        if (cmd.service != nullptr) {
+            cmd.result = issue_start_stop(cmd.service, cmd.command, cmd.flags);
+        }
+    }
+
+    services->process_queues();
+
+    // Reply:
+    // 1 byte: DINIT_RP_BATCH
+    // 2 bytes: number of results, N
+    // N * result (in command order):
+    //   1 byte: reply code, as for the individual command (or DINIT_RP_NOSERVICE)
+    //   4 bytes: service handle (-1 if the service could not be loaded)
+    std::vector<char> reply;
+    reply.reserve(3 + cmds.size() * (1 + sizeof(handle_t)));
+    reply.push_back(DINIT_RP_BATCH);
+    reply.insert(reply.end(), (char *)&num_cmds, (char *)&num_cmds + 2);
+    for (batch_cmd &cmd : cmds) {
+        int result = cmd.result;
+        if (cmd.service != nullptr) {
+            result = start_stop_result(cmd.service, cmd.command, cmd.flags, result);
+        }
+        reply.push_back((char) result);
+        reply.insert(reply.end(), (char *)&cmd.handle, (char *)&cmd.handle + sizeof(handle_t));
+    }
+
+    if (! queue_packet(reply)) return false;
+
     // Clear the packet from the buffer
-    rbuf.consume(pkt_size);
+    rbuf.consume(pkt_len);
     chklen = 0;
     return true;
 }
@@ -431,14 +658,13 @@ bool control_conn_t::process_unload_service()
     }
     else {
         // unload
+        // drop handle(s)
+        release_service_handles(service);
+
         service->prepare_for_unload();
         services->remove_service(service);
         delete service;
 
-        // drop handle
-        service_key_map.erase(service);
-        key_service_map.erase(handle);
-
         // send ack
         char ack_buf[] = { (char) DINIT_RP_ACK };
         if (! queue_packet(ack_buf, 1)) return false;
@@ -486,18 +712,15 @@ bool control_conn_t::process_reload_service()
         try {
             // reload
             auto *new_service = services->reload_service(service);
+
+            // drop handle(s)
+            release_service_handles(service);
+
             if (new_service != service) {
                 service->prepare_for_unload();
                 services->replace_service(service, new_service);
                 delete service;
             }
-            else {
-                service->remove_listener(this);
-            }
-
-            // drop handle
-            key_service_map.erase(handle);
-            service_key_map.erase(service);
 
             services->process_queues();
 
@@ -524,59 +747,489 @@ bool control_conn_t::list_services()
     rbuf.consume(1); // clear request packet
     chklen = 0;
     
-    try {
-        auto slist = services->list_services();
-        for (auto sptr : slist) {
-            std::vector<char> pkt_buf;
-            
-            int hdrsize = 8 + std::max(sizeof(int), sizeof(pid_t));
-
-            const std::string &name = sptr->get_name();
-            int nameLen = std::min((size_t)256, name.length());
-            pkt_buf.resize(hdrsize + nameLen);
-            
-            pkt_buf[0] = DINIT_RP_SVCINFO;
-            pkt_buf[1] = nameLen;
-            pkt_buf[2] = static_cast<char>(sptr->get_state());
-            pkt_buf[3] = static_cast<char>(sptr->get_target_state());
-            
-            char b0 = sptr->is_waiting_for_console() ? 1 : 0;
-            b0 |= sptr->has_console() ? 2 : 0;
-            b0 |= sptr->was_start_skipped() ? 4 : 0;
-            b0 |= sptr->is_marked_active() ? 8 : 0;
-            pkt_buf[4] = b0;
-            pkt_buf[5] = static_cast<char>(sptr->get_stop_reason());
-
-            pkt_buf[6] = 0; // reserved
-            pkt_buf[7] = 0;
-            
-            // Next: either the exit status, or the process ID
-            if (sptr->get_state() != service_state_t::STOPPED) {
-                pid_t proc_pid = sptr->get_pid();
-                memcpy(pkt_buf.data() + 8, &proc_pid, sizeof(proc_pid));
-            }
-            else {
-                int exit_status = sptr->get_exit_status();
-                memcpy(pkt_buf.data() + 8, &exit_status, sizeof(exit_status));
-            }
+    constexpr int hdrsize = 8 + pid_status_size;
+    char pkt_buf[hdrsize + 255];
 
-            for (int i = 0; i < nameLen; i++) {
-                pkt_buf[hdrsize+i] = name[i];
-            }
-            
-            if (! queue_packet(std::move(pkt_buf))) return false;
+    for (auto sptr : services->list_services()) {
+        const std::string &name = sptr->get_name();
+        int nameLen = std::min((size_t)255, name.length());
+
+        pkt_buf[0] = DINIT_RP_SVCINFO;
+        pkt_buf[1] = nameLen;
+        pkt_buf[2] = static_cast<char>(sptr->get_state());
+        pkt_buf[3] = static_cast<char>(sptr->get_target_state());
+        pkt_buf[4] = service_info_flags(sptr);
+        pkt_buf[5] = static_cast<char>(sptr->get_stop_reason());
+
+        pkt_buf[6] = 0; // reserved
+        pkt_buf[7] = 0;
+
+        // Next: either the exit status, or the process ID
+        fill_pid_or_status(pkt_buf + 8, sptr);
+
+        memcpy(pkt_buf + hdrsize, name.data(), nameLen);
+
+        if (! queue_packet(pkt_buf, hdrsize + nameLen)) return false;
+    }
+
+    char ack_buf[] = { (char) DINIT_RP_LISTDONE };
+    if (! queue_packet(ack_buf, 1)) return false;
+
+    return true;
+}
+
+bool control_conn_t::list_services2()
+{
+    // 1 byte: packet type
+    // 4 bytes: cursor: list only services after the service with this id (0 = from the start)
+    // 2 bytes: limit: maximum number of services to list (0 = no limit)
+    // 1 byte: filter flags: 1 = state, 2 = target state, 4 = service type, 8 = name prefix
+    // 1 byte: state, 1 byte: target state, 1 byte: service type (if filtering on these)
+    // 2 bytes: name prefix length, N bytes: name prefix (without nul terminator)
+
+    constexpr int hdr_size = 13;
+
+    if (rbuf.get_length() < hdr_size) {
+        chklen = hdr_size;
+        return true;
+    }
+
+    uint16_t prefix_len;
+    rbuf.extract((char *)&prefix_len, 11, sizeof(prefix_len));
+    if (prefix_len > rbuf.get_size() - hdr_size) {
+        char badreq_rep[] = { DINIT_RP_BADREQ };
+        if (! queue_packet(badreq_rep, 1)) return false;
+        bad_conn_close = true;
+        iob.set_watches(OUT_EVENTS);
+        return true;
+    }
+
+    chklen = hdr_size + prefix_len;
+    if (rbuf.get_length() < chklen) {
+        // packet not complete yet; read more
+        return true;
+    }
+
+    uint32_t cursor;
+    uint16_t limit;
+    rbuf.extract((char *)&cursor, 1, sizeof(cursor));
+    rbuf.extract((char *)&limit, 5, sizeof(limit));
+    int filter = rbuf[7];
+    auto f_state = static_cast<service_state_t>(rbuf[8]);
+    auto f_target = static_cast<service_state_t>(rbuf[9]);
+    auto f_type = static_cast<service_type_t>(rbuf[10]);
+    std::string prefix = rbuf.extract_string(hdr_size, prefix_len);
+
+    rbuf.consume(chklen);
+    chklen = 0;
+
+    // Reply with DINIT_RP_SVCINFO2 packets, each:
+    // 1 byte: packet type
+    // 2 bytes: packet length (including all fields)
+    // 2 bytes: number of service records in the packet
+    // service records, each:
+    //   4 bytes: service id, 1 byte: name length, 1 byte: state, 1 byte: target state,
+    //   1 byte: flags, 1 byte: stop reason, 1 byte: service type, 2 bytes: reserved,
+    //   pid or exit status (as for DINIT_RP_SVCINFO), name (without nul terminator)
+    // ... followed by DINIT_RP_LISTDONE2, with a 4-byte cursor to continue the listing, or 0 if
+    // there are no more matching services.
+
+    constexpr int pkt_hdr_size = 5;
+    constexpr int rec_hdr_size = 12 + pid_status_size;
+    constexpr int max_pkt_size = 1024;
+
+    char pkt_buf[max_pkt_size];
+    int pkt_len = pkt_hdr_size;
+    uint16_t pkt_recs = 0;
+
+    auto flush_pkt = [&]() -> bool {
+        pkt_buf[0] = DINIT_RP_SVCINFO2;
+        uint16_t pkt_len16 = pkt_len;
+        memcpy(pkt_buf + 1, &pkt_len16, sizeof(pkt_len16));
+        memcpy(pkt_buf + 3, &pkt_recs, sizeof(pkt_recs));
+        bool r = queue_packet(pkt_buf, pkt_len);
+        pkt_len = pkt_hdr_size;
+        pkt_recs = 0;
+        return r;
+    };
+
+    unsigned count = 0;
+    uint32_t last_id = 0;
+    uint32_t next_cursor = 0;
+
+    const std::list<service_record *> &records = services->list_services();
+    for (auto i = services->list_services_after(cursor); i != records.end(); ++i) {
+        service_record *sptr = *i;
+        if ((filter & 1) && sptr->get_state() != f_state) continue;
+        if ((filter & 2) && sptr->get_target_state() != f_target) continue;
+        if ((filter & 4) && sptr->get_type() != f_type) continue;
+        const std::string &name = sptr->get_name();
+        if ((filter & 8) && name.compare(0, prefix.length(), prefix) != 0) continue;
+
+        if (limit != 0 && count == limit) {
+            // There are more matching services than requested:
+            next_cursor = last_id;
+            break;
         }
-        
-        char ack_buf[] = { (char) DINIT_RP_LISTDONE };
-        if (! queue_packet(ack_buf, 1)) return false;
-        
+
+        int name_len = std::min((size_t)255, name.length());
+        if (pkt_len + rec_hdr_size + name_len > max_pkt_size) {
+            if (! flush_pkt()) return false;
+        }
+
+        char *rec = pkt_buf + pkt_len;
+        uint32_t id = sptr->get_id();
+        memcpy(rec, &id, sizeof(id));
+        rec[4] = name_len;
+        rec[5] = static_cast<char>(sptr->get_state());
+        rec[6] = static_cast<char>(sptr->get_target_state());
+        rec[7] = service_info_flags(sptr);
+        rec[8] = static_cast<char>(sptr->get_stop_reason());
+        rec[9] = static_cast<char>(sptr->get_type());
+        rec[10] = 0; // reserved
+        rec[11] = 0;
+        fill_pid_or_status(rec + 12, sptr);
+        memcpy(rec + rec_hdr_size, name.data(), name_len);
+
+        pkt_len += rec_hdr_size + name_len;
+        ++pkt_recs;
+        ++count;
+        last_id = id;
+    }
+
+    if (pkt_recs != 0) {
+        if (! flush_pkt()) return false;
+    }
+
+    char done_buf[1 + sizeof(next_cursor)] = { (char) DINIT_RP_LISTDONE2 };
+    memcpy(done_buf + 1, &next_cursor, sizeof(next_cursor));
+    return queue_packet(done_buf, sizeof(done_buf));
+}
+
+bool control_conn_t::process_subscribe_all()
+{
+    // 1 byte: packet type
+    // 1 byte: 1 = subscribe, 0 = unsubscribe
+    constexpr int pkt_size = 2;
+
+    if (rbuf.get_length() < pkt_size) {
+        chklen = pkt_size;
         return true;
     }
-    catch (std::bad_alloc &exc)
-    {
-        do_oom_close();
+
+    bool subscribe = rbuf[1] != 0;
+    rbuf.consume(pkt_size);
+    chklen = 0;
+
+    if (subscribe && !subscribed_all) {
+        services->add_set_listener(this);
+        subscribed_all = true;
+    }
+    else if (!subscribe && subscribed_all) {
+        services->remove_set_listener(this);
+        subscribed_all = false;
+    }
+
+    char ack_rep[] = { DINIT_RP_ACK };
+    return queue_packet(ack_rep, 1);
+}
+
+bool control_conn_t::process_query_conn_stats()
+{
+    // 1 byte: packet type
+    rbuf.consume(1);
+
+    // Reply:
+    // 1 byte: DINIT_RP_CONNSTATS
+    // 4 bytes: number of connections, 4 bytes: number of connections with input paused
+    // 8 bytes: total queued output, 8 bytes: per-connection budget, 8 bytes: total budget
+    // 8 bytes: number of times input paused, 8 bytes: number of connections closed (overrun)
+    uint32_t num_conns = active_control_conns;
+    uint32_t paused_conns = cp_output_budget.paused_conns;
+    uint64_t values[] = { cp_output_budget.total_queued, cp_output_budget.conn_limit,
+            cp_output_budget.total_limit, cp_output_budget.pause_count,
+            cp_output_budget.overrun_count };
+
+    char reply[1 + 2 * sizeof(uint32_t) + sizeof(values)];
+    reply[0] = DINIT_RP_CONNSTATS;
+    memcpy(reply + 1, &num_conns, sizeof(num_conns));
+    memcpy(reply + 1 + sizeof(uint32_t), &paused_conns, sizeof(paused_conns));
+    memcpy(reply + 1 + 2 * sizeof(uint32_t), values, sizeof(values));
+    return queue_packet(reply, sizeof(reply));
+}
+
+bool control_conn_t::process_service_status()
+{
+    // 1 byte packet type
+    // handle: service
+    constexpr int pkt_size = 1 + sizeof(handle_t);
+
+    if (rbuf.get_length() < pkt_size) {
+        chklen = pkt_size;
         return true;
     }
+
+    handle_t handle;
+    rbuf.extract(&handle, 1, sizeof(handle));
+    rbuf.consume(pkt_size);
+    chklen = 0;
+
+    service_record *service = find_service_for_key(handle);
+    if (service == nullptr) {
+        // Service handle is bad
+        char badreq_rep[] = { DINIT_RP_BADREQ };
+        if (! queue_packet(badreq_rep, 1)) return false;
+        bad_conn_close = true;
+        iob.set_watches(OUT_EVENTS);
+        return true;
+    }
+
+    // Reply:
+    // 1 byte: DINIT_RP_SERVICESTATUS
+    // 1 byte: state, 1 byte: target state
+    // 1 byte: flags, as for DINIT_RP_SVCINFO, plus:
+    //         16 = exec failure stage/errno are valid, 32 = time since process launch is valid
+    // 1 byte: stop reason
+    // 1 byte: exec stage of most recent failure to execute process
+    // 1 byte: service type, 1 byte: reserved
+    // 4 bytes: errno of most recent failure to execute process
+    // 4 bytes: process ID (-1 if none), 4 bytes: exit status of most recent process
+    // 4 bytes: restart count, 4 bytes: restart count within current restart interval
+    // 8 bytes: milliseconds since most recent process launch
+    // 8 bytes: milliseconds since current state was entered
+    // 4 * 8 bytes: total milliseconds spent in each state (STOPPED, STARTING, STARTED, STOPPING)
+    constexpr int num_states = static_cast<int>(service_state_t::STOPPING) + 1;
+    char reply[28 + (2 + num_states) * sizeof(uint64_t)];
+
+    auto to_millis = [](time_val t) -> uint64_t {
+        return (uint64_t)t.seconds() * 1000u + t.nseconds() / 1000000u;
+    };
+
+    char flags = service_info_flags(service);
+
+    exec_stage stage = exec_stage::DO_EXEC;
+    int32_t exec_errno = 0;
+    int st_errno;
+    if (service->get_exec_error(stage, st_errno)) {
+        flags |= 16;
+        exec_errno = st_errno;
+    }
+
+    uint64_t millis[2 + num_states];
+    millis[0] = 0;
+    time_val start_time;
+    if (service->get_process_start_time(start_time)) {
+        flags |= 32;
+        time_val now;
+        event_loop.get_time(now, clock_type::MONOTONIC);
+        millis[0] = to_millis(now - start_time);
+    }
+    millis[1] = to_millis(service->get_time_in_state());
+    for (int i = 0; i < num_states; i++) {
+        millis[2 + i] = to_millis(service->get_state_duration(static_cast<service_state_t>(i)));
+    }
+
+    int32_t ivalues[] = { service->get_pid(), service->get_exit_status(),
+            (int32_t)service->get_restart_count(), service->get_restart_interval_count() };
+
+    reply[0] = DINIT_RP_SERVICESTATUS;
+    reply[1] = static_cast<char>(service->get_state());
+    reply[2] = static_cast<char>(service->get_target_state());
+    reply[3] = flags;
+    reply[4] = static_cast<char>(service->get_stop_reason());
+    reply[5] = static_cast<char>(stage);
+    reply[6] = static_cast<char>(service->get_type());
+    reply[7] = 0; // reserved
+    memcpy(reply + 8, &exec_errno, sizeof(exec_errno));
+    memcpy(reply + 12, ivalues, sizeof(ivalues));
+    memcpy(reply + 28, millis, sizeof(millis));
+
+    return queue_packet(reply, sizeof(reply));
+}
+
+bool control_conn_t::process_query_timeline()
+{
+    // 1 byte: packet type
+    // 8 bytes: sequence number of the first entry wanted (i.e. number of entries recorded before it)
+    // 4 bytes: name cursor: include names only of services with an id greater than this
+    constexpr int pkt_size = 13;
+
+    if (rbuf.get_length() < pkt_size) {
+        chklen = pkt_size;
+        return true;
+    }
+
+    uint64_t first_seq;
+    uint32_t name_cursor;
+    rbuf.extract((char *)&first_seq, 1, sizeof(first_seq));
+    rbuf.extract((char *)&name_cursor, 9, sizeof(name_cursor));
+    rbuf.consume(pkt_size);
+    chklen = 0;
+
+    // Reply:
+    // 1 byte: DINIT_RP_TIMELINE, 1 byte: 1 if the reply is complete (no further entries or names
+    // follow), 2 bytes: reserved
+    // 4 bytes: number of entries, N
+    // 8 bytes: sequence number of the first entry; greater than requested if entries have been
+    //          discarded (overwritten)
+    // 8 + 4 bytes: time (monotonic clock, seconds + nanoseconds) at which recording began
+    // 8 + 4 bytes: current time (monotonic clock)
+    // 4 bytes: number of service names, M
+    // 4 bytes: name cursor to request further names
+    // N * entry (oldest first):
+    //   8 + 4 bytes: time of event, 4 bytes: service id, 4 bytes: related service id,
+    //   1 byte: event (timeline_event_t), 1 byte: detail
+    // M * name (loaded services, in order of id):
+    //   4 bytes: service id, 2 bytes: name length, name
+    //
+    // The reply is limited in size (to avoid queueing more output than allowed for the connection);
+    // entries are given first, and names only once all entries have been given. The client should
+    // request the remainder (if not complete) from the next entry, and the given name cursor.
+
+    constexpr unsigned hdr_size = 48;
+    constexpr unsigned max_reply_size = 16 * 1024;
+
+    const service_timeline &timeline = services->get_timeline();
+    uint64_t dropped = timeline.get_dropped();
+    uint64_t end_seq = dropped + timeline.size();
+    first_seq = std::min(std::max(first_seq, dropped), end_seq);
+
+    uint32_t num_entries = std::min(end_seq - first_seq,
+            (uint64_t)((max_reply_size - hdr_size) / timeline_entry_wire_size));
+
+    std::vector<char> reply;
+    reply.resize(hdr_size + num_entries * timeline_entry_wire_size);
+
+    char *ebuf = reply.data() + hdr_size;
+    for (uint32_t i = 0; i < num_entries; i++) {
+        const timeline_entry &entry = timeline[first_seq - dropped + i];
+        memcpy(ebuf, &entry.secs, 8);
+        memcpy(ebuf + 8, &entry.nsecs, 4);
+        memcpy(ebuf + 12, &entry.service_id, 4);
+        memcpy(ebuf + 16, &entry.related_id, 4);
+        ebuf[20] = static_cast<char>(entry.event);
+        ebuf[21] = static_cast<char>(entry.detail);
+        ebuf += timeline_entry_wire_size;
+    }
+
+    bool complete = false;
+    uint32_t num_names = 0;
+    if (first_seq + num_entries == end_seq) {
+        const std::list<service_record *> &records = services->list_services();
+        auto i = services->list_services_after(name_cursor);
+        for ( ; i != records.end(); ++i) {
+            const std::string &name = (*i)->get_name();
+            uint16_t name_len = std::min(name.length(), (size_t)std::numeric_limits<uint16_t>::max());
+            if (num_names != 0 && reply.size() + 6 + name_len > max_reply_size) break;
+            uint32_t id = (*i)->get_id();
+            reply.insert(reply.end(), (char *)&id, (char *)&id + 4);
+            reply.insert(reply.end(), (char *)&name_len, (char *)&name_len + 2);
+            reply.insert(reply.end(), name.data(), name.data() + name_len);
+            name_cursor = id;
+            ++num_names;
+        }
+        complete = (i == records.end());
+    }
+
+    time_val origin = services->get_timeline_origin();
+    time_val now;
+    event_loop.get_time(now, clock_type::MONOTONIC);
+    int64_t origin_secs = origin.seconds();
+    uint32_t origin_nsecs = origin.nseconds();
+    int64_t now_secs = now.seconds();
+    uint32_t now_nsecs = now.nseconds();
+
+    char *buf = reply.data();
+    buf[0] = DINIT_RP_TIMELINE;
+    buf[1] = complete ? 1 : 0;
+    buf[2] = buf[3] = 0; // reserved
+    memcpy(buf + 4, &num_entries, 4);
+    memcpy(buf + 8, &first_seq, 8);
+    memcpy(buf + 16, &origin_secs, 8);
+    memcpy(buf + 24, &origin_nsecs, 4);
+    memcpy(buf + 28, &now_secs, 8);
+    memcpy(buf + 36, &now_nsecs, 4);
+    memcpy(buf + 40, &num_names, 4);
+    memcpy(buf + 44, &name_cursor, 4);
+
+    return queue_packet(std::move(reply));
+}
+
+bool control_conn_t::process_query_start_history()
+{
+    // 1 byte: packet type
+    // 2 bytes: cursor length, N bytes: cursor: list only services with a name ordered after this
+    //          (i.e. the last name listed in the previous reply; empty to list from the start)
+    constexpr int hdr_size = 3;
+
+    if (rbuf.get_length() < hdr_size) {
+        chklen = hdr_size;
+        return true;
+    }
+
+    uint16_t cursor_len;
+    rbuf.extract((char *)&cursor_len, 1, sizeof(cursor_len));
+    if (cursor_len > rbuf.get_size() - hdr_size) {
+        char badreq_rep[] = { DINIT_RP_BADREQ };
+        if (! queue_packet(badreq_rep, 1)) return false;
+        bad_conn_close = true;
+        iob.set_watches(OUT_EVENTS);
+        return true;
+    }
+
+    chklen = hdr_size + cursor_len;
+    if (rbuf.get_length() < chklen) {
+        // packet not complete yet; read more
+        return true;
+    }
+
+    std::string cursor = rbuf.extract_string(hdr_size, cursor_len);
+    rbuf.consume(chklen);
+    chklen = 0;
+
+    // Reply:
+    // 1 byte: DINIT_RP_STARTHISTORY, 1 byte: 1 if the reply is complete (no further services
+    // follow), 2 bytes: reserved
+    // 4 bytes: number of services, N (0 if no history is being recorded)
+    // N * service (in order of name):
+    //   2 bytes: name length, 1 byte: number of durations (D), 1 byte: number of durations recorded
+    //   since the history was loaded (i.e. during the current boot), D * 4 bytes: durations
+    //   (milliseconds, oldest first), name
+    //
+    // The reply is limited in size; if it is not complete, the client should request the remainder
+    // using the last listed name as the cursor.
+
+    constexpr unsigned max_reply_size = 16 * 1024;
+
+    std::vector<char> reply = { DINIT_RP_STARTHISTORY, 1, 0, 0, 0, 0, 0, 0 };
+
+    start_history *history = services->get_start_history();
+    if (history != nullptr) {
+        uint32_t num_services = 0;
+        auto &histories = history->get_histories();
+        for (auto i = histories.upper_bound(cursor); i != histories.end(); ++i) {
+            const std::string &name = i->first;
+            if (name.length() > std::numeric_limits<uint16_t>::max()) continue;
+            uint16_t name_len = name.length();
+            const std::vector<uint32_t> &durations = i->second.durations;
+            size_t rec_size = 4 + durations.size() * 4 + name_len;
+            if (num_services != 0 && reply.size() + rec_size > max_reply_size) {
+                reply[1] = 0; // not complete
+                break;
+            }
+            reply.insert(reply.end(), (char *)&name_len, (char *)&name_len + 2);
+            reply.push_back((char)durations.size());
+            reply.push_back((char)i->second.new_count);
+            for (uint32_t d : durations) {
+                reply.insert(reply.end(), (char *)&d, (char *)&d + 4);
+            }
+            reply.insert(reply.end(), name.begin(), name.end());
+            ++num_services;
+        }
+        memcpy(reply.data() + 4, &num_services, 4);
+    }
+
+    return queue_packet(std::move(reply));
 }
 
 bool control_conn_t::add_service_dep(bool do_enable)
@@ -680,6 +1333,11 @@ bool control_conn_t::add_service_dep(bool do_enable)
         services->process_queues();
     }
 
+    if (do_enable) {
+        // Enabling is accompanied by a change to the "from" service's dependency directory:
+        invalidate_dir_listings(services);
+    }
+
     if (do_enable && contains({service_state_t::STARTED, service_state_t::STARTING},
             from_service->get_state())) {
         // The dependency record is activated: mark it as holding acquisition of the dependency, and start
@@ -738,9 +1396,11 @@ bool control_conn_t::rm_service_dep()
     }
     dependency_type dep_type = static_cast<dependency_type>(dep_type_int);
 
-    // Remove dependency:
+    // Remove dependency. (This is also used to disable a service, which is accompanied by a change
+    // to the "from" service's dependency directory.)
     from_service->rm_dep(to_service, dep_type);
     services->process_queues();
+    invalidate_dir_listings(services);
 
     char ack_rep[] = { DINIT_RP_ACK };
     if (! queue_packet(ack_rep, 1)) return false;
@@ -789,6 +1449,40 @@ bool control_conn_t::process_query_name()
     return queue_packet(std::move(reply));
 }
 
+bool control_conn_t::process_preload()
+{
+    rbuf.consume(1);
+    chklen = 0;
+
+    if (services->get_set_type_id() != SSET_TYPE_DIRLOAD) {
+        char nak_rep[] = { DINIT_RP_NAK };
+        return queue_packet(nak_rep, 1);
+    }
+
+    dirload_service_set *dss = static_cast<dirload_service_set *>(services);
+
+    time_val start_time, end_time;
+    event_loop.get_time(start_time, clock_type::MONOTONIC);
+    std::list<std::pair<std::string, std::string>> errors;
+    uint32_t num_loaded = dss->preload_services(errors);
+    event_loop.get_time(end_time, clock_type::MONOTONIC);
+
+    for (auto &error : errors) {
+        log(loglevel_t::ERROR, "Could not load service ", error.first, ": ", error.second);
+    }
+
+    time_val elapsed = end_time - start_time;
+    uint32_t num_failed = errors.size();
+    uint32_t elapsed_ms = elapsed.seconds() * 1000 + elapsed.nseconds() / 1000000;
+
+    char reply[1 + sizeof(uint32_t) * 3];
+    reply[0] = DINIT_RP_PRELOADINFO;
+    memcpy(reply + 1, &num_loaded, sizeof(num_loaded));
+    memcpy(reply + 1 + sizeof(uint32_t), &num_failed, sizeof(num_failed));
+    memcpy(reply + 1 + sizeof(uint32_t) * 2, &elapsed_ms, sizeof(elapsed_ms));
+    return queue_packet(reply, sizeof(reply));
+}
+
 bool control_conn_t::query_load_mech()
 {
     rbuf.consume(1);
@@ -867,41 +1561,77 @@ bool control_conn_t::query_load_mech()
 
 control_conn_t::handle_t control_conn_t::allocate_service_handle(service_record *record)
 {
-    // Try to find a unique handle (integer) in a single pass. Since the map is ordered, we can search until
-    // we find a gap in the handle values.
-    handle_t candidate = 0;
-    for (auto p : key_service_map) {
-        if (p.first == candidate) ++candidate;
-        else break;
+    // Take a slot from the free list, or add a new slot to the table.
+    handle_t index = first_free_slot;
+    bool new_slot = (index == no_free_slot);
+    if (new_slot) {
+        index = handle_table.size();
+        if (index >= no_free_slot) {
+            throw std::bad_alloc();
+        }
+        handle_table.emplace_back();
     }
 
+    handle_slot &slot = handle_table[index];
+    handle_t handle = index | (slot.generation << handle_index_bits);
     bool is_unique = (service_key_map.find(record) == service_key_map.end());
 
     // The following operations perform allocation (can throw std::bad_alloc). If an exception occurs we
     // must undo any previous actions:
-    if (is_unique) {
-        record->add_listener(this);
-    }
-    
     try {
-        key_service_map[candidate] = record;
-        service_key_map.insert(std::make_pair(record, candidate));
+        service_key_map.insert(std::make_pair(record, handle));
+        try {
+            if (is_unique) {
+                record->add_listener(this);
+            }
+        }
+        catch (...) {
+            service_key_map.erase(record);
+            throw;
+        }
     }
     catch (...) {
-        if (is_unique) {
-            record->remove_listener(this);
+        if (new_slot) {
+            handle_table.pop_back();
         }
+        throw;
+    }
 
-        key_service_map.erase(candidate);
+    if (!new_slot) {
+        first_free_slot = slot.next_free;
     }
-    
-    return candidate;
+    slot.service = record;
+    return handle;
+}
+
+void control_conn_t::release_service_handles(service_record *record) noexcept
+{
+    auto range = service_key_map.equal_range(record);
+    if (range.first == range.second) return;
+
+    for (auto i = range.first; i != range.second; ++i) {
+        handle_slot &slot = handle_table[i->second & handle_index_mask];
+        slot.service = nullptr;
+        slot.generation = (slot.generation + 1) & (handle_t(-1) >> handle_index_bits);
+        slot.next_free = first_free_slot;
+        first_free_slot = i->second & handle_index_mask;
+    }
+
+    service_key_map.erase(range.first, range.second);
+    record->remove_listener(this);
+}
+
+void control_conn_t::spill_event_ring()
+{
+    char ring_data[event_pkt_size * event_ring_pkts];
+    event_ring.copy_to(ring_data);
+    outbuf.append(ring_data, event_ring.size());
+    event_ring.clear();
 }
 
 bool control_conn_t::queue_packet(const char *pkt, unsigned size) noexcept
 {
-    int in_flag = bad_conn_close ? 0 : IN_EVENTS;
-    bool was_empty = outbuf.empty();
+    bool was_empty = !output_pending();
 
     // If the queue is empty, we can try to write the packet out now rather than queueing it.
     // If the write is unsuccessful or partial, we queue the remainder.
@@ -920,7 +1650,7 @@ bool control_conn_t::queue_packet(const char *pkt, unsigned size) noexcept
         else {
             if ((unsigned)wr == size) {
                 // Ok, all written.
-                iob.set_watches(in_flag);
+                iob.set_watches(input_watch_flag());
                 return true;
             }
             pkt += wr;
@@ -928,10 +1658,14 @@ bool control_conn_t::queue_packet(const char *pkt, unsigned size) noexcept
         }
     }
     
-    // Create a vector out of the (remaining part of the) packet:
+    // Queue the (remaining part of the) packet, after any queued events:
     try {
-        outbuf.emplace_back(pkt, pkt + size);
-        iob.set_watches(in_flag | OUT_EVENTS);
+        if (!event_ring.empty()) {
+            spill_event_ring();
+        }
+        outbuf.append(pkt, size);
+        account_output();
+        iob.set_watches(input_watch_flag() | OUT_EVENTS);
         return true;
     }
     catch (std::bad_alloc &baexc) {
@@ -951,17 +1685,12 @@ bool control_conn_t::queue_packet(const char *pkt, unsigned size) noexcept
     }
 }
 
-// This queue_packet method is frustratingly similar to the one above, but the subtle differences
-// make them extraordinary difficult to combine into a single method.
-bool control_conn_t::queue_packet(std::vector<char> &&pkt) noexcept
+bool control_conn_t::queue_event_packet(const char *pkt) noexcept
 {
-    int in_flag = bad_conn_close ? 0 : IN_EVENTS;
-    bool was_empty = outbuf.empty();
-    
-    if (was_empty) {
-        outpkt_index = 0;
-        // We can try sending the packet immediately:
-        int wr = bp_sys::write(iob.get_watched_fd(), pkt.data(), pkt.size());
+    unsigned written = 0;
+
+    if (!output_pending()) {
+        int wr = bp_sys::write(iob.get_watched_fd(), pkt, event_pkt_size);
         if (wr == -1) {
             if (errno == EPIPE) {
                 return false;
@@ -970,38 +1699,108 @@ bool control_conn_t::queue_packet(std::vector<char> &&pkt) noexcept
                 log(loglevel_t::WARN, "Error writing to control connection: ", strerror(errno));
                 return false;
             }
-            // EAGAIN etc: fall through to below
         }
         else {
-            if ((unsigned)wr == pkt.size()) {
-                // Ok, all written.
-                iob.set_watches(in_flag);
+            if ((unsigned)wr == event_pkt_size) {
+                iob.set_watches(input_watch_flag());
                 return true;
             }
-            outpkt_index = wr;
+            written = wr;
         }
     }
-    
-    try {
-        outbuf.emplace_back(pkt);
-        iob.set_watches(in_flag | OUT_EVENTS);
-        return true;
-    }
-    catch (std::bad_alloc &baexc) {
-        // Mark the connection bad, and stop reading further requests
-        bad_conn_close = true;
-        oom_close = true;
-        if (was_empty) {
-            // We can't send out-of-memory response as we already wrote as much as we
-            // could above. Neither can we later send the response since we have currently
-            // sent an incomplete packet. All we can do is close the connection.
-            return false;
+
+    if (event_ring.full()) {
+        // Replace any queued event for the same service handle; failing that, move the queued
+        // events to the output buffer to make room.
+        if (event_ring.replace_matching(pkt, 2, sizeof(handle_t))) {
+            return true;
         }
-        else {
+        if (check_output_overrun(event_ring.size())) {
+            return true;
+        }
+        try {
+            spill_event_ring();
+        }
+        catch (std::bad_alloc &baexc) {
+            bad_conn_close = true;
+            oom_close = true;
             iob.set_watches(OUT_EVENTS);
             return true;
         }
     }
+
+    // (If we wrote part of the packet above, the ring was empty; the written part is consumed.)
+    event_ring.push(pkt);
+    event_ring.consume(written);
+    account_output();
+    iob.set_watches(input_watch_flag() | OUT_EVENTS);
+    return true;
+}
+
+void control_conn_t::account_output() noexcept
+{
+    size_t queued = outbuf.size() + event_ring.size();
+    cp_output_budget.total_queued = cp_output_budget.total_queued - accounted_output + queued;
+    accounted_output = queued;
+
+    if (!input_paused && (queued > cp_output_budget.conn_limit
+            || (queued != 0 && cp_output_budget.total_queued > cp_output_budget.total_limit))) {
+        input_paused = true;
+        cp_output_budget.paused_conns++;
+        cp_output_budget.pause_count++;
+    }
+}
+
+bool control_conn_t::check_output_overrun(size_t size) noexcept
+{
+    if (accounted_output + size <= cp_output_budget.conn_limit * 2
+            && (accounted_output == 0
+                || cp_output_budget.total_queued + size <= cp_output_budget.total_limit * 2)) {
+        return false;
+    }
+
+    if (!bad_conn_close) {
+        log(loglevel_t::WARN, "Control connection output exceeds budget (client not reading?); "
+                "closing connection");
+        cp_output_budget.overrun_count++;
+        bad_conn_close = true;
+        iob.set_watches(OUT_EVENTS);
+    }
+    return true;
+}
+
+void control_conn_t::service_set_event(service_record *service, service_event_t event) noexcept
+{
+    // 1 byte: packet type = DINIT_IP_SERVICEEVENT2
+    // 1 byte: packet length
+    // 4 bytes: service id
+    // 1 byte: event
+    // 8 bytes: seconds, 4 bytes: nanoseconds (system time of event)
+    // N bytes: name (truncated if necessary to fit the packet length)
+    constexpr unsigned hdr_size = 19;
+    constexpr unsigned max_pkt_size = std::numeric_limits<uint8_t>::max();
+
+    const std::string &name = service->get_name();
+    unsigned name_len = std::min(name.length(), (size_t)(max_pkt_size - hdr_size));
+
+    time_val now;
+    loop.get_time(now, clock_type::SYSTEM);
+    int64_t secs = now.seconds();
+    uint32_t nsecs = now.nseconds();
+    uint32_t id = service->get_id();
+
+    char pkt[max_pkt_size];
+    pkt[0] = DINIT_IP_SERVICEEVENT2;
+    pkt[1] = hdr_size + name_len;
+    memcpy(pkt + 2, &id, sizeof(id));
+    pkt[6] = static_cast<char>(event);
+    memcpy(pkt + 7, &secs, sizeof(secs));
+    memcpy(pkt + 15, &nsecs, sizeof(nsecs));
+    memcpy(pkt + hdr_size, name.data(), name_len);
+
+    if (!check_output_overrun(hdr_size + name_len)) {
+        queue_packet(pkt, hdr_size + name_len);
+    }
 }
 
 bool control_conn_t::data_ready() noexcept
@@ -1023,25 +1822,40 @@ bool control_conn_t::data_ready() noexcept
         return true;
     }
     
-    // complete packet?
-    if (rbuf.get_length() >= chklen) {
-        try {
-            return !process_packet();
-        }
-        catch (std::bad_alloc &baexc) {
-            do_oom_close();
-            return false;
+    return process_packets();
+}
+
+bool control_conn_t::process_packets() noexcept
+{
+    // Process complete packets. The client may have sent several without waiting for replies (in
+    // particular, a set of services too large for one BATCH request is sent as several batches),
+    // and they may arrive together; we won't get another read event for those already buffered:
+    try {
+        while (!input_paused && rbuf.get_length() != 0 && rbuf.get_length() >= chklen) {
+            if (! process_packet()) {
+                return true;
+            }
+            if (bad_conn_close) {
+                // (watches have been set appropriately)
+                return false;
+            }
         }
     }
-    else if (rbuf.get_length() == rbuf.get_size()) {
+    catch (std::bad_alloc &baexc) {
+        do_oom_close();
+        return false;
+    }
+
+    if (!input_paused && rbuf.get_length() == rbuf.get_size()) {
         // Too big packet
         log(loglevel_t::WARN, "Received too-large control packet; dropping connection");
         bad_conn_close = true;
         iob.set_watches(OUT_EVENTS);
     }
     else {
-        int out_flags = (bad_conn_close || !outbuf.empty()) ? OUT_EVENTS : 0;
-        iob.set_watches(IN_EVENTS | out_flags);
+        // Wait for (the remainder of) the next packet, or for output to drain:
+        int out_flags = output_pending() ? OUT_EVENTS : 0;
+        iob.set_watches(input_watch_flag() | out_flags);
     }
     
     return false;
@@ -1049,7 +1863,7 @@ bool control_conn_t::data_ready() noexcept
 
 bool control_conn_t::send_data() noexcept
 {
-    if (outbuf.empty() && bad_conn_close) {
+    if (!output_pending() && bad_conn_close) {
         if (oom_close) {
             // Send oom response
             char oomBuf[] = { DINIT_RP_OOM };
@@ -1058,9 +1872,16 @@ bool control_conn_t::send_data() noexcept
         return true;
     }
     
-    vector<char> & pkt = outbuf.front();
-    char *data = pkt.data();
-    int written = bp_sys::write(iob.get_watched_fd(), data + outpkt_index, pkt.size() - outpkt_index);
+    // Write out as much queued data as we can (possibly several packets), including the queued
+    // events if all data in the output buffer can be written:
+    struct iovec iov[output_queue::max_iov + 2];
+    size_t outbuf_len;
+    int iov_count = outbuf.get_iov(iov, output_queue::max_iov, outbuf_len);
+    if (outbuf_len == outbuf.size()) {
+        iov_count += event_ring.get_iov(iov + iov_count);
+    }
+
+    ssize_t written = bp_sys::writev(iob.get_watched_fd(), iov, iov_count);
     if (written == -1) {
         if (errno == EPIPE) {
             // read end closed
@@ -1076,18 +1897,29 @@ bool control_conn_t::send_data() noexcept
         return false;
     }
 
-    outpkt_index += written;
-    if (outpkt_index == pkt.size()) {
-        // We've finished this packet, move on to the next:
-        outbuf.pop_front();
-        outpkt_index = 0;
-        if (outbuf.empty() && ! oom_close) {
-            if (! bad_conn_close) {
-                iob.set_watches(IN_EVENTS);
-            }
-            else {
-                return true;
-            }
+    size_t outbuf_written = std::min((size_t)written, outbuf_len);
+    outbuf.consume(outbuf_written);
+    event_ring.consume(written - outbuf_written);
+    account_output();
+
+    if (input_paused && (accounted_output <= cp_output_budget.conn_limit / 2)
+            && (accounted_output == 0
+                || cp_output_budget.total_queued <= cp_output_budget.total_limit / 2)) {
+        // Output has drained sufficiently; resume processing requests (including any already
+        // received):
+        input_paused = false;
+        cp_output_budget.paused_conns--;
+        if (!bad_conn_close) {
+            return process_packets();
+        }
+    }
+
+    if (!output_pending() && ! oom_close) {
+        if (! bad_conn_close) {
+            iob.set_watches(IN_EVENTS);
+        }
+        else {
+            return true;
         }
     }
     
@@ -1103,6 +1935,14 @@ control_conn_t::~control_conn_t() noexcept
     for (auto p : service_key_map) {
         p.first->remove_listener(this);
     }
+    if (subscribed_all) {
+        services->remove_set_listener(this);
+    }
+
+    cp_output_budget.total_queued -= accounted_output;
+    if (input_paused) {
+        cp_output_budget.paused_conns--;
+    }
     
     active_control_conns--;
 }
@@ -5,6 +5,7 @@
 #include <csignal>
 #include <cstddef>
 #include <cstdlib>
+#include <limits>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -27,6 +28,11 @@
 
 #include "dinit.h"
 #include "service.h"
+#include "service-cache.h"
+#include "status-page.h"
+#include "start-history.h"
+#include "service-watch.h"
+#include "env-file.h"
 #include "control.h"
 #include "dinit-log.h"
 #include "dinit-socket.h"
@@ -60,8 +66,11 @@ static void sigquit_cb(eventloop_t &eloop) noexcept;
 static void sigterm_cb(eventloop_t &eloop) noexcept;
 static bool open_control_socket(bool report_ro_failure = true) noexcept;
 static void close_control_socket() noexcept;
+static void open_status_page() noexcept;
+static void save_start_history() noexcept;
 static void confirm_restart_boot() noexcept;
 static void flush_log() noexcept;
+static void preload_services() noexcept;
 
 static void control_socket_cb(eventloop_t *loop, int fd);
 
@@ -69,6 +78,11 @@ static void control_socket_cb(eventloop_t *loop, int fd);
 // Variables
 
 static dirload_service_set *services;
+static service_cache svc_cache;
+static status_page svc_status_page;
+static start_history svc_start_history;
+static bool start_history_save_failed = false;  // whether failure to save history has been logged
+static bool rootfs_rw = false;  // whether the root filesystem is (known to be) writable
 
 static bool am_system_mgr = false;     // true if we are PID 1
 static bool am_system_init = false; // true if we are the system init process
@@ -171,9 +185,36 @@ namespace {
         }
     };
 
+    // Timer used to save the start history shortly after a service starts (so that services
+    // starting at around the same time, as at boot, are saved together).
+    class start_history_timer_t : public eventloop_t::timer_impl<start_history_timer_t>,
+            public service_set_listener
+    {
+        using rearm = dasynq::rearm;
+
+        bool armed = false;
+
+        public:
+        rearm timer_expiry(eventloop_t &, int expiry_count)
+        {
+            armed = false;
+            save_start_history();
+            return rearm::DISARM;
+        }
+
+        void service_set_event(service_record *service, service_event_t event) noexcept override
+        {
+            if (event == service_event_t::STARTED && !armed) {
+                arm_timer_rel(event_loop, timespec{2,0}); // 2 seconds
+                armed = true;
+            }
+        }
+    };
+
     control_socket_watcher control_socket_io;
     console_input_watcher console_input_io;
     log_flush_timer_t log_flush_timer;
+    start_history_timer_t start_history_timer;
 
     // These need to be at namespace scope to prevent causing stack allocations when using them:
     constexpr auto shutdown_exec = literal(SBINDIR) + "/" + SHUTDOWN_PREFIX + "shutdown";
@@ -191,6 +232,21 @@ struct options {
 
     service_dir_opt service_dir_opts;
 
+    // service description cache file, if any
+    const char * service_cache_path = nullptr;
+
+    // start duration history file, if any
+    const char * start_history_path = nullptr;
+
+    // whether to load all services from the service directories at startup
+    bool preload = false;
+
+    // whether to reload services automatically when their description files change
+    bool auto_reload = false;
+
+    // maximum number of services starting a process concurrently (0 = no limit)
+    unsigned start_limit = 0;
+
     // list of services to start
     std::list<const char *> services_to_start;
 };
@@ -231,6 +287,60 @@ static int process_commandline_arg(char **argv, int argc, int &i, options &opts)
                 return 1;
             }
         }
+        else if (strcmp(argv[i], "--service-cache") == 0) {
+            if (++i < argc) {
+                opts.service_cache_path = argv[i];
+            }
+            else {
+                cerr << "dinit: '--service-cache' requires an argument" << endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--start-history") == 0) {
+            if (++i < argc) {
+                opts.start_history_path = argv[i];
+            }
+            else {
+                cerr << "dinit: '--start-history' requires an argument" << endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--control-output-limit") == 0
+                || strcmp(argv[i], "--control-total-output-limit") == 0) {
+            bool is_total = (argv[i][10] == 't');
+            char *endp;
+            unsigned long long limit = 0;
+            if (++i < argc) {
+                errno = 0;
+                limit = strtoull(argv[i], &endp, 10);
+            }
+            if (i == argc || *argv[i] == 0 || *endp != 0 || errno != 0 || limit == 0
+                    || limit > std::numeric_limits<size_t>::max()) {
+                cerr << "dinit: '" << argv[i - 1] << "' requires a (non-zero) size in bytes" << endl;
+                return 1;
+            }
+            (is_total ? cp_output_budget.total_limit : cp_output_budget.conn_limit) = limit;
+        }
+        else if (strcmp(argv[i], "--start-limit") == 0) {
+            char *endp;
+            unsigned long limit = 0;
+            if (++i < argc) {
+                errno = 0;
+                limit = strtoul(argv[i], &endp, 10);
+            }
+            if (i == argc || *argv[i] == 0 || *endp != 0 || errno != 0
+                    || limit > std::numeric_limits<unsigned>::max()) {
+                cerr << "dinit: '--start-limit' requires a number of services (0 for no limit)" << endl;
+                return 1;
+            }
+            opts.start_limit = limit;
+        }
+        else if (strcmp(argv[i], "--preload") == 0) {
+            opts.preload = true;
+        }
+        else if (strcmp(argv[i], "--auto-reload") == 0) {
+            opts.auto_reload = true;
+        }
         else if (strcmp(argv[i], "--system") == 0 || strcmp(argv[i], "-s") == 0) {
             am_system_init = true;
         }
@@ -283,6 +393,19 @@ static int process_commandline_arg(char **argv, int argc, int &i, options &opts)
                     " --services-dir <dir>, -d <dir>\n"
                     "                              set base directory for service description\n"
                     "                              files, can be specified multiple times\n"
+                    " --service-cache <file>       use pre-parsed service descriptions from\n"
+                    "                              <file> (as written by dinitcheck)\n"
+                    " --control-output-limit <bytes>\n"
+                    "                              limit output queued for each control connection\n"
+                    " --control-total-output-limit <bytes>\n"
+                    "                              limit output queued for all control connections\n"
+                    " --start-limit <count>        limit the number of services starting a process\n"
+                    "                              at once\n"
+                    " --start-history <file>       record service start durations in <file>\n"
+                    " --preload                    load all services from the service directories\n"
+                    "                              at startup\n"
+                    " --auto-reload                reload services when their description files\n"
+                    "                              change\n"
                     " --system, -s                 run as the system service manager\n"
                     " --system-mgr, -m             run as system manager (perform shutdown etc)\n"
                     " --user, -u                   run as a user service manager\n"
@@ -448,6 +571,10 @@ int dinit_main(int argc, char **argv)
     init_log(log_is_syslog);
     log_flush_timer.add_timer(event_loop, dasynq::clock_type::MONOTONIC);
 
+    // If we are not system init, the root filesystem should already be writable (as far as we are
+    // concerned); otherwise we wait until notified (see rootfs_is_rw()).
+    rootfs_rw = !am_system_init;
+
     // Try to open control socket (may fail due to readonly filesystem, we ignore that if we are
     // system init)
     if (!open_control_socket(!am_system_init)) {
@@ -478,8 +605,46 @@ int dinit_main(int argc, char **argv)
     // Start requested services
 
     services = new dirload_service_set(std::move(service_dir_opts.get_paths()));
+    services->set_start_slot_limit(opts.start_limit);
+
+    if (opts.service_cache_path != nullptr) {
+        std::string cache_err;
+        try {
+            if (svc_cache.open(opts.service_cache_path, services->get_service_dirs(), cache_err)) {
+                services->set_service_cache(&svc_cache);
+            }
+            else {
+                log(loglevel_t::WARN, "Not using service cache: ", cache_err);
+            }
+        }
+        catch (std::bad_alloc &) {
+            log(loglevel_t::WARN, "Not using service cache: out of memory");
+        }
+    }
+
+    if (opts.start_history_path != nullptr) {
+        try {
+            std::string history_err;
+            if (!svc_start_history.load(opts.start_history_path, history_err) && errno != ENOENT) {
+                if (errno != 0) {
+                    log(loglevel_t::WARN, "Could not read start history: ", opts.start_history_path,
+                            ": ", strerror(errno));
+                }
+                else {
+                    log(loglevel_t::WARN, "Could not read start history: ", history_err);
+                }
+            }
+            start_history_timer.add_timer(event_loop, dasynq::clock_type::MONOTONIC);
+            services->add_set_listener(&start_history_timer);
+            services->set_start_history(&svc_start_history);
+        }
+        catch (std::bad_alloc &) {
+            log(loglevel_t::WARN, "Not recording start history: out of memory");
+        }
+    }
 
     setup_log_console_handoff(services);
+    open_status_page();
 
     if (am_system_init) {
         log(loglevel_t::NOTICE, false, "Starting system");
@@ -493,6 +658,14 @@ int dinit_main(int argc, char **argv)
         read_env_file(env_file);
     }
 
+    if (opts.preload) {
+        preload_services();
+    }
+
+    if (opts.auto_reload && !start_service_dir_watch(services)) {
+        log(loglevel_t::WARN, "Could not watch service directories for changes: ", strerror(errno));
+    }
+
     for (auto svc : services_to_start) {
         try {
             services->start_service(svc);
@@ -615,47 +788,38 @@ void read_env_file(const char *env_file_path)
 
     env_file.exceptions(std::ios::badbit);
 
-    auto &clocale = std::locale::classic();
-    std::string line;
-    int linenum = 0;
-
-    while (std::getline(env_file, line)) {
-        linenum++;
-        auto lpos = line.begin();
-        auto lend = line.end();
-        while (lpos != lend && std::isspace(*lpos, clocale)) {
-            ++lpos;
-        }
-
-        if (lpos != lend) {
-            if (*lpos != '#') {
-                if (*lpos == '=') {
-                    log_bad_env(linenum);
-                    continue;
-                }
-                auto name_begin = lpos++;
-                // skip until '=' or whitespace:
-                while (lpos != lend && *lpos != '=' && ! std::isspace(*lpos, clocale)) ++lpos;
-                auto name_end = lpos;
-                //  skip whitespace:
-                while (lpos != lend && std::isspace(*lpos, clocale)) ++lpos;
-                if (lpos == lend) {
-                    log_bad_env(linenum);
-                    continue;
-                }
-
-                ++lpos;
-                auto val_begin = lpos;
-                while (lpos != lend && *lpos != '\n') ++lpos;
-                auto val_end = lpos;
-
-                std::string name = line.substr(name_begin - line.begin(), name_end - name_begin);
-                std::string value = line.substr(val_begin - line.begin(), val_end - val_begin);
+    parse_env_file(env_file,
+            [](const std::string &name, const std::string &value) {
                 if (setenv(name.c_str(), value.c_str(), true) == -1) {
                     throw std::system_error(errno, std::system_category());
                 }
-            }
+            },
+            log_bad_env);
+}
+
+// Load all services from the service directories (--preload option), reporting load failures and
+// the time taken.
+static void preload_services() noexcept
+{
+    time_val start_time, end_time;
+    event_loop.get_time(start_time, clock_type::MONOTONIC);
+
+    try {
+        std::list<std::pair<std::string, std::string>> errors;
+        unsigned num_loaded = services->preload_services(errors);
+        event_loop.get_time(end_time, clock_type::MONOTONIC);
+
+        for (auto &error : errors) {
+            log(loglevel_t::ERROR, "Could not load service ", error.first, ": ", error.second);
         }
+
+        time_val elapsed = end_time - start_time;
+        int elapsed_ms = elapsed.seconds() * 1000 + elapsed.nseconds() / 1000000;
+        log(loglevel_t::NOTICE, "Preloaded ", (int)num_loaded, " services (", (int)errors.size(),
+                " failed) in ", elapsed_ms, "ms.");
+    }
+    catch (std::bad_alloc &) {
+        log(loglevel_t::ERROR, "Out of memory while preloading services.");
     }
 }
 
@@ -752,7 +916,10 @@ static void control_socket_cb(eventloop_t *loop, int sockfd)
 // Callback when the root filesystem is read/write:
 void rootfs_is_rw() noexcept
 {
+    rootfs_rw = true;
     open_control_socket(true);
+    open_status_page();
+    save_start_history();
     if (! did_log_boot) {
         did_log_boot = log_boot();
     }
@@ -872,6 +1039,60 @@ static void close_control_socket() noexcept
 
         control_socket_open = false;
     }
+
+    if (svc_status_page.is_open()) {
+        services->set_status_page(nullptr);
+        svc_status_page.close();
+    }
+}
+
+// Create the status page (alongside the control socket, which must be open) and publish the
+// status of all services to it. Failure is not fatal.
+static void open_status_page() noexcept
+{
+    if (svc_status_page.is_open() || !control_socket_open || services == nullptr) {
+        return;
+    }
+
+    std::string status_err;
+    try {
+        std::string status_path = std::string(control_socket_path) + ".status";
+        if (!svc_status_page.open(status_path.c_str(), status_err)) {
+            log(loglevel_t::WARN, "Could not create status page: ", status_err);
+            return;
+        }
+    }
+    catch (std::bad_alloc &) {
+        log(loglevel_t::WARN, "Could not create status page: out of memory");
+        return;
+    }
+
+    services->set_status_page(&svc_status_page);
+}
+
+// Save the start history (if it has changed), once the root filesystem is writable. If the file
+// cannot be written because the filesystem is nonetheless read-only, or the directory does not
+// (yet) exist, this is not reported; saving will be attempted again after the next service starts.
+static void save_start_history() noexcept
+{
+    if (services == nullptr || services->get_start_history() == nullptr
+            || !svc_start_history.is_dirty() || !rootfs_rw) {
+        return;
+    }
+
+    bool saved;
+    try {
+        saved = svc_start_history.save();
+    }
+    catch (std::bad_alloc &) {
+        saved = false;
+        errno = ENOMEM;
+    }
+
+    if (!saved && errno != EROFS && errno != ENOENT && !start_history_save_failed) {
+        log(loglevel_t::WARN, "Could not write start history: ", strerror(errno));
+        start_history_save_failed = true;
+    }
 }
 
 void setup_external_log() noexcept
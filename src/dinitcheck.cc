@@ -18,6 +18,7 @@
 #include "dinit-util.h"
 #include "service-constants.h"
 #include "load-service.h"
+#include "service-cache.h"
 #include "options-processing.h"
 
 // dinitcheck:  utility to check Dinit configuration for correctness/lint
@@ -68,6 +69,11 @@ template <typename T> bool contains(std::vector<T> vec, const T& elem)
 
 static bool errors_found = false;
 
+// Service description cache: records for successfully checked services are added to the builder,
+// if writing a cache, or compared to the existing cache if verifying.
+static service_cache_builder *cache_builder = nullptr;
+static service_cache *cache_to_verify = nullptr;
+
 int main(int argc, char **argv)
 {
     using namespace std;
@@ -76,6 +82,8 @@ int main(int argc, char **argv)
     bool am_system_init = (getuid() == 0);
 
     std::vector<std::string> services_to_check;
+    const char *write_cache_path = nullptr;
+    const char *verify_cache_path = nullptr;
 
     // Process command line
     if (argc > 1) {
@@ -91,12 +99,34 @@ int main(int argc, char **argv)
                         return 1;
                     }
                 }
+                else if (strcmp(argv[i], "--write-cache") == 0) {
+                    if (++i < argc) {
+                        write_cache_path = argv[i];
+                    }
+                    else {
+                        cerr << "dinitcheck: '--write-cache' requires an argument" << endl;
+                        return 1;
+                    }
+                }
+                else if (strcmp(argv[i], "--verify-cache") == 0) {
+                    if (++i < argc) {
+                        verify_cache_path = argv[i];
+                    }
+                    else {
+                        cerr << "dinitcheck: '--verify-cache' requires an argument" << endl;
+                        return 1;
+                    }
+                }
                 else if (strcmp(argv[i], "--help") == 0) {
                     cout << "dinitcheck: check dinit service descriptions\n"
                             " --help                       display help\n"
                             " --services-dir <dir>, -d <dir>\n"
                             "                              set base directory for service description\n"
                             "                              files, can be specified multiple times\n"
+                            " --write-cache <file>         write pre-parsed descriptions of the checked\n"
+                            "                              services to <file>, for use by dinit\n"
+                            " --verify-cache <file>        check that the cache in <file> is current for\n"
+                            "                              the checked services\n"
                             " <service-name>               check service with name <service-name>\n";
                     return EXIT_SUCCESS;
                 }
@@ -113,6 +143,23 @@ int main(int argc, char **argv)
 
     service_dir_opts.build_paths(am_system_init);
 
+    service_cache_builder builder;
+    if (write_cache_path != nullptr) {
+        cache_builder = &builder;
+    }
+
+    service_cache existing_cache;
+    if (verify_cache_path != nullptr) {
+        std::string cache_err;
+        if (!existing_cache.open(verify_cache_path, service_dir_opts.get_paths(), cache_err)) {
+            std::cerr << "Service cache is not usable: " << cache_err << "\n";
+            errors_found = true;
+        }
+        else {
+            cache_to_verify = &existing_cache;
+        }
+    }
+
     if (services_to_check.empty()) {
         services_to_check.push_back("boot");
     }
@@ -212,6 +259,13 @@ int main(int argc, char **argv)
         std::cerr << "    " << std::get<0>(service_chain[0])->name << ".\n";
     }
 
+    if (write_cache_path != nullptr) {
+        if (!builder.write(write_cache_path, service_dir_opts.get_paths())) {
+            std::cerr << "Error writing service cache " << write_cache_path << ": " << strerror(errno) << "\n";
+            errors_found = true;
+        }
+    }
+
     if (! errors_found) {
         std::cout << "No problems found.\n";
     }
@@ -324,7 +378,12 @@ service_record *load_service(service_set_t &services, const std::string &name,
         }
     }
 
-    service_settings_wrapper<prelim_dep> settings;
+    // Dependencies are recorded by name (or dependency directory), as they are in the service
+    // cache; dependency directories are read after the settings have been processed.
+    service_settings_wrapper<cached_dep> settings;
+
+    // Whether the description is valid (and so can be stored in the cache)
+    bool description_valid = true;
 
     string line;
     service_file.exceptions(ios::badbit);
@@ -333,9 +392,9 @@ service_record *load_service(service_set_t &services, const std::string &name,
         process_service_file(name, service_file,
                 [&](string &line, string &setting, string_iterator &i, string_iterator &end) -> void {
 
-            auto process_dep_dir_n = [&](std::list<prelim_dep> &deplist, const std::string &waitsford,
+            auto process_dep_dir_n = [&](std::list<cached_dep> &deplist, const std::string &waitsford,
                     dependency_type dep_type) -> void {
-                process_dep_dir(name.c_str(), service_filename, deplist, waitsford, dep_type);
+                deplist.emplace_back(waitsford, dep_type, true);
             };
 
             auto load_service_n = [&](const string &dep_name) -> const string & {
@@ -347,6 +406,7 @@ service_record *load_service(service_set_t &services, const std::string &name,
             }
             catch (service_description_exc &exc) {
                 report_service_description_exc(exc);
+                description_valid = false;
             }
         });
     }
@@ -356,8 +416,19 @@ service_record *load_service(service_set_t &services, const std::string &name,
         throw service_description_exc(name, "error while reading service description.");
     }
 
+    // The cache holds settings as they were before being finalised:
+    cache_writer cache_settings;
+    if (cache_builder != nullptr || cache_to_verify != nullptr) {
+        write_cached_settings(cache_settings, settings, settings.depends);
+    }
+
     auto report_err = [&](const char *msg) {
         report_service_description_err(name, msg);
+        description_valid = false;
+    };
+
+    auto report_lint = [&](const char *msg) {
+        report_service_description_err(name, msg);
     };
 
     bool issued_var_subst_warning = false;
@@ -371,7 +442,7 @@ service_record *load_service(service_set_t &services, const std::string &name,
         return resolve_env_var(name);
     };
 
-    settings.finalise(report_err, report_err, resolve_var);
+    settings.finalise(report_err, report_lint, resolve_var);
 
     auto check_command = [&](const char *setting_name, const char *command) {
         struct stat command_stat;
@@ -404,5 +475,33 @@ service_record *load_service(service_set_t &services, const std::string &name,
                 settings.stop_command.substr(offset_start, offset_end - offset_start).c_str());
     }
 
-    return new service_record(name, settings.chain_to_name, settings.depends);
+    if (description_valid) {
+        std::vector<char> &cache_data = cache_settings.get_buffer();
+        if (cache_builder != nullptr) {
+            if (!cache_builder->add_record(name, service_filename, cache_data)) {
+                report_service_description_err(name, std::string("could not add to service cache: ")
+                        + strerror(errno));
+            }
+        }
+        if (cache_to_verify != nullptr) {
+            cache_reader cached_r;
+            if (!cache_to_verify->lookup(name, service_filename, cached_r)
+                    || cached_r.remaining() != cache_data.size()
+                    || memcmp(cached_r.get_pos(), cache_data.data(), cache_data.size()) != 0) {
+                report_service_description_err(name, "service cache record is missing or out of date.");
+            }
+        }
+    }
+
+    std::list<prelim_dep> dependencies;
+    for (auto &dep : settings.depends) {
+        if (dep.is_dir) {
+            process_dep_dir(name.c_str(), service_filename, dependencies, dep.name, dep.dep_type);
+        }
+        else {
+            dependencies.emplace_back(dep.name, dep.dep_type);
+        }
+    }
+
+    return new service_record(name, settings.chain_to_name, dependencies);
 }
@@ -1,18 +1,24 @@
 #include <cstdio>
 #include <cstddef>
 #include <cstring>
+#include <ctime>
 #include <string>
 #include <iostream>
 #include <fstream>
 #include <system_error>
 #include <memory>
+#include <vector>
 #include <algorithm>
+#include <unordered_map>
+#include <iomanip>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <signal.h>
 #include <pwd.h>
@@ -23,6 +29,8 @@
 #include "dinit-client.h"
 #include "load-service.h"
 #include "dinit-util.h"
+#include "status-page.h"
+#include "service-timeline.h"
 #include "mconfig.h"
 
 // dinitctl:  utility to control the Dinit daemon, including starting and stopping of services.
@@ -31,7 +39,7 @@
 // SYSCONTROLSOCKET, or $HOME/.dinitctl).
 
 static constexpr uint16_t min_cp_version = 1;
-static constexpr uint16_t max_cp_version = 1;
+static constexpr uint16_t max_cp_version = 9;
 
 enum class command_t;
 
@@ -40,11 +48,22 @@ static int check_load_reply(int socknum, cpbuffer_t &, handle_t *handle_p, servi
         bool write_error=true);
 static int start_stop_service(int socknum, cpbuffer_t &, const char *service_name, command_t command,
         bool do_pin, bool do_force, bool wait_for_service, bool ignore_unstarted, bool verbose);
+static int start_stop_services(int socknum, cpbuffer_t &, const std::vector<const char *> &service_names,
+        command_t command, bool do_pin, bool do_force, bool wait_for_service, bool ignore_unstarted,
+        bool verbose);
 static int unpin_service(int socknum, cpbuffer_t &, const char *service_name, bool verbose);
 static int unload_service(int socknum, cpbuffer_t &, const char *service_name, bool verbose);
 static int reload_service(int socknum, cpbuffer_t &, const char *service_name, bool verbose);
-static int list_services(int socknum, cpbuffer_t &);
+struct list_filter;
+static int list_services(int socknum, cpbuffer_t &, uint16_t cp_version, const list_filter &filter);
+static int list_services_fast(const char *status_page_path, const list_filter &filter);
 static int shutdown_dinit(int soclknum, cpbuffer_t &, bool verbose);
+static int preload_services(int socknum, cpbuffer_t &, uint16_t cp_version, bool verbose);
+static int follow_events(int socknum, cpbuffer_t &, uint16_t cp_version);
+static int service_status(int socknum, cpbuffer_t &, uint16_t cp_version,
+        const std::vector<const char *> &service_names);
+static int analyze_timeline(int socknum, cpbuffer_t &, uint16_t cp_version, const char *service_name);
+static int trace_timeline(int socknum, cpbuffer_t &, uint16_t cp_version);
 static int add_remove_dependency(int socknum, cpbuffer_t &rbuffer, bool add, const char *service_from,
         const char *service_to, dependency_type dep_type, bool verbose);
 static int enable_disable_service(int socknum, cpbuffer_t &rbuffer, const char *from, const char *to,
@@ -75,7 +94,12 @@ enum class command_t {
     ADD_DEPENDENCY,
     RM_DEPENDENCY,
     ENABLE_SERVICE,
-    DISABLE_SERVICE
+    DISABLE_SERVICE,
+    PRELOAD_SERVICES,
+    FOLLOW_EVENTS,
+    SERVICE_STATUS,
+    ANALYZE_TIMELINE,
+    TRACE_TIMELINE
 };
 
 class dinit_protocol_error
@@ -83,6 +107,46 @@ class dinit_protocol_error
     // no body
 };
 
+// Filter for listing services (LISTSERVICES2); flags are as for the request packet.
+struct list_filter
+{
+    int flags = 0;  // 1 = state, 2 = target state, 4 = service type, 8 = name prefix
+    service_state_t state = service_state_t::STOPPED;
+    service_state_t target = service_state_t::STOPPED;
+    service_type_t type = service_type_t::INTERNAL;
+    const char *prefix = "";
+};
+
+// Parse a service state name for a list filter. Returns false if the name is not recognized.
+static bool parse_state_name(const char *name, service_state_t &state)
+{
+    if (strcmp(name, "started") == 0) state = service_state_t::STARTED;
+    else if (strcmp(name, "stopped") == 0) state = service_state_t::STOPPED;
+    else if (strcmp(name, "starting") == 0) state = service_state_t::STARTING;
+    else if (strcmp(name, "stopping") == 0) state = service_state_t::STOPPING;
+    else return false;
+    return true;
+}
+
+// Parse a service type name for a list filter. Returns false if the name is not recognized.
+static bool parse_type_name(const char *name, service_type_t &type)
+{
+    if (strcmp(name, "process") == 0) type = service_type_t::PROCESS;
+    else if (strcmp(name, "bgprocess") == 0) type = service_type_t::BGPROCESS;
+    else if (strcmp(name, "scripted") == 0) type = service_type_t::SCRIPTED;
+    else if (strcmp(name, "internal") == 0) type = service_type_t::INTERNAL;
+    else return false;
+    return true;
+}
+
+// Check whether a command can be applied to several services (named on the command line) at once.
+static bool is_multi_service_command(command_t command)
+{
+    return command == command_t::START_SERVICE || command == command_t::WAKE_SERVICE
+            || command == command_t::STOP_SERVICE || command == command_t::RESTART_SERVICE
+            || command == command_t::RELEASE_SERVICE || command == command_t::SERVICE_STATUS;
+}
+
 // Entry point.
 int main(int argc, char **argv)
 {
@@ -90,6 +154,7 @@ int main(int argc, char **argv)
     
     bool show_help = argc < 2;
     const char *service_name = nullptr;
+    std::vector<const char *> service_names;  // for commands which accept several services
     const char *to_service_name = nullptr;
     dependency_type dep_type;
     bool dep_type_set = false;
@@ -103,6 +168,8 @@ int main(int argc, char **argv)
     bool do_pin = false;
     bool do_force = false;
     bool ignore_unstarted = false;
+    bool list_fast = false;
+    list_filter filter;
     
     command_t command = command_t::NONE;
         
@@ -155,6 +222,39 @@ int main(int argc, char **argv)
                     && (strcmp(argv[i], "--force") == 0 || strcmp(argv[i], "-f") == 0)) {
                 do_force = true;
             }
+            else if (command == command_t::LIST_SERVICES && (strcmp(argv[i], "--state") == 0
+                    || strcmp(argv[i], "--target") == 0)) {
+                bool is_target = (argv[i][2] == 't');
+                ++i;
+                if (i == argc || ! parse_state_name(argv[i],
+                        is_target ? filter.target : filter.state)) {
+                    cerr << "dinitctl: " << argv[i - 1] << " should be followed by one of: "
+                            "started, stopped, starting, stopping" << std::endl;
+                    return 1;
+                }
+                filter.flags |= (is_target ? 2 : 1);
+            }
+            else if (command == command_t::LIST_SERVICES && strcmp(argv[i], "--type") == 0) {
+                ++i;
+                if (i == argc || ! parse_type_name(argv[i], filter.type)) {
+                    cerr << "dinitctl: --type should be followed by one of: process, bgprocess, "
+                            "scripted, internal" << std::endl;
+                    return 1;
+                }
+                filter.flags |= 4;
+            }
+            else if (command == command_t::LIST_SERVICES && strcmp(argv[i], "--fast") == 0) {
+                list_fast = true;
+            }
+            else if (command == command_t::LIST_SERVICES && strcmp(argv[i], "--prefix") == 0) {
+                ++i;
+                if (i == argc) {
+                    cerr << "dinitctl: --prefix should be followed by a service name prefix" << std::endl;
+                    return 1;
+                }
+                filter.prefix = argv[i];
+                filter.flags |= 8;
+            }
             else {
                 cerr << "dinitctl: unrecognized/invalid option: " << argv[i] << " (use --help for help)\n";
                 return 1;
@@ -203,6 +303,21 @@ int main(int argc, char **argv)
             else if (strcmp(argv[i], "disable") == 0) {
                 command = command_t::DISABLE_SERVICE;
             }
+            else if (strcmp(argv[i], "preload") == 0) {
+                command = command_t::PRELOAD_SERVICES;
+            }
+            else if (strcmp(argv[i], "events") == 0) {
+                command = command_t::FOLLOW_EVENTS;
+            }
+            else if (strcmp(argv[i], "status") == 0) {
+                command = command_t::SERVICE_STATUS;
+            }
+            else if (strcmp(argv[i], "analyze") == 0) {
+                command = command_t::ANALYZE_TIMELINE;
+            }
+            else if (strcmp(argv[i], "trace") == 0) {
+                command = command_t::TRACE_TIMELINE;
+            }
             else {
                 cerr << "dinitctl: unrecognized command: " << argv[i] << " (use --help for help)\n";
                 return 1;
@@ -246,21 +361,31 @@ int main(int argc, char **argv)
                 to_service_name = argv[i];
             }
             else {
-                if (service_name != nullptr) {
+                if (service_name != nullptr && ! is_multi_service_command(command)) {
                     show_help = true;
                     break;
                 }
-                service_name = argv[i];
-                // TODO support multiple services
+                if (service_name == nullptr) {
+                    service_name = argv[i];
+                }
+                service_names.push_back(argv[i]);
             }
         }
     }
     
-    bool no_service_cmd = (command == command_t::LIST_SERVICES || command == command_t::SHUTDOWN);
+    bool no_service_cmd = (command == command_t::LIST_SERVICES || command == command_t::SHUTDOWN
+            || command == command_t::PRELOAD_SERVICES || command == command_t::FOLLOW_EVENTS);
 
     if (command == command_t::ENABLE_SERVICE || command == command_t::DISABLE_SERVICE) {
         show_help |= (to_service_name == nullptr);
     }
+    else if (command == command_t::ANALYZE_TIMELINE) {
+        // service name is optional
+    }
+    else if (command == command_t::TRACE_TIMELINE) {
+        // "dump" is currently the only trace sub-command
+        show_help |= (service_name == nullptr || strcmp(service_name, "dump") != 0);
+    }
     else if ((service_name == nullptr && ! no_service_cmd) || command == command_t::NONE) {
         show_help = true;
     }
@@ -278,20 +403,26 @@ int main(int argc, char **argv)
         cout << "dinitctl:   control Dinit services\n"
           "\n"
           "Usage:\n"
-          "    dinitctl [options] start [options] <service-name>\n"
-          "    dinitctl [options] stop [options] <service-name>\n"
-          "    dinitctl [options] restart [options] <service-name>\n"
-          "    dinitctl [options] wake [options] <service-name>\n"
-          "    dinitctl [options] release [options] <service-name>\n"
+          "    dinitctl [options] start [options] <service-name>...\n"
+          "    dinitctl [options] stop [options] <service-name>...\n"
+          "    dinitctl [options] restart [options] <service-name>...\n"
+          "    dinitctl [options] wake [options] <service-name>...\n"
+          "    dinitctl [options] release [options] <service-name>...\n"
           "    dinitctl [options] unpin <service-name>\n"
           "    dinitctl [options] unload <service-name>\n"
           "    dinitctl [options] reload <service-name>\n"
-          "    dinitctl [options] list\n"
+          "    dinitctl [options] list [--fast] [--state <state>] [--target <state>]\n"
+          "                            [--type <type>] [--prefix <name-prefix>]\n"
           "    dinitctl [options] shutdown\n"
           "    dinitctl [options] add-dep <type> <from-service> <to-service>\n"
           "    dinitctl [options] rm-dep <type> <from-service> <to-service>\n"
           "    dinitctl [options] enable [--from <from-service>] <to-service>\n"
           "    dinitctl [options] disable [--from <from-service>] <to-service>\n"
+          "    dinitctl [options] preload\n"
+          "    dinitctl [options] events\n"
+          "    dinitctl [options] status <service-name>...\n"
+          "    dinitctl [options] analyze [<service-name>]\n"
+          "    dinitctl [options] trace dump\n"
           "\n"
           "Note: An activated service continues running when its dependents stop.\n"
           "\n"
@@ -306,7 +437,14 @@ int main(int argc, char **argv)
           "Command options:\n"
           "  --no-wait        : don't wait for service startup/shutdown to complete\n"
           "  --pin            : pin the service in the requested state\n"
-          "  --force          : force stop even if dependents will be affected\n";
+          "  --force          : force stop even if dependents will be affected\n"
+          "  --fast           : list services from the status page, without contacting the\n"
+          "                     daemon\n"
+          "  --state <state>, --target <state>\n"
+          "                   : list only services in the given (target) state\n"
+          "  --type <type>    : list only services of the given type\n"
+          "  --prefix <name-prefix>\n"
+          "                   : list only services with names beginning with the given prefix\n";
         return 1;
     }
     
@@ -340,6 +478,10 @@ int main(int argc, char **argv)
         }
     }
     
+    if (list_fast) {
+        return list_services_fast((std::string(control_socket_path) + ".status").c_str(), filter);
+    }
+
     int socknum = socket(AF_UNIX, SOCK_STREAM, 0);
     if (socknum == -1) {
         perror("dinitctl: error opening socket");
@@ -366,7 +508,7 @@ int main(int argc, char **argv)
     try {
         // Start by querying protocol version:
         cpbuffer_t rbuffer;
-        check_protocol_version(min_cp_version, max_cp_version, rbuffer, socknum);
+        uint16_t cp_version = check_protocol_version(min_cp_version, max_cp_version, rbuffer, socknum);
 
         if (command == command_t::UNPIN_SERVICE) {
             return unpin_service(socknum, rbuffer, service_name, verbose);
@@ -378,11 +520,26 @@ int main(int argc, char **argv)
             return reload_service(socknum, rbuffer, service_name, verbose);
         }
         else if (command == command_t::LIST_SERVICES) {
-            return list_services(socknum, rbuffer);
+            return list_services(socknum, rbuffer, cp_version, filter);
         }
         else if (command == command_t::SHUTDOWN) {
             return shutdown_dinit(socknum, rbuffer, verbose);
         }
+        else if (command == command_t::PRELOAD_SERVICES) {
+            return preload_services(socknum, rbuffer, cp_version, verbose);
+        }
+        else if (command == command_t::FOLLOW_EVENTS) {
+            return follow_events(socknum, rbuffer, cp_version);
+        }
+        else if (command == command_t::SERVICE_STATUS) {
+            return service_status(socknum, rbuffer, cp_version, service_names);
+        }
+        else if (command == command_t::ANALYZE_TIMELINE) {
+            return analyze_timeline(socknum, rbuffer, cp_version, service_name);
+        }
+        else if (command == command_t::TRACE_TIMELINE) {
+            return trace_timeline(socknum, rbuffer, cp_version);
+        }
         else if (command == command_t::ADD_DEPENDENCY || command == command_t::RM_DEPENDENCY) {
             return add_remove_dependency(socknum, rbuffer, command == command_t::ADD_DEPENDENCY,
                     service_name, to_service_name, dep_type, verbose);
@@ -395,6 +552,10 @@ int main(int argc, char **argv)
             return enable_disable_service(socknum, rbuffer, service_name, to_service_name,
                     command == command_t::ENABLE_SERVICE, verbose);
         }
+        else if (service_names.size() > 1) {
+            return start_stop_services(socknum, rbuffer, service_names, command, do_pin, do_force,
+                    wait_for_service, ignore_unstarted, verbose);
+        }
         else {
             return start_stop_service(socknum, rbuffer, service_name, command, do_pin, do_force,
                     wait_for_service, ignore_unstarted, verbose);
@@ -721,6 +882,286 @@ static int start_stop_service(int socknum, cpbuffer_t &rbuffer, const char *serv
     return 1;
 }
 
+// Maximum number of requests to send before reading the replies, when pipelining requests for
+// several services. This bounds the amount of reply data that the daemon must queue for us.
+static constexpr size_t max_pipelined = 256;
+
+// Append a LOADSERVICE (or FINDSERVICE) request for the named service to a buffer.
+static void append_load_request(std::vector<char> &buf, const char *service_name, bool find_only)
+{
+    uint16_t sname_len = strlen(service_name);
+    buf.push_back(find_only ? DINIT_CP_FINDSERVICE : DINIT_CP_LOADSERVICE);
+    buf.insert(buf.end(), (char *) &sname_len, (char *) &sname_len + 2);
+    buf.insert(buf.end(), service_name, service_name + sname_len);
+}
+
+// Wait for a reply packet, as for wait_for_reply, but pass any service events received in the
+// meantime to the given function (as handle, event) rather than discarding them.
+template <typename F>
+static void wait_for_reply_with_events(cpbuffer_t &rbuffer, int fd, F event_func)
+{
+    fill_buffer_to(rbuffer, fd, 1);
+
+    while (rbuffer[0] >= 100) {
+        fill_buffer_to(rbuffer, fd, 2);
+        int pktlen = (unsigned char) rbuffer[1];
+        fill_buffer_to(rbuffer, fd, pktlen);
+
+        if (rbuffer[0] == DINIT_IP_SERVICEEVENT) {
+            handle_t ev_handle;
+            rbuffer.extract((char *) &ev_handle, 2, sizeof(ev_handle));
+            event_func(ev_handle, static_cast<service_event_t>(rbuffer[2 + sizeof(ev_handle)]));
+        }
+
+        rbuffer.consume(pktlen);
+        fill_buffer_to(rbuffer, fd, 1);
+    }
+}
+
+// Start/stop several services. The requests to load the services, and then the start/stop
+// commands, are pipelined (sent together before any reply is read), and all services are then
+// waited for together.
+static int start_stop_services(int socknum, cpbuffer_t &rbuffer, const std::vector<const char *> &service_names,
+        command_t command, bool do_pin, bool do_force, bool wait_for_service, bool ignore_unstarted,
+        bool verbose)
+{
+    using namespace std;
+
+    bool do_stop = (command == command_t::STOP_SERVICE || command == command_t::RELEASE_SERVICE);
+
+    if (command != command_t::RESTART_SERVICE && command != command_t::STOP_SERVICE
+            && command != command_t::RELEASE_SERVICE) {
+        ignore_unstarted = false;
+    }
+
+    int pcommand = 0;
+    switch (command) {
+        case command_t::STOP_SERVICE:
+        case command_t::RESTART_SERVICE:  // stop, and then start
+            pcommand = DINIT_CP_STOPSERVICE;
+            break;
+        case command_t::RELEASE_SERVICE:
+            pcommand = DINIT_CP_RELEASESERVICE;
+            break;
+        case command_t::START_SERVICE:
+            pcommand = DINIT_CP_STARTSERVICE;
+            break;
+        case command_t::WAKE_SERVICE:
+            pcommand = DINIT_CP_WAKESERVICE;
+            break;
+        default: ;
+    }
+
+    char flags = (do_pin ? 1 : 0) | ((pcommand == DINIT_CP_STOPSERVICE && !do_force) ? 2 : 0);
+    if (command == command_t::RESTART_SERVICE) {
+        flags |= 4;
+    }
+
+    service_event_t completion_event;
+    service_event_t cancelled_event;
+
+    if (do_stop) {
+        completion_event = service_event_t::STOPPED;
+        cancelled_event = service_event_t::STOPCANCELLED;
+    }
+    else {
+        completion_event = service_event_t::STARTED;
+        cancelled_event = service_event_t::STARTCANCELLED;
+    }
+
+    struct service_op
+    {
+        const char *name;
+        handle_t handle = -1;
+        bool loaded = false;
+        bool waiting = false;   // command issued, waiting for completion
+        std::vector<handle_t> dependents;  // dependents preventing stop
+    };
+
+    std::vector<service_op> ops(service_names.size());
+    for (size_t i = 0; i < ops.size(); i++) {
+        ops[i].name = service_names[i];
+    }
+
+    int result = 0;
+    size_t num_waiting = 0;
+
+    // Process an event for one of the services we are waiting for:
+    auto process_event = [&](handle_t ev_handle, service_event_t event) {
+        for (service_op &op : ops) {
+            if (! op.waiting || op.handle != ev_handle) continue;
+            if (event == completion_event) {
+                if (verbose) {
+                    cout << "Service '" << op.name << "' " << describeState(do_stop) << "." << endl;
+                }
+            }
+            else if (event == cancelled_event) {
+                if (verbose) {
+                    cout << "Service '" << op.name << "' " << describeVerb(do_stop) << " cancelled." << endl;
+                }
+                result = 1;
+            }
+            else if (! do_stop && event == service_event_t::FAILEDSTART) {
+                if (verbose) {
+                    cout << "Service '" << op.name << "' failed to start." << endl;
+                }
+                result = 1;
+            }
+            else {
+                continue;
+            }
+            op.waiting = false;
+            --num_waiting;
+        }
+    };
+
+    // Load all services:
+    for (size_t base = 0; base < ops.size(); base += max_pipelined) {
+        size_t end = std::min(ops.size(), base + max_pipelined);
+        std::vector<char> reqs;
+        for (size_t i = base; i < end; i++) {
+            append_load_request(reqs, ops[i].name, false);
+        }
+        write_all_x(socknum, reqs.data(), reqs.size());
+
+        for (size_t i = base; i < end; i++) {
+            wait_for_reply(rbuffer, socknum);
+            if (check_load_reply(socknum, rbuffer, &ops[i].handle, nullptr, false) != 0) {
+                rbuffer.consume(1);
+                if (! ignore_unstarted) {
+                    cerr << "dinitctl: failed to find/load service '" << ops[i].name << "'." << endl;
+                    result = 1;
+                }
+                continue;
+            }
+            ops[i].loaded = true;
+        }
+    }
+
+    // Issue the start/stop commands (regardless of the current service states, as for a single
+    // service):
+    for (size_t base = 0; base < ops.size(); base += max_pipelined) {
+        size_t end = std::min(ops.size(), base + max_pipelined);
+        std::vector<char> reqs;
+        for (size_t i = base; i < end; i++) {
+            if (! ops[i].loaded) continue;
+            auto m = membuf()
+                    .append((char) pcommand)
+                    .append(flags)
+                    .append(ops[i].handle);
+            reqs.insert(reqs.end(), m.data(), m.data() + m.size());
+        }
+        write_all_x(socknum, reqs.data(), reqs.size());
+
+        for (size_t i = base; i < end; i++) {
+            service_op &op = ops[i];
+            if (! op.loaded) continue;
+
+            wait_for_reply_with_events(rbuffer, socknum, process_event);
+            auto reply_pkt_h = rbuffer[0];
+            rbuffer.consume(1); // consume header
+
+            if (reply_pkt_h == DINIT_RP_ACK) {
+                if (wait_for_service) {
+                    op.waiting = true;
+                    ++num_waiting;
+                }
+                else if (verbose) {
+                    cout << "Issued " << describeVerb(do_stop) << " command successfully for service '"
+                            << op.name << "'." << endl;
+                }
+            }
+            else if (reply_pkt_h == DINIT_RP_ALREADYSS) {
+                if (verbose) {
+                    cout << "Service '" << op.name << "' (already) " << describeState(do_stop) << "." << endl;
+                }
+            }
+            else if (reply_pkt_h == DINIT_RP_PINNEDSTARTED) {
+                cerr << "dinitctl: cannot stop service '" << op.name << "' as it is pinned started\n";
+                result = 1;
+            }
+            else if (reply_pkt_h == DINIT_RP_PINNEDSTOPPED) {
+                cerr << "dinitctl: cannot start service '" << op.name << "' as it is pinned stopped\n";
+                result = 1;
+            }
+            else if (reply_pkt_h == DINIT_RP_DEPENDENTS && pcommand == DINIT_CP_STOPSERVICE) {
+                // size_t number, N * handle_t handles (names are queried once all replies are read)
+                size_t number;
+                fill_buffer_to(rbuffer, socknum, sizeof(number));
+                rbuffer.extract(&number, 0, sizeof(number));
+                rbuffer.consume(sizeof(number));
+                op.dependents.reserve(number);
+                for (size_t j = 0; j < number; j++) {
+                    handle_t handle;
+                    fill_buffer_to(rbuffer, socknum, sizeof(handle_t));
+                    rbuffer.extract(&handle, 0, sizeof(handle));
+                    op.dependents.push_back(handle);
+                    rbuffer.consume(sizeof(handle));
+                }
+                result = 1;
+            }
+            else if (reply_pkt_h == DINIT_RP_NAK && command == command_t::RESTART_SERVICE) {
+                if (ignore_unstarted) {
+                    if (verbose) {
+                        cout << "Service '" << op.name << "' is not currently started.\n";
+                    }
+                }
+                else {
+                    cerr << "dinitctl: cannot restart service '" << op.name << "'; service not started.\n";
+                    result = 1;
+                }
+            }
+            else if (reply_pkt_h == DINIT_RP_NAK && command == command_t::WAKE_SERVICE) {
+                cerr << "dinitctl: service '" << op.name << "' has no active dependents, cannot wake.\n";
+                result = 1;
+            }
+            else if (reply_pkt_h == DINIT_RP_SHUTTINGDOWN) {
+                cerr << "dinitctl: cannot start/restart/wake service '" << op.name
+                        << "', shutdown is in progress.\n";
+                result = 1;
+            }
+            else {
+                throw dinit_protocol_error();
+            }
+        }
+    }
+
+    // Wait until all services have started/stopped:
+    while (num_waiting != 0) {
+        fill_buffer_to(rbuffer, socknum, 2);
+        if (rbuffer[0] < 100) {
+            // Not an information packet?
+            throw dinit_protocol_error();
+        }
+        int pktlen = (unsigned char) rbuffer[1];
+        fill_buffer_to(rbuffer, socknum, pktlen);
+
+        if (rbuffer[0] == DINIT_IP_SERVICEEVENT) {
+            handle_t ev_handle;
+            rbuffer.extract((char *) &ev_handle, 2, sizeof(ev_handle));
+            process_event(ev_handle, static_cast<service_event_t>(rbuffer[2 + sizeof(ev_handle)]));
+        }
+
+        rbuffer.consume(pktlen);
+    }
+
+    // Report services which could not be stopped due to dependents:
+    for (service_op &op : ops) {
+        if (op.dependents.empty()) continue;
+        cerr << "dinitctl: cannot stop service '" << op.name << "' due to the following dependents:\n";
+        if (command != command_t::RESTART_SERVICE) {
+            cerr << "(only direct dependents are listed. Exercise caution before using '--force' !!)\n";
+        }
+        cerr << " ";
+        for (handle_t handle : op.dependents) {
+            cerr << " " << get_service_name(socknum, rbuffer, handle);
+        }
+        cerr << "\n";
+    }
+
+    return result;
+}
+
 // Issue a "load service" command (DINIT_CP_LOADSERVICE), without waiting for
 // a response. Returns 1 on failure (with error logged), 0 on success.
 static int issue_load_service(int socknum, const char *service_name, bool find_only)
@@ -892,9 +1333,169 @@ static int reload_service(int socknum, cpbuffer_t &rbuffer, const char *service_
     return 0;
 }
 
-static int list_services(int socknum, cpbuffer_t &rbuffer)
+// Print the listing line for a service.
+static void print_service_info(const std::string &name, service_state_t current, service_state_t target,
+        int console_flags, stopped_reason_t stop_reason, pid_t service_pid, int exit_status)
+{
+    using namespace std;
+
+    bool has_console = (console_flags & 2) != 0;
+    bool waiting_console = (console_flags & 1) != 0;
+    bool was_skipped = (console_flags & 4) != 0;
+    bool marked_active = (console_flags & 8) != 0;
+
+    cout << "[";
+
+    // [ ] if marked active; otherwise, { } if target state is STARTED
+    //  +  if started, 's' if skipped, space otherwise
+    char lbracket = target == service_state_t::STARTED ? '{' : ' ';
+    char rbracket = target == service_state_t::STARTED ? '}' : ' ';
+    cout << (marked_active ? '[' : lbracket);
+    if (current == service_state_t::STARTED) {
+        cout << (was_skipped ? 's' : '+');
+    }
+    else {
+        cout << ' ';
+    }
+    cout << (marked_active ? ']' : rbracket);
+    
+    if (current == service_state_t::STARTING) {
+        cout << "<<";
+    }
+    else if (current == service_state_t::STOPPING) {
+        cout << ">>";
+    }
+    else {
+        cout << "  ";
+    }
+    
+    cout << (target == service_state_t::STOPPED ? '{' : ' ');
+    if (current == service_state_t::STOPPED) {
+        bool did_fail = false;
+        if (stop_reason == stopped_reason_t::TERMINATED) {
+            if (!WIFEXITED(exit_status) || WEXITSTATUS(exit_status) != 0) {
+                did_fail = true;
+            }
+        }
+        else did_fail = (stop_reason != stopped_reason_t::NORMAL);
+
+        cout << (did_fail ? 'X' : '-');
+    }
+    else {
+    	cout << ' ';
+    }
+    cout << (target == service_state_t::STOPPED ? '}' : ' ');
+
+    cout << "] " << name;
+
+    if (current != service_state_t::STOPPED && service_pid != -1) {
+    	cout << " (pid: " << service_pid << ")";
+    }
+    
+    if (current == service_state_t::STOPPED && stop_reason == stopped_reason_t::TERMINATED) {
+        if (WIFEXITED(exit_status)) {
+            cout << " (exit status: " << WEXITSTATUS(exit_status) << ")";
+        }
+        else if (WIFSIGNALED(exit_status)) {
+            cout << " (signal: " << WTERMSIG(exit_status) << ")";
+        }
+    }
+
+    if (has_console) {
+    	cout << " (has console)";
+    }
+    else if (waiting_console) {
+    	cout << " (waiting for console)";
+    }
+
+    cout << endl;
+}
+
+// List services using LISTSERVICES2 (protocol version 4 and later), which applies the filter
+// at the server.
+static int list_services2(int socknum, cpbuffer_t &rbuffer, const list_filter &filter)
+{
+    using namespace std;
+
+    uint32_t cursor = 0;
+    uint16_t limit = 0;
+    uint16_t prefix_len = strlen(filter.prefix);
+    auto m = membuf()
+            .append((char) DINIT_CP_LISTSERVICES2)
+            .append(cursor)
+            .append(limit)
+            .append((char) filter.flags)
+            .append((char) filter.state)
+            .append((char) filter.target)
+            .append((char) filter.type)
+            .append(prefix_len);
+
+    std::vector<char> cmd(m.data(), m.data() + m.size());
+    cmd.insert(cmd.end(), filter.prefix, filter.prefix + prefix_len);
+    write_all_x(socknum, cmd.data(), cmd.size());
+
+    const int rec_hdr_size = 12 + std::max(sizeof(int), sizeof(pid_t));
+
+    wait_for_reply(rbuffer, socknum);
+    while (rbuffer[0] == DINIT_RP_SVCINFO2) {
+        fill_buffer_to(rbuffer, socknum, 5);
+        uint16_t pkt_len;
+        uint16_t num_recs;
+        rbuffer.extract((char *)&pkt_len, 1, sizeof(pkt_len));
+        rbuffer.extract((char *)&num_recs, 3, sizeof(num_recs));
+        if (pkt_len > rbuffer.get_size()) {
+            cerr << "dinitctl: control socket protocol error" << endl;
+            return 1;
+        }
+        fill_buffer_to(rbuffer, socknum, pkt_len);
+
+        int pos = 5;
+        for (unsigned i = 0; i < num_recs; i++) {
+            int name_len = (unsigned char) rbuffer[pos + 4];
+            service_state_t current = static_cast<service_state_t>(rbuffer[pos + 5]);
+            service_state_t target = static_cast<service_state_t>(rbuffer[pos + 6]);
+            int console_flags = rbuffer[pos + 7];
+            stopped_reason_t stop_reason = static_cast<stopped_reason_t>(rbuffer[pos + 8]);
+
+            pid_t service_pid = -1;
+            int exit_status = 0;
+            if (current != service_state_t::STOPPED) {
+                rbuffer.extract((char *)&service_pid, pos + 12, sizeof(service_pid));
+            }
+            else {
+                rbuffer.extract((char *)&exit_status, pos + 12, sizeof(exit_status));
+            }
+
+            string name = rbuffer.extract_string(pos + rec_hdr_size, name_len);
+            print_service_info(name, current, target, console_flags, stop_reason, service_pid,
+                    exit_status);
+            pos += rec_hdr_size + name_len;
+        }
+
+        rbuffer.consume(pkt_len);
+        wait_for_reply(rbuffer, socknum);
+    }
+
+    if (rbuffer[0] != DINIT_RP_LISTDONE2) {
+        cerr << "dinitctl: control socket protocol error" << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+static int list_services(int socknum, cpbuffer_t &rbuffer, uint16_t cp_version, const list_filter &filter)
 {
     using namespace std;
+
+    if (cp_version >= 4) {
+        return list_services2(socknum, rbuffer, filter);
+    }
+
+    if (filter.flags != 0) {
+        cerr << "dinitctl: filtered listing is not supported by this version of dinit" << endl;
+        return 1;
+    }
     
     char cmdbuf[] = { (char)DINIT_CP_LISTSERVICES };
     write_all_x(socknum, cmdbuf, 1);
@@ -903,20 +1504,15 @@ static int list_services(int socknum, cpbuffer_t &rbuffer)
     while (rbuffer[0] == DINIT_RP_SVCINFO) {
         int hdrsize = 8 + std::max(sizeof(int), sizeof(pid_t));
         fill_buffer_to(rbuffer, socknum, hdrsize);
-        int nameLen = rbuffer[1];
+        int nameLen = (unsigned char) rbuffer[1];
         service_state_t current = static_cast<service_state_t>(rbuffer[2]);
         service_state_t target = static_cast<service_state_t>(rbuffer[3]);
 
         int console_flags = rbuffer[4];
-        bool has_console = (console_flags & 2) != 0;
-        bool waiting_console = (console_flags & 1) != 0;
-        bool was_skipped = (console_flags & 4) != 0;
-        bool marked_active = (console_flags & 8) != 0;
-
         stopped_reason_t stop_reason = static_cast<stopped_reason_t>(rbuffer[5]);
 
-        pid_t service_pid;
-        int exit_status;
+        pid_t service_pid = -1;
+        int exit_status = 0;
         if (current != service_state_t::STOPPED) {
             rbuffer.extract((char *)&service_pid, 8, sizeof(service_pid));
         }
@@ -932,71 +1528,7 @@ static int list_services(int socknum, cpbuffer_t &rbuffer)
         string name = string(name_ptr, clength);
         name.append(rbuffer.get_buf_base(), nameLen - clength);
 
-        cout << "[";
-
-        // [ ] if marked active; otherwise, { } if target state is STARTED
-        //  +  if started, 's' if skipped, space otherwise
-        char lbracket = target == service_state_t::STARTED ? '{' : ' ';
-        char rbracket = target == service_state_t::STARTED ? '}' : ' ';
-        cout << (marked_active ? '[' : lbracket);
-        if (current == service_state_t::STARTED) {
-            cout << (was_skipped ? 's' : '+');
-        }
-        else {
-            cout << ' ';
-        }
-        cout << (marked_active ? ']' : rbracket);
-        
-        if (current == service_state_t::STARTING) {
-            cout << "<<";
-        }
-        else if (current == service_state_t::STOPPING) {
-            cout << ">>";
-        }
-        else {
-            cout << "  ";
-        }
-        
-        cout << (target == service_state_t::STOPPED ? '{' : ' ');
-        if (current == service_state_t::STOPPED) {
-            bool did_fail = false;
-            if (stop_reason == stopped_reason_t::TERMINATED) {
-                if (!WIFEXITED(exit_status) || WEXITSTATUS(exit_status) != 0) {
-                    did_fail = true;
-                }
-            }
-            else did_fail = (stop_reason != stopped_reason_t::NORMAL);
-
-            cout << (did_fail ? 'X' : '-');
-        }
-        else {
-        	cout << ' ';
-        }
-        cout << (target == service_state_t::STOPPED ? '}' : ' ');
-
-        cout << "] " << name;
-
-        if (current != service_state_t::STOPPED && service_pid != -1) {
-        	cout << " (pid: " << service_pid << ")";
-        }
-        
-        if (current == service_state_t::STOPPED && stop_reason == stopped_reason_t::TERMINATED) {
-            if (WIFEXITED(exit_status)) {
-                cout << " (exit status: " << WEXITSTATUS(exit_status) << ")";
-            }
-            else if (WIFSIGNALED(exit_status)) {
-                cout << " (signal: " << WTERMSIG(exit_status) << ")";
-            }
-        }
-
-        if (has_console) {
-        	cout << " (has console)";
-        }
-        else if (waiting_console) {
-        	cout << " (waiting for console)";
-        }
-
-        cout << endl;
+        print_service_info(name, current, target, console_flags, stop_reason, service_pid, exit_status);
 
         rbuffer.consume(hdrsize + nameLen);
         wait_for_reply(rbuffer, socknum);
@@ -1010,16 +1542,98 @@ static int list_services(int socknum, cpbuffer_t &rbuffer)
     return 0;
 }
 
-static int add_remove_dependency(int socknum, cpbuffer_t &rbuffer, bool add,
-        const char *service_from, const char *service_to, dependency_type dep_type, bool verbose)
+// List services by reading the status page published by the daemon (which is only a snapshot of
+// service status, and which may be a little out of date by the time it is displayed).
+static int list_services_fast(const char *status_page_path, const list_filter &filter)
 {
     using namespace std;
 
-    handle_t from_handle;
-    handle_t to_handle;
-
-    if (! load_service(socknum, rbuffer, service_from, &from_handle, nullptr)
-            || ! load_service(socknum, rbuffer, service_to, &to_handle, nullptr)) {
+    int fd = open(status_page_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        cerr << "dinitctl: " << status_page_path << ": " << strerror(errno) << endl;
+        return 1;
+    }
+
+    struct stat st;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(status_page_header)) {
+        mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        cerr << "dinitctl: " << status_page_path << ": cannot read status page" << endl;
+        return 1;
+    }
+
+    const char *map_base = static_cast<const char *>(mapping);
+    const status_page_header *header = static_cast<const status_page_header *>(mapping);
+    if (memcmp(header->magic, status_page_magic, sizeof(status_page_magic)) != 0
+            || header->version != status_page_version
+            || header->slot_size != sizeof(status_page_slot)
+            || header->header_size != sizeof(status_page_header)) {
+        cerr << "dinitctl: " << status_page_path << ": not a status page, or incompatible version"
+                << endl;
+        munmap(mapping, st.st_size);
+        return 1;
+    }
+
+    // (The page may have grown since we mapped it; any slots beyond the mapping are ignored).
+    size_t num_slots = std::min((size_t)header->num_slots.load(std::memory_order_acquire),
+            (st.st_size - sizeof(status_page_header)) / sizeof(status_page_slot));
+    const status_page_slot *slots = reinterpret_cast<const status_page_slot *>(map_base
+            + sizeof(status_page_header));
+
+    std::vector<status_page_record> records;
+    size_t prefix_len = strlen(filter.prefix);
+    size_t unreadable_slots = 0;
+    for (size_t i = 0; i < num_slots; i++) {
+        status_page_record rec;
+        if (! read_status_slot(slots[i], rec)) {
+            unreadable_slots++;
+            continue;
+        }
+        if (rec.service_id == 0) continue;
+        if ((filter.flags & 1) && rec.state != (uint8_t) filter.state) continue;
+        if ((filter.flags & 2) && rec.target_state != (uint8_t) filter.target) continue;
+        if ((filter.flags & 4) && rec.type != (uint8_t) filter.type) continue;
+        if ((filter.flags & 8) && (rec.name_len < prefix_len
+                || memcmp(rec.name, filter.prefix, prefix_len) != 0)) continue;
+        records.push_back(rec);
+    }
+    munmap(mapping, st.st_size);
+
+    // List in the same order as the daemon would (i.e. the order in which services were loaded):
+    std::sort(records.begin(), records.end(),
+            [](const status_page_record &a, const status_page_record &b) {
+                return a.service_id < b.service_id;
+            });
+
+    for (auto &rec : records) {
+        service_state_t current = static_cast<service_state_t>(rec.state);
+        print_service_info(string(rec.name, rec.name_len), current,
+                static_cast<service_state_t>(rec.target_state), rec.flags,
+                static_cast<stopped_reason_t>(rec.stop_reason), rec.pid, rec.exit_status);
+    }
+
+    if (unreadable_slots != 0) {
+        cerr << "dinitctl: " << status_page_path << ": status of " << unreadable_slots
+                << " service(s) could not be read" << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+static int add_remove_dependency(int socknum, cpbuffer_t &rbuffer, bool add,
+        const char *service_from, const char *service_to, dependency_type dep_type, bool verbose)
+{
+    using namespace std;
+
+    handle_t from_handle;
+    handle_t to_handle;
+
+    if (! load_service(socknum, rbuffer, service_from, &from_handle, nullptr)
+            || ! load_service(socknum, rbuffer, service_to, &to_handle, nullptr)) {
         return 1;
     }
 
@@ -1093,6 +1707,897 @@ static int shutdown_dinit(int socknum, cpbuffer_t &rbuffer, bool verbose)
     return 0;
 }
 
+static int preload_services(int socknum, cpbuffer_t &rbuffer, uint16_t cp_version, bool verbose)
+{
+    using namespace std;
+
+    if (cp_version < 2) {
+        cerr << "dinitctl: dinit daemon does not support preloading services" << endl;
+        return 1;
+    }
+
+    char cmdbuf[] = { (char)DINIT_CP_PRELOADSERVICES };
+    write_all_x(socknum, cmdbuf, 1);
+
+    wait_for_reply(rbuffer, socknum);
+    if (rbuffer[0] == DINIT_RP_NAK) {
+        cerr << "dinitctl: dinit daemon does not load services from service directories" << endl;
+        return 1;
+    }
+    if (rbuffer[0] != DINIT_RP_PRELOADINFO) {
+        throw dinit_protocol_error();
+    }
+
+    constexpr int pktsize = 1 + sizeof(uint32_t) * 3;
+    fill_buffer_to(rbuffer, socknum, pktsize);
+    uint32_t num_loaded, num_failed, elapsed_ms;
+    rbuffer.extract((char *) &num_loaded, 1, sizeof(num_loaded));
+    rbuffer.extract((char *) &num_failed, 1 + sizeof(uint32_t), sizeof(num_failed));
+    rbuffer.extract((char *) &elapsed_ms, 1 + sizeof(uint32_t) * 2, sizeof(elapsed_ms));
+    rbuffer.consume(pktsize);
+
+    if (verbose) {
+        cout << "Preloaded " << num_loaded << " services in " << elapsed_ms << "ms." << endl;
+    }
+    if (num_failed != 0) {
+        cerr << "dinitctl: " << num_failed << " service(s) could not be loaded (see dinit log for details)."
+                << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+static const char *describe_event(service_event_t event)
+{
+    switch (event) {
+    case service_event_t::STARTED:
+        return "started";
+    case service_event_t::STOPPED:
+        return "stopped";
+    case service_event_t::FAILEDSTART:
+        return "failed to start";
+    case service_event_t::STARTCANCELLED:
+        return "start cancelled";
+    case service_event_t::STOPCANCELLED:
+        return "stop cancelled";
+    default:
+        return "unknown event";
+    }
+}
+
+// Subscribe to events for all services, and report each event as it occurs (until the daemon
+// closes the connection).
+static int follow_events(int socknum, cpbuffer_t &rbuffer, uint16_t cp_version)
+{
+    using namespace std;
+
+    if (cp_version < 5) {
+        cerr << "dinitctl: dinit daemon does not support following service events" << endl;
+        return 1;
+    }
+
+    char cmdbuf[] = { (char)DINIT_CP_SUBSCRIBEALL, 1 };
+    write_all_x(socknum, cmdbuf, sizeof(cmdbuf));
+
+    wait_for_reply(rbuffer, socknum);
+    if (rbuffer[0] != DINIT_RP_ACK) {
+        throw dinit_protocol_error();
+    }
+    rbuffer.consume(1);
+
+    constexpr int hdr_size = 19;
+
+    try {
+        while (true) {
+            wait_for_info(rbuffer, socknum);
+            int pktlen = (unsigned char) rbuffer[1];
+            if (rbuffer[0] == DINIT_IP_SERVICEEVENT2 && pktlen >= hdr_size) {
+                service_event_t event = static_cast<service_event_t>(rbuffer[6]);
+                int64_t secs;
+                uint32_t nsecs;
+                rbuffer.extract((char *) &secs, 7, sizeof(secs));
+                rbuffer.extract((char *) &nsecs, 15, sizeof(nsecs));
+                string name = rbuffer.extract_string(hdr_size, pktlen - hdr_size);
+
+                time_t event_time = secs;
+                char time_str[32];
+                struct tm event_tm;
+                if (localtime_r(&event_time, &event_tm) == nullptr
+                        || strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &event_tm) == 0) {
+                    time_str[0] = 0;
+                }
+                char msecs_str[8];
+                snprintf(msecs_str, sizeof(msecs_str), ".%03u", (unsigned)(nsecs / 1000000));
+
+                cout << time_str << msecs_str << " " << name << ": " << describe_event(event) << endl;
+            }
+            rbuffer.consume(pktlen);
+        }
+    }
+    catch (cp_read_exception &e) {
+        if (e.errcode != 0) {
+            throw;
+        }
+    }
+
+    return 0;
+}
+
+static const char *describe_state(service_state_t state)
+{
+    switch (state) {
+    case service_state_t::STOPPED:
+        return "stopped";
+    case service_state_t::STARTING:
+        return "starting";
+    case service_state_t::STARTED:
+        return "started";
+    case service_state_t::STOPPING:
+        return "stopping";
+    default:
+        return "unknown";
+    }
+}
+
+static const char *describe_stop_reason(stopped_reason_t reason)
+{
+    switch (reason) {
+    case stopped_reason_t::NORMAL:
+        return "normal";
+    case stopped_reason_t::DEPFAILED:
+        return "dependency failed to start";
+    case stopped_reason_t::FAILED:
+        return "failed to start";
+    case stopped_reason_t::EXECFAILED:
+        return "could not launch process";
+    case stopped_reason_t::TIMEDOUT:
+        return "timed out while starting";
+    case stopped_reason_t::TERMINATED:
+        return "process terminated";
+    default:
+        return "unknown";
+    }
+}
+
+static const char *describe_type(service_type_t type)
+{
+    switch (type) {
+    case service_type_t::PROCESS:
+        return "process";
+    case service_type_t::BGPROCESS:
+        return "bgprocess";
+    case service_type_t::SCRIPTED:
+        return "scripted";
+    case service_type_t::INTERNAL:
+        return "internal";
+    default:
+        return "unknown";
+    }
+}
+
+// Format a duration, given in milliseconds, as (for example) "2h05m03.250s".
+static std::string format_duration(uint64_t millis)
+{
+    uint64_t secs = millis / 1000;
+    char buf[48];
+    if (secs >= 3600) {
+        snprintf(buf, sizeof(buf), "%lluh%02um%02u.%03us", (unsigned long long)(secs / 3600),
+                (unsigned)(secs / 60 % 60), (unsigned)(secs % 60), (unsigned)(millis % 1000));
+    }
+    else if (secs >= 60) {
+        snprintf(buf, sizeof(buf), "%um%02u.%03us", (unsigned)(secs / 60), (unsigned)(secs % 60),
+                (unsigned)(millis % 1000));
+    }
+    else {
+        snprintf(buf, sizeof(buf), "%u.%03us", (unsigned)secs, (unsigned)(millis % 1000));
+    }
+    return buf;
+}
+
+// Read a SERVICESTATUS reply (the packet type has already been checked) and display the status.
+static void print_service_status(int socknum, cpbuffer_t &rbuffer, const char *service_name)
+{
+    using namespace std;
+
+    constexpr int num_states = static_cast<int>(service_state_t::STOPPING) + 1;
+    constexpr int reply_size = 28 + (2 + num_states) * sizeof(uint64_t);
+    fill_buffer_to(rbuffer, socknum, reply_size);
+
+    service_state_t current = static_cast<service_state_t>(rbuffer[1]);
+    service_state_t target = static_cast<service_state_t>(rbuffer[2]);
+    int flags = (unsigned char) rbuffer[3];
+    stopped_reason_t stop_reason = static_cast<stopped_reason_t>(rbuffer[4]);
+    int stage = (unsigned char) rbuffer[5];
+    service_type_t type = static_cast<service_type_t>(rbuffer[6]);
+
+    int32_t exec_errno;
+    int32_t ivalues[4]; // pid, exit status, restart count, restart count within interval
+    uint64_t millis[2 + num_states];
+    rbuffer.extract((char *) &exec_errno, 8, sizeof(exec_errno));
+    rbuffer.extract((char *) ivalues, 12, sizeof(ivalues));
+    rbuffer.extract((char *) millis, 28, sizeof(millis));
+    rbuffer.consume(reply_size);
+
+    cout << "Service: " << service_name << "\n";
+    cout << "    Type:            " << describe_type(type) << "\n";
+    cout << "    State:           " << describe_state(current);
+    if (target != current) {
+        cout << " (target: " << describe_state(target) << ")";
+    }
+    if (flags & 8) {
+        cout << " (marked active)";
+    }
+    if (flags & 2) {
+        cout << " (has console)";
+    }
+    else if (flags & 1) {
+        cout << " (waiting for console)";
+    }
+    cout << "\n";
+    cout << "    In state for:    " << format_duration(millis[1]) << "\n";
+
+    if (current == service_state_t::STOPPED) {
+        cout << "    Stop reason:     " << describe_stop_reason(stop_reason) << "\n";
+    }
+
+    if (ivalues[0] != -1) {
+        cout << "    Process ID:      " << ivalues[0] << "\n";
+    }
+    if (flags & 32) {
+        cout << "    Last launch:     " << format_duration(millis[0]) << " ago\n";
+    }
+    if ((flags & 32) && ivalues[0] == -1 && stop_reason != stopped_reason_t::EXECFAILED) {
+        // A process was launched and has since terminated
+        int exit_status = ivalues[1];
+        if (WIFEXITED(exit_status)) {
+            cout << "    Last exit:       exit status " << WEXITSTATUS(exit_status) << "\n";
+        }
+        else if (WIFSIGNALED(exit_status)) {
+            cout << "    Last exit:       signal " << WTERMSIG(exit_status) << "\n";
+        }
+    }
+    if ((flags & 16) && stage <= static_cast<int>(exec_stage::DO_EXEC)) {
+        cout << "    Launch failure:  " << exec_stage_descriptions[stage] << ": " << strerror(exec_errno)
+                << "\n";
+    }
+
+    cout << "    Restarts:        " << (uint32_t) ivalues[2] << " (" << ivalues[3]
+            << " within current restart interval)\n";
+    cout << "    Time spent:      ";
+    for (int i = 0; i < num_states; i++) {
+        if (i != 0) cout << ", ";
+        cout << describe_state(static_cast<service_state_t>(i)) << " "
+                << format_duration(millis[2 + i]);
+    }
+    cout << endl;
+}
+
+// Query and display the full status of (loaded) services. The requests for all services are
+// pipelined.
+static int service_status(int socknum, cpbuffer_t &rbuffer, uint16_t cp_version,
+        const std::vector<const char *> &service_names)
+{
+    using namespace std;
+
+    if (cp_version < 7) {
+        cerr << "dinitctl: dinit daemon does not support service status query" << endl;
+        return 1;
+    }
+
+    int result = 0;
+    bool first = true;
+
+    for (size_t base = 0; base < service_names.size(); base += max_pipelined) {
+        size_t end = std::min(service_names.size(), base + max_pipelined);
+
+        // Find the services:
+        std::vector<char> reqs;
+        for (size_t i = base; i < end; i++) {
+            append_load_request(reqs, service_names[i], true);
+        }
+        write_all_x(socknum, reqs.data(), reqs.size());
+
+        std::vector<handle_t> handles(end - base);
+        std::vector<bool> found(end - base);
+        for (size_t i = base; i < end; i++) {
+            wait_for_reply(rbuffer, socknum);
+            if (rbuffer[0] == DINIT_RP_NOSERVICE) {
+                rbuffer.consume(1);
+                cerr << "dinitctl: service '" << service_names[i] << "' not loaded." << endl;
+                result = 1;
+                continue;
+            }
+            check_load_reply(socknum, rbuffer, &handles[i - base], nullptr, false);
+            found[i - base] = true;
+        }
+
+        // Query their status:
+        reqs.clear();
+        for (size_t i = base; i < end; i++) {
+            if (! found[i - base]) continue;
+            auto m = membuf()
+                    .append<char>(DINIT_CP_SERVICESTATUS)
+                    .append(handles[i - base]);
+            reqs.insert(reqs.end(), m.data(), m.data() + m.size());
+        }
+        write_all_x(socknum, reqs.data(), reqs.size());
+
+        for (size_t i = base; i < end; i++) {
+            if (! found[i - base]) continue;
+            wait_for_reply(rbuffer, socknum);
+            if (rbuffer[0] == DINIT_RP_BADREQ) {
+                cerr << "dinitctl: dinit daemon does not support service status query" << endl;
+                return 1;
+            }
+            if (rbuffer[0] != DINIT_RP_SERVICESTATUS) {
+                throw dinit_protocol_error();
+            }
+            if (! first) {
+                cout << "\n";
+            }
+            first = false;
+            print_service_status(socknum, rbuffer, service_names[i]);
+        }
+    }
+
+    return result;
+}
+
+// An entry from the service timeline, with time in nanoseconds since recording began
+struct timeline_record
+{
+    int64_t time;
+    uint32_t service_id;
+    uint32_t related_id;
+    timeline_event_t event;
+    uint8_t detail;
+};
+
+// The service timeline, as retrieved from the daemon
+struct timeline_data
+{
+    uint64_t dropped;   // number of earlier entries not retained
+    int64_t now;        // current time, in nanoseconds since recording began
+    std::vector<timeline_record> entries;
+    std::unordered_map<uint32_t, std::string> names;  // names of loaded services, by id
+
+    std::string get_name(uint32_t id) const
+    {
+        auto i = names.find(id);
+        if (i == names.end()) return "(unloaded service #" + std::to_string(id) + ")";
+        return i->second;
+    }
+};
+
+// Retrieve the service timeline from the daemon. Returns false (after issuing an error message) if
+// the daemon does not support the timeline query.
+static bool query_timeline(int socknum, cpbuffer_t &rbuffer, uint16_t cp_version, timeline_data &data)
+{
+    using namespace std;
+
+    if (cp_version < 8) {
+        cerr << "dinitctl: dinit daemon does not support timeline query" << endl;
+        return false;
+    }
+
+    // The timeline is retrieved in parts (each reply is limited in size); entries first, then the
+    // names of loaded services.
+    uint64_t next_seq = 0;
+    uint32_t name_cursor = 0;
+    bool first = true;
+    bool complete = false;
+
+    while (! complete) {
+        auto m = membuf()
+                .append((char) DINIT_CP_QUERYTIMELINE)
+                .append(next_seq)
+                .append(name_cursor);
+        write_all_x(socknum, m);
+
+        wait_for_reply(rbuffer, socknum);
+        if (rbuffer[0] == DINIT_RP_BADREQ) {
+            cerr << "dinitctl: dinit daemon does not support timeline query" << endl;
+            return false;
+        }
+        if (rbuffer[0] != DINIT_RP_TIMELINE) {
+            throw dinit_protocol_error();
+        }
+
+        constexpr int hdr_size = 48;
+        fill_buffer_to(rbuffer, socknum, hdr_size);
+        uint32_t num_entries;
+        uint64_t first_seq;
+        int64_t origin_secs, now_secs;
+        uint32_t origin_nsecs, now_nsecs;
+        uint32_t num_names;
+        complete = (rbuffer[1] != 0);
+        rbuffer.extract((char *) &num_entries, 4, 4);
+        rbuffer.extract((char *) &first_seq, 8, 8);
+        rbuffer.extract((char *) &origin_secs, 16, 8);
+        rbuffer.extract((char *) &origin_nsecs, 24, 4);
+        rbuffer.extract((char *) &now_secs, 28, 8);
+        rbuffer.extract((char *) &now_nsecs, 36, 4);
+        rbuffer.extract((char *) &num_names, 40, 4);
+        rbuffer.extract((char *) &name_cursor, 44, 4);
+        rbuffer.consume(hdr_size);
+
+        int64_t origin = origin_secs * 1000000000 + origin_nsecs;
+        data.now = now_secs * 1000000000 + now_nsecs - origin;
+
+        if (first) {
+            data.dropped = first_seq;
+            first = false;
+        }
+        else if (first_seq > next_seq) {
+            // entries were overwritten since the previous part was retrieved:
+            data.dropped += first_seq - next_seq;
+        }
+        next_seq = first_seq + num_entries;
+
+        for (uint32_t i = 0; i < num_entries; i++) {
+            fill_buffer_to(rbuffer, socknum, timeline_entry_wire_size);
+            int64_t secs;
+            uint32_t nsecs;
+            timeline_record entry;
+            rbuffer.extract((char *) &secs, 0, 8);
+            rbuffer.extract((char *) &nsecs, 8, 4);
+            rbuffer.extract((char *) &entry.service_id, 12, 4);
+            rbuffer.extract((char *) &entry.related_id, 16, 4);
+            entry.event = static_cast<timeline_event_t>(rbuffer[20]);
+            entry.detail = rbuffer[21];
+            rbuffer.consume(timeline_entry_wire_size);
+            entry.time = secs * 1000000000 + nsecs - origin;
+            data.entries.push_back(entry);
+        }
+
+        for (uint32_t i = 0; i < num_names; i++) {
+            fill_buffer_to(rbuffer, socknum, 6);
+            uint32_t id;
+            uint16_t name_len;
+            rbuffer.extract((char *) &id, 0, 4);
+            rbuffer.extract((char *) &name_len, 4, 2);
+            rbuffer.consume(6);
+            data.names[id] = read_string(socknum, rbuffer, name_len);
+        }
+    }
+
+    return true;
+}
+
+// Retrieve the start duration history from the daemon, recording for each service the durations
+// (in milliseconds) of its starts during previous boots. Returns false if the daemon does not
+// support the query.
+static bool query_start_history(int socknum, cpbuffer_t &rbuffer, uint16_t cp_version,
+        std::unordered_map<std::string, std::vector<uint32_t>> &previous)
+{
+    if (cp_version < 9) {
+        return false;
+    }
+
+    // The history is retrieved in parts (each reply is limited in size), each following on from
+    // the last service name in the previous part.
+    std::string cursor;
+    bool complete = false;
+
+    while (! complete) {
+        uint16_t cursor_len = cursor.length();
+        auto m = membuf()
+                .append((char) DINIT_CP_QUERYSTARTHISTORY)
+                .append(cursor_len);
+        std::vector<char> cmd(m.data(), m.data() + m.size());
+        cmd.insert(cmd.end(), cursor.begin(), cursor.end());
+        write_all_x(socknum, cmd.data(), cmd.size());
+
+        wait_for_reply(rbuffer, socknum);
+        if (rbuffer[0] != DINIT_RP_STARTHISTORY) {
+            throw dinit_protocol_error();
+        }
+
+        fill_buffer_to(rbuffer, socknum, 8);
+        uint32_t num_services;
+        complete = (rbuffer[1] != 0);
+        rbuffer.extract((char *) &num_services, 4, 4);
+        rbuffer.consume(8);
+
+        for (uint32_t i = 0; i < num_services; i++) {
+            fill_buffer_to(rbuffer, socknum, 4);
+            uint16_t name_len;
+            rbuffer.extract((char *) &name_len, 0, 2);
+            unsigned num_durations = (unsigned char)rbuffer[2];
+            unsigned new_count = (unsigned char)rbuffer[3];
+            rbuffer.consume(4);
+
+            std::vector<uint32_t> durations;
+            for (unsigned j = 0; j < num_durations; j++) {
+                fill_buffer_to(rbuffer, socknum, 4);
+                uint32_t d;
+                rbuffer.extract((char *) &d, 0, 4);
+                rbuffer.consume(4);
+                durations.push_back(d);
+            }
+            durations.resize(num_durations - std::min(new_count, num_durations));
+
+            cursor = read_string(socknum, rbuffer, name_len);
+            if (! durations.empty()) {
+                previous[cursor] = std::move(durations);
+            }
+        }
+
+        if (num_services == 0) break;
+    }
+
+    return true;
+}
+
+// A single start of a service, as recorded in the service timeline (times in nanoseconds since
+// recording began; -1 if not recorded).
+struct timeline_start
+{
+    int64_t starting = -1;   // began starting
+    int64_t deps_started = -1;  // dependencies started
+    int64_t started = -1;    // started
+    uint32_t last_dep = 0;   // dependency which was last to start
+};
+
+// Query the service timeline, and display the time taken to start each service and the chain of
+// dependencies which determined the start time of the given service (or, if none is given, of
+// the service which was last to start). If the daemon records start history, also display the
+// services which took significantly longer to start than during previous boots.
+static int analyze_timeline(int socknum, cpbuffer_t &rbuffer, uint16_t cp_version,
+        const char *service_name)
+{
+    using namespace std;
+
+    timeline_data data;
+    if (! query_timeline(socknum, rbuffer, cp_version, data)) {
+        return 1;
+    }
+
+    // Collect the starts of each service:
+    std::unordered_map<uint32_t, std::vector<timeline_start>> starts;
+    for (const timeline_record &entry : data.entries) {
+        int64_t t = entry.time;
+        std::vector<timeline_start> &svc_starts = starts[entry.service_id];
+        bool in_progress = !svc_starts.empty() && svc_starts.back().started == -1;
+
+        switch (entry.event) {
+        case timeline_event_t::STARTING:
+            if (in_progress) {
+                // previous start didn't complete
+                svc_starts.back() = timeline_start();
+            }
+            else {
+                svc_starts.emplace_back();
+            }
+            svc_starts.back().starting = t;
+            break;
+        case timeline_event_t::DEPS_STARTED:
+            if (! in_progress) {
+                // (beginning of start not recorded)
+                svc_starts.emplace_back();
+                svc_starts.back().starting = t;
+            }
+            svc_starts.back().deps_started = t;
+            svc_starts.back().last_dep = entry.related_id;
+            break;
+        case timeline_event_t::STARTED:
+            if (! in_progress) {
+                svc_starts.emplace_back();
+                svc_starts.back().starting = t;
+            }
+            svc_starts.back().started = t;
+            if (svc_starts.back().deps_started == -1) {
+                svc_starts.back().deps_started = svc_starts.back().starting;
+            }
+            break;
+        case timeline_event_t::STOPPING:
+        case timeline_event_t::STOPPED:
+            if (in_progress) {
+                // start did not complete
+                svc_starts.pop_back();
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    for (auto &svc_starts : starts) {
+        if (! svc_starts.second.empty() && svc_starts.second.back().started == -1) {
+            svc_starts.second.pop_back();
+        }
+    }
+
+    auto to_millis = [](int64_t ns) -> uint64_t {
+        return ns < 0 ? 0 : ns / 1000000;
+    };
+
+    // Use the first recorded start of each service:
+    struct blame_entry
+    {
+        uint32_t id;
+        const timeline_start *start;
+    };
+    std::vector<blame_entry> blame;
+    for (auto &svc_starts : starts) {
+        if (! svc_starts.second.empty()) {
+            blame.push_back({svc_starts.first, &svc_starts.second.front()});
+        }
+    }
+
+    if (blame.empty()) {
+        cout << "No service starts recorded." << endl;
+        return 0;
+    }
+
+    if (data.dropped != 0) {
+        cout << "(note: " << data.dropped << " earlier event(s) were not retained)\n";
+    }
+
+    // Find the service whose start we are to explain:
+    uint32_t target_id = 0;
+    const timeline_start *target = nullptr;
+    if (service_name != nullptr) {
+        for (auto &name : data.names) {
+            if (name.second == service_name) {
+                target_id = name.first;
+                break;
+            }
+        }
+        auto i = starts.find(target_id);
+        if (target_id == 0 || i == starts.end() || i->second.empty()) {
+            cerr << "dinitctl: no start recorded for service '" << service_name << "'." << endl;
+            return 1;
+        }
+        target = &i->second.front();
+    }
+    else {
+        for (auto &b : blame) {
+            if (target == nullptr || b.start->started > target->started) {
+                target = b.start;
+                target_id = b.id;
+            }
+        }
+    }
+
+    cout << "Service '" << data.get_name(target_id) << "' started "
+            << format_duration(to_millis(target->started)) << " after dinit started.\n\n";
+
+    std::sort(blame.begin(), blame.end(), [](const blame_entry &a, const blame_entry &b) {
+        return (a.start->started - a.start->deps_started) > (b.start->started - b.start->deps_started);
+    });
+
+    cout << "Time taken to start (after dependencies started), and time waiting for dependencies:\n";
+    for (auto &b : blame) {
+        cout << "  " << setw(12) << format_duration(to_millis(b.start->started - b.start->deps_started))
+                << "  " << setw(12) << format_duration(to_millis(b.start->deps_started - b.start->starting))
+                << "  " << data.get_name(b.id) << "\n";
+    }
+
+    // Follow the chain of dependencies which determined the start time of the target service:
+    cout << "\nCritical chain (@time started, +time taken to start):\n";
+    uint32_t cur_id = target_id;
+    const timeline_start *cur = target;
+    std::string indent;
+    for (size_t depth = 0; depth <= starts.size(); depth++) {
+        cout << indent << data.get_name(cur_id) << " @" << format_duration(to_millis(cur->started))
+                << " +" << format_duration(to_millis(cur->started - cur->deps_started)) << "\n";
+
+        // Find the most recent start of the dependency that held up this service:
+        uint32_t dep_id = cur->last_dep;
+        auto i = starts.find(dep_id);
+        if (dep_id == 0 || i == starts.end()) break;
+        const timeline_start *dep_start = nullptr;
+        for (auto &s : i->second) {
+            if (s.started <= cur->deps_started) {
+                dep_start = &s;
+            }
+        }
+        if (dep_start == nullptr) break;
+
+        cur_id = dep_id;
+        cur = dep_start;
+        indent += "  ";
+    }
+
+    // Compare the time taken to start each service with previous boots:
+    std::unordered_map<std::string, std::vector<uint32_t>> previous;
+    if (query_start_history(socknum, rbuffer, cp_version, previous) && ! previous.empty()) {
+        // a start is reported as a regression if it took at least this much longer and at least
+        // half as long again as (the median of) previous starts:
+        constexpr uint64_t regression_min_ms = 100;
+
+        struct regression
+        {
+            std::string name;
+            uint64_t now_ms;
+            uint64_t prev_ms;
+        };
+        std::vector<regression> regressions;
+        for (auto &b : blame) {
+            std::string name = data.get_name(b.id);
+            auto i = previous.find(name);
+            if (i == previous.end()) continue;
+            std::vector<uint32_t> &prev = i->second;
+            std::sort(prev.begin(), prev.end());
+            uint64_t prev_ms = prev[prev.size() / 2];
+            uint64_t now_ms = to_millis(b.start->started - b.start->deps_started);
+            if (now_ms >= prev_ms + regression_min_ms && now_ms * 2 >= prev_ms * 3) {
+                regressions.push_back({std::move(name), now_ms, prev_ms});
+            }
+        }
+
+        std::sort(regressions.begin(), regressions.end(), [](const regression &a, const regression &b) {
+            return (a.now_ms - a.prev_ms) > (b.now_ms - b.prev_ms);
+        });
+
+        cout << "\nSlower to start than in previous boots (increase, time taken, previously):\n";
+        if (regressions.empty()) {
+            cout << "  (none)\n";
+        }
+        for (auto &r : regressions) {
+            cout << "  " << setw(12) << ("+" + format_duration(r.now_ms - r.prev_ms))
+                    << "  " << setw(12) << format_duration(r.now_ms)
+                    << "  " << setw(12) << format_duration(r.prev_ms) << "  " << r.name << "\n";
+        }
+    }
+
+    cout << flush;
+    return 0;
+}
+
+// Write a string as a JSON string literal (including quotes).
+static void write_json_string(std::ostream &out, const std::string &str)
+{
+    static const char hexdigits[] = "0123456789abcdef";
+    out << '"';
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        }
+        else if ((unsigned char)c < 0x20) {
+            out << "\\u00" << hexdigits[(c >> 4) & 0xF] << hexdigits[c & 0xF];
+        }
+        else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+// Write a time (nanoseconds) as microseconds, which is the unit used in trace event format.
+static void write_trace_time(std::ostream &out, int64_t ns)
+{
+    if (ns < 0) ns = 0;
+    char frac[4];
+    snprintf(frac, sizeof(frac), "%03d", (int)(ns % 1000));
+    out << (ns / 1000) << '.' << frac;
+}
+
+// Query the service timeline, and write it to standard output in Chrome trace event (JSON) format,
+// as accepted by chrome://tracing and Perfetto. Each service is represented as a thread (track),
+// with a span for each start and stop, and nested spans for the phases of each: waiting for
+// dependencies, waiting for the console or a start slot, executing the process, and waiting for
+// readiness (or for a stop command to complete).
+static int trace_timeline(int socknum, cpbuffer_t &rbuffer, uint16_t cp_version)
+{
+    using namespace std;
+
+    timeline_data data;
+    if (! query_timeline(socknum, rbuffer, cp_version, data)) {
+        return 1;
+    }
+
+    if (data.dropped != 0) {
+        cerr << "dinitctl: note: " << data.dropped << " earlier event(s) were not retained" << endl;
+    }
+
+    // The current (outer) span and phase (inner span) of each service
+    struct span
+    {
+        const char *name;
+        int64_t start;
+    };
+    struct service_spans
+    {
+        span outer = { nullptr, 0 };
+        span inner = { nullptr, 0 };
+        bool starting = false;  // outer span is a start (rather than a stop)
+    };
+    std::unordered_map<uint32_t, service_spans> open_spans;
+
+    bool first_event = true;
+    auto begin_event = [&]() {
+        cout << (first_event ? "\n" : ",\n");
+        first_event = false;
+    };
+
+    auto write_span = [&](uint32_t id, span &sp, int64_t end, const char *stop_reason) {
+        if (sp.name == nullptr) return;
+        begin_event();
+        cout << "{\"name\":\"" << sp.name << "\",\"cat\":\"service\",\"ph\":\"X\",\"ts\":";
+        write_trace_time(cout, sp.start);
+        cout << ",\"dur\":";
+        write_trace_time(cout, end - sp.start);
+        cout << ",\"pid\":1,\"tid\":" << id;
+        if (stop_reason != nullptr) {
+            cout << ",\"args\":{\"stop reason\":\"" << stop_reason << "\"}";
+        }
+        cout << "}";
+        sp.name = nullptr;
+    };
+
+    cout << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+    begin_event();
+    cout << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"dinit\"}}";
+
+    for (const timeline_record &entry : data.entries) {
+        uint32_t id = entry.service_id;
+        int64_t t = entry.time;
+
+        if (open_spans.find(id) == open_spans.end()) {
+            // First event for this service: name its track
+            begin_event();
+            cout << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << id
+                    << ",\"args\":{\"name\":";
+            write_json_string(cout, data.get_name(id));
+            cout << "}}";
+        }
+        service_spans &spans = open_spans[id];
+
+        write_span(id, spans.inner, t, nullptr);
+
+        switch (entry.event) {
+        case timeline_event_t::STARTING:
+            write_span(id, spans.outer, t, nullptr);
+            spans.outer = { "start", t };
+            spans.starting = true;
+            spans.inner = { "waiting for dependencies", t };
+            break;
+        case timeline_event_t::CONSOLE_WAIT:
+            spans.inner = { "waiting for console", t };
+            break;
+        case timeline_event_t::START_SLOT_WAIT:
+            spans.inner = { "waiting for start slot", t };
+            break;
+        case timeline_event_t::EXEC:
+            spans.inner = { "exec", t };
+            break;
+        case timeline_event_t::EXEC_SUCCEEDED:
+            if (spans.outer.name != nullptr) {
+                spans.inner = { spans.starting ? "waiting for readiness" : "waiting for stop command",
+                        t };
+            }
+            break;
+        case timeline_event_t::STARTED:
+            write_span(id, spans.outer, t, nullptr);
+            break;
+        case timeline_event_t::STOPPING:
+            write_span(id, spans.outer, t, nullptr);
+            spans.outer = { "stop", t };
+            spans.starting = false;
+            break;
+        case timeline_event_t::STOPPED:
+            write_span(id, spans.outer, t,
+                    describe_stop_reason(static_cast<stopped_reason_t>(entry.detail)));
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Close any spans still in progress at the current time:
+    for (auto &spans : open_spans) {
+        write_span(spans.first, spans.second.inner, data.now, nullptr);
+        write_span(spans.first, spans.second.outer, data.now, nullptr);
+    }
+
+    cout << "\n]}" << endl;
+    return 0;
+}
+
 // exception for cancelling a service operation
 class service_op_cancel { };
 
@@ -1187,7 +2692,9 @@ static int enable_disable_service(int socknum, cpbuffer_t &rbuffer, const char *
     try {
         process_service_file(from, service_file, [&](string &line, string &setting,
                 dinit_load::string_iterator i, dinit_load::string_iterator end) -> void {
-            if (setting == "waits-for" || setting == "depends-on" || setting == "depends-ms") {
+            using dinit_load::setting_id;
+            setting_id id = dinit_load::lookup_setting_id(setting);
+            if (id == setting_id::WAITS_FOR || id == setting_id::DEPENDS_ON || id == setting_id::DEPENDS_MS) {
                 string dname = dinit_load::read_setting_value(i, end);
                 if (dname == to) {
                     // There is already a dependency
@@ -1196,7 +2703,7 @@ static int enable_disable_service(int socknum, cpbuffer_t &rbuffer, const char *
                     throw service_op_cancel();
                 }
             }
-            else if (setting == "waits-for.d") {
+            else if (id == setting_id::WAITS_FOR_D) {
                 string dname = dinit_load::read_setting_value(i, end);
                 if (! waits_for_d.empty()) {
                     cerr << "dinitctl: service '" << from << "' has multiple waits-for.d directories "
@@ -0,0 +1,177 @@
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <system_error>
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "env-file.h"
+#include "dinit-log.h"
+
+/*
+ * env-file.cc - reading (and caching) of service environment files, and preparation of the
+ * environment for service processes. See env-file.h.
+ */
+
+extern char **environ;
+
+namespace {
+
+// A cached environment file
+struct env_file_record
+{
+    // identity of the file when it was read; if any differ, the file is re-read
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+
+    std::vector<std::string> vars;
+
+    bool matches(const struct stat &st) const noexcept
+    {
+        #ifdef __APPLE__
+        const struct timespec &st_mtim = st.st_mtimespec;
+        #else
+        const struct timespec &st_mtim = st.st_mtim;
+        #endif
+        return dev == st.st_dev && ino == st.st_ino && size == st.st_size
+                && mtime.tv_sec == st_mtim.tv_sec && mtime.tv_nsec == st_mtim.tv_nsec;
+    }
+
+    void set_id(const struct stat &st) noexcept
+    {
+        dev = st.st_dev;
+        ino = st.st_ino;
+        size = st.st_size;
+        #ifdef __APPLE__
+        mtime = st.st_mtimespec;
+        #else
+        mtime = st.st_mtim;
+        #endif
+    }
+};
+
+std::unordered_map<std::string, env_file_record> env_file_cache;
+
+const std::vector<std::string> no_vars;
+
+// Get the length of the name part of a NAME=VALUE setting
+size_t setting_name_len(const char *setting) noexcept
+{
+    const char *eq = strchr(setting, '=');
+    return (eq == nullptr) ? strlen(setting) : (eq - setting);
+}
+
+// Check whether setting_b is for the variable named by the first name_len characters of setting_a
+bool same_var(const char *setting_a, const char *setting_b, size_t name_len) noexcept
+{
+    return strncmp(setting_a, setting_b, name_len) == 0
+            && (setting_b[name_len] == '=' || setting_b[name_len] == 0);
+}
+
+} // anonymous namespace
+
+const std::vector<std::string> &get_env_file_vars(const char *env_file_path)
+{
+    struct stat st;
+    if (stat(env_file_path, &st) == -1) {
+        // No file (or inaccessible): no settings. The file may appear later, so don't cache.
+        env_file_cache.erase(env_file_path);
+        return no_vars;
+    }
+
+    auto i = env_file_cache.find(env_file_path);
+    if (i != env_file_cache.end() && i->second.matches(st)) {
+        return i->second.vars;
+    }
+
+    std::ifstream env_file(env_file_path);
+    if (!env_file) {
+        env_file_cache.erase(env_file_path);
+        return no_vars;
+    }
+
+    std::vector<std::string> vars;
+    parse_env_file(env_file,
+            [&](const std::string &name, const std::string &value) {
+                std::string setting = name + "=" + value;
+                // A later setting for the same variable overrides an earlier one:
+                for (auto &var : vars) {
+                    if (same_var(setting.c_str(), var.c_str(), name.length())) {
+                        var = std::move(setting);
+                        return;
+                    }
+                }
+                vars.push_back(std::move(setting));
+            },
+            [&](int linenum) {
+                log(loglevel_t::ERROR, "Invalid environment variable setting in environment file ",
+                        env_file_path, " (line ", linenum, ")");
+            });
+
+    if (env_file.bad()) {
+        throw std::system_error(EIO, std::system_category());
+    }
+
+    if (i == env_file_cache.end()) {
+        i = env_file_cache.emplace(env_file_path, env_file_record()).first;
+    }
+    i->second.set_id(st);
+    i->second.vars = std::move(vars);
+    return i->second.vars;
+}
+
+void build_child_env(std::vector<const char *> &envp, const std::vector<std::string> *vars, unsigned spare)
+{
+    envp.clear();
+
+    for (char **env = environ; *env != nullptr; ++env) {
+        if (vars != nullptr) {
+            size_t name_len = setting_name_len(*env);
+            bool overridden = false;
+            for (auto &var : *vars) {
+                if (same_var(*env, var.c_str(), name_len)) {
+                    overridden = true;
+                    break;
+                }
+            }
+            if (overridden) continue;
+        }
+        envp.push_back(*env);
+    }
+
+    if (vars != nullptr) {
+        for (auto &var : *vars) {
+            envp.push_back(var.c_str());
+        }
+    }
+
+    envp.insert(envp.end(), spare + 1, nullptr);
+}
+
+bool set_child_env_var(std::vector<const char *> &envp, const char *setting) noexcept
+{
+    size_t name_len = setting_name_len(setting);
+
+    // Note that the final slot is the terminator, which must not be used:
+    size_t limit = envp.size() - 1;
+    for (size_t i = 0; i < limit; ++i) {
+        if (envp[i] == nullptr) {
+            envp[i] = setting;
+            return true;
+        }
+        if (same_var(setting, envp[i], name_len)) {
+            envp[i] = setting;
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,63 @@
+#!/bin/sh
+
+# Check that changed service descriptions are reloaded automatically (--auto-reload), and that a
+# service which is in use by a control connection is not reloaded.
+
+# Start with boot depending on a
+rm -rf sd dinit-run.log
+cp -R sd1 sd
+
+../../dinit -d sd -u -p socket -q --auto-reload -l dinit-run.log &
+DINITPID=$!
+
+# Give some time for startup
+sleep 0.2
+
+STATUS=PASS
+
+DINITCTLOUT="$(../../dinitctl -p socket list)"
+if [ "$DINITCTLOUT" != "$(cat initial.expected)" ]; then
+    echo "$DINITCTLOUT" > initial.actual
+    STATUS=FAIL
+fi
+
+# Change boot so that it also waits for b; the change should be picked up without any reload
+# command (once the reload delay has passed).
+if [ "$STATUS" = PASS ]; then
+    cp sd2/boot sd/boot
+    sleep 1
+
+    DINITCTLOUT="$(../../dinitctl -p socket list)"
+    if [ "$DINITCTLOUT" != "$(cat output2.expected)" ]; then
+        echo "$DINITCTLOUT" > output2.actual
+        STATUS=FAIL
+    fi
+fi
+
+# Change slow while a dinitctl connection is waiting for it to start (and so holds a handle to
+# it); it should not be reloaded.
+if [ "$STATUS" = PASS ]; then
+    ../../dinitctl --quiet -p socket start slow &
+    DINITCTLPID=$!
+    sleep 0.2
+    cp sd2/slow sd/slow
+    sleep 1
+    wait $DINITCTLPID
+
+    if ! grep -q "^dinit: Reloaded changed service boot\.$" dinit-run.log; then
+        STATUS=FAIL
+    fi
+    if ! grep -q "^dinit: Not reloading changed service slow: service is in use by a control connection\.$" \
+            dinit-run.log; then
+        STATUS=FAIL
+    fi
+    if grep -q "Reloaded changed service slow" dinit-run.log; then
+        STATUS=FAIL
+    fi
+fi
+
+../../dinitctl --quiet -p socket shutdown
+wait $DINITPID
+
+if [ $STATUS = PASS ]; then exit 0; fi
+exit 1
@@ -0,0 +1,32 @@
+#!/bin/sh
+
+# Check that a service can chain to a service whose description was added after the service
+# directories were first read.
+
+rm -rf sd
+cp -R sd1 sd
+
+../../dinit -d sd -u -p socket -q &
+DINITPID=$!
+
+# Give some time for startup
+sleep 0.2
+
+STATUS=PASS
+
+# Add the description of the service chained to while "first" runs (i.e. after it has been loaded):
+../../dinitctl --quiet -p socket start --no-wait first
+cp second sd/second
+sleep 1
+
+DINITCTLOUT="$(../../dinitctl -p socket list)"
+if [ "$DINITCTLOUT" != "$(cat output.expected)" ]; then
+    echo "$DINITCTLOUT" > output.actual
+    STATUS=FAIL
+fi
+
+../../dinitctl --quiet -p socket shutdown
+wait $DINITPID
+
+if [ $STATUS = PASS ]; then exit 0; fi
+exit 1
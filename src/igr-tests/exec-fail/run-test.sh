@@ -0,0 +1,29 @@
+#!/bin/sh
+#
+# Check that failure to launch a service process (in the child, before or at exec) is reported via
+# the status pipe, both for failure to execute the command and for failure at an earlier stage.
+#
+
+rm -f dinit-run.log
+
+../../dinit -d sd -u -p socket -q -l dinit-run.log &
+DINITPID=$!
+
+# Give some time for startup
+sleep 0.2
+
+../../dinitctl --quiet -p socket start badexec
+../../dinitctl --quiet -p socket start badchdir
+
+../../dinitctl --quiet -p socket shutdown
+wait $DINITPID
+
+STATUS=FAIL
+if [ -e dinit-run.log ]; then
+   if [ "$(cat dinit-run.log)" = "$(cat dinit-run.expected)" ]; then
+       STATUS=PASS
+   fi
+fi
+
+if [ $STATUS = PASS ]; then exit 0; fi
+exit 1
@@ -14,7 +14,8 @@ int main(int argc, char **argv)
 {
     const char * const test_dirs[] = { "basic", "environ", "ps-environ", "chain-to", "force-stop",
             "restart", "check-basic", "check-cycle", "check-lint", "reload1", "reload2", "no-command-error",
-            "add-rm-dep", "var-subst" };
+            "add-rm-dep", "var-subst", "multi-start", "auto-reload", "exec-fail",
+            "chain-to-new" };
     constexpr int num_tests = sizeof(test_dirs) / sizeof(test_dirs[0]);
 
     int passed = 0;
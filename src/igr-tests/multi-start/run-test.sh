@@ -0,0 +1,34 @@
+#!/bin/sh
+
+# Start and stop several services with a single dinitctl command.
+
+rm -f actual-1 actual-2
+
+../../dinit -d sd -u -p socket -q &
+DINITPID=$!
+
+# give time for socket to open
+while [ ! -e socket ]; do
+    sleep 0.1
+done
+
+DINITCTLOUT="$(../../dinitctl -p socket start quick slow proc nonexistent 2>&1)"
+if [ $? != 1 ] || [ "$DINITCTLOUT" != "$(cat expected-1)" ]; then
+    echo "$DINITCTLOUT" > actual-1
+    ../../dinitctl --quiet -p socket shutdown
+    wait $DINITPID
+    exit 1
+fi
+
+DINITCTLOUT="$(../../dinitctl -p socket stop quick slow proc 2>&1)"
+if [ $? != 0 ] || [ "$DINITCTLOUT" != "$(cat expected-2)" ]; then
+    echo "$DINITCTLOUT" > actual-2
+    ../../dinitctl --quiet -p socket shutdown
+    wait $DINITPID
+    exit 1
+fi
+
+../../dinitctl --quiet -p socket shutdown
+wait $DINITPID
+
+exit 0
@@ -14,6 +14,11 @@
 #include <unistd.h>
 #include <fcntl.h>
 
+#ifdef __linux__
+#include <sched.h>
+#include <csignal>
+#endif
+
 namespace bp_sys {
 
 using dasynq::pipe2;
@@ -78,6 +83,28 @@ inline pid_t waitpid(pid_t p, exit_status *statusp, int flags)
     return ::waitpid(p, &statusp->status, flags);
 }
 
+// Whether vfork_spawn is supported
+#ifdef __linux__
+constexpr bool have_vfork_spawn = true;
+#else
+constexpr bool have_vfork_spawn = false;
+#endif
+
+// Create a child process which shares memory with the parent (until it executes another program or
+// exits), with func(arg) run in the child on the given stack. The parent is suspended until the
+// child executes or exits, and so the child must not return from func. This avoids the cost of
+// copying the parent's page tables (as done by fork). Returns the child pid, or -1 on failure (with
+// errno set).
+inline pid_t vfork_spawn(int (*func)(void *), void *arg, char *stack, size_t stack_size)
+{
+#ifdef __linux__
+    return clone(func, stack + stack_size, CLONE_VM | CLONE_VFORK | SIGCHLD, arg);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
 }
 
 #endif  // BPSYS_INCLUDED
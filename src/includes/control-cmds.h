@@ -45,6 +45,31 @@ constexpr static int DINIT_CP_QUERYSERVICENAME = 15;
 // Reload a service:
 constexpr static int DINIT_CP_RELOADSERVICE = 16;
 
+// Load all services from the service directories:
+constexpr static int DINIT_CP_PRELOADSERVICES = 17;
+
+// Find/load several services and issue a start/stop/wake/release command for each:
+constexpr static int DINIT_CP_BATCH = 18;
+
+// List services, with filtering and pagination:
+constexpr static int DINIT_CP_LISTSERVICES2 = 19;
+
+// Subscribe to (or unsubscribe from) events for all services:
+constexpr static int DINIT_CP_SUBSCRIBEALL = 20;
+ // followed by 1-byte flag: 1 = subscribe, 0 = unsubscribe
+
+// Query control connection output statistics:
+constexpr static int DINIT_CP_QUERYCONNSTATS = 21;
+
+// Query full status of a service:
+constexpr static int DINIT_CP_SERVICESTATUS = 22;
+
+// Query the service timeline (record of service state transitions):
+constexpr static int DINIT_CP_QUERYTIMELINE = 23;
+
+// Query the service start duration history:
+constexpr static int DINIT_CP_QUERYSTARTHISTORY = 24;
+
 // Replies:
 
 // Reply: ACK/NAK to request
@@ -98,7 +123,35 @@ constexpr static int DINIT_RP_PINNEDSTARTED = 68;
 // Shutdown is in progress, can't start/restart/wake service:
 constexpr static int DINIT_RP_SHUTTINGDOWN = 69;
 
+// Preload complete: 4-byte # services loaded, 4-byte # failures, 4-byte elapsed time (milliseconds)
+constexpr static int DINIT_RP_PRELOADINFO = 70;
+
+// Batch results: 2-byte count N, N * (1-byte reply code, 4-byte service handle)
+constexpr static int DINIT_RP_BATCH = 71;
+
+// Information on several services (LISTSERVICES2) / list complete (4-byte continuation cursor):
+constexpr static int DINIT_RP_SVCINFO2 = 72;
+constexpr static int DINIT_RP_LISTDONE2 = 73;
+
+// Control connection statistics: 4-byte # connections, 4-byte # connections paused, 8-byte total
+// queued output, 8-byte connection budget, 8-byte total budget, 8-byte # times paused, 8-byte #
+// connections closed due to overrun
+constexpr static int DINIT_RP_CONNSTATS = 74;
+
+// Full status of a service (see control.cc, process_service_status, for the layout):
+constexpr static int DINIT_RP_SERVICESTATUS = 75;
+
+// Service timeline (see control.cc, process_query_timeline, for the layout):
+constexpr static int DINIT_RP_TIMELINE = 76;
+
+// Service start duration history (see control.cc, process_query_start_history, for the layout):
+constexpr static int DINIT_RP_STARTHISTORY = 77;
+
 // Information:
 
 // Service event occurred (4-byte service handle, 1 byte event code)
 constexpr static int DINIT_IP_SERVICEEVENT = 100;
+
+// Service event occurred, for connections subscribed to all services (1-byte packet length,
+// 4-byte service id, 1 byte event code, 8-byte seconds + 4-byte nanoseconds system time, name)
+constexpr static int DINIT_IP_SERVICEEVENT2 = 101;
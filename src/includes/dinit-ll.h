@@ -58,6 +58,11 @@ class dlist
         }
     }
 
+    T * front() noexcept
+    {
+        return first;
+    }
+
     T * tail() noexcept
     {
         if (first == nullptr) {
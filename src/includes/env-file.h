@@ -0,0 +1,80 @@
+#ifndef DINIT_ENV_FILE_H
+#define DINIT_ENV_FILE_H 1
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <locale>
+
+// Environment files: files containing environment variable settings, one per line, in the form
+// NAME=VALUE. Blank lines and lines beginning with '#' are ignored.
+//
+// Environment files for services are read by dinit itself (rather than in the child process), and
+// the settings are cached (by path) until the file changes. Before a service process is forked,
+// a complete environment block is prepared, so that the child process need not allocate memory.
+
+// Parse an environment file from a stream. For each valid setting, calls set_var(name, value) (with
+// std::string arguments); for each invalid line, calls bad_line(linenum). May throw std::bad_alloc
+// and anything thrown by the callbacks.
+template <typename SET_VAR, typename BAD_LINE>
+void parse_env_file(std::istream &env_file, SET_VAR set_var, BAD_LINE bad_line)
+{
+    auto &clocale = std::locale::classic();
+    std::string line;
+    int linenum = 0;
+
+    while (std::getline(env_file, line)) {
+        linenum++;
+        auto lpos = line.begin();
+        auto lend = line.end();
+        while (lpos != lend && std::isspace(*lpos, clocale)) {
+            ++lpos;
+        }
+
+        if (lpos != lend) {
+            if (*lpos != '#') {
+                if (*lpos == '=') {
+                    bad_line(linenum);
+                    continue;
+                }
+                auto name_begin = lpos++;
+                // skip until '=' or whitespace:
+                while (lpos != lend && *lpos != '=' && ! std::isspace(*lpos, clocale)) ++lpos;
+                auto name_end = lpos;
+                //  skip whitespace:
+                while (lpos != lend && std::isspace(*lpos, clocale)) ++lpos;
+                if (lpos == lend) {
+                    bad_line(linenum);
+                    continue;
+                }
+
+                ++lpos;
+                auto val_begin = lpos;
+                while (lpos != lend && *lpos != '\n') ++lpos;
+                auto val_end = lpos;
+
+                std::string name = line.substr(name_begin - line.begin(), name_end - name_begin);
+                std::string value = line.substr(val_begin - line.begin(), val_end - val_begin);
+                set_var(name, value);
+            }
+        }
+    }
+}
+
+// Get the variable settings (each in NAME=VALUE form) from an environment file. The settings are
+// cached, and the file is re-read only if it has changed since it was last read. If the file does
+// not exist, there are no settings. Throws std::bad_alloc, or std::system_error if the file
+// cannot be read.
+const std::vector<std::string> &get_env_file_vars(const char *env_file_path);
+
+// Prepare an environment block for a child process: the current environment, with the given
+// settings (if any) overriding existing values, followed by 'spare' empty (nullptr) slots for use by
+// set_child_env_var, and a terminating nullptr. May throw std::bad_alloc.
+void build_child_env(std::vector<const char *> &envp, const std::vector<std::string> *vars, unsigned spare);
+
+// Set a variable in an environment block prepared by build_child_env, given in NAME=VALUE form. An
+// existing setting for the variable is replaced, otherwise a spare slot is used. Returns false if
+// no spare slot is available. Does not allocate (suitable for use after fork).
+bool set_child_env_var(std::vector<const char *> &envp, const char *setting) noexcept;
+
+#endif
@@ -1,4 +1,8 @@
+#ifndef DINIT_LOAD_SERVICE_H
+#define DINIT_LOAD_SERVICE_H 1
+
 #include <iostream>
+#include <algorithm>
 #include <list>
 #include <limits>
 #include <utility>
@@ -8,6 +12,7 @@
 #include <csignal>
 #include <cstring>
 #include <cstdlib>
+#include <cstdint>
 
 #include <sys/types.h>
 #include <sys/time.h>
@@ -126,15 +131,26 @@ class setting_exception
 };
 
 
+// Get the character classification facet of the "classic" locale. The facet is looked up only once,
+// since doing so for every character is comparatively expensive.
+inline const std::ctype<char> &classic_ctype() noexcept
+{
+    static const std::ctype<char> &facet = std::use_facet<std::ctype<char>>(std::locale::classic());
+    return facet;
+}
+
+// Check whether a character is white space (in the "classic" locale).
+inline bool is_classic_space(char c) noexcept
+{
+    return classic_ctype().is(std::ctype<char>::space, c);
+}
+
 // Utility function to skip white space. Returns an iterator at the
 // first non-white-space position (or at end).
 inline string_iterator skipws(string_iterator i, string_iterator end) noexcept
 {
-    using std::locale;
-    using std::isspace;
-
     while (i != end) {
-      if (! isspace(*i, locale::classic())) {
+      if (! is_classic_space(*i)) {
         break;
       }
       ++i;
@@ -156,35 +172,41 @@ inline int signal_name_to_number(std::string &signame) noexcept
     return -1;
 }
 
-// Read a setting/variable name; return empty string if no valid name
-inline string read_config_name(string_iterator & i, string_iterator end) noexcept
+// Read a setting/variable name into the given string (which is set empty if there is no valid name).
+// Re-using the same string for each name avoids allocation.
+inline void read_config_name(string_iterator & i, string_iterator end, string &name)
 {
-    using std::locale;
     using std::ctype;
-    using std::use_facet;
 
     // To avoid the horror of locales, we'll use the classic facet only, to identify digits, control
     // characters and punctuation. (Unless something is totally crazy, we are talking about ASCII or
     // a superset of it, but using the facet allows us to avoid that assumption). However, we're only
     // working with "narrow" char type so accuracy is limited. In general, that's not going to matter
     // much, but may allow certain unicode punctuation characters to be used as part of a name for example.
-    const ctype<char> & facet = use_facet<ctype<char>>(locale::classic());
-
-    string rval;
+    const ctype<char> & facet = classic_ctype();
 
     // Don't allow empty name, numeric digit, or dash/dot at start of setting name
     if (i == end || (*i == '-' || *i == '.' || facet.is(ctype<char>::digit, *i))) {
-        return {};
+        name.clear();
+        return;
     }
 
     // Within the setting name, allow dash and dot; also allow any non-control, non-punctuation,
     // non-space character.
+    string_iterator name_start = i;
     while (i != end && (*i == '-' || *i == '.' || *i == '_'
             || (!facet.is(ctype<char>::cntrl, *i) && !facet.is(ctype<char>::punct, *i)
                     && !facet.is(ctype<char>::space, *i)))) {
-        rval += *i;
         ++i;
     }
+    name.assign(name_start, i);
+}
+
+// Read a setting/variable name; return empty string if no valid name
+inline string read_config_name(string_iterator & i, string_iterator end)
+{
+    string rval;
+    read_config_name(i, end, rval);
     return rval;
 }
 
@@ -214,9 +236,6 @@ inline string read_config_name(string_iterator & i, string_iterator end) noexcep
 inline string read_setting_value(string_iterator & i, string_iterator end,
         std::list<std::pair<unsigned,unsigned>> * part_positions = nullptr)
 {
-    using std::locale;
-    using std::isspace;
-
     i = skipws(i, end);
 
     string rval;
@@ -270,7 +289,7 @@ inline string read_setting_value(string_iterator & i, string_iterator end,
                 throw setting_exception("backslash escape (`\\') not followed by character");
             }
         }
-        else if (isspace(c, locale::classic())) {
+        else if (is_classic_space(c)) {
             if (! new_part && part_positions != nullptr) {
                 part_positions->emplace_back(part_start, rval.length());
                 new_part = true;
@@ -556,40 +575,76 @@ inline void parse_rlimit(const std::string &line, const std::string &service_nam
     }
 }
 
-// Process an opened service file, line by line.
+// Read the (remaining) contents of a stream into a buffer, replacing any existing contents of the
+// buffer. If the stream is seekable, the buffer is sized so that it is filled by a single read.
+// May throw I/O exceptions if enabled on the stream.
+inline void read_whole_stream(std::istream &in, string &buf)
+{
+    std::streambuf *sb = in.rdbuf();
+    std::streamoff size = 0;
+    auto start = sb->pubseekoff(0, std::ios::cur, std::ios::in);
+    if (start != std::streampos(-1)) {
+        auto stream_end = sb->pubseekoff(0, std::ios::end, std::ios::in);
+        if (stream_end != std::streampos(-1)) {
+            size = stream_end - start;
+        }
+        sb->pubseekpos(start, std::ios::in);
+    }
+
+    // Read one more character than expected, so that end-of-file is detected by the first read
+    size_t len = 0;
+    size_t chunk = (size > 0) ? (size_t)size + 1 : 1024;
+    while (true) {
+        buf.resize(len + chunk);
+        in.read(&buf[len], chunk);
+        len += in.gcount();
+        if (!in) break;
+        chunk = buf.size();
+    }
+    buf.resize(len);
+}
+
+// Process an opened service file, line by line. The whole file is read into a single buffer, and
+// the setting value on each line is presented to the processing function as a pair of iterators
+// into it, so that only the values actually used are copied.
 //    name - the service name
 //    service_file - the service file input stream
 //    func - a function of the form:
-//             void(string &line, string &setting, string_iterator i, string_iterator end)
+//             void(string &file_buf, string &setting, string_iterator i, string_iterator end)
 //           Called with:
-//               line - the complete line (excluding newline character)
+//               file_buf - the buffer containing the file contents
 //               setting - the setting name, from the beginning of the line
 //               i - iterator at the beginning of the setting value
-//               end - iterator marking the end of the line
+//               end - iterator marking the end of the line (at the newline character, if any)
 //
 // May throw service load exceptions or I/O exceptions if enabled on stream.
 template <typename T>
 void process_service_file(string name, std::istream &service_file, T func)
 {
-    string line;
+    string file_buf;
+    read_whole_stream(service_file, file_buf);
+
+    string setting;
+    string::iterator line_start = file_buf.begin();
+    string::iterator buf_end = file_buf.end();
 
-    while (getline(service_file, line)) {
-        string::iterator i = line.begin();
-        string::iterator end = line.end();
+    while (line_start != buf_end) {
+        string::iterator end = std::find(line_start, buf_end, '\n');
+        string::iterator i = skipws(line_start, end);
+        line_start = (end == buf_end) ? end : std::next(end);
 
-        i = skipws(i, end);
         if (i != end) {
             if (*i == '#') {
                 continue;  // comment line
             }
-            string setting = read_config_name(i, end);
+            read_config_name(i, end, setting);
             i = skipws(i, end);
             if (setting.empty() || i == end || (*i != '=' && *i != ':')) {
                 throw service_description_exc(name, "badly formed line.");
             }
             i = skipws(++i, end);
 
-            func(line, setting, i, end);
+            func(file_buf, setting, i, end);
         }
     }
 }
@@ -867,6 +922,117 @@ class service_settings_wrapper
     }
 };
 
+// Identifiers for the settings that may appear in a service description.
+enum class setting_id
+{
+    NONE, // not a recognised setting
+    COMMAND,
+    WORKING_DIR,
+    ENV_FILE,
+    SOCKET_LISTEN,
+    SOCKET_PERMISSIONS,
+    SOCKET_UID,
+    SOCKET_GID,
+    STOP_COMMAND,
+    PID_FILE,
+    DEPENDS_ON,
+    DEPENDS_MS,
+    WAITS_FOR,
+    WAITS_FOR_D,
+    LOGFILE,
+    RESTART,
+    SMOOTH_RECOVERY,
+    TYPE,
+    OPTIONS,
+    LOAD_OPTIONS,
+    TERM_SIGNAL,
+    TERMSIGNAL,
+    RESTART_LIMIT_INTERVAL,
+    RESTART_DELAY,
+    RESTART_LIMIT_COUNT,
+    STOP_TIMEOUT,
+    START_TIMEOUT,
+    RUN_AS,
+    CHAIN_TO,
+    READY_NOTIFICATION,
+    INITTAB_ID,
+    INITTAB_LINE,
+    RLIMIT_NOFILE,
+    RLIMIT_CORE,
+    RLIMIT_DATA,
+    RLIMIT_ADDRSPACE
+};
+
+// Hash a setting name (FNV-1a). This is usable at compile time, so that the hash of each known
+// setting name can be used as a case label; should two names ever collide, compilation fails
+// (duplicate case value).
+constexpr uint32_t setting_name_hash(const char *name, uint32_t hash = 2166136261u)
+{
+    return (*name == 0) ? hash
+            : setting_name_hash(name + 1, (hash ^ (unsigned char)*name) * 16777619u);
+}
+
+// Hash a setting name at run time; equivalent to the above.
+inline uint32_t setting_name_hash(const string &name) noexcept
+{
+    uint32_t hash = 2166136261u;
+    for (char c : name) {
+        hash = (hash ^ (unsigned char)c) * 16777619u;
+    }
+    return hash;
+}
+
+// Identify a setting by name. Returns setting_id::NONE if the name is not that of a known setting.
+inline setting_id lookup_setting_id(const string &name) noexcept
+{
+    // Each case must still compare the complete name, since unknown names may share a hash value
+    // with a known setting.
+    #define DINIT_SETTING_CASE(sname, id) \
+        case setting_name_hash(sname): return (name == sname) ? setting_id::id : setting_id::NONE;
+
+    switch (setting_name_hash(name)) {
+    DINIT_SETTING_CASE("command", COMMAND)
+    DINIT_SETTING_CASE("working-dir", WORKING_DIR)
+    DINIT_SETTING_CASE("env-file", ENV_FILE)
+    DINIT_SETTING_CASE("socket-listen", SOCKET_LISTEN)
+    DINIT_SETTING_CASE("socket-permissions", SOCKET_PERMISSIONS)
+    DINIT_SETTING_CASE("socket-uid", SOCKET_UID)
+    DINIT_SETTING_CASE("socket-gid", SOCKET_GID)
+    DINIT_SETTING_CASE("stop-command", STOP_COMMAND)
+    DINIT_SETTING_CASE("pid-file", PID_FILE)
+    DINIT_SETTING_CASE("depends-on", DEPENDS_ON)
+    DINIT_SETTING_CASE("depends-ms", DEPENDS_MS)
+    DINIT_SETTING_CASE("waits-for", WAITS_FOR)
+    DINIT_SETTING_CASE("waits-for.d", WAITS_FOR_D)
+    DINIT_SETTING_CASE("logfile", LOGFILE)
+    DINIT_SETTING_CASE("restart", RESTART)
+    DINIT_SETTING_CASE("smooth-recovery", SMOOTH_RECOVERY)
+    DINIT_SETTING_CASE("type", TYPE)
+    DINIT_SETTING_CASE("options", OPTIONS)
+    DINIT_SETTING_CASE("load-options", LOAD_OPTIONS)
+    DINIT_SETTING_CASE("term-signal", TERM_SIGNAL)
+    DINIT_SETTING_CASE("termsignal", TERMSIGNAL)
+    DINIT_SETTING_CASE("restart-limit-interval", RESTART_LIMIT_INTERVAL)
+    DINIT_SETTING_CASE("restart-delay", RESTART_DELAY)
+    DINIT_SETTING_CASE("restart-limit-count", RESTART_LIMIT_COUNT)
+    DINIT_SETTING_CASE("stop-timeout", STOP_TIMEOUT)
+    DINIT_SETTING_CASE("start-timeout", START_TIMEOUT)
+    DINIT_SETTING_CASE("run-as", RUN_AS)
+    DINIT_SETTING_CASE("chain-to", CHAIN_TO)
+    DINIT_SETTING_CASE("ready-notification", READY_NOTIFICATION)
+    DINIT_SETTING_CASE("inittab-id", INITTAB_ID)
+    DINIT_SETTING_CASE("inittab-line", INITTAB_LINE)
+    DINIT_SETTING_CASE("rlimit-nofile", RLIMIT_NOFILE)
+    DINIT_SETTING_CASE("rlimit-core", RLIMIT_CORE)
+    DINIT_SETTING_CASE("rlimit-data", RLIMIT_DATA)
+    DINIT_SETTING_CASE("rlimit-addrspace", RLIMIT_ADDRSPACE)
+    default:
+        return setting_id::NONE;
+    }
+
+    #undef DINIT_SETTING_CASE
+}
+
 // Process a service description line. In general, parse the setting value and record the parsed value
 // in a service settings wrapper object. Errors will be reported via service_description_exc exception.
 //
@@ -878,7 +1044,7 @@ class service_settings_wrapper
 // parameters:
 //     settings     : wrapper object for service settings
 //     name         : name of the service being processed
-//     line         : the current line of the service description file
+//     line         : the buffer holding the service description (containing the current line)
 //     setting      : the name of the setting (from the beginning of line)
 //     i            : iterator at beginning of setting value (including whitespace)
 //     end          : iterator at end of line
@@ -897,19 +1063,24 @@ void process_service_line(settings_wrapper &settings, const char *name, string &
         string::iterator &i, string::iterator &end, load_service_t load_service,
         process_dep_dir_t process_dep_dir)
 {
-    if (setting == "command") {
+    switch (lookup_setting_id(setting)) {
+    case setting_id::COMMAND: {
         settings.command = read_setting_value(i, end, &settings.command_offsets);
+        break;
     }
-    else if (setting == "working-dir") {
+    case setting_id::WORKING_DIR: {
         settings.working_dir = read_setting_value(i, end, nullptr);
+        break;
     }
-    else if (setting == "env-file") {
+    case setting_id::ENV_FILE: {
         settings.env_file = read_setting_value(i, end, nullptr);
+        break;
     }
-    else if (setting == "socket-listen") {
+    case setting_id::SOCKET_LISTEN: {
         settings.socket_path = read_setting_value(i, end, nullptr);
+        break;
     }
-    else if (setting == "socket-permissions") {
+    case setting_id::SOCKET_PERMISSIONS: {
         string sock_perm_str = read_setting_value(i, end, nullptr);
         std::size_t ind = 0;
         try {
@@ -922,49 +1093,61 @@ void process_service_line(settings_wrapper &settings, const char *name, string &
             throw service_description_exc(name, "socket-permissions: badly-formed or "
                     "out-of-range numeric value");
         }
+        break;
     }
-    else if (setting == "socket-uid") {
+    case setting_id::SOCKET_UID: {
         string sock_uid_s = read_setting_value(i, end, nullptr);
         settings.socket_uid = parse_uid_param(sock_uid_s, name, "socket-uid", &settings.socket_uid_gid);
+        break;
     }
-    else if (setting == "socket-gid") {
+    case setting_id::SOCKET_GID: {
         string sock_gid_s = read_setting_value(i, end, nullptr);
         settings.socket_gid = parse_gid_param(sock_gid_s, "socket-gid", name);
+        break;
     }
-    else if (setting == "stop-command") {
+    case setting_id::STOP_COMMAND: {
         settings.stop_command = read_setting_value(i, end, &settings.stop_command_offsets);
+        break;
     }
-    else if (setting == "pid-file") {
+    case setting_id::PID_FILE: {
         settings.pid_file = read_setting_value(i, end);
+        break;
     }
-    else if (setting == "depends-on") {
+    case setting_id::DEPENDS_ON: {
         string dependency_name = read_setting_value(i, end);
         settings.depends.emplace_back(load_service(dependency_name.c_str()), dependency_type::REGULAR);
+        break;
     }
-    else if (setting == "depends-ms") {
+    case setting_id::DEPENDS_MS: {
         string dependency_name = read_setting_value(i, end);
         settings.depends.emplace_back(load_service(dependency_name.c_str()), dependency_type::MILESTONE);
+        break;
     }
-    else if (setting == "waits-for") {
+    case setting_id::WAITS_FOR: {
         string dependency_name = read_setting_value(i, end);
         settings.depends.emplace_back(load_service(dependency_name.c_str()), dependency_type::WAITS_FOR);
+        break;
     }
-    else if (setting == "waits-for.d") {
+    case setting_id::WAITS_FOR_D: {
         string waitsford = read_setting_value(i, end);
         process_dep_dir(settings.depends, waitsford, dependency_type::WAITS_FOR);
+        break;
     }
-    else if (setting == "logfile") {
+    case setting_id::LOGFILE: {
         settings.logfile = read_setting_value(i, end);
+        break;
     }
-    else if (setting == "restart") {
+    case setting_id::RESTART: {
         string restart = read_setting_value(i, end);
         settings.auto_restart = (restart == "yes" || restart == "true");
+        break;
     }
-    else if (setting == "smooth-recovery") {
+    case setting_id::SMOOTH_RECOVERY: {
         string recovery = read_setting_value(i, end);
         settings.smooth_recovery = (recovery == "yes" || recovery == "true");
+        break;
     }
-    else if (setting == "type") {
+    case setting_id::TYPE: {
         string type_str = read_setting_value(i, end);
         if (type_str == "scripted") {
             settings.service_type = service_type_t::SCRIPTED;
@@ -982,8 +1165,9 @@ void process_service_line(settings_wrapper &settings, const char *name, string &
             throw service_description_exc(name, "service type must be one of: \"scripted\","
                 " \"process\", \"bgprocess\" or \"internal\"");
         }
+        break;
     }
-    else if (setting == "options") {
+    case setting_id::OPTIONS: {
         std::list<std::pair<unsigned,unsigned>> indices;
         string onstart_cmds = read_setting_value(i, end, &indices);
         for (auto indexpair : indices) {
@@ -1029,8 +1213,9 @@ void process_service_line(settings_wrapper &settings, const char *name, string &
                 throw service_description_exc(name, "Unknown option: " + option_txt);
             }
         }
+        break;
     }
-    else if (setting == "load-options") {
+    case setting_id::LOAD_OPTIONS: {
         std::list<std::pair<unsigned,unsigned>> indices;
         string load_opts = read_setting_value(i, end, &indices);
         for (auto indexpair : indices) {
@@ -1047,8 +1232,10 @@ void process_service_line(settings_wrapper &settings, const char *name, string &
                 throw service_description_exc(name, "unknown load option: " + option_txt);
             }
         }
+        break;
     }
-    else if (setting == "term-signal" || setting == "termsignal") {
+    case setting_id::TERM_SIGNAL:
+    case setting_id::TERMSIGNAL: {
         // Note: "termsignal" supported for legacy reasons.
         string signame = read_setting_value(i, end, nullptr);
         int signo = signal_name_to_number(signame);
@@ -1059,35 +1246,43 @@ void process_service_line(settings_wrapper &settings, const char *name, string &
         else {
             settings.term_signal = signo;
         }
+        break;
     }
-    else if (setting == "restart-limit-interval") {
+    case setting_id::RESTART_LIMIT_INTERVAL: {
         string interval_str = read_setting_value(i, end, nullptr);
         parse_timespec(interval_str, name, "restart-limit-interval", settings.restart_interval);
+        break;
     }
-    else if (setting == "restart-delay") {
+    case setting_id::RESTART_DELAY: {
         string rsdelay_str = read_setting_value(i, end, nullptr);
         parse_timespec(rsdelay_str, name, "restart-delay", settings.restart_delay);
+        break;
     }
-    else if (setting == "restart-limit-count") {
+    case setting_id::RESTART_LIMIT_COUNT: {
         string limit_str = read_setting_value(i, end, nullptr);
         settings.max_restarts = parse_unum_param(limit_str, name, std::numeric_limits<int>::max());
+        break;
     }
-    else if (setting == "stop-timeout") {
+    case setting_id::STOP_TIMEOUT: {
         string stoptimeout_str = read_setting_value(i, end, nullptr);
         parse_timespec(stoptimeout_str, name, "stop-timeout", settings.stop_timeout);
+        break;
     }
-    else if (setting == "start-timeout") {
+    case setting_id::START_TIMEOUT: {
         string starttimeout_str = read_setting_value(i, end, nullptr);
         parse_timespec(starttimeout_str, name, "start-timeout", settings.start_timeout);
+        break;
     }
-    else if (setting == "run-as") {
+    case setting_id::RUN_AS: {
         string run_as_str = read_setting_value(i, end, nullptr);
         settings.run_as_uid = parse_uid_param(run_as_str, name, "run-as", &settings.run_as_uid_gid);
+        break;
     }
-    else if (setting == "chain-to") {
+    case setting_id::CHAIN_TO: {
         settings.chain_to_name = read_setting_value(i, end, nullptr);
+        break;
     }
-    else if (setting == "ready-notification") {
+    case setting_id::READY_NOTIFICATION: {
         string notify_setting = read_setting_value(i, end, nullptr);
         if (starts_with(notify_setting, "pipefd:")) {
             settings.readiness_fd = parse_unum_param(notify_setting.substr(7 /* len 'pipefd:' */),
@@ -1104,8 +1299,9 @@ void process_service_line(settings_wrapper &settings, const char *name, string &
             throw service_description_exc(name, "unknown ready-notification setting: "
                     + notify_setting);
         }
+        break;
     }
-    else if (setting == "inittab-id") {
+    case setting_id::INITTAB_ID: {
         string inittab_setting = read_setting_value(i, end, nullptr);
         #if USE_UTMPX
         if (inittab_setting.length() > sizeof(settings.inittab_id)) {
@@ -1113,8 +1309,9 @@ void process_service_line(settings_wrapper &settings, const char *name, string &
         }
         strncpy(settings.inittab_id, inittab_setting.c_str(), sizeof(settings.inittab_id));
         #endif
+        break;
     }
-    else if (setting == "inittab-line") {
+    case setting_id::INITTAB_LINE: {
         string inittab_setting = read_setting_value(i, end, nullptr);
         #if USE_UTMPX
         if (inittab_setting.length() > sizeof(settings.inittab_line)) {
@@ -1122,30 +1319,35 @@ void process_service_line(settings_wrapper &settings, const char *name, string &
         }
         strncpy(settings.inittab_line, inittab_setting.c_str(), sizeof(settings.inittab_line));
         #endif
+        break;
     }
-    else if (setting == "rlimit-nofile") {
+    case setting_id::RLIMIT_NOFILE: {
         string nofile_setting = read_setting_value(i, end, nullptr);
         service_rlimits &nofile_limits = find_rlimits(settings.rlimits, RLIMIT_NOFILE);
         parse_rlimit(nofile_setting, name, "rlimit-nofile", nofile_limits);
+        break;
     }
-    else if (setting == "rlimit-core") {
+    case setting_id::RLIMIT_CORE: {
         string core_setting = read_setting_value(i, end, nullptr);
         service_rlimits &nofile_limits = find_rlimits(settings.rlimits, RLIMIT_CORE);
         parse_rlimit(core_setting, name, "rlimit-core", nofile_limits);
+        break;
     }
-    else if (setting == "rlimit-data") {
+    case setting_id::RLIMIT_DATA: {
         string data_setting = read_setting_value(i, end, nullptr);
         service_rlimits &nofile_limits = find_rlimits(settings.rlimits, RLIMIT_DATA);
         parse_rlimit(data_setting, name, "rlimit-data", nofile_limits);
+        break;
     }
-    else if (setting == "rlimit-addrspace") {
+    case setting_id::RLIMIT_ADDRSPACE: {
         #if defined(RLIMIT_AS)
             string addrspace_setting = read_setting_value(i, end, nullptr);
             service_rlimits &nofile_limits = find_rlimits(settings.rlimits, RLIMIT_AS);
             parse_rlimit(addrspace_setting, name, "rlimit-addrspace", nofile_limits);
         #endif
+        break;
     }
-    else {
+    default:
         throw service_description_exc(name, "unknown setting: '" + setting + "'.");
     }
 }
@@ -1153,3 +1355,5 @@ void process_service_line(settings_wrapper &settings, const char *name, string &
 } // namespace dinit_load
 
 using dinit_load::process_service_file;
+
+#endif /* DINIT_LOAD_SERVICE_H */
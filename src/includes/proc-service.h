@@ -1,6 +1,7 @@
 #include <vector>
 #include <string>
 #include <list>
+#include <csignal>
 
 #include <sys/types.h>
 #include <sys/resource.h>
@@ -25,7 +26,7 @@ struct run_proc_params
     const char * const *args; // program arguments including executable (args[0])
     const char *working_dir;  // working directory
     const char *logfile;      // log file or nullptr (stdout/stderr); must be valid if !on_console
-    const char *env_file;     // file with environment settings (or nullptr)
+    std::vector<const char *> *envp; // environment, prepared by build_child_env (with 4 spare slots)
     bool on_console;          // whether to run on console
     bool in_foreground;       // if on console: whether to run in foreground
     int wpipefd;              // pipe to which error status will be sent (if error occurs)
@@ -34,15 +35,19 @@ struct run_proc_params
     int notify_fd;            // pipe for readiness notification message (or -1); may be moved
     int force_notify_fd;      // if not -1, notification fd must be moved to this fd
     const char *notify_var;   // environment variable name where notification fd will be stored, or nullptr
+    char *notify_var_buf;     // buffer for notify_var setting (NAME=nnn) if notify_var is specified
+    size_t notify_var_bufsz;  // size of notify_var_buf
+    const sigset_t *signal_mask; // signal mask for the process (nullptr: current mask)
     uid_t uid;
     gid_t gid;
     const std::vector<service_rlimits> &rlimits;
 
     run_proc_params(const char * const *args, const char *working_dir, const char *logfile, int wpipefd,
             uid_t uid, gid_t gid, const std::vector<service_rlimits> &rlimits)
-            : args(args), working_dir(working_dir), logfile(logfile), env_file(nullptr), on_console(false),
+            : args(args), working_dir(working_dir), logfile(logfile), envp(nullptr), on_console(false),
               in_foreground(false), wpipefd(wpipefd), csfd(-1), socket_fd(-1), notify_fd(-1),
-              force_notify_fd(-1), notify_var(nullptr), uid(uid), gid(gid), rlimits(rlimits)
+              force_notify_fd(-1), notify_var(nullptr), notify_var_buf(nullptr), notify_var_bufsz(0),
+              signal_mask(nullptr), uid(uid), gid(gid), rlimits(rlimits)
     { }
 };
 
@@ -177,14 +182,28 @@ class base_process_service : public service_record
 
     bool reserved_child_watch : 1;
     bool tracking_child : 1;  // whether we expect to see child process status
+    bool have_start_time : 1; // whether a process has been launched (last_start_time is valid)
+    bool have_exec_err : 1;   // whether executing a child process has failed (exec_err_info is valid)
 
-    // If executing child process failed, information about the error
+    // If executing child process failed, information about the (most recent) error
     run_proc_err exec_err_info;
 
     // Run a child process (call after forking). Note that some parameters specify file descriptors,
     // but in general file descriptors may be moved before the exec call.
     void run_child_proc(run_proc_params params) noexcept;
 
+    // Entry point for a child process created via bp_sys::vfork_spawn; arg points to a
+    // vfork_child_args.
+    static int vfork_child(void *arg) noexcept;
+
+    // Check whether the process can be launched via vfork_spawn rather than fork, i.e. whether
+    // everything that must be done in the child before exec can be done without a full copy of the
+    // parent process.
+    bool can_vfork(bool on_console) noexcept
+    {
+        return bp_sys::have_vfork_spawn && !on_console && run_as_uid == uid_t(-1) && !needs_after_fork();
+    }
+
     // Launch the process with the given arguments, return true on success
     bool start_ps_process(const std::vector<const char *> &args, bool on_console) noexcept;
 
@@ -201,6 +220,10 @@ class base_process_service : public service_record
     // Called after forking (before executing remote process).
     virtual void after_fork(pid_t child_pid) noexcept { }
 
+    // Check whether after_fork() has anything to do (in which case, the process must be launched
+    // via a full fork).
+    virtual bool needs_after_fork() noexcept { return false; }
+
     // Called when the process exits. The exit_status is the status value yielded by
     // the "wait" system call.
     virtual void handle_exit_status(bp_sys::exit_status exit_status) noexcept = 0;
@@ -213,6 +236,11 @@ class base_process_service : public service_record
     // Called if exec succeeds.
     virtual void exec_succeeded() noexcept { };
 
+    virtual bool uses_start_slot() noexcept override
+    {
+        return true;
+    }
+
     virtual bool can_interrupt_start() noexcept override
     {
         return waiting_restart_timer || onstart_flags.start_interruptible
@@ -376,6 +404,24 @@ class base_process_service : public service_record
     {
         return exit_status.as_int();
     }
+
+    bool get_process_start_time(time_val &start_time) override
+    {
+        start_time = last_start_time;
+        return have_start_time;
+    }
+
+    int get_restart_interval_count() override
+    {
+        return restart_interval_count;
+    }
+
+    bool get_exec_error(exec_stage &stage, int &st_errno) override
+    {
+        stage = exec_err_info.stage;
+        st_errno = exec_err_info.st_errno;
+        return have_exec_err;
+    }
 };
 
 // Standard process service.
@@ -390,8 +436,8 @@ class process_service : public base_process_service
 
 #if USE_UTMPX
 
-    char inittab_id[sizeof(utmpx().ut_id)];
-    char inittab_line[sizeof(utmpx().ut_line)];
+    char inittab_id[sizeof(utmpx().ut_id)] = {0};
+    char inittab_line[sizeof(utmpx().ut_line)] = {0};
 
     protected:
     void after_fork(pid_t child_pid) noexcept override
@@ -401,6 +447,11 @@ class process_service : public base_process_service
         }
     }
 
+    bool needs_after_fork() noexcept override
+    {
+        return *inittab_id || *inittab_line;
+    }
+
 #endif
 
     protected:
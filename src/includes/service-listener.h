@@ -15,4 +15,15 @@ class service_listener
     virtual void service_event(service_record * service, service_event_t event) noexcept = 0;
 };
 
+// Interface for listening to all services in a service set
+class service_set_listener
+{
+    public:
+
+    // An event occurred on a service in the set. This is called after the listeners for the
+    // individual service have been notified.
+    // Listeners must not be added or removed during event notification.
+    virtual void service_set_event(service_record * service, service_event_t event) noexcept = 0;
+};
+
 #endif
@@ -0,0 +1,86 @@
+#ifndef DINIT_SERVICE_TIMELINE_H
+#define DINIT_SERVICE_TIMELINE_H 1
+
+#include <vector>
+
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Service timeline.
+ *
+ * The timeline is a record of service state transitions (and some other significant points in
+ * the startup of a service), each with a timestamp from the monotonic clock. It is kept in a
+ * bounded buffer; once the buffer is full, the oldest entries are overwritten. It is used to
+ * analyse boot time: how long each service took to start, and which dependencies held up the
+ * start of each service (see DINIT_CP_QUERYTIMELINE).
+ */
+
+enum class timeline_event_t : uint8_t
+{
+    STARTING,       // service began starting (waiting for dependencies)
+    DEPS_STARTED,   // dependencies started; service itself begins starting
+    EXEC,           // process launched
+    STARTED,        // service started
+    STOPPING,       // service began stopping
+    STOPPED,        // service stopped
+    CONSOLE_WAIT,   // dependencies started; service waiting for access to the console
+    EXEC_SUCCEEDED, // process successfully executed (following EXEC)
+    START_SLOT_WAIT // dependencies started; service waiting for a start slot (see
+                    // service_set::set_start_slot_limit)
+};
+
+struct timeline_entry
+{
+    int64_t secs;           // time of the event (monotonic clock)
+    uint32_t nsecs;
+    uint32_t service_id;    // service to which the event applies
+    uint32_t related_id;    // for DEPS_STARTED and CONSOLE_WAIT, the dependency which was last to
+                            // start (or 0)
+    timeline_event_t event;
+    uint8_t detail;         // for STOPPED, the stop reason (stopped_reason_t)
+};
+
+// Size of an entry in the DINIT_RP_TIMELINE reply: secs (8), nsecs (4), service id (4),
+// related id (4), event (1), detail (1)
+constexpr unsigned timeline_entry_wire_size = 22;
+
+class service_timeline
+{
+    std::vector<timeline_entry> entries;
+    size_t capacity;
+    size_t next = 0;        // once the buffer is full, index of the oldest entry (next to overwrite)
+    uint64_t total = 0;     // number of entries ever recorded
+
+    public:
+    static constexpr size_t default_capacity = 4096;
+
+    explicit service_timeline(size_t capacity_p = default_capacity) noexcept : capacity(capacity_p)
+    {
+    }
+
+    // Record an event. If the buffer is full, the oldest entry is discarded.
+    void record(int64_t secs, uint32_t nsecs, uint32_t service_id, timeline_event_t event,
+            uint32_t related_id = 0, uint8_t detail = 0) noexcept;
+
+    // Number of entries currently held
+    size_t size() const noexcept
+    {
+        return entries.size();
+    }
+
+    // Number of entries which have been discarded (overwritten, or not recorded due to lack of
+    // memory)
+    uint64_t get_dropped() const noexcept
+    {
+        return total - entries.size();
+    }
+
+    // Get an entry, by position (0 is the oldest entry).
+    const timeline_entry &operator[](size_t i) const noexcept
+    {
+        return entries[(next + i) % entries.size()];
+    }
+};
+
+#endif
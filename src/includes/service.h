@@ -6,7 +6,11 @@
 #include <vector>
 #include <csignal>
 #include <unordered_set>
+#include <unordered_map>
+#include <map>
 #include <algorithm>
+#include <iterator>
+#include <cstddef>
 
 #include "dasynq.h"
 
@@ -18,6 +22,9 @@
 #include "dinit-ll.h"
 #include "dinit-log.h"
 #include "service-dir.h"
+#include "status-page.h"
+#include "service-timeline.h"
+#include "start-history.h"
 
 /*
  * This header defines service_record, a data record maintaining information about a service,
@@ -146,6 +153,7 @@
 class service_record;
 class service_set;
 class base_process_service;
+class service_cache;
 
 /* Service dependency record */
 class service_dep
@@ -189,6 +197,102 @@ class service_dep
     {
         to = new_to;
     }
+
+    // Records are allocated from a pool (see service.cc). May throw std::bad_alloc.
+    static void *operator new(std::size_t size);
+    static void operator delete(void *p) noexcept;
+};
+
+// The dependencies of a service: an array of pointers to service_dep records, iterated as if it
+// held the records themselves. Each record is allocated separately (from a pool, so that the
+// dependencies of a service are normally adjacent in memory) and is owned by the list; records
+// keep their address when other dependencies are added or removed, since dependents refer to
+// them. Inserting or removing a dependency invalidates iterators.
+class service_dep_list
+{
+    using ptr_vector = std::vector<service_dep *>;
+    ptr_vector deps;
+
+    public:
+    class iterator
+    {
+        friend class service_dep_list;
+        ptr_vector::iterator i;
+
+        public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = service_dep;
+        using difference_type = std::ptrdiff_t;
+        using pointer = service_dep *;
+        using reference = service_dep &;
+
+        iterator() noexcept { }
+        iterator(ptr_vector::iterator i_p) noexcept : i(i_p) { }
+
+        service_dep &operator*() const noexcept { return **i; }
+        service_dep *operator->() const noexcept { return *i; }
+        iterator &operator++() noexcept { ++i; return *this; }
+        iterator operator++(int) noexcept { return iterator(i++); }
+        iterator operator+(difference_type n) const noexcept { return iterator(i + n); }
+        bool operator==(const iterator &other) const noexcept { return i == other.i; }
+        bool operator!=(const iterator &other) const noexcept { return i != other.i; }
+    };
+
+    service_dep_list() noexcept { }
+    service_dep_list(const service_dep_list &) = delete;
+    void operator=(const service_dep_list &) = delete;
+
+    ~service_dep_list() noexcept
+    {
+        clear();
+    }
+
+    iterator begin() noexcept { return iterator(deps.begin()); }
+    iterator end() noexcept { return iterator(deps.end()); }
+    size_t size() const noexcept { return deps.size(); }
+    bool empty() const noexcept { return deps.empty(); }
+    service_dep &front() noexcept { return *deps.front(); }
+
+    // Reserve space for the given total number of dependencies. May throw std::bad_alloc.
+    void reserve(size_t n)
+    {
+        deps.reserve(n);
+    }
+
+    // Create a dependency record and insert it before the given position. May throw std::bad_alloc.
+    iterator emplace(iterator pos, service_record *from, service_record *to, dependency_type dep_type)
+    {
+        service_dep *dep = new service_dep(from, to, dep_type);
+        try {
+            return iterator(deps.insert(pos.i, dep));
+        }
+        catch (...) {
+            delete dep;
+            throw;
+        }
+    }
+
+    // Remove and destroy the dependency record at the given position, returning the position of
+    // the following record.
+    iterator erase(iterator pos) noexcept
+    {
+        delete *pos.i;
+        return iterator(deps.erase(pos.i));
+    }
+
+    void pop_back() noexcept
+    {
+        delete deps.back();
+        deps.pop_back();
+    }
+
+    void clear() noexcept
+    {
+        for (service_dep *dep : deps) {
+            delete dep;
+        }
+        deps.clear();
+    }
 };
 
 /* preliminary service dependency information */
@@ -220,12 +324,26 @@ class service_record
     private:
     string service_name;
     service_type_t record_type;  // service_type_t::DUMMY, PROCESS, SCRIPTED, or INTERNAL
+    uint32_t service_id = 0;     // identifier assigned by the service set (0 if not yet assigned)
 
     // 'service_state' can be any valid state: STARTED, STARTING, STOPPING, STOPPED.
     // 'desired_state' is only set to final states: STARTED or STOPPED.
     service_state_t service_state = service_state_t::STOPPED;
     service_state_t desired_state = service_state_t::STOPPED;
 
+    // Time (monotonic clock) at which the service entered its current state, and the total time
+    // spent in each state, not counting the time since the current state was entered:
+    time_val state_entered_time;
+    time_val state_durations[4] = { {0, 0}, {0, 0}, {0, 0}, {0, 0} };
+
+    // Time (monotonic clock) at which the service itself began starting (its dependencies having
+    // started), used to record the duration of the start in the start history:
+    time_val bring_up_time;
+
+    // Record a change of state: add the time spent in the current state to its total, and add the
+    // transition to the service timeline.
+    void record_state_change(service_state_t new_state) noexcept;
+
     protected:
     service_flags_t onstart_flags;
 
@@ -240,6 +358,8 @@ class service_record
                                 // if STOPPING, whether we are waiting for dependents to stop
     bool waiting_for_console : 1;   // waiting for exclusive console access (while STARTING)
     bool have_console : 1;      // whether we have exclusive console access (STARTING/STARTED)
+    bool waiting_for_start_slot : 1;  // waiting for a start slot (while STARTING)
+    bool have_start_slot : 1;   // whether we hold a start slot (STARTING)
     bool waiting_for_execstat : 1;  // if we are waiting for exec status after fork()
     bool start_explicit : 1;    // whether we are are explicitly required to be started
 
@@ -256,11 +376,13 @@ class service_record
 
     int required_by = 0;        // number of dependents wanting this service to be started
 
+    uint32_t restart_count = 0; // number of times the service has restarted (incl. smooth recovery)
+
     // list of dependencies
-    typedef std::list<service_dep> dep_list;
+    typedef service_dep_list dep_list;
     
     // list of dependents
-    typedef std::list<service_dep *> dpt_list;
+    typedef std::vector<service_dep *> dpt_list;
     
     dep_list depends_on;  // services this one depends on
     dpt_list dependents;  // services depending on this one
@@ -290,10 +412,17 @@ class service_record
     
     // Console queue.
     lld_node<service_record> console_queue_node;
+
+    // Start slot queue, and priority within it (see service_set::append_start_slot_queue)
+    lld_node<service_record> start_slot_queue_node;
+    uint64_t start_priority = 0;
     
     // Propagation and start/stop queues
     lls_node<service_record> prop_queue_node;
     lls_node<service_record> stop_queue_node;
+
+    // Slot in the status page (if any)
+    uint32_t status_slot = status_page::no_slot;
     
     protected:
 
@@ -350,12 +479,8 @@ class service_record
             || (service_state == service_state_t::STARTING && waiting_for_deps);
     }
     
-    void notify_listeners(service_event_t event) noexcept
-    {
-        for (auto l : listeners) {
-            l->service_event(this, event);
-        }
-    }
+    // Notify listeners for this service, and for all services in the set, of an event.
+    inline void notify_listeners(service_event_t event) noexcept;
     
     // Queue to run on the console. 'acquired_console()' will be called when the console is available.
     // Has no effect if the service has already queued for console.
@@ -363,6 +488,13 @@ class service_record
     
     // Release console (console must be currently held by this service)
     void release_console() noexcept;
+
+    // Queue for a start slot. 'acquired_start_slot()' will be called when a slot is available.
+    // Has no effect if the service has already queued for a start slot.
+    void queue_for_start_slot() noexcept;
+
+    // Release start slot (must be currently held by this service)
+    void release_start_slot() noexcept;
     
     // Started state reached
     bool process_started() noexcept;
@@ -379,7 +511,18 @@ class service_record
     // Set the service state
     void set_state(service_state_t new_state) noexcept
     {
+        if (new_state != service_state) {
+            record_state_change(new_state);
+        }
         service_state = new_state;
+        status_changed();
+    }
+
+    // Set the target (desired) state
+    void set_target_state(service_state_t new_state) noexcept
+    {
+        desired_state = new_state;
+        status_changed();
     }
 
     // Virtual functions, to be implemented by service implementations:
@@ -392,6 +535,13 @@ class service_record
     // All dependents have stopped, and this service should proceed to stop.
     virtual void bring_down() noexcept;
 
+    // Whether starting the service requires a start slot (i.e. whether starting is subject to the
+    // limit on the number of services starting concurrently).
+    virtual bool uses_start_slot() noexcept
+    {
+        return false;
+    }
+
     // Whether a STARTING service can immediately transition to STOPPED (as opposed to
     // having to wait for it reach STARTED and then go through STOPPING). Note that the
     // waiting_for_deps flag being set may override this check.
@@ -414,7 +564,8 @@ class service_record
         : service_name(name), service_state(service_state_t::STOPPED),
             desired_state(service_state_t::STOPPED), auto_restart(false), smooth_recovery(false),
             pinned_stopped(false), pinned_started(false), waiting_for_deps(false),
-            waiting_for_console(false), have_console(false), waiting_for_execstat(false),
+            waiting_for_console(false), have_console(false), waiting_for_start_slot(false),
+            have_start_slot(false), waiting_for_execstat(false),
             start_explicit(false), prop_require(false), prop_release(false), prop_failure(false),
             prop_start(false), prop_stop(false), start_failed(false), start_skipped(false),
             in_auto_restart(false), force_stop(false)
@@ -422,6 +573,7 @@ class service_record
         services = set;
         record_type = service_type_t::DUMMY;
         socket_perms = 0;
+        event_loop.get_time(state_entered_time, clock_type::MONOTONIC);
     }
 
     service_record(service_set *set, const string &name, service_type_t record_type_p,
@@ -433,6 +585,7 @@ class service_record
         this->record_type = record_type_p;
 
         try {
+            depends_on.reserve(deplist_p.size());
             for (auto & pdep : deplist_p) {
                 auto b = depends_on.emplace(depends_on.end(), this, pdep.to, pdep.dep_type);
                 try {
@@ -466,6 +619,19 @@ class service_record
         return record_type;
     }
 
+    // Get the identifier of this service record within its service set. Identifiers are assigned
+    // in increasing order as services are added to the set and are not re-used (a reloaded
+    // service which replaces the original record retains its identifier).
+    uint32_t get_id() noexcept
+    {
+        return service_id;
+    }
+
+    void set_id(uint32_t id) noexcept
+    {
+        service_id = id;
+    }
+
     // begin transition from stopped to started state or vice versa depending on current and desired state
     void execute_transition() noexcept;
     
@@ -473,6 +639,16 @@ class service_record
 
     // Console is available.
     void acquired_console() noexcept;
+
+    // Start slot is available.
+    void acquired_start_slot() noexcept;
+
+    // Get the length of the critical path from the start of this service: the longest chain of
+    // services which are waiting (directly or indirectly) for this service to start, including
+    // this service, where the length of each service is its expected start duration in
+    // milliseconds (at least 1). The lengths found for this and other services are recorded in
+    // 'lengths' (and those already recorded are used). May throw std::bad_alloc.
+    uint64_t get_critical_path_length(std::unordered_map<service_record *, uint64_t> &lengths);
     
     // Get the target (aka desired) state.
     service_state_t get_target_state() noexcept
@@ -598,6 +774,13 @@ class service_record
         listeners.erase(listener);
     }
     
+    // Check whether there are any listeners (such as control connections holding a handle to the
+    // service).
+    bool has_listeners() noexcept
+    {
+        return !listeners.empty();
+    }
+
     // Assuming there is one reference (from a control link), return true if this is the only reference,
     // or false if there are others (including dependents).
     bool has_lone_ref(bool check_deps = true) noexcept
@@ -618,6 +801,28 @@ class service_record
         depends_on.clear();
     }
 
+    // Publish the current status of the service to the status page (if there is one). To be called
+    // when the state, target state, process or restart count changes.
+    inline void status_changed() noexcept;
+
+    // Get the number of times the service has been restarted (including smooth recovery).
+    uint32_t get_restart_count() noexcept
+    {
+        return restart_count;
+    }
+
+    // Get the total time spent in the given state, including the time spent so far if it is the
+    // current state.
+    time_val get_state_duration(service_state_t state) noexcept;
+
+    // Get the time since the service entered its current state.
+    time_val get_time_in_state() noexcept
+    {
+        time_val now;
+        event_loop.get_time(now, clock_type::MONOTONIC);
+        return now - state_entered_time;
+    }
+
     // Why did the service stop?
     stopped_reason_t get_stop_reason()
     {
@@ -644,6 +849,26 @@ class service_record
         return 0;
     }
 
+    // Get the time (monotonic clock) at which a process for the service was most recently launched.
+    // Returns false if no process has been launched (or the service has no process).
+    virtual bool get_process_start_time(time_val &start_time)
+    {
+        return false;
+    }
+
+    // Get the number of automatic restarts within the current restart interval.
+    virtual int get_restart_interval_count()
+    {
+        return 0;
+    }
+
+    // Get details of the most recent failure to execute a process for the service. Returns false if
+    // there has been no such failure.
+    virtual bool get_exec_error(exec_stage &stage, int &st_errno)
+    {
+        return false;
+    }
+
     dep_list & get_dependencies()
     {
         return depends_on;
@@ -676,7 +901,7 @@ class service_record
             to->dependents.push_back(&(*pre_i));
         }
         catch (...) {
-            depends_on.erase(i);
+            depends_on.erase(pre_i);
             throw;
         }
 
@@ -746,6 +971,11 @@ inline auto extract_console_queue(service_record *sr) -> decltype(sr->console_qu
     return sr->console_queue_node;
 }
 
+inline auto extract_start_slot_queue(service_record *sr) -> decltype(sr->start_slot_queue_node) &
+{
+    return sr->start_slot_queue_node;
+}
+
 /*
  * A service_set, as the name suggests, manages a set of services.
  *
@@ -769,13 +999,49 @@ class service_set
     protected:
     int active_services;
     std::list<service_record *> records;
+
+    // Index of records by service name, mapping each name to the position of its record within
+    // 'records'. Kept in sync by add_service(), remove_service() and replace_service().
+    std::unordered_map<std::string, std::list<service_record *>::iterator> records_by_name;
+
+    // Index of records by service id, mapping each id to the position of its record within
+    // 'records' (so that a listing can resume after a given service without scanning from the
+    // start). Kept in sync by add_service() and remove_service().
+    std::map<uint32_t, std::list<service_record *>::iterator> records_by_id;
+
+    // Identifier to be assigned to the next service added (ids of services in 'records' are in
+    // increasing order):
+    uint32_t next_service_id = 1;
     bool restart_enabled; // whether automatic restart is enabled (allowed)
     
     shutdown_type_t shutdown_type = shutdown_type_t::NONE;  // Shutdown type, if stopping
     
+    // Listeners for events on all services in the set
+    std::vector<service_set_listener *> set_listeners;
+
+    // Status page to which service status is published (may be null)
+    status_page *status_pg = nullptr;
+
+    // History of service start durations (may be null)
+    start_history *start_hist = nullptr;
+
+    // Record of service state transitions, and the time (monotonic clock) at which recording began
+    service_timeline timeline;
+    time_val timeline_origin;
+
     // Services waiting for exclusive access to the console
     dlist<service_record, extract_console_queue> console_queue;
 
+    // Limit on the number of services which may hold a start slot at once (0 = no limit), the
+    // number of slots currently held, and services waiting for a slot (highest priority first)
+    unsigned start_slot_limit = 0;
+    unsigned start_slots_held = 0;
+    dlist<service_record, extract_start_slot_queue> start_slot_queue;
+    bool start_slot_queue_ordered = true;  // whether queue is in priority order (see below)
+
+    // Compute the priority of each service in the start slot queue, and put the queue in order.
+    void order_start_slot_queue() noexcept;
+
     // Propagation and start/stop "queues" - list of services waiting for processing
     slist<service_record, extract_prop_queue> prop_queue;
     slist<service_record, extract_stop_queue> stop_queue;
@@ -785,6 +1051,7 @@ class service_set
     {
         active_services = 0;
         restart_enabled = true;
+        event_loop.get_time(timeline_origin, clock_type::MONOTONIC);
     }
     
     virtual ~service_set()
@@ -848,20 +1115,150 @@ class service_set
         service_set::start_service(record);
     }
     
+    // Add a service record to the set. May throw std::bad_alloc.
     void add_service(service_record *svc)
     {
-        records.push_back(svc);
+        auto i = records.insert(records.end(), svc);
+        try {
+            auto j = records_by_id.emplace_hint(records_by_id.end(), next_service_id, i);
+            try {
+                records_by_name.emplace(svc->get_name(), i);
+            }
+            catch (...) {
+                records_by_id.erase(j);
+                throw;
+            }
+        }
+        catch (...) {
+            records.erase(i);
+            throw;
+        }
+        svc->set_id(next_service_id++);
+        if (status_pg != nullptr) {
+            svc->status_slot = status_pg->allocate_slot();
+            svc->status_changed();
+        }
     }
-    
-    void remove_service(service_record *svc)
+
+    // Remove a service record from the set (the record is not deleted).
+    void remove_service(service_record *svc) noexcept
     {
-        records.erase(std::find(records.begin(), records.end(), svc));
+        if (svc->status_slot != status_page::no_slot) {
+            status_pg->release_slot(svc->status_slot);
+            svc->status_slot = status_page::no_slot;
+        }
+        auto i = records_by_id.find(svc->get_id());
+        auto n = records_by_name.find(svc->get_name());
+        if (n != records_by_name.end() && n->second == i->second) {
+            records_by_name.erase(n);
+        }
+        records.erase(i->second);
+        records_by_id.erase(i);
+    }
+
+    // Replace a service record with another of the same name (the original is not deleted).
+    void replace_service(service_record *orig, service_record *replacement) noexcept
+    {
+        replacement->set_id(orig->get_id());
+        replacement->status_slot = orig->status_slot;
+        orig->status_slot = status_page::no_slot;
+        replacement->status_changed();
+        // (the position of the record in 'records' is unchanged, so the indexes remain valid)
+        *(records_by_id.find(orig->get_id())->second) = replacement;
+    }
+
+    // Add a listener for events on all services. A listener must only be added once. May throw
+    // std::bad_alloc.
+    void add_set_listener(service_set_listener *listener)
+    {
+        set_listeners.push_back(listener);
     }
 
-    void replace_service(service_record *orig, service_record *replacement)
+    // Remove a listener for events on all services.
+    void remove_set_listener(service_set_listener *listener) noexcept
     {
-        auto i = std::find(records.begin(), records.end(), orig);
-        *i = replacement;
+        auto i = std::find(set_listeners.begin(), set_listeners.end(), listener);
+        if (i != set_listeners.end()) {
+            set_listeners.erase(i);
+        }
+    }
+
+    // Notify the listeners for all services of an event on a particular service.
+    void notify_set_listeners(service_record *service, service_event_t event) noexcept
+    {
+        for (auto l : set_listeners) {
+            l->service_set_event(service, event);
+        }
+    }
+
+    // Set the start duration history, in which the duration of each service start is recorded.
+    void set_start_history(start_history *history) noexcept
+    {
+        start_hist = history;
+    }
+
+    start_history *get_start_history() noexcept
+    {
+        return start_hist;
+    }
+
+    // Record the duration of a start of a service (in the start history, if there is one).
+    void record_start_duration(service_record *svc, time_val duration) noexcept
+    {
+        if (start_hist != nullptr) {
+            uint64_t millis = duration.seconds() * 1000 + duration.nseconds() / 1000000;
+            start_hist->record(svc->get_name(), std::min(millis, (uint64_t)UINT32_MAX));
+        }
+    }
+
+    // Get the expected duration of a start of a service, in milliseconds (0 if unknown).
+    uint32_t get_expected_start_duration(service_record *svc) noexcept
+    {
+        return (start_hist != nullptr) ? start_hist->get_expected(svc->get_name()) : 0;
+    }
+
+    // Set the status page to which service status is published (or nullptr for none). The status
+    // of all services is published immediately.
+    void set_status_page(status_page *page) noexcept
+    {
+        for (auto *svc : records) {
+            svc->status_slot = status_page::no_slot;
+        }
+        status_pg = page;
+        if (page != nullptr) {
+            for (auto *svc : records) {
+                svc->status_slot = page->allocate_slot();
+                svc->status_changed();
+            }
+        }
+    }
+
+    // Publish the status of a service to the status page.
+    void update_status_page(service_record *svc) noexcept
+    {
+        if (svc->status_slot != status_page::no_slot) {
+            status_pg->update(svc->status_slot, svc);
+        }
+    }
+
+    // Record an event for a service in the service timeline.
+    void record_timeline(service_record *svc, timeline_event_t event, uint32_t related_id = 0,
+            uint8_t detail = 0) noexcept
+    {
+        time_val now;
+        event_loop.get_time(now, clock_type::MONOTONIC);
+        timeline.record(now.seconds(), now.nseconds(), svc->get_id(), event, related_id, detail);
+    }
+
+    const service_timeline &get_timeline() noexcept
+    {
+        return timeline;
+    }
+
+    // Get the time (monotonic clock) at which recording of the service timeline began.
+    time_val get_timeline_origin() noexcept
+    {
+        return timeline_origin;
     }
 
     // Get the list of all loaded services.
@@ -869,6 +1266,18 @@ class service_set
     {
         return records;
     }
+
+    // Get the position, in the list of all loaded services (list_services()), of the first service
+    // with an identifier greater than the given identifier. (Services are listed in order of
+    // identifier).
+    std::list<service_record *>::const_iterator list_services_after(uint32_t id) noexcept
+    {
+        auto i = records_by_id.upper_bound(id);
+        if (i == records_by_id.end()) {
+            return records.end();
+        }
+        return i->second;
+    }
     
     // Add a service record to the state propagation queue. The service record will have its
     // do_propagation() method called when the queue is processed.
@@ -888,19 +1297,22 @@ class service_set
         }
     }
     
-    // Process state propagation and start/stop queues, until they are empty.
+    // Process state propagation and start/stop queues, until they are empty. Start slots released
+    // meanwhile are then dispatched to waiting services (which may queue further propagation).
     void process_queues() noexcept
     {
-        while (! stop_queue.is_empty() || ! prop_queue.is_empty()) {
-            while (! prop_queue.is_empty()) {
-                auto next = prop_queue.pop_front();
-                next->do_propagation();
-            }
-            if (! stop_queue.is_empty()) {
-                auto next = stop_queue.pop_front();
-                next->execute_transition();
+        do {
+            while (! stop_queue.is_empty() || ! prop_queue.is_empty()) {
+                while (! prop_queue.is_empty()) {
+                    auto next = prop_queue.pop_front();
+                    next->do_propagation();
+                }
+                if (! stop_queue.is_empty()) {
+                    auto next = stop_queue.pop_front();
+                    next->execute_transition();
+                }
             }
-        }
+        } while (pull_start_slot_queue());
     }
     
     // Set the console queue tail (returns previous tail)
@@ -949,6 +1361,79 @@ class service_set
         return console_queue.is_queued(service);
     }
 
+    // Set the limit on the number of services which may be starting a process (i.e. which hold a
+    // start slot) at once; 0 for no limit. A service requires a start slot once its dependencies
+    // have started, and holds it until it has started (or stopped).
+    void set_start_slot_limit(unsigned limit) noexcept
+    {
+        start_slot_limit = limit;
+        pull_start_slot_queue();
+    }
+
+    unsigned get_start_slot_limit() noexcept
+    {
+        return start_slot_limit;
+    }
+
+    // Try to acquire a start slot. Returns false if no slot is available, in which case the
+    // service should queue for a slot (service_record::queue_for_start_slot()).
+    bool try_acquire_start_slot() noexcept
+    {
+        if (start_slot_limit != 0 && start_slots_held >= start_slot_limit) {
+            return false;
+        }
+        ++start_slots_held;
+        return true;
+    }
+
+    // Queue a service to receive a start slot. Slots are given in order of priority: services
+    // with the longest critical path (see service_record::get_critical_path_length()) first.
+    // Priorities are computed, for all waiting services at once, only when a slot is to be given
+    // out (since they require a traversal of the dependents graph).
+    void append_start_slot_queue(service_record *service) noexcept
+    {
+        start_slot_queue.append(service);
+        start_slot_queue_ordered = false;
+    }
+
+    // Release a start slot. It is dispatched to a waiting service (if there is one) when the queues
+    // are next processed, rather than immediately, since the releasing service may be part-way
+    // through a state transition.
+    void release_start_slot() noexcept
+    {
+        --start_slots_held;
+    }
+
+    // Dispatch start slots (as available) to waiting services. Returns true if any were dispatched.
+    bool pull_start_slot_queue() noexcept
+    {
+        bool dispatched = false;
+        while (! start_slot_queue.is_empty()
+                && (start_slot_limit == 0 || start_slots_held < start_slot_limit)) {
+            if (! start_slot_queue_ordered) {
+                order_start_slot_queue();
+            }
+            service_record *front = start_slot_queue.pop_front();
+            ++start_slots_held;
+            front->acquired_start_slot();
+            dispatched = true;
+        }
+        return dispatched;
+    }
+
+    void unqueue_start_slot(service_record *service) noexcept
+    {
+        if (start_slot_queue.is_queued(service)) {
+            start_slot_queue.unlink(service);
+        }
+    }
+
+    // Get the number of start slots currently held
+    unsigned get_start_slots_held() noexcept
+    {
+        return start_slots_held;
+    }
+
     // Notification from service that it is active (state != STOPPED)
     // Only to be called on the transition from inactive to active.
     void service_active(service_record *) noexcept;
@@ -993,11 +1478,31 @@ class service_set
     }
 };
 
+inline void service_record::notify_listeners(service_event_t event) noexcept
+{
+    for (auto l : listeners) {
+        l->service_event(this, event);
+    }
+    services->notify_set_listeners(this, event);
+}
+
+inline void service_record::status_changed() noexcept
+{
+    services->update_status_page(this);
+}
+
 // A service set which loads services from one of several service directories.
 class dirload_service_set : public service_set
 {
     service_dir_pathlist service_dirs;
 
+    // Cache of pre-parsed service descriptions (may be null)
+    const service_cache *svc_cache = nullptr;
+
+    // Snapshots of the contents of dependency directories (waits-for.d), by path. Along with the
+    // snapshots of the service directories themselves, these are kept until explicitly invalidated.
+    std::unordered_map<std::string, std::vector<std::string>> dep_dir_listings;
+
     // Implementation of service load/reload.
     // Find a service record, or load it from file. If the service has dependencies, load those also.
     //
@@ -1045,6 +1550,33 @@ class dirload_service_set : public service_set
         return service_dirs[n].get_dir();
     }
 
+    const service_dir_pathlist &get_service_dirs() noexcept
+    {
+        return service_dirs;
+    }
+
+    // Set the cache of service descriptions to use when loading services (null for none). Cached
+    // descriptions are used only if they are current.
+    void set_service_cache(const service_cache *cache) noexcept
+    {
+        svc_cache = cache;
+    }
+
+    // Get the (sorted) names in a dependency directory, reading the directory only if it has not
+    // been read since directory listings were last invalidated. Returns null, with errno set, if the
+    // directory cannot be read. May throw std::bad_alloc.
+    const std::vector<std::string> *get_dep_dir_listing(const std::string &path);
+
+    // Discard the snapshots of service and dependency directory contents, so that they are read
+    // again when next needed (i.e. changes in the directories will be seen).
+    void invalidate_dir_listings() noexcept
+    {
+        for (auto &service_dir : service_dirs) {
+            service_dir.clear_listing();
+        }
+        dep_dir_listings.clear();
+    }
+
     service_record *load_service(const char *name) override
     {
         return load_service(name, nullptr);
@@ -1052,6 +1584,12 @@ class dirload_service_set : public service_set
 
     service_record *load_service(const char *name, const service_record *avoid_circular);
 
+    // Load all services described in the service directories, in a single pass. Failure to load a
+    // service (or one of its dependencies) does not prevent loading the others; each failure is
+    // recorded in 'errors' as a (service name, description) pair. Returns the number of services
+    // which are loaded (including any that were loaded already). May throw std::bad_alloc.
+    unsigned preload_services(std::list<std::pair<std::string, std::string>> &errors);
+
     service_record *reload_service(service_record *service) override;
 
     int get_set_type_id() override
@@ -1060,4 +1598,15 @@ class dirload_service_set : public service_set
     }
 };
 
+// Discard the snapshots of service directory contents held by a service set (if it loads services
+// from directories), so that changes made since they were taken are seen. Snapshots are not
+// refreshed when a lookup misses, so this must be done before loading a service which may have been
+// added since (and wherever a dependency directory may have been altered).
+inline void invalidate_dir_listings(service_set *services) noexcept
+{
+    if (services->get_set_type_id() == SSET_TYPE_DIRLOAD) {
+        static_cast<dirload_service_set *>(services)->invalidate_dir_listings();
+    }
+}
+
 #endif
@@ -15,6 +15,7 @@
 #include <dirent.h>
 
 #include "proc-service.h"
+#include "service-cache.h"
 #include "dinit-log.h"
 #include "dinit-util.h"
 #include "dinit-utmp.h"
@@ -49,20 +50,17 @@ static void process_dep_dir(dirload_service_set &sset,
 {
     std::string depdir_fname = combine_paths(parent_path(service_filename), depdirpath.c_str());
 
-    DIR *depdir = opendir(depdir_fname.c_str());
-    if (depdir == nullptr) {
-        log(loglevel_t::WARN, "Could not open dependency directory '", depdir_fname,
-                "' for ", servicename, " service.");
+    const std::vector<std::string> *listing = sset.get_dep_dir_listing(depdir_fname);
+    if (listing == nullptr) {
+        log(loglevel_t::WARN, "Could not read dependency directory '", depdir_fname,
+                "' for ", servicename, " service: ", strerror(errno));
         return;
     }
 
-    errno = 0;
-    dirent * dent = readdir(depdir);
-    while (dent != nullptr) {
-        char * name =  dent->d_name;
+    for (auto &name : *listing) {
         if (name[0] != '.') {
             try {
-                service_record * sr = sset.load_service(name);
+                service_record * sr = sset.load_service(name.c_str());
                 deplist.emplace_back(sr, dep_type);
             }
             catch (service_not_found &) {
@@ -71,15 +69,25 @@ static void process_dep_dir(dirload_service_set &sset,
                         "' for ", servicename, " service.");
             }
         }
-        dent = readdir(depdir);
     }
+}
 
-    if (errno != 0) {
-        log(loglevel_t::WARN, "Error reading dependency directory '", depdirpath,
-                "' for ", servicename, " service.");
+const std::vector<std::string> *dirload_service_set::get_dep_dir_listing(const std::string &path)
+{
+    auto i = dep_dir_listings.find(path);
+    if (i != dep_dir_listings.end()) {
+        return &i->second;
+    }
+
+    std::vector<std::string> names;
+    if (!read_dir_listing(path.c_str(), names)) {
+        if (errno == ENOMEM) {
+            throw std::bad_alloc();
+        }
+        return nullptr;
     }
 
-    closedir(depdir);
+    return &dep_dir_listings.emplace(path, std::move(names)).first->second;
 }
 
 service_record * dirload_service_set::load_service(const char * name, const service_record *avoid_circular)
@@ -89,15 +97,65 @@ service_record * dirload_service_set::load_service(const char * name, const serv
 
 service_record * dirload_service_set::reload_service(service_record * service)
 {
+    // The service description or its dependency directories may have changed, as may other
+    // services that it (newly) depends on:
+    invalidate_dir_listings();
     return load_reload_service(service->get_name().c_str(), service, service);
 }
 
+unsigned dirload_service_set::preload_services(std::list<std::pair<std::string, std::string>> &errors)
+{
+    std::unordered_set<std::string> seen_names;
+    std::unordered_set<std::string> failed_names;
+    unsigned loaded = 0;
+
+    auto record_error = [&](const std::string &service_name, const std::string &description) {
+        // A service which fails to load may be a dependency of several others; report it only once.
+        if (failed_names.insert(service_name).second) {
+            errors.emplace_back(service_name, description);
+        }
+    };
+
+    // Services or dependency directories may have been added since they were last read:
+    invalidate_dir_listings();
+
+    for (auto &service_dir : service_dirs) {
+        service_dir.take_listing();
+        for (auto &name : service_dir.get_listing()) {
+            if (name[0] == '.' || !seen_names.insert(name).second) {
+                continue;
+            }
+
+            // Skip anything which is not a regular file, and executable files: helper scripts are
+            // commonly kept alongside service descriptions.
+            struct stat st;
+            string path = combine_paths(service_dir.get_dir(), name.c_str());
+            if (stat(path.c_str(), &st) == -1 || !S_ISREG(st.st_mode)
+                    || (st.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH)) != 0) {
+                continue;
+            }
+
+            try {
+                load_service(name.c_str());
+                ++loaded;
+            }
+            catch (service_not_found &snf) {
+                record_error(snf.service_name, "could not find service description.");
+            }
+            catch (service_load_exc &sle) {
+                record_error(sle.service_name, sle.exc_description);
+            }
+        }
+    }
+
+    return loaded;
+}
+
 // Update the dependencies of the specified service atomically. May fail with bad_alloc.
 static void update_depenencies(service_record *service,
         dinit_load::service_settings_wrapper<prelim_dep> &settings)
 {
-    std::list<service_dep> &deps = service->get_dependencies();
-    auto first_preexisting = deps.begin();
+    auto &deps = service->get_dependencies();
 
     // build a set of services currently issuing acquisition
     std::unordered_set<service_record *> deps_with_acqs;
@@ -107,16 +165,19 @@ static void update_depenencies(service_record *service,
         }
     }
 
+    // Insert all the new dependencies before the first pre-existing dependency
+    deps.reserve(deps.size() + settings.depends.size());
+    size_t num_new = 0;
     try {
-        // Insert all the new dependencies before the first pre-existing dependency
         for (auto &new_dep : settings.depends) {
             bool has_acq = deps_with_acqs.count(new_dep.to);
-            service->add_dep(new_dep.to, new_dep.dep_type, first_preexisting, has_acq);
+            service->add_dep(new_dep.to, new_dep.dep_type, deps.begin() + num_new, has_acq);
+            ++num_new;
         }
     }
     catch (...) {
         // remove the inserted dependencies
-        for (auto i = deps.begin(); i != first_preexisting; ++i) {
+        for (auto i = deps.begin(); num_new > 0; --num_new) {
             i = service->rm_dep(i);
         }
 
@@ -125,8 +186,8 @@ static void update_depenencies(service_record *service,
     }
 
     // Now remove all pre-existing dependencies (no exceptions possible from here).
-    for( ; first_preexisting != deps.end(); ) {
-        first_preexisting = service->rm_dep(first_preexisting);
+    for (auto i = deps.begin() + num_new; i != deps.end(); ) {
+        i = service->rm_dep(i);
     }
 }
 
@@ -225,8 +286,17 @@ service_record * dirload_service_set::load_reload_service(const char *name, serv
     int fail_load_errno = 0;
     std::string fail_load_path;
 
-    // Couldn't find one. Have to load it.
+    // Couldn't find one. Have to load it. Directories whose contents snapshot shows that they don't
+    // contain the service are skipped (avoiding a failed open() for each). Snapshots are not
+    // refreshed if the service isn't found; they must be invalidated (invalidate_dir_listings())
+    // when services may have been added.
     for (auto &service_dir : service_dirs) {
+        if (!service_dir.has_listing()) {
+            service_dir.take_listing();
+        }
+
+        if (!service_dir.may_contain(name)) continue;
+
         service_filename = service_dir.get_dir();
         if (*(service_filename.rbegin()) != '/') {
             service_filename += '/';
@@ -242,7 +312,7 @@ service_record * dirload_service_set::load_reload_service(const char *name, serv
         }
     }
 
-    if (!service_file) {
+    if (!service_file.is_open()) {
         if (fail_load_errno == 0) {
             throw service_not_found(string(name));
         }
@@ -253,6 +323,24 @@ service_record * dirload_service_set::load_reload_service(const char *name, serv
 
     service_settings_wrapper<prelim_dep> settings;
 
+    // If there is a current cache record for the service, use it rather than parsing the service
+    // description. (When explicitly reloading, we always re-read the description).
+    bool use_cache = false;
+    std::list<cached_dep> cached_deps;
+    cache_reader cache_r;
+    if (svc_cache != nullptr && reload_svc == nullptr
+            && svc_cache->lookup(name, service_filename, cache_r)) {
+        use_cache = read_cached_settings(cache_r, settings, cached_deps);
+        if (use_cache) {
+            service_file.close();
+        }
+        else {
+            log(loglevel_t::WARN, "Ignoring malformed cache record for service: ", name);
+            settings = service_settings_wrapper<prelim_dep>();
+            cached_deps.clear();
+        }
+    }
+
     string line;
     // getline can set failbit if it reaches end-of-file, we don't want an exception in that case. There's
     // no good way to handle an I/O error however, so we'll have exceptions thrown on badbit:
@@ -268,22 +356,36 @@ service_record * dirload_service_set::load_reload_service(const char *name, serv
             add_service(dummy);
         }
 
-        process_service_file(name, service_file,
-                [&](string &line, string &setting, string_iterator &i, string_iterator &end) -> void {
+        if (use_cache) {
+            for (auto &cdep : cached_deps) {
+                if (cdep.is_dir) {
+                    process_dep_dir(*this, name, service_filename, settings.depends, cdep.name,
+                            cdep.dep_type, reload_svc);
+                }
+                else {
+                    settings.depends.emplace_back(load_service(cdep.name.c_str(), reload_svc),
+                            cdep.dep_type);
+                }
+            }
+        }
+        else {
+            process_service_file(name, service_file,
+                    [&](string &line, string &setting, string_iterator &i, string_iterator &end) -> void {
 
-            auto process_dep_dir_n = [&](std::list<prelim_dep> &deplist, const std::string &waitsford,
-                    dependency_type dep_type) -> void {
-                process_dep_dir(*this, name, service_filename, deplist, waitsford, dep_type, reload_svc);
-            };
+                auto process_dep_dir_n = [&](std::list<prelim_dep> &deplist, const std::string &waitsford,
+                        dependency_type dep_type) -> void {
+                    process_dep_dir(*this, name, service_filename, deplist, waitsford, dep_type, reload_svc);
+                };
 
-            auto load_service_n = [&](const string &dep_name) -> service_record * {
-                return load_service(dep_name.c_str(), reload_svc);
-            };
+                auto load_service_n = [&](const string &dep_name) -> service_record * {
+                    return load_service(dep_name.c_str(), reload_svc);
+                };
 
-            process_service_line(settings, name, line, setting, i, end, load_service_n, process_dep_dir_n);
-        });
+                process_service_line(settings, name, line, setting, i, end, load_service_n, process_dep_dir_n);
+            });
 
-        service_file.close();
+            service_file.close();
+        }
 
         auto report_err = [&](const char *msg){
             throw service_description_exc(name, msg);
@@ -482,8 +584,7 @@ service_record * dirload_service_set::load_reload_service(const char *name, serv
         }
 
         if (dummy != nullptr) {
-            auto iter = std::find(records.begin(), records.end(), dummy);
-            *iter = rval;
+            replace_service(dummy, rval);
             delete dummy;
         }
 
@@ -493,7 +594,7 @@ service_record * dirload_service_set::load_reload_service(const char *name, serv
     {
         // Must remove the dummy service record.
         if (dummy != nullptr) {
-            records.erase(std::find(records.begin(), records.end(), dummy));
+            remove_service(dummy);
             delete dummy;
         }
         if (create_new_record) delete rval;
@@ -502,7 +603,7 @@ service_record * dirload_service_set::load_reload_service(const char *name, serv
     catch (std::system_error &sys_err)
     {
         if (dummy != nullptr) {
-            records.erase(std::find(records.begin(), records.end(), dummy));
+            remove_service(dummy);
             delete dummy;
         }
         if (create_new_record) delete rval;
@@ -511,7 +612,7 @@ service_record * dirload_service_set::load_reload_service(const char *name, serv
     catch (...) // (should only be std::bad_alloc / service_description_exc)
     {
         if (dummy != nullptr) {
-            records.erase(std::find(records.begin(), records.end(), dummy));
+            remove_service(dummy);
             delete dummy;
         }
         if (create_new_record) delete rval;
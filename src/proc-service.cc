@@ -82,9 +82,9 @@ rearm exec_status_pipe_watcher::fd_event(eventloop_t &loop, int fd, int flags) n
     sr->waiting_for_execstat = false;
 
     run_proc_err exec_status;
-    int r = read(get_watched_fd(), &exec_status, sizeof(exec_status));
+    int r = bp_sys::read(fd, &exec_status, sizeof(exec_status));
     deregister(loop);
-    close(get_watched_fd());
+    bp_sys::close(fd);
 
     if (r > 0) {
         // We read an errno code; exec() failed, and the service startup failed.
@@ -97,9 +97,12 @@ rearm exec_status_pipe_watcher::fd_event(eventloop_t &loop, int fd, int flags) n
             }
         }
         sr->pid = -1;
+        sr->exec_err_info = exec_status;
+        sr->have_exec_err = true;
         sr->exec_failed(exec_status);
     }
     else {
+        sr->services->record_timeline(sr, timeline_event_t::EXEC_SUCCEEDED);
         sr->exec_succeeded();
 
         if (sr->pid == -1) {
@@ -157,6 +160,7 @@ dasynq::rearm service_child_watcher::status_change(eventloop_t &loop, pid_t chil
 
     sr->pid = -1;
     sr->exit_status = bp_sys::exit_status(status);
+    sr->status_changed();
 
     // Ok, for a process service, any process death which we didn't rig ourselves is a bit... unexpected.
     // Probably, the child died because we asked it to (sr->service_state == STOPPING). But even if we
@@ -12,6 +12,9 @@
 
 #include "service.h"
 #include "proc-service.h"
+#include "env-file.h"
+
+extern char **environ;
 
 // Move an fd, if necessary, to another fd. The destination fd must be available (not open).
 // if fd is specified as -1, returns -1 immediately. Returns 0 on success.
@@ -55,6 +58,7 @@ void base_process_service::run_child_proc(run_proc_params params) noexcept
     uid_t uid = params.uid;
     gid_t gid = params.gid;
     const std::vector<service_rlimits> &rlimits = params.rlimits;
+    std::vector<const char *> &envp = *params.envp;
 
     // If the console already has a session leader, presumably it is us. On the other hand
     // if it has no session leader, and we don't create one, then control inputs such as
@@ -67,6 +71,9 @@ void base_process_service::run_child_proc(run_proc_params params) noexcept
     sigset_t sigall_set;
     sigfillset(&sigall_set);
     sigprocmask(SIG_SETMASK, &sigall_set, &sigwait_set);
+    if (params.signal_mask != nullptr) {
+        sigwait_set = *params.signal_mask;
+    }
     sigdelset(&sigwait_set, SIGCHLD);
     sigdelset(&sigwait_set, SIGINT);
     sigdelset(&sigwait_set, SIGTERM);
@@ -132,32 +139,15 @@ void base_process_service::run_child_proc(run_proc_params params) noexcept
         if (notify_fd == -1) goto failure_out;
     }
 
-    err.stage = exec_stage::READ_ENV_FILE;
-
-    // Read environment from file
-    if (params.env_file != nullptr) {
-        try {
-            read_env_file(params.env_file);
-        }
-        catch (std::system_error &sys_err) {
-            errno = sys_err.code().value();
-        }
-        catch (std::bad_alloc &alloc_err) {
-            errno = ENOMEM; goto failure_out;
-        }
-    }
+    // Note that the environment (including the contents of the environment file, if any) has been
+    // prepared by the parent, with spare slots for the variables that we set below; we must not
+    // allocate here.
 
     // Set up notify-fd variable:
     if (notify_var != nullptr && *notify_var != 0) {
         err.stage = exec_stage::SET_NOTIFYFD_VAR;
-        // We need to do an allocation: the variable name length, '=', and space for the value,
-        // and nul terminator:
-        int notify_var_len = strlen(notify_var);
-        int req_sz = notify_var_len + ((CHAR_BIT * sizeof(int) - 1 + 2) / 3) + 1;
-        char * var_str = (char *) malloc(req_sz);
-        if (var_str == nullptr) goto failure_out;
-        snprintf(var_str, req_sz, "%s=%d", notify_var, notify_fd);
-        if (putenv(var_str)) goto failure_out;
+        snprintf(params.notify_var_buf, params.notify_var_bufsz, "%s=%d", notify_var, notify_fd);
+        if (!set_child_env_var(envp, params.notify_var_buf)) goto failure_out;
     }
 
     // Set up Systemd-style socket activation:
@@ -168,15 +158,15 @@ void base_process_service::run_child_proc(run_proc_params params) noexcept
         if (dup2(socket_fd, 3) == -1) goto failure_out;
         if (socket_fd != 3) close(socket_fd);
 
-        if (putenv(const_cast<char *>("LISTEN_FDS=1"))) goto failure_out;
+        if (!set_child_env_var(envp, "LISTEN_FDS=1")) goto failure_out;
         snprintf(nbuf, bufsz, "LISTEN_PID=%jd", static_cast<intmax_t>(getpid()));
-        if (putenv(nbuf)) goto failure_out;
+        if (!set_child_env_var(envp, nbuf)) goto failure_out;
     }
 
     if (csfd != -1) {
         err.stage = exec_stage::SETUP_CONTROL_SOCKET;
         snprintf(csenvbuf, csenvbufsz, "DINIT_CS_FD=%d", csfd);
-        if (putenv(csenvbuf)) goto failure_out;
+        if (!set_child_env_var(envp, csenvbuf)) goto failure_out;
     }
 
     if (working_dir != nullptr && *working_dir != 0) {
@@ -266,6 +256,7 @@ void base_process_service::run_child_proc(run_proc_params params) noexcept
     sigprocmask(SIG_SETMASK, &sigwait_set, nullptr);
 
     err.stage = exec_stage::DO_EXEC;
+    environ = const_cast<char **>(envp.data());
     execvp(args[0], const_cast<char **>(args));
 
     // If we got here, the exec failed:
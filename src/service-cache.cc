@@ -0,0 +1,233 @@
+#include <string>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "service-cache.h"
+
+/*
+ * service-cache.cc - reading and writing the service description cache.
+ * See service-cache.h for details.
+ */
+
+static const char cache_magic[8] = { 'D', 'I', 'N', 'I', 'T', 'S', 'C', '\0' };
+static const uint32_t cache_version = 1;
+static const uint32_t cache_byte_order = 0x01020304;
+
+// The user and group databases; cached user/group ids are only valid if these are unchanged.
+static const char * const passwd_db_path = "/etc/passwd";
+static const char * const group_db_path = "/etc/group";
+
+cached_file_id::cached_file_id(const struct stat &st) noexcept
+{
+    dev = st.st_dev;
+    ino = st.st_ino;
+    #ifdef __APPLE__
+    mtime_sec = st.st_mtimespec.tv_sec;
+    mtime_nsec = st.st_mtimespec.tv_nsec;
+    #else
+    mtime_sec = st.st_mtim.tv_sec;
+    mtime_nsec = st.st_mtim.tv_nsec;
+    #endif
+    size = st.st_size;
+}
+
+// Get the identity of a file; if the file cannot be examined, a zeroed identity is returned.
+static cached_file_id get_file_id(const char *path) noexcept
+{
+    struct stat st;
+    if (stat(path, &st) == -1) {
+        return cached_file_id();
+    }
+    return cached_file_id(st);
+}
+
+// Write the header, identifying the circumstances under which the cache is valid.
+static void write_cache_header(cache_writer &w, uint32_t num_records, const service_dir_pathlist &service_dirs)
+{
+    w.write_bytes(cache_magic, sizeof(cache_magic));
+    w.write_num(cache_version);
+    w.write_num(cache_byte_order);
+    w.write_num(num_records);
+    w.write_num<uint32_t>(service_dirs.size());
+    for (auto &dir : service_dirs) {
+        w.write_str(dir.get_dir(), strlen(dir.get_dir()));
+    }
+    w.write_file_id(get_file_id(passwd_db_path));
+    w.write_file_id(get_file_id(group_db_path));
+}
+
+bool service_cache_builder::add_record(const std::string &name, const std::string &path,
+        const std::vector<char> &settings_data)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) == -1) {
+        return false;
+    }
+
+    cache_writer rec_w;
+    rec_w.write_str(name);
+    rec_w.write_str(path);
+    rec_w.write_file_id(cached_file_id(st));
+    rec_w.write_bytes(settings_data.data(), settings_data.size());
+
+    std::vector<char> &rec = rec_w.get_buffer();
+    records.write_str(rec.data(), rec.size());
+    ++num_records;
+    return true;
+}
+
+bool service_cache_builder::write(const char *path, const service_dir_pathlist &service_dirs)
+{
+    cache_writer header;
+    write_cache_header(header, num_records, service_dirs);
+
+    std::string tmp_path = std::string(path) + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return false;
+    }
+
+    std::vector<char> &hbuf = header.get_buffer();
+    std::vector<char> &rbuf = records.get_buffer();
+    if (::write(fd, hbuf.data(), hbuf.size()) != (ssize_t)hbuf.size()
+            || ::write(fd, rbuf.data(), rbuf.size()) != (ssize_t)rbuf.size()
+            || fsync(fd) == -1) {
+        int write_errno = errno;
+        close(fd);
+        unlink(tmp_path.c_str());
+        errno = write_errno;
+        return false;
+    }
+
+    if (close(fd) == -1 || rename(tmp_path.c_str(), path) == -1) {
+        int write_errno = errno;
+        unlink(tmp_path.c_str());
+        errno = write_errno;
+        return false;
+    }
+
+    return true;
+}
+
+service_cache::~service_cache()
+{
+    if (map_base != nullptr) {
+        munmap(const_cast<char *>(map_base), map_size);
+    }
+}
+
+bool service_cache::open(const char *path, const service_dir_pathlist &service_dirs, std::string &err)
+{
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        err = std::string(path) + ": " + strerror(errno);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        err = std::string(path) + ": " + strerror(errno);
+        close(fd);
+        return false;
+    }
+
+    if (st.st_size == 0) {
+        err = std::string(path) + ": cache file is empty";
+        close(fd);
+        return false;
+    }
+
+    void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        err = std::string(path) + ": " + strerror(errno);
+        return false;
+    }
+
+    map_base = static_cast<const char *>(mapping);
+    map_size = st.st_size;
+
+    // Check the header
+    uint32_t len;
+    bool header_ok = map_size >= sizeof(cache_magic)
+            && memcmp(map_base, cache_magic, sizeof(cache_magic)) == 0;
+    cache_reader r(map_base + (header_ok ? sizeof(cache_magic) : 0), map_base + map_size);
+    header_ok = header_ok && r.read_num<uint32_t>() == cache_version
+            && r.read_num<uint32_t>() == cache_byte_order;
+    if (!header_ok) {
+        err = std::string(path) + ": not a service cache file, or incompatible version";
+        return false;
+    }
+
+    uint32_t num_records = r.read_num<uint32_t>();
+
+    uint32_t num_dirs = r.read_num<uint32_t>();
+    bool dirs_match = (num_dirs == service_dirs.size());
+    for (uint32_t i = 0; i < num_dirs; ++i) {
+        const char *dir = r.read_str(len);
+        if (dirs_match) {
+            const char *sdir = service_dirs[i].get_dir();
+            dirs_match = (strlen(sdir) == len && memcmp(sdir, dir, len) == 0);
+        }
+    }
+    if (!dirs_match) {
+        err = std::string(path) + ": cache was generated for different service directories";
+        return false;
+    }
+
+    if (r.read_file_id() != get_file_id(passwd_db_path) || r.read_file_id() != get_file_id(group_db_path)) {
+        err = std::string(path) + ": user/group database has changed since cache was generated";
+        return false;
+    }
+
+    // Index the records
+    for (uint32_t i = 0; i < num_records && r.is_good(); ++i) {
+        uint32_t rec_len;
+        const char *rec = r.read_str(rec_len);
+        cache_reader rec_r(rec, rec + rec_len);
+        std::string name = rec_r.read_str();
+        if (rec_r.is_good()) {
+            index.emplace(std::move(name), rec_r);
+        }
+    }
+
+    if (!r.is_good() || !r.at_end()) {
+        index.clear();
+        err = std::string(path) + ": cache file is corrupt";
+        return false;
+    }
+
+    return true;
+}
+
+bool service_cache::lookup(const std::string &name, const std::string &path, cache_reader &settings_r)
+        const noexcept
+{
+    auto i = index.find(name);
+    if (i == index.end()) {
+        return false;
+    }
+
+    cache_reader r = i->second;
+    uint32_t path_len;
+    const char *rec_path = r.read_str(path_len);
+    if (path_len != path.length() || memcmp(rec_path, path.data(), path_len) != 0) {
+        return false;
+    }
+
+    cached_file_id rec_id = r.read_file_id();
+    if (!r.is_good() || rec_id != get_file_id(path.c_str())) {
+        return false;
+    }
+
+    settings_r = r;
+    return true;
+}
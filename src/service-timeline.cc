@@ -0,0 +1,40 @@
+#include <new>
+
+#include "service-timeline.h"
+
+/*
+ * service-timeline.cc - recording of service state transitions.
+ * See service-timeline.h for details.
+ */
+
+void service_timeline::record(int64_t secs, uint32_t nsecs, uint32_t service_id,
+        timeline_event_t event, uint32_t related_id, uint8_t detail) noexcept
+{
+    ++total;
+
+    timeline_entry entry;
+    entry.secs = secs;
+    entry.nsecs = nsecs;
+    entry.service_id = service_id;
+    entry.related_id = related_id;
+    entry.event = event;
+    entry.detail = detail;
+
+    if (entries.size() < capacity) {
+        try {
+            if (entries.capacity() == 0) {
+                entries.reserve(capacity);
+            }
+            entries.push_back(entry);
+        }
+        catch (std::bad_alloc &) {
+            // The entry is dropped.
+        }
+        return;
+    }
+
+    if (capacity == 0) return;
+
+    entries[next] = entry;
+    next = (next + 1) % capacity;
+}
@@ -0,0 +1,218 @@
+#include <string>
+#include <vector>
+#include <unordered_set>
+
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "dasynq.h"
+
+#include "dinit.h"
+#include "service.h"
+#include "dinit-log.h"
+#include "service-watch.h"
+
+// Automatic reloading of changed service descriptions. See service-watch.h.
+
+#ifdef __linux__
+
+using rearm = dasynq::rearm;
+
+namespace {
+
+// Time to wait after the last change before reloading, so that a burst of changes (such as from
+// a package upgrade or configuration management run) results in a single reload of each service.
+constexpr timespec reload_delay = { 0, 500000000 };  // 0.5 seconds
+
+class service_dir_watcher : public eventloop_t::fd_watcher_impl<service_dir_watcher>
+{
+    public:
+    rearm fd_event(eventloop_t &loop, int fd, int flags) noexcept;
+};
+
+class reload_timer_t : public eventloop_t::timer_impl<reload_timer_t>
+{
+    public:
+    rearm timer_expiry(eventloop_t &loop, int expiry_count) noexcept;
+};
+
+dirload_service_set *watched_services = nullptr;
+service_dir_watcher dir_watcher;
+reload_timer_t reload_timer;
+
+// Names of files which have been written or replaced since the last reload
+std::unordered_set<std::string> changed_names;
+
+// Whether all loaded services should be reloaded (because change events may have been missed)
+bool reload_all = false;
+
+// Reload a single service, replacing its record if necessary.
+void reload_changed_service(service_record *service) noexcept
+{
+    const std::string &name = service->get_name();
+
+    // If a new record is created for the service, the existing one is deleted; that can't be done
+    // if a control connection holds a handle to it.
+    if (service->has_listeners()) {
+        log(loglevel_t::WARN, "Not reloading changed service ", name,
+                ": service is in use by a control connection.");
+        return;
+    }
+
+    try {
+        service_record *new_service = watched_services->reload_service(service);
+        log(loglevel_t::NOTICE, "Reloaded changed service ", new_service->get_name(), ".");
+        if (new_service != service) {
+            service->prepare_for_unload();
+            watched_services->replace_service(service, new_service);
+            delete service;
+        }
+    }
+    catch (service_load_exc &sle) {
+        log(loglevel_t::ERROR, "Could not reload service ", sle.service_name, ": ", sle.exc_description);
+    }
+    catch (std::bad_alloc &) {
+        log(loglevel_t::ERROR, "Could not reload service ", name, ": out of memory.");
+    }
+}
+
+rearm service_dir_watcher::fd_event(eventloop_t &loop, int fd, int flags) noexcept
+{
+    alignas(struct inotify_event) char buf[4096];
+
+    while (true) {
+        ssize_t r = read(fd, buf, sizeof(buf));
+        if (r <= 0) {
+            if (r == -1 && errno == EINTR) continue;
+            break;
+        }
+
+        for (char *p = buf; p < buf + r; ) {
+            struct inotify_event *ev = reinterpret_cast<struct inotify_event *>(p);
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                reload_all = true;
+            }
+            else if (ev->len != 0 && (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE))
+                    && !(ev->mask & IN_ISDIR)) {
+                try {
+                    changed_names.insert(ev->name);
+                }
+                catch (std::bad_alloc &) {
+                    reload_all = true;
+                }
+            }
+            // (other events, i.e. removal of files, only require directory listings to be refreshed,
+            // which is done before reloading regardless).
+        }
+    }
+
+    // (Re-)start the timer, so that reload happens once changes have ceased:
+    reload_timer.arm_timer_rel(loop, reload_delay);
+    return rearm::REARM;
+}
+
+rearm reload_timer_t::timer_expiry(eventloop_t &loop, int expiry_count) noexcept
+{
+    watched_services->invalidate_dir_listings();
+
+    std::vector<service_record *> to_reload;
+    try {
+        if (reload_all) {
+            for (service_record *service : watched_services->list_services()) {
+                if (!service->is_dummy()) {
+                    to_reload.push_back(service);
+                }
+            }
+        }
+        else {
+            for (auto &name : changed_names) {
+                service_record *service = watched_services->find_service(name);
+                if (service != nullptr && !service->is_dummy()) {
+                    to_reload.push_back(service);
+                }
+            }
+        }
+    }
+    catch (std::bad_alloc &) {
+        log(loglevel_t::ERROR, "Out of memory: could not reload changed services.");
+    }
+
+    changed_names.clear();
+    reload_all = false;
+
+    // Reloading a service cannot remove or replace any other already-loaded service, so the
+    // collected records remain valid.
+    for (service_record *service : to_reload) {
+        reload_changed_service(service);
+    }
+
+    // Propagate any changes to dependencies made by the reloads:
+    watched_services->process_queues();
+
+    return rearm::DISARM;
+}
+
+} // anonymous namespace
+
+bool start_service_dir_watch(dirload_service_set *services) noexcept
+{
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+
+    int watch_errno = ENOENT;
+    int num_watched = 0;
+    for (auto &service_dir : services->get_service_dirs()) {
+        if (inotify_add_watch(fd, service_dir.get_dir(),
+                IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_ONLYDIR) != -1) {
+            ++num_watched;
+        }
+        else {
+            watch_errno = errno;
+        }
+    }
+
+    if (num_watched == 0) {
+        close(fd);
+        errno = watch_errno;
+        return false;
+    }
+
+    try {
+        reload_timer.add_timer(event_loop, clock_type::MONOTONIC);
+        try {
+            dir_watcher.add_watch(event_loop, fd, dasynq::IN_EVENTS);
+        }
+        catch (...) {
+            reload_timer.deregister(event_loop);
+            throw;
+        }
+    }
+    catch (...) {
+        close(fd);
+        errno = ENOMEM;
+        return false;
+    }
+
+    watched_services = services;
+    return true;
+}
+
+#else
+
+bool start_service_dir_watch(dirload_service_set *services) noexcept
+{
+    errno = ENOTSUP;
+    return false;
+}
+
+#endif
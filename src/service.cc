@@ -1,4 +1,5 @@
 #include <cstring>
+#include <algorithm>
 #include <cerrno>
 #include <iterator>
 #include <memory>
@@ -20,23 +21,87 @@
  * See service.h for details.
  */
 
-// Find the requested service by name
-static service_record * find_service(const std::list<service_record *> & records,
-                                    const char *name) noexcept
+// Pool from which service_dep records are allocated. Records are taken in sequence from blocks of
+// dep_block_slots records, so that records created together (as the dependencies of a service
+// are, when it is loaded) are adjacent in memory. Freed records are kept on a free list for re-use;
+// blocks are never released.
+namespace {
+    union dep_slot
+    {
+        dep_slot *next_free;
+        alignas(service_dep) char record[sizeof(service_dep)];
+    };
+
+    constexpr size_t dep_block_slots = 128;
+
+    dep_slot *dep_free_list = nullptr;
+    dep_slot *dep_block = nullptr;
+    size_t dep_block_used = dep_block_slots;
+}
+
+void *service_dep::operator new(std::size_t size)
 {
-    using std::list;
-    list<service_record *>::const_iterator i = records.begin();
-    for ( ; i != records.end(); ++i ) {
-        if (strcmp((*i)->get_name().c_str(), name) == 0) {
-            return *i;
-        }
+    if (dep_free_list != nullptr) {
+        dep_slot *slot = dep_free_list;
+        dep_free_list = slot->next_free;
+        return slot;
     }
-    return nullptr;
+
+    if (dep_block_used == dep_block_slots) {
+        dep_block = new dep_slot[dep_block_slots];
+        dep_block_used = 0;
+    }
+    return &dep_block[dep_block_used++];
+}
+
+void service_dep::operator delete(void *p) noexcept
+{
+    dep_slot *slot = static_cast<dep_slot *>(p);
+    slot->next_free = dep_free_list;
+    dep_free_list = slot;
 }
 
 service_record * service_set::find_service(const std::string &name) noexcept
 {
-    return ::find_service(records, name.c_str());
+    auto i = records_by_name.find(name);
+    if (i == records_by_name.end()) {
+        return nullptr;
+    }
+    return *(i->second);
+}
+
+void service_record::record_state_change(service_state_t new_state) noexcept
+{
+    time_val now;
+    event_loop.get_time(now, clock_type::MONOTONIC);
+    state_durations[static_cast<int>(service_state)] += now - state_entered_time;
+    state_entered_time = now;
+
+    timeline_event_t event;
+    switch (new_state) {
+    case service_state_t::STARTING:
+        event = timeline_event_t::STARTING;
+        break;
+    case service_state_t::STARTED:
+        event = timeline_event_t::STARTED;
+        break;
+    case service_state_t::STOPPING:
+        event = timeline_event_t::STOPPING;
+        break;
+    default:
+        event = timeline_event_t::STOPPED;
+    }
+    services->record_timeline(this, event, 0,
+            new_state == service_state_t::STOPPED ? static_cast<uint8_t>(stop_reason) : 0);
+}
+
+service_record::time_val service_record::get_state_duration(service_state_t state) noexcept
+{
+    time_val r = state_durations[static_cast<int>(state)];
+    if (state == service_state) {
+        r += get_time_in_state();
+    }
+    return r;
 }
 
 // Called when a service has actually stopped; dependents have stopped already, unless this stop
@@ -47,6 +112,9 @@ void service_record::stopped() noexcept
         bp_sys::tcsetpgrp(0, bp_sys::getpgrp());
         release_console();
     }
+    if (have_start_slot) {
+        release_start_slot();
+    }
 
     force_stop = false;
 
@@ -78,10 +146,11 @@ void service_record::stopped() noexcept
         dependency.get_to()->dependent_stopped();
     }
 
-    service_state = service_state_t::STOPPED;
+    set_state(service_state_t::STOPPED);
 
     if (will_restart) {
         // Desired state is "started".
+        restart_count++;
         initiate_start();
     }
     else {
@@ -113,6 +182,10 @@ void service_record::stopped() noexcept
         if ((onstart_flags.always_chain || (did_finish(stop_reason) && get_exit_status() == 0 && ! will_restart))
                 && ! start_on_completion.empty() && ! services->is_shutting_down()) {
             try {
+                // (the chained service may have been added since the service directories were read)
+                if (services->find_service(start_on_completion) == nullptr) {
+                    invalidate_dir_listings(services);
+                }
                 auto chain_to = services->load_service(start_on_completion.c_str());
                 chain_to->start();
             }
@@ -152,7 +225,7 @@ void service_record::release(bool issue_stop) noexcept
                 notify_listeners(service_event_t::STARTCANCELLED);
             }
         }
-        desired_state = service_state_t::STOPPED;
+        set_target_state(service_state_t::STOPPED);
 
         if (pinned_started) return;
 
@@ -204,7 +277,7 @@ void service_record::initiate_start() noexcept
 {
     start_failed = false;
     start_skipped = false;
-    service_state = service_state_t::STARTING;
+    set_state(service_state_t::STARTING);
     waiting_for_deps = true;
 
     if (start_check_dependencies()) {
@@ -265,7 +338,7 @@ void service_record::do_start() noexcept
 {
     bool was_active = service_state != service_state_t::STOPPED;
 
-    desired_state = service_state_t::STARTED;
+    set_target_state(service_state_t::STARTED);
 
     if (pinned_stopped) {
         if (!was_active) {
@@ -355,13 +428,43 @@ bool service_record::check_deps_started() noexcept
 
 void service_record::all_deps_started() noexcept
 {
+    // Record which dependency (if any) we were waiting for: the one which most recently changed
+    // state, if it did so after we began starting.
+    service_record *last_dep = nullptr;
+    for (auto &dep : depends_on) {
+        service_record *to = dep.get_to();
+        if (last_dep == nullptr || last_dep->state_entered_time < to->state_entered_time) {
+            last_dep = to;
+        }
+    }
+    uint32_t last_dep_id = 0;
+    if (last_dep != nullptr && !(last_dep->state_entered_time < state_entered_time)) {
+        last_dep_id = last_dep->get_id();
+    }
+
     if (onstart_flags.starts_on_console && ! have_console) {
+        services->record_timeline(this, timeline_event_t::CONSOLE_WAIT, last_dep_id);
         queue_for_console();
         return;
     }
 
+    if (uses_start_slot() && ! have_start_slot) {
+        if (waiting_for_start_slot) {
+            return;
+        }
+        if (! services->try_acquire_start_slot()) {
+            services->record_timeline(this, timeline_event_t::START_SLOT_WAIT, last_dep_id);
+            queue_for_start_slot();
+            return;
+        }
+        have_start_slot = true;
+    }
+
     waiting_for_deps = false;
 
+    services->record_timeline(this, timeline_event_t::DEPS_STARTED, last_dep_id);
+    event_loop.get_time(bring_up_time, clock_type::MONOTONIC);
+
     if (!bring_up()) {
         failed_to_start();
     }
@@ -385,6 +488,44 @@ void service_record::acquired_console() noexcept
     }
 }
 
+void service_record::acquired_start_slot() noexcept
+{
+    waiting_for_start_slot = false;
+    have_start_slot = true;
+
+    if (service_state != service_state_t::STARTING) {
+        // We got the slot but no longer want it.
+        release_start_slot();
+    }
+    else if (check_deps_started()) {
+        all_deps_started();
+    }
+    else {
+        // We got the slot but can't use it yet.
+        release_start_slot();
+    }
+}
+
+uint64_t service_record::get_critical_path_length(std::unordered_map<service_record *, uint64_t> &lengths)
+{
+    auto i = lengths.find(this);
+    if (i != lengths.end()) {
+        return i->second;
+    }
+
+    uint64_t dependents_length = 0;
+    for (service_dep *dept : dependents) {
+        if (dept->waiting_on) {
+            dependents_length = std::max(dependents_length,
+                    dept->get_from()->get_critical_path_length(lengths));
+        }
+    }
+
+    uint64_t length = std::max(services->get_expected_start_duration(this), 1u) + dependents_length;
+    lengths[this] = length;
+    return length;
+}
+
 void service_record::started() noexcept
 {
     // If we start on console but don't keep it, release it now:
@@ -392,9 +533,16 @@ void service_record::started() noexcept
         bp_sys::tcsetpgrp(0, bp_sys::getpgrp());
         release_console();
     }
+    if (have_start_slot) {
+        release_start_slot();
+    }
+
+    time_val now;
+    event_loop.get_time(now, clock_type::MONOTONIC);
+    services->record_start_duration(this, now - bring_up_time);
 
     log_service_started(get_name());
-    service_state = service_state_t::STARTED;
+    set_state(service_state_t::STARTED);
     notify_listeners(service_event_t::STARTED);
 
     if (onstart_flags.rw_ready) {
@@ -423,6 +571,13 @@ void service_record::failed_to_start(bool depfailed, bool immediate_stop) noexce
         services->unqueue_console(this);
         waiting_for_console = false;
     }
+    if (waiting_for_start_slot) {
+        services->unqueue_start_slot(this);
+        waiting_for_start_slot = false;
+    }
+    if (have_start_slot) {
+        release_start_slot();
+    }
 
     if (start_explicit) {
         start_explicit = false;
@@ -470,7 +625,7 @@ void service_record::failed_to_start(bool depfailed, bool immediate_stop) noexce
 
 void service_record::unrecoverable_stop() noexcept
 {
-    desired_state = service_state_t::STOPPED;
+    set_target_state(service_state_t::STOPPED);
     forced_stop();
 }
 
@@ -512,7 +667,7 @@ void service_record::stop(bool bring_down) noexcept
     if (bring_down || required_by == 0) {
         // Set desired state to STOPPED, this will inhibit automatic restart (and will be
         // propagated to dependents)
-        desired_state = service_state_t::STOPPED;
+        set_target_state(service_state_t::STOPPED);
     }
 
     if (pinned_started) {
@@ -574,9 +729,9 @@ void service_record::do_stop(bool with_restart) noexcept
 
     if (service_state != service_state_t::STARTED) {
         if (service_state == service_state_t::STARTING) {
-            // If waiting for a dependency, or waiting for the console, we can interrupt start. Otherwise,
-            // we need to delegate to can_interrupt_start() (which can be overridden).
-            if (! waiting_for_deps && ! waiting_for_console) {
+            // If waiting for a dependency, the console, or a start slot, we can interrupt start.
+            // Otherwise, we need to delegate to can_interrupt_start() (which can be overridden).
+            if (! waiting_for_deps && ! waiting_for_console && ! waiting_for_start_slot) {
                 if (! can_interrupt_start()) {
                     // Well this is awkward: we're going to have to continue starting. We can stop once
                     // we've reached the started state.
@@ -593,6 +748,10 @@ void service_record::do_stop(bool with_restart) noexcept
                 services->unqueue_console(this);
                 waiting_for_console = false;
             }
+            else if (waiting_for_start_slot) {
+                services->unqueue_start_slot(this);
+                waiting_for_start_slot = false;
+            }
 
             // We must have had desired_state == STARTED.
             notify_listeners(service_event_t::STARTCANCELLED);
@@ -607,7 +766,7 @@ void service_record::do_stop(bool with_restart) noexcept
         }
     }
 
-    service_state = service_state_t::STOPPING;
+    set_state(service_state_t::STOPPING);
     waiting_for_deps = !all_deps_stopped;
     if (all_deps_stopped) {
         services->add_transition_queue(this);
@@ -660,7 +819,7 @@ bool service_record::stop_dependents(bool for_restart) noexcept
                 dep_from->prop_stop = true;
                 if (desired_state == service_state_t::STOPPED) {
                     // if we don't want to restart, don't restart dependent
-                    dep_from->desired_state = service_state_t::STOPPED;
+                    dep_from->set_target_state(service_state_t::STOPPED);
                     if (dep_from->start_explicit) {
                         dep_from->start_explicit = false;
                         dep_from->release(true);
@@ -738,11 +897,55 @@ void service_record::release_console() noexcept
     services->pull_console_queue();
 }
 
+void service_record::queue_for_start_slot() noexcept
+{
+    waiting_for_start_slot = true;
+    services->append_start_slot_queue(this);
+}
+
+void service_record::release_start_slot() noexcept
+{
+    have_start_slot = false;
+    services->release_start_slot();
+}
+
 bool service_record::interrupt_start() noexcept
 {
     return true;
 }
 
+void service_set::order_start_slot_queue() noexcept
+{
+    start_slot_queue_ordered = true;
+
+    try {
+        // The critical path lengths are shared between the queued services, so that the dependents
+        // graph is traversed only once:
+        std::unordered_map<service_record *, uint64_t> lengths;
+        std::vector<service_record *> queued;
+        service_record *first = start_slot_queue.front();
+        service_record *sr = first;
+        do {
+            sr->start_priority = sr->get_critical_path_length(lengths);
+            queued.push_back(sr);
+            sr = sr->start_slot_queue_node.next;
+        } while (sr != first);
+
+        // (Services of equal priority stay in the order in which they were queued)
+        std::stable_sort(queued.begin(), queued.end(),
+                [](service_record *a, service_record *b) {
+                    return a->start_priority > b->start_priority;
+                });
+        for (service_record *sr : queued) {
+            start_slot_queue.unlink(sr);
+            start_slot_queue.append(sr);
+        }
+    }
+    catch (std::bad_alloc &) {
+        // Leave the queue in the order in which services were queued.
+    }
+}
+
 void service_set::service_active(service_record *sr) noexcept
 {
     active_services++;
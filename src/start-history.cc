@@ -0,0 +1,172 @@
+#include <algorithm>
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "start-history.h"
+#include "service-cache.h"
+
+/*
+ * start-history.cc - recording, reading and writing service start durations.
+ * See start-history.h for details.
+ */
+
+static const char history_magic[8] = { 'D', 'I', 'N', 'I', 'T', 'S', 'H', '\0' };
+static const uint32_t history_version = 2;
+static const uint32_t history_byte_order = 0x01020304;
+
+bool start_history::load(const char *path_p, std::string &err)
+{
+    path = path_p;
+    histories.clear();
+
+    int fd = ::open(path_p, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+
+    std::vector<char> data;
+    char buf[4096];
+    ssize_t r;
+    while ((r = ::read(fd, buf, sizeof(buf))) > 0) {
+        data.insert(data.end(), buf, buf + r);
+    }
+    int read_errno = errno;
+    close(fd);
+    if (r == -1) {
+        errno = read_errno;
+        return false;
+    }
+
+    bool header_ok = data.size() >= sizeof(history_magic)
+            && memcmp(data.data(), history_magic, sizeof(history_magic)) == 0;
+    cache_reader rd(data.data() + (header_ok ? sizeof(history_magic) : 0), data.data() + data.size());
+    header_ok = header_ok && rd.read_num<uint32_t>() == history_version
+            && rd.read_num<uint32_t>() == history_byte_order;
+    if (!header_ok) {
+        err = path + ": not a start history file, or incompatible version";
+        errno = 0;
+        return false;
+    }
+
+    // Each service may appear only once, with at most max_durations durations:
+    bool corrupt = false;
+    std::vector<std::string> expired;
+    uint32_t num_records = rd.read_num<uint32_t>();
+    for (uint32_t i = 0; i < num_records && rd.is_good(); ++i) {
+        std::string name = rd.read_str();
+        uint32_t unstarted_boots = rd.read_num<uint32_t>();
+        uint32_t count = rd.read_num<uint32_t>();
+        if (count > max_durations || histories.count(name) != 0) {
+            corrupt = true;
+            break;
+        }
+        service_history &hist = histories[name];
+        for (uint32_t j = 0; j < count; ++j) {
+            hist.durations.push_back(rd.read_num<uint32_t>());
+        }
+        // This is a new boot, in which the service has not (yet) started:
+        hist.unstarted_boots = std::min(unstarted_boots, (uint32_t)max_unstarted_boots) + 1;
+        if (hist.unstarted_boots > max_unstarted_boots) {
+            expired.push_back(name);
+        }
+    }
+
+    if (corrupt || !rd.is_good() || !rd.at_end()) {
+        histories.clear();
+        err = path + ": start history file is corrupt";
+        errno = 0;
+        return false;
+    }
+
+    for (auto &name : expired) {
+        histories.erase(name);
+    }
+    // (The boot counts have changed, and must be saved even if no service starts)
+    dirty = num_records != 0;
+
+    return true;
+}
+
+bool start_history::save()
+{
+    cache_writer w;
+    w.write_bytes(history_magic, sizeof(history_magic));
+    w.write_num(history_version);
+    w.write_num(history_byte_order);
+    w.write_num<uint32_t>(histories.size());
+    for (auto &hist : histories) {
+        w.write_str(hist.first);
+        w.write_num(hist.second.unstarted_boots);
+        w.write_num<uint32_t>(hist.second.durations.size());
+        for (uint32_t d : hist.second.durations) {
+            w.write_num(d);
+        }
+    }
+
+    std::string tmp_path = path + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return false;
+    }
+
+    std::vector<char> &wbuf = w.get_buffer();
+    if (::write(fd, wbuf.data(), wbuf.size()) != (ssize_t)wbuf.size()) {
+        int write_errno = errno;
+        close(fd);
+        unlink(tmp_path.c_str());
+        errno = write_errno;
+        return false;
+    }
+
+    if (close(fd) == -1 || rename(tmp_path.c_str(), path.c_str()) == -1) {
+        int write_errno = errno;
+        unlink(tmp_path.c_str());
+        errno = write_errno;
+        return false;
+    }
+
+    dirty = false;
+    return true;
+}
+
+void start_history::record(const std::string &name, uint32_t millis) noexcept
+{
+    try {
+        service_history &hist = histories[name];
+        if (hist.durations.size() >= max_durations) {
+            hist.durations.erase(hist.durations.begin(),
+                    hist.durations.end() - (max_durations - 1));
+        }
+        hist.durations.push_back(millis);
+        hist.unstarted_boots = 0;
+        if (hist.new_count < max_durations) {
+            ++hist.new_count;
+        }
+        dirty = true;
+    }
+    catch (std::bad_alloc &) {
+        // The duration is not recorded.
+    }
+}
+
+uint32_t start_history::get_expected(const std::string &name) const noexcept
+{
+    auto i = histories.find(name);
+    if (i == histories.end() || i->second.durations.empty()) {
+        return 0;
+    }
+
+    // Find the median (upper median, for an even count) of the most recent durations:
+    uint32_t sorted[max_durations];
+    const std::vector<uint32_t> &durations = i->second.durations;
+    size_t count = std::min(durations.size(), (size_t)max_durations);
+    std::copy(durations.end() - count, durations.end(), sorted);
+    std::sort(sorted, sorted + count);
+    return sorted[count / 2];
+}
@@ -0,0 +1,167 @@
+#include <algorithm>
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "status-page.h"
+#include "service.h"
+
+/*
+ * status-page.cc - maintaining the service status page.
+ * See status-page.h for details.
+ */
+
+// Number of slots for which to allocate space initially
+static const uint32_t initial_slots = 64;
+
+bool status_page::open(const char *path_p, std::string &err)
+{
+    close();
+
+    path = path_p;
+    unlink(path_p);
+    fd = ::open(path_p, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        err = path + ": " + strerror(errno);
+        return false;
+    }
+
+    if (!extend(initial_slots)) {
+        err = path + ": " + strerror(errno);
+        ::close(fd);
+        fd = -1;
+        unlink(path_p);
+        return false;
+    }
+
+    status_page_header *header = reinterpret_cast<status_page_header *>(map_base);
+    header->version = status_page_version;
+    header->header_size = sizeof(status_page_header);
+    header->slot_size = sizeof(status_page_slot);
+    header->dinit_pid = getpid();
+    // (Write the magic last, so that a reader does not see a partially initialised header)
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header->magic, status_page_magic, sizeof(status_page_magic));
+
+    return true;
+}
+
+void status_page::close() noexcept
+{
+    if (map_base != nullptr) {
+        munmap(map_base, map_size);
+        map_base = nullptr;
+        map_size = 0;
+    }
+    if (fd != -1) {
+        ::close(fd);
+        fd = -1;
+        unlink(path.c_str());
+    }
+    num_slots = 0;
+    next_unused_slot = 0;
+    free_slots.clear();
+}
+
+bool status_page::extend(uint32_t min_slots) noexcept
+{
+    uint32_t new_slots = std::max(min_slots, num_slots * 2);
+    size_t new_size = sizeof(status_page_header) + (size_t)new_slots * sizeof(status_page_slot);
+
+    // The file is extended with zero bytes, i.e. the new slots are unused:
+    if (ftruncate(fd, new_size) == -1) {
+        return false;
+    }
+
+    void *mapping = mmap(nullptr, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    if (map_base != nullptr) {
+        munmap(map_base, map_size);
+    }
+    map_base = static_cast<char *>(mapping);
+    map_size = new_size;
+    num_slots = new_slots;
+
+    status_page_header *header = reinterpret_cast<status_page_header *>(map_base);
+    header->num_slots.store(new_slots, std::memory_order_release);
+    return true;
+}
+
+uint32_t status_page::allocate_slot() noexcept
+{
+    if (!free_slots.empty()) {
+        uint32_t slot = free_slots.back();
+        free_slots.pop_back();
+        return slot;
+    }
+
+    if (next_unused_slot == num_slots && !extend(num_slots + 1)) {
+        return no_slot;
+    }
+
+    return next_unused_slot++;
+}
+
+void status_page::release_slot(uint32_t slot) noexcept
+{
+    status_page_slot *s = get_slot(slot);
+    uint32_t seq = s->seq.load(std::memory_order_relaxed);
+    s->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s->rec.service_id = 0;
+    s->seq.store(seq + 2, std::memory_order_release);
+
+    try {
+        free_slots.push_back(slot);
+    }
+    catch (std::bad_alloc &) {
+        // The slot is simply not re-used.
+    }
+}
+
+void status_page::update(uint32_t slot, service_record *service) noexcept
+{
+    status_page_slot *s = get_slot(slot);
+
+    status_page_record rec;
+    memcpy(&rec, &s->rec, sizeof(rec));
+
+    uint8_t state = static_cast<uint8_t>(service->get_state());
+    uint8_t target_state = static_cast<uint8_t>(service->get_target_state());
+    if (rec.service_id != service->get_id() || rec.state != state || rec.target_state != target_state) {
+        time_val now;
+        event_loop.get_time(now, clock_type::SYSTEM);
+        rec.transition_secs = now.seconds();
+        rec.transition_nsecs = now.nseconds();
+    }
+
+    rec.service_id = service->get_id();
+    rec.pid = service->get_pid();
+    rec.exit_status = service->get_exit_status();
+    rec.restart_count = service->get_restart_count();
+    rec.state = state;
+    rec.target_state = target_state;
+    rec.type = static_cast<uint8_t>(service->get_type());
+    rec.flags = (service->is_waiting_for_console() ? 1 : 0) | (service->has_console() ? 2 : 0)
+            | (service->was_start_skipped() ? 4 : 0) | (service->is_marked_active() ? 8 : 0);
+    rec.stop_reason = static_cast<uint8_t>(service->get_stop_reason());
+
+    const std::string &name = service->get_name();
+    rec.name_len = std::min(name.length(), sizeof(rec.name));
+    memcpy(rec.name, name.data(), rec.name_len);
+
+    uint32_t seq = s->seq.load(std::memory_order_relaxed);
+    s->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&s->rec, &rec, sizeof(rec));
+    s->seq.store(seq + 2, std::memory_order_release);
+}
@@ -0,0 +1,464 @@
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <new>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+#include <dirent.h>
+#include <sched.h>
+#include <csignal>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "service.h"
+#include "proc-service.h"
+
+// Micro-benchmarks for performance-sensitive parts of dinit. These are not run as part of
+// "make check"; use "make bench" instead. Each benchmark reports the elapsed wall-clock time.
+
+using bench_clock = std::chrono::steady_clock;
+
+// Count of heap allocations, for benchmarks that report allocations per operation.
+static unsigned long bench_alloc_count = 0;
+
+void *operator new(std::size_t size)
+{
+    ++bench_alloc_count;
+    void *r = malloc(size == 0 ? 1 : size);
+    if (r == nullptr) throw std::bad_alloc();
+    return r;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+static std::string bench_dir;
+
+static double elapsed_ms(bench_clock::time_point start)
+{
+    std::chrono::duration<double, std::milli> d = bench_clock::now() - start;
+    return d.count();
+}
+
+// Create a temporary directory to hold generated service descriptions.
+static void init_bench_dir()
+{
+    char dir_template[] = "/tmp/dinit-bench.XXXXXX";
+    if (mkdtemp(dir_template) == nullptr) {
+        std::cerr << "Couldn't create temporary directory: " << strerror(errno) << std::endl;
+        exit(1);
+    }
+    bench_dir = dir_template;
+}
+
+static void cleanup_bench_dir()
+{
+    std::string cmd = "rm -rf '" + bench_dir + "'";
+    if (system(cmd.c_str()) != 0) {
+        std::cerr << "Couldn't remove " << bench_dir << std::endl;
+    }
+}
+
+static std::string bench_service_name(int n)
+{
+    return "bench-svc-" + std::to_string(n);
+}
+
+// Write a service description file with the given contents.
+static void write_service(const std::string &dir, const std::string &name, const std::string &contents)
+{
+    std::ofstream f(dir + "/" + name);
+    f << contents;
+    assert(f.good());
+}
+
+// Load 10000 independent services via a dirload_service_set. Prior to indexing the service set by
+// name, each load performed a linear lookup over the already-loaded services.
+static void bench_load_10k()
+{
+    const int NUM_SERVICES = 10000;
+
+    for (int i = 0; i < NUM_SERVICES; i++) {
+        write_service(bench_dir, bench_service_name(i), "type = internal\nrestart = no\n");
+    }
+
+    dirload_service_set sset(bench_dir.c_str());
+
+    auto start = bench_clock::now();
+    for (int i = 0; i < NUM_SERVICES; i++) {
+        sset.load_service(bench_service_name(i).c_str());
+    }
+    double load_ms = elapsed_ms(start);
+
+    start = bench_clock::now();
+    for (int i = 0; i < NUM_SERVICES; i++) {
+        service_record *sr = sset.find_service(bench_service_name(i));
+        assert(sr != nullptr);
+        (void)sr;
+    }
+    double find_ms = elapsed_ms(start);
+
+    std::cout << "load " << load_ms << "ms, find " << find_ms << "ms ... ";
+}
+
+// Load services which are all found in the last of several service directories (as for the system
+// service manager, where /etc/dinit.d and /usr/local/lib/dinit.d are searched before /lib/dinit.d).
+static void bench_load_multidir()
+{
+    const int NUM_SERVICES = 5000;
+    const int NUM_DIRS = 3;
+
+    service_dir_pathlist dirs;
+    std::vector<std::string> dir_names;
+    for (int d = 0; d < NUM_DIRS; d++) {
+        dir_names.push_back(bench_dir + "/dir" + std::to_string(d));
+        mkdir(dir_names.back().c_str(), 0755);
+    }
+    for (auto &dir_name : dir_names) {
+        dirs.emplace_back(dir_name.c_str(), false);
+    }
+
+    for (int i = 0; i < NUM_SERVICES; i++) {
+        write_service(dir_names.back(), bench_service_name(i), "type = internal\n");
+    }
+
+    dirload_service_set sset(std::move(dirs));
+
+    auto start = bench_clock::now();
+    for (int i = 0; i < NUM_SERVICES; i++) {
+        sset.load_service(bench_service_name(i).c_str());
+    }
+    double load_ms = elapsed_ms(start);
+
+    std::cout << "load " << load_ms << "ms ... ";
+}
+
+// A dependency as recorded by the parse benchmark (by name only).
+class bench_prelim_dep
+{
+    public:
+    std::string name;
+    dependency_type dep_type;
+
+    bench_prelim_dep(const std::string &name_p, dependency_type dep_type_p)
+        : name(name_p), dep_type(dep_type_p) { }
+};
+
+// Read the example service descriptions (doc/linux/services) into memory. Returns the total number
+// of lines.
+static unsigned long read_corpus(std::vector<std::pair<std::string, std::string>> &corpus)
+{
+    const char *corpus_dir = "../../doc/linux/services";
+    unsigned long corpus_lines = 0;
+
+    DIR *dir = opendir(corpus_dir);
+    assert(dir != nullptr);
+    while (dirent *dent = readdir(dir)) {
+        std::string name = dent->d_name;
+        if (name[0] == '.' || name.find('.') != std::string::npos) continue; // skip scripts (*.sh), boot.d
+        std::ifstream f(std::string(corpus_dir) + "/" + name);
+        std::stringstream ss;
+        ss << f.rdbuf();
+        std::string contents = ss.str();
+        for (char c : contents) {
+            if (c == '\n') ++corpus_lines;
+        }
+        corpus.emplace_back(std::move(name), std::move(contents));
+    }
+    closedir(dir);
+
+    return corpus_lines;
+}
+
+// Run process_service_file over each file in the corpus, repeatedly, with a line-processing function
+// produced by make_func (given the service name and settings). Report time and heap allocations per
+// line of input.
+template <typename F>
+static void bench_corpus_pass(const char *label, std::vector<std::pair<std::string, std::string>> &corpus,
+        unsigned long corpus_lines, F make_func)
+{
+    const int ITERATIONS = 2000;
+
+    unsigned long allocs_before = bench_alloc_count;
+    auto start = bench_clock::now();
+
+    for (int n = 0; n < ITERATIONS; n++) {
+        for (auto &svc : corpus) {
+            std::istringstream svc_file(svc.second);
+            dinit_load::service_settings_wrapper<bench_prelim_dep> settings;
+            process_service_file(svc.first, svc_file, make_func(svc.first.c_str(), settings));
+        }
+    }
+
+    double parse_ms = elapsed_ms(start);
+    unsigned long allocs = bench_alloc_count - allocs_before;
+    double total_lines = (double)corpus_lines * ITERATIONS;
+
+    std::cout << label << " " << (parse_ms * 1000000.0 / total_lines) << "ns/line, "
+            << (allocs / total_lines) << " allocs/line; ";
+}
+
+// Parse the example service descriptions, reporting the cost of tokenizing alone (splitting lines
+// and reading setting names) and of fully processing each setting. Allocations made by the input
+// stream and settings object are included in both.
+static void bench_parse_corpus()
+{
+    using string = std::string;
+    using string_iterator = std::string::iterator;
+    using settings_t = dinit_load::service_settings_wrapper<bench_prelim_dep>;
+
+    std::vector<std::pair<string, string>> corpus;
+    unsigned long corpus_lines = read_corpus(corpus);
+    std::cout << corpus.size() << " files, " << corpus_lines << " lines; ";
+
+    bench_corpus_pass("tokenize", corpus, corpus_lines, [](const char *name, settings_t &settings) {
+        return [](string &line, string &setting, string_iterator &i, string_iterator &end) -> void { };
+    });
+
+    bench_corpus_pass("parse", corpus, corpus_lines, [](const char *name, settings_t &settings) {
+        return [name, &settings](string &line, string &setting, string_iterator &i,
+                string_iterator &end) -> void {
+            auto process_dep_dir_n = [](std::list<bench_prelim_dep> &deplist, const std::string &waitsford,
+                    dependency_type dep_type) -> void { };
+
+            auto load_service_n = [](const string &dep_name) -> const string & {
+                return dep_name;
+            };
+
+            process_service_line(settings, name, line, setting, i, end, load_service_n,
+                    process_dep_dir_n);
+        };
+    });
+
+    std::cout << "... ";
+}
+
+// Parse a large generated service description, using (in rotation) each of the settings that the
+// parser recognises. This mostly measures the per-line overhead of identifying the setting.
+static void bench_parse_large()
+{
+    using string = std::string;
+    using string_iterator = std::string::iterator;
+
+    const int NUM_LINES = 200000;
+    const char * const setting_lines[] = {
+        "command = /bin/true arg", "working-dir = /", "env-file = /dev/null", "socket-listen = /run/x",
+        "socket-permissions = 600", "socket-uid = 0", "socket-gid = 0", "stop-command = /bin/true",
+        "pid-file = /run/x.pid", "depends-on = a", "depends-ms = b", "waits-for = c",
+        "waits-for.d = d", "logfile = /dev/null", "restart = yes", "smooth-recovery = no",
+        "type = process", "options = skippable", "load-options = sub-vars", "term-signal = TERM",
+        "termsignal = INT", "restart-limit-interval = 10", "restart-delay = 1", "restart-limit-count = 3",
+        "stop-timeout = 10", "start-timeout = 10", "run-as = 0", "chain-to = e",
+        "ready-notification = pipefd:3", "inittab-id = 1", "inittab-line = tty1", "rlimit-nofile = 10:20",
+        "rlimit-core = 0", "rlimit-data = -:-", "rlimit-addrspace = 100:"
+    };
+    const int NUM_SETTINGS = sizeof(setting_lines) / sizeof(setting_lines[0]);
+
+    string contents;
+    for (int i = 0; i < NUM_LINES; i++) {
+        contents += setting_lines[i % NUM_SETTINGS];
+        contents += '\n';
+    }
+    write_service(bench_dir, "bench-large", contents);
+
+    dinit_load::service_settings_wrapper<bench_prelim_dep> settings;
+    std::ifstream svc_file(bench_dir + "/bench-large");
+    const char *name = "bench-large";
+
+    auto start = bench_clock::now();
+    process_service_file(name, svc_file,
+            [&](string &line, string &setting, string_iterator &i, string_iterator &end) -> void {
+        auto process_dep_dir_n = [](std::list<bench_prelim_dep> &deplist, const std::string &waitsford,
+                dependency_type dep_type) -> void { };
+
+        auto load_service_n = [](const string &dep_name) -> const string & {
+            return dep_name;
+        };
+
+        process_service_line(settings, name, line, setting, i, end, load_service_n, process_dep_dir_n);
+    });
+    double parse_ms = elapsed_ms(start);
+
+    std::cout << NUM_LINES << " lines, " << (parse_ms * 1000000.0 / NUM_LINES) << "ns/line ... ";
+}
+
+// Compare identification of setting names via dinit_load::lookup_setting_id against a sequence of
+// string comparisons in the order previously used by process_service_line.
+static void bench_setting_dispatch()
+{
+    const char * const setting_names[] = {
+        "command", "working-dir", "env-file", "socket-listen", "socket-permissions", "socket-uid",
+        "socket-gid", "stop-command", "pid-file", "depends-on", "depends-ms", "waits-for",
+        "waits-for.d", "logfile", "restart", "smooth-recovery", "type", "options", "load-options",
+        "term-signal", "termsignal", "restart-limit-interval", "restart-delay", "restart-limit-count",
+        "stop-timeout", "start-timeout", "run-as", "chain-to", "ready-notification", "inittab-id",
+        "inittab-line", "rlimit-nofile", "rlimit-core", "rlimit-data", "rlimit-addrspace"
+    };
+    const int NUM_SETTINGS = sizeof(setting_names) / sizeof(setting_names[0]);
+    const int ITERATIONS = 20000;
+
+    // Each known setting, and an unknown setting:
+    std::vector<std::string> names(setting_names, setting_names + NUM_SETTINGS);
+    names.emplace_back("no-such-setting");
+
+    unsigned long found = 0;
+    auto start = bench_clock::now();
+    for (int n = 0; n < ITERATIONS; n++) {
+        for (auto &name : names) {
+            found += (dinit_load::lookup_setting_id(name) != dinit_load::setting_id::NONE);
+        }
+    }
+    double lookup_ms = elapsed_ms(start);
+    assert(found == (unsigned long)ITERATIONS * NUM_SETTINGS);
+
+    found = 0;
+    start = bench_clock::now();
+    for (int n = 0; n < ITERATIONS; n++) {
+        for (auto &name : names) {
+            for (int i = 0; i < NUM_SETTINGS; i++) {
+                if (name == setting_names[i]) {
+                    ++found;
+                    break;
+                }
+            }
+        }
+    }
+    double chain_ms = elapsed_ms(start);
+    assert(found == (unsigned long)ITERATIONS * NUM_SETTINGS);
+
+    double lookups = (double)ITERATIONS * names.size();
+    std::cout << "hash switch " << (lookup_ms * 1000000.0 / lookups) << "ns, compare chain "
+            << (chain_ms * 1000000.0 / lookups) << "ns per setting ... ";
+}
+
+// Dependency propagation: start and then stop a service at the root of a graph of 10000 internal
+// services, arranged in layers of 50 where each service depends on every service in the layer
+// below (so that each service has a fan-out of 50, and there are roughly 500000 dependency
+// edges). Every edge is visited when the start propagates down the graph and again when the stop
+// propagates back up.
+static void bench_propagation()
+{
+    const int NUM_SERVICES = 10000;
+    const int FAN_OUT = 50;
+    const int ITERATIONS = 10;
+
+    service_set sset;
+    std::vector<service_record *> svcs(NUM_SERVICES);
+
+    auto start = bench_clock::now();
+    for (int i = NUM_SERVICES - 1; i >= 0; i--) {
+        std::list<prelim_dep> deps;
+        int next_layer = (i / FAN_OUT + 1) * FAN_OUT;
+        if (next_layer < NUM_SERVICES) {
+            for (int j = next_layer; j < next_layer + FAN_OUT; j++) {
+                deps.emplace_back(svcs[j], dependency_type::REGULAR);
+            }
+        }
+        svcs[i] = new service_record(&sset, bench_service_name(i), service_type_t::INTERNAL, deps);
+        sset.add_service(svcs[i]);
+    }
+
+    std::list<prelim_dep> root_deps;
+    for (int j = 0; j < FAN_OUT; j++) {
+        root_deps.emplace_back(svcs[j], dependency_type::REGULAR);
+    }
+    service_record *root = new service_record(&sset, "bench-root", service_type_t::INTERNAL, root_deps);
+    sset.add_service(root);
+    double build_ms = elapsed_ms(start);
+
+    double start_ms = 0, stop_ms = 0;
+    for (int n = 0; n < ITERATIONS; n++) {
+        start = bench_clock::now();
+        sset.start_service(root);
+        start_ms += elapsed_ms(start);
+        assert(svcs[NUM_SERVICES - 1]->get_state() == service_state_t::STARTED);
+
+        start = bench_clock::now();
+        sset.stop_service(root);
+        stop_ms += elapsed_ms(start);
+        assert(svcs[NUM_SERVICES - 1]->get_state() == service_state_t::STOPPED);
+    }
+
+    std::cout << "build " << build_ms << "ms, start " << (start_ms / ITERATIONS) << "ms, stop "
+            << (stop_ms / ITERATIONS) << "ms ... ";
+}
+
+// Process launch: fork+exec (as used for services requiring a full fork) versus a child sharing
+// the parent's memory until exec (vfork_spawn, see baseproc-sys.h), with a parent process of a
+// size representative of a system with many services loaded. (This uses the system calls
+// directly, since the service launch path is stubbed out in the test build).
+
+static const char * const spawn_args[] = { "/bin/true", nullptr };
+
+static int bench_spawn_child(void *arg)
+{
+    execv(spawn_args[0], const_cast<char **>(spawn_args));
+    _exit(1);
+}
+
+static void bench_spawn()
+{
+#ifdef __linux__
+    const int SPAWNS = 300;
+    const size_t PARENT_SIZE = 128 * 1024 * 1024;
+
+    // Grow the parent (touching each page so that it is mapped):
+    std::vector<char> ballast(PARENT_SIZE, 1);
+
+    auto run_spawns = [&](bool use_vfork) {
+        static char stack[64 * 1024];
+        auto start = bench_clock::now();
+        for (int i = 0; i < SPAWNS; ++i) {
+            pid_t child;
+            if (use_vfork) {
+                child = clone(bench_spawn_child, stack + sizeof(stack), CLONE_VM | CLONE_VFORK | SIGCHLD,
+                        nullptr);
+            }
+            else {
+                child = fork();
+                if (child == 0) {
+                    bench_spawn_child(nullptr);
+                }
+            }
+            assert(child > 0);
+            int status;
+            waitpid(child, &status, 0);
+            assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        }
+        return SPAWNS * 1000.0 / elapsed_ms(start);
+    };
+
+    double fork_rate = run_spawns(false);
+    double vfork_rate = run_spawns(true);
+
+    std::cout << "fork " << (int)fork_rate << "/s, vfork_spawn " << (int)vfork_rate << "/s (parent "
+            << (ballast.size() >> 20) << "MB) ... ";
+#endif
+}
+
+#define RUN_BENCH(name, spacing) \
+    std::cout << #name "..." spacing << std::flush; \
+    name(); \
+    std::cout << "DONE" << std::endl;
+
+int main(int argc, char **argv)
+{
+    init_bench_dir();
+    RUN_BENCH(bench_load_10k, "              ");
+    RUN_BENCH(bench_load_multidir, "         ");
+    RUN_BENCH(bench_parse_corpus, "          ");
+    RUN_BENCH(bench_parse_large, "           ");
+    RUN_BENCH(bench_setting_dispatch, "      ");
+    RUN_BENCH(bench_propagation, "           ");
+    RUN_BENCH(bench_spawn, "                 ");
+    cleanup_bench_dir();
+    return 0;
+}
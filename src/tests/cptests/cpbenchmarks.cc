@@ -0,0 +1,123 @@
+#include <cassert>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstring>
+
+#include "dinit.h"
+#include "service.h"
+#include "baseproc-sys.h"
+#include "control.h"
+
+// Micro-benchmarks for the control protocol implementation. These are not run as part of
+// "make check"; use "make bench" instead. Each benchmark reports the elapsed wall-clock time.
+
+using bench_clock = std::chrono::steady_clock;
+
+static double elapsed_ms(bench_clock::time_point start)
+{
+    std::chrono::duration<double, std::milli> d = bench_clock::now() - start;
+    return d.count();
+}
+
+class control_conn_t_test
+{
+    public:
+    static service_record * service_from_handle(control_conn_t *cc, control_conn_t::handle_t handle)
+    {
+        return cc->find_service_for_key(handle);
+    }
+};
+
+// Issue FINDSERVICE for the named service, and return the handle from the reply.
+static control_conn_t::handle_t find_service(int fd, const std::string &name)
+{
+    std::vector<char> cmd = { DINIT_CP_FINDSERVICE };
+    uint16_t name_len = name.length();
+    char *name_len_cptr = reinterpret_cast<char *>(&name_len);
+    cmd.insert(cmd.end(), name_len_cptr, name_len_cptr + sizeof(name_len));
+    cmd.insert(cmd.end(), name.begin(), name.end());
+
+    bp_sys::supply_read_data(fd, std::move(cmd));
+
+    // (The packet may wrap around the end of the receive buffer, in which case it is read in two
+    // parts.)
+    std::vector<char> wdata;
+    for (int i = 0; i < 2 && wdata.empty(); i++) {
+        event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+        bp_sys::extract_written_data(fd, wdata);
+    }
+    assert(wdata.size() == 3 + sizeof(control_conn_t::handle_t));
+    assert(wdata[0] == DINIT_RP_SERVICERECORD);
+
+    control_conn_t::handle_t h;
+    memcpy(&h, wdata.data() + 2, sizeof(h));
+    return h;
+}
+
+// Allocate handles for many services on a single connection, and then look them up (including
+// lookups of handles which are not valid).
+static void bench_handles()
+{
+    const int NUM_SERVICES = 20000;
+    const int LOOKUP_PASSES = 50;
+
+    service_set sset;
+    std::vector<std::string> names;
+    names.reserve(NUM_SERVICES);
+    for (int i = 0; i < NUM_SERVICES; i++) {
+        names.push_back("test-service-" + std::to_string(i));
+        sset.add_service(new service_record(&sset, names.back(), service_type_t::INTERNAL, {}));
+    }
+
+    int fd = bp_sys::allocfd();
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    std::vector<control_conn_t::handle_t> handles;
+    handles.reserve(NUM_SERVICES);
+
+    auto start = bench_clock::now();
+    for (int i = 0; i < NUM_SERVICES; i++) {
+        handles.push_back(find_service(fd, names[i]));
+    }
+    double alloc_ms = elapsed_ms(start);
+
+    start = bench_clock::now();
+    unsigned long found = 0;
+    for (int p = 0; p < LOOKUP_PASSES; p++) {
+        for (auto h : handles) {
+            found += (control_conn_t_test::service_from_handle(cc, h) != nullptr);
+        }
+    }
+    double lookup_ms = elapsed_ms(start);
+    assert(found == (unsigned long)NUM_SERVICES * LOOKUP_PASSES);
+
+    start = bench_clock::now();
+    unsigned long missed = 0;
+    for (int p = 0; p < LOOKUP_PASSES; p++) {
+        for (int i = 0; i < NUM_SERVICES; i++) {
+            missed += (control_conn_t_test::service_from_handle(cc, -1 - i) == nullptr);
+        }
+    }
+    double miss_ms = elapsed_ms(start);
+    assert(missed == (unsigned long)NUM_SERVICES * LOOKUP_PASSES);
+
+    unsigned long lookups = (unsigned long)NUM_SERVICES * LOOKUP_PASSES;
+    std::cout << NUM_SERVICES << " handles: find " << (alloc_ms * 1000.0 / NUM_SERVICES)
+            << "us/service, lookup " << (lookup_ms * 1000000.0 / lookups) << "ns, miss "
+            << (miss_ms * 1000000.0 / lookups) << "ns ... ";
+
+    delete cc;
+}
+
+#define RUN_BENCH(name, spacing) \
+    std::cout << #name "..." spacing << std::flush; \
+    name(); \
+    std::cout << "DONE" << std::endl;
+
+int main(int argc, char **argv)
+{
+    RUN_BENCH(bench_handles, "     ");
+    return 0;
+}
@@ -3,6 +3,7 @@
 #include <vector>
 #include <string>
 #include <set>
+#include <algorithm>
 
 #include "dinit.h"
 #include "service.h"
@@ -1162,6 +1163,1048 @@ void cptest_wake()
     delete cc;
 }
 
+// Write handler which can be "blocked", in which case writes fail with EAGAIN; it also counts
+// the write calls which succeed.
+class blockable_write_handler : public bp_sys::default_write_handler
+{
+    public:
+    bool blocked = true;
+    int writes = 0;
+
+    ssize_t write(int fd, const void *buf, size_t count) override
+    {
+        if (blocked) {
+            errno = EAGAIN;
+            return -1;
+        }
+        ++writes;
+        return default_write_handler::write(fd, buf, count);
+    }
+};
+
+// Check that output queued while the connection is not writable is later sent intact, and that
+// many packets are sent with few writes.
+void cptest_outqueue()
+{
+    service_set sset;
+
+    const int NUM_SERVICES = 500;
+    for (int i = 0; i < NUM_SERVICES; i++) {
+        service_record *s = new service_record(&sset, "test-service-" + std::to_string(i),
+                service_type_t::INTERNAL, {});
+        sset.add_service(s);
+    }
+
+    blockable_write_handler *whandler = new blockable_write_handler();
+    int fd = bp_sys::allocfd(whandler);
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    bp_sys::supply_read_data(fd, { DINIT_CP_LISTSERVICES });
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    assert(whandler->data.empty());
+
+    whandler->blocked = false;
+    while (true) {
+        size_t prev_size = whandler->data.size();
+        event_loop.regd_bidi_watchers[fd]->write_ready(event_loop, fd);
+        if (whandler->data.size() == prev_size) break;
+    }
+
+    // Many more packets than writes:
+    assert(whandler->writes < NUM_SERVICES / 10);
+
+    std::vector<char> &wdata = whandler->data;
+    std::set<std::string> names;
+    size_t pos = 0;
+    for (int i = 0; i < NUM_SERVICES; i++) {
+        assert(wdata[pos] == DINIT_RP_SVCINFO);
+        unsigned char name_len_c = wdata[pos + 1];
+        pos += 8 + std::max(sizeof(int), sizeof(pid_t));
+        names.insert(std::string(wdata.data() + pos, name_len_c));
+        pos += name_len_c;
+    }
+    assert(names.size() == NUM_SERVICES);
+    assert(names.count("test-service-0") == 1);
+    assert(names.count("test-service-499") == 1);
+    assert(wdata[pos++] == DINIT_RP_LISTDONE);
+    assert(pos == wdata.size());
+
+    delete cc;
+}
+
+// Query control connection statistics via the given connection; returns the number of connections
+// with input paused, and stores the pause and overrun counts.
+static uint32_t query_conn_stats(int fd, uint64_t &pause_count, uint64_t &overrun_count)
+{
+    bp_sys::supply_read_data(fd, { DINIT_CP_QUERYCONNSTATS });
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    std::vector<char> wdata;
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == 1 + 4 * 2 + 8 * 5);
+    assert(wdata[0] == DINIT_RP_CONNSTATS);
+
+    uint32_t paused_conns;
+    memcpy(&paused_conns, wdata.data() + 5, sizeof(paused_conns));
+    memcpy(&pause_count, wdata.data() + 1 + 8 + 8 * 3, sizeof(pause_count));
+    memcpy(&overrun_count, wdata.data() + 1 + 8 + 8 * 4, sizeof(overrun_count));
+    return paused_conns;
+}
+
+// Check that a connection stops processing requests while its queued output exceeds the budget,
+// and resumes once the output drains.
+void cptest_outputbudget()
+{
+    service_set sset;
+
+    const int NUM_SERVICES = 50;
+    for (int i = 0; i < NUM_SERVICES; i++) {
+        service_record *s = new service_record(&sset, "test-service-" + std::to_string(i),
+                service_type_t::INTERNAL, {});
+        sset.add_service(s);
+    }
+
+    size_t orig_conn_limit = cp_output_budget.conn_limit;
+    cp_output_budget.conn_limit = 512;
+
+    blockable_write_handler *whandler = new blockable_write_handler();
+    int fd = bp_sys::allocfd(whandler);
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    int stats_fd = bp_sys::allocfd();
+    auto *stats_cc = new control_conn_t(event_loop, &sset, stats_fd);
+
+    uint64_t pause_count, overrun_count;
+    assert(query_conn_stats(stats_fd, pause_count, overrun_count) == 0);
+    uint64_t orig_pause_count = pause_count;
+
+    // The listing exceeds the budget, so the following request is not processed (yet):
+    bp_sys::supply_read_data(fd, { DINIT_CP_LISTSERVICES, DINIT_CP_QUERYVERSION });
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+    assert(whandler->data.empty());
+
+    assert(query_conn_stats(stats_fd, pause_count, overrun_count) == 1);
+    assert(pause_count == orig_pause_count + 1);
+
+    whandler->blocked = false;
+    event_loop.regd_bidi_watchers[fd]->write_ready(event_loop, fd);
+    event_loop.regd_bidi_watchers[fd]->write_ready(event_loop, fd);
+
+    // All output including the reply to the second request has now been written:
+    std::vector<char> &wdata = whandler->data;
+    assert(wdata.size() > 5);
+    assert(wdata[wdata.size() - 6] == DINIT_RP_LISTDONE);
+    assert(wdata[wdata.size() - 5] == DINIT_RP_CPVERSION);
+    assert(query_conn_stats(stats_fd, pause_count, overrun_count) == 0);
+
+    delete cc;
+    delete stats_cc;
+    cp_output_budget.conn_limit = orig_conn_limit;
+}
+
+// Check that a connection which does not read service events is closed once the queued events
+// exceed (twice) the budget.
+void cptest_outputoverrun()
+{
+    service_set sset;
+
+    const int NUM_SERVICES = 10;
+    std::vector<service_record *> services;
+    for (int i = 0; i < NUM_SERVICES; i++) {
+        service_record *s = new service_record(&sset, "test-service-" + std::to_string(i),
+                service_type_t::INTERNAL, {});
+        sset.add_service(s);
+        services.push_back(s);
+    }
+
+    size_t orig_conn_limit = cp_output_budget.conn_limit;
+    cp_output_budget.conn_limit = 100;
+
+    blockable_write_handler *whandler = new blockable_write_handler();
+    int fd = bp_sys::allocfd(whandler);
+    new control_conn_t(event_loop, &sset, fd);
+
+    whandler->blocked = false;
+    bp_sys::supply_read_data(fd, { DINIT_CP_SUBSCRIBEALL, 1 });
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+    assert(whandler->data.size() == 1);
+    whandler->data.clear();
+    whandler->blocked = true;
+
+    int stats_fd = bp_sys::allocfd();
+    auto *stats_cc = new control_conn_t(event_loop, &sset, stats_fd);
+    uint64_t pause_count, overrun_count;
+    query_conn_stats(stats_fd, pause_count, overrun_count);
+    uint64_t orig_overrun_count = overrun_count;
+
+    // Each event is 33 bytes; the seventh would exceed twice the budget:
+    for (auto *s : services) {
+        sset.start_service(s);
+    }
+
+    query_conn_stats(stats_fd, pause_count, overrun_count);
+    assert(overrun_count == orig_overrun_count + 1);
+
+    // Once the queued events are written, the connection is closed:
+    assert(cp_output_budget.total_queued == 6 * 33);
+    whandler->blocked = false;
+    event_loop.regd_bidi_watchers[fd]->write_ready(event_loop, fd);
+    assert(event_loop.regd_bidi_watchers.count(fd) == 0);
+    assert(cp_output_budget.total_queued == 0);
+
+    delete stats_cc;
+    cp_output_budget.conn_limit = orig_conn_limit;
+}
+
+
+// Find a service via the control connection, and return its handle.
+static control_conn_t::handle_t find_service_handle(int fd, const char *service_name)
+{
+    std::vector<char> cmd = { DINIT_CP_FINDSERVICE };
+    uint16_t name_len = strlen(service_name);
+    char *name_len_cptr = reinterpret_cast<char *>(&name_len);
+    cmd.insert(cmd.end(), name_len_cptr, name_len_cptr + sizeof(name_len));
+    cmd.insert(cmd.end(), service_name, service_name + name_len);
+
+    bp_sys::supply_read_data(fd, std::move(cmd));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    std::vector<char> wdata;
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == 3 + sizeof(control_conn_t::handle_t));
+    assert(wdata[0] == DINIT_RP_SERVICERECORD);
+
+    control_conn_t::handle_t h;
+    std::copy(wdata.data() + 2, wdata.data() + 2 + sizeof(h), reinterpret_cast<char *>(&h));
+    return h;
+}
+
+// Check that service events queued while the connection is not writable are bounded, with newer
+// events for a service replacing older ones, and are sent before a subsequent reply.
+void cptest_eventcoalesce()
+{
+    service_set sset;
+
+    service_record *s1 = new service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    service_record *s2 = new service_record(&sset, "test-service-2", service_type_t::INTERNAL, {});
+    sset.add_service(s1);
+    sset.add_service(s2);
+
+    blockable_write_handler *whandler = new blockable_write_handler();
+    whandler->blocked = false;
+    int fd = bp_sys::allocfd(whandler);
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    control_conn_t::handle_t h1 = find_service_handle(fd, "test-service-1");
+    control_conn_t::handle_t h2 = find_service_handle(fd, "test-service-2");
+
+    whandler->blocked = true;
+
+    s2->start();
+    sset.process_queues();
+
+    const int NUM_CYCLES = 100;
+    for (int i = 0; i < NUM_CYCLES; i++) {
+        s1->start();
+        sset.process_queues();
+        s1->stop(true);
+        sset.process_queues();
+    }
+
+    bp_sys::supply_read_data(fd, { DINIT_CP_QUERYVERSION });
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    whandler->blocked = false;
+    whandler->writes = 0;
+    while (true) {
+        size_t prev_size = whandler->data.size();
+        event_loop.regd_bidi_watchers[fd]->write_ready(event_loop, fd);
+        if (whandler->data.size() == prev_size) break;
+    }
+
+    assert(whandler->writes <= 4);
+
+    std::vector<char> &wdata = whandler->data;
+    size_t pos = 0;
+    int num_events = 0;
+    bool seen_h2 = false;
+    control_conn_t::handle_t last_h = -1;
+    service_event_t last_event = service_event_t::STARTED;
+    while (wdata[pos] == DINIT_IP_SERVICEEVENT) {
+        assert(wdata[pos + 1] == 7);
+        control_conn_t::handle_t ip_h;
+        std::copy(wdata.data() + pos + 2, wdata.data() + pos + 2 + sizeof(ip_h),
+                reinterpret_cast<char *>(&ip_h));
+        if (ip_h == h2) {
+            seen_h2 = true;
+        }
+        last_h = ip_h;
+        last_event = static_cast<service_event_t>(wdata[pos + 6]);
+        pos += 7;
+        num_events++;
+    }
+
+    assert(num_events > 1 && num_events < NUM_CYCLES * 2);
+    assert(seen_h2);
+    assert(last_h == h1 && last_event == service_event_t::STOPPED);
+
+    // The reply comes after the events:
+    assert(wdata[pos] == DINIT_RP_CPVERSION);
+    assert(pos + 5 == wdata.size());
+
+    delete cc;
+}
+
+// Check that a handle is not valid after the service it refers to is unloaded, even if the
+// handle's table slot is re-used.
+void cptest_handlereuse()
+{
+    service_set sset;
+
+    service_record *s1 = new service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    service_record *s2 = new service_record(&sset, "test-service-2", service_type_t::INTERNAL, {});
+    sset.add_service(s1);
+    sset.add_service(s2);
+
+    int fd = bp_sys::allocfd();
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    control_conn_t::handle_t h1 = find_service_handle(fd, "test-service-1");
+    control_conn_t::handle_t h1b = find_service_handle(fd, "test-service-1");
+    assert(h1 != h1b);
+    assert(control_conn_t_test::service_from_handle(cc, h1) == s1);
+    assert(control_conn_t_test::service_from_handle(cc, h1b) == s1);
+
+    // Issue unload:
+    std::vector<char> cmd = { DINIT_CP_UNLOADSERVICE };
+    char * h_cp = reinterpret_cast<char *>(&h1);
+    cmd.insert(cmd.end(), h_cp, h_cp + sizeof(h1));
+    bp_sys::supply_read_data(fd, std::move(cmd));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    std::vector<char> wdata;
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == 1);
+    assert(wdata[0] == DINIT_RP_ACK);
+
+    // Both handles for the unloaded service are invalid:
+    assert(control_conn_t_test::service_from_handle(cc, h1) == nullptr);
+    assert(control_conn_t_test::service_from_handle(cc, h1b) == nullptr);
+
+    control_conn_t::handle_t h2 = find_service_handle(fd, "test-service-2");
+    assert(h2 != h1 && h2 != h1b);
+    assert(control_conn_t_test::service_from_handle(cc, h2) == s2);
+    assert(control_conn_t_test::service_from_handle(cc, h1) == nullptr);
+    assert(control_conn_t_test::service_from_handle(cc, h1b) == nullptr);
+
+    delete cc;
+}
+
+// Append a command to a BATCH packet.
+static void add_batch_cmd(std::vector<char> &pkt, char command, char flags, const char *service_name)
+{
+    pkt.push_back(command);
+    pkt.push_back(flags);
+    uint16_t name_len = strlen(service_name);
+    char *name_len_cptr = reinterpret_cast<char *>(&name_len);
+    pkt.insert(pkt.end(), name_len_cptr, name_len_cptr + sizeof(name_len));
+    pkt.insert(pkt.end(), service_name, service_name + name_len);
+}
+
+// Finish a BATCH packet by filling in the length and command count.
+static void finish_batch(std::vector<char> &pkt, uint16_t num_cmds)
+{
+    uint16_t pkt_len = pkt.size();
+    memcpy(pkt.data() + 1, &pkt_len, sizeof(pkt_len));
+    memcpy(pkt.data() + 3, &num_cmds, sizeof(num_cmds));
+}
+
+// Skip over service event information packets in written data; returns the position of the
+// first other packet.
+static size_t skip_info_packets(const std::vector<char> &wdata)
+{
+    size_t pos = 0;
+    while (pos < wdata.size() && wdata[pos] >= 100) {
+        pos += (unsigned char)wdata[pos + 1];
+    }
+    return pos;
+}
+
+void cptest_batch()
+{
+    service_set sset;
+
+    service_record *s1 = new service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    service_record *s2 = new service_record(&sset, "test-service-2", service_type_t::INTERNAL, {});
+    sset.add_service(s1);
+    sset.add_service(s2);
+
+    int fd = bp_sys::allocfd();
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    std::vector<char> cmd = { DINIT_CP_BATCH, 0, 0, 0, 0 };
+    add_batch_cmd(cmd, DINIT_CP_STARTSERVICE, 0, "test-service-1");
+    add_batch_cmd(cmd, DINIT_CP_STARTSERVICE, 1 /* pin */, "test-service-2");
+    add_batch_cmd(cmd, DINIT_CP_STARTSERVICE, 0, "test-service-3");
+    finish_batch(cmd, 3);
+
+    bp_sys::supply_read_data(fd, std::move(cmd));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    assert(s1->get_state() == service_state_t::STARTED);
+    assert(s2->get_state() == service_state_t::STARTED);
+
+    // STARTED events, followed by the batch reply:
+    std::vector<char> wdata;
+    bp_sys::extract_written_data(fd, wdata);
+    size_t pos = skip_info_packets(wdata);
+    assert(pos == 2 * 7);
+    assert(wdata.size() == pos + 3 + 3 * (1 + sizeof(control_conn_t::handle_t)));
+    assert(wdata[pos] == DINIT_RP_BATCH);
+    uint16_t num_results;
+    memcpy(&num_results, wdata.data() + pos + 1, sizeof(num_results));
+    assert(num_results == 3);
+    pos += 3;
+
+    control_conn_t::handle_t h1, h2, h3;
+    assert(wdata[pos] == DINIT_RP_ALREADYSS);
+    memcpy(&h1, wdata.data() + pos + 1, sizeof(h1));
+    pos += 1 + sizeof(h1);
+    assert(wdata[pos] == DINIT_RP_ALREADYSS);
+    memcpy(&h2, wdata.data() + pos + 1, sizeof(h2));
+    pos += 1 + sizeof(h2);
+    assert(wdata[pos] == DINIT_RP_NOSERVICE);
+    memcpy(&h3, wdata.data() + pos + 1, sizeof(h3));
+
+    assert(control_conn_t_test::service_from_handle(cc, h1) == s1);
+    assert(control_conn_t_test::service_from_handle(cc, h2) == s2);
+    assert(control_conn_t_test::service_from_handle(cc, h3) == nullptr);
+
+    // Stop both; service 2 is pinned started:
+    cmd = { DINIT_CP_BATCH, 0, 0, 0, 0 };
+    add_batch_cmd(cmd, DINIT_CP_STOPSERVICE, 0, "test-service-1");
+    add_batch_cmd(cmd, DINIT_CP_STOPSERVICE, 0, "test-service-2");
+    finish_batch(cmd, 2);
+
+    bp_sys::supply_read_data(fd, std::move(cmd));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    assert(s1->get_state() == service_state_t::STOPPED);
+    assert(s2->get_state() == service_state_t::STARTED);
+
+    bp_sys::extract_written_data(fd, wdata);
+    pos = skip_info_packets(wdata);
+    assert(pos == 7);
+    assert(wdata.size() == pos + 3 + 2 * (1 + sizeof(control_conn_t::handle_t)));
+    assert(wdata[pos] == DINIT_RP_BATCH);
+    pos += 3;
+    control_conn_t::handle_t h;
+    assert(wdata[pos] == DINIT_RP_ALREADYSS);
+    memcpy(&h, wdata.data() + pos + 1, sizeof(h));
+    assert(h == h1);
+    pos += 1 + sizeof(h);
+    assert(wdata[pos] == DINIT_RP_PINNEDSTARTED);
+    memcpy(&h, wdata.data() + pos + 1, sizeof(h));
+    assert(h == h2);
+
+    // A malformed batch (command not valid in a batch) is rejected:
+    cmd = { DINIT_CP_BATCH, 0, 0, 0, 0 };
+    add_batch_cmd(cmd, DINIT_CP_UNLOADSERVICE, 0, "test-service-1");
+    finish_batch(cmd, 1);
+
+    bp_sys::supply_read_data(fd, std::move(cmd));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == 1);
+    assert(wdata[0] == DINIT_RP_BADREQ);
+    assert(s1->get_state() == service_state_t::STOPPED);
+
+    delete cc;
+}
+
+// Check that several batches sent without waiting for replies (as a client must, to act on more
+// services than fit in one batch) are all processed, in order.
+void cptest_batch_pipelined()
+{
+    service_set sset;
+
+    service_record *s1 = new service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    service_record *s2 = new service_record(&sset, "test-service-2", service_type_t::INTERNAL, {});
+    sset.add_service(s1);
+    sset.add_service(s2);
+
+    int fd = bp_sys::allocfd();
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    std::vector<char> cmd1 = { DINIT_CP_BATCH, 0, 0, 0, 0 };
+    add_batch_cmd(cmd1, DINIT_CP_STARTSERVICE, 0, "test-service-1");
+    finish_batch(cmd1, 1);
+    std::vector<char> cmd2 = { DINIT_CP_BATCH, 0, 0, 0, 0 };
+    add_batch_cmd(cmd2, DINIT_CP_STARTSERVICE, 0, "test-service-2");
+    finish_batch(cmd2, 1);
+
+    // Both batches arrive in a single read:
+    std::vector<char> cmd = cmd1;
+    cmd.insert(cmd.end(), cmd2.begin(), cmd2.end());
+    bp_sys::supply_read_data(fd, std::move(cmd));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    assert(s1->get_state() == service_state_t::STARTED);
+    assert(s2->get_state() == service_state_t::STARTED);
+
+    // STARTED event and batch reply, for each batch:
+    std::vector<char> wdata;
+    bp_sys::extract_written_data(fd, wdata);
+    const size_t reply_size = 3 + 1 + sizeof(control_conn_t::handle_t);
+    assert(wdata.size() == 2 * (7 + reply_size));
+    control_conn_t::handle_t h1, h2;
+    assert(wdata[7] == DINIT_RP_BATCH);
+    memcpy(&h1, wdata.data() + 7 + 4, sizeof(h1));
+    assert(wdata[7 + reply_size + 7] == DINIT_RP_BATCH);
+    memcpy(&h2, wdata.data() + 7 + reply_size + 7 + 4, sizeof(h2));
+
+    assert(control_conn_t_test::service_from_handle(cc, h1) == s1);
+    assert(control_conn_t_test::service_from_handle(cc, h2) == s2);
+
+    sset.stop_all_services();
+    delete cc;
+}
+
+// Build a LISTSERVICES2 request.
+static std::vector<char> list2_request(uint32_t cursor, uint16_t limit, char filter,
+        service_state_t state, const char *prefix = "")
+{
+    std::vector<char> cmd = { DINIT_CP_LISTSERVICES2 };
+    cmd.insert(cmd.end(), (char *)&cursor, (char *)&cursor + sizeof(cursor));
+    cmd.insert(cmd.end(), (char *)&limit, (char *)&limit + sizeof(limit));
+    cmd.push_back(filter);
+    cmd.push_back(static_cast<char>(state));
+    cmd.push_back(0);
+    cmd.push_back(0);
+    uint16_t prefix_len = strlen(prefix);
+    cmd.insert(cmd.end(), (char *)&prefix_len, (char *)&prefix_len + sizeof(prefix_len));
+    cmd.insert(cmd.end(), prefix, prefix + prefix_len);
+    return cmd;
+}
+
+// Parse a LISTSERVICES2 reply, returning the names of the listed services, and the continuation
+// cursor. Also returns the number of SVCINFO2 packets.
+static int parse_list2_reply(const std::vector<char> &wdata, std::vector<std::string> &names,
+        uint32_t &cursor)
+{
+    const int rec_hdr_size = 12 + std::max(sizeof(int), sizeof(pid_t));
+    size_t pos = 0;
+    int num_pkts = 0;
+    while (wdata[pos] == DINIT_RP_SVCINFO2) {
+        uint16_t pkt_len, num_recs;
+        memcpy(&pkt_len, wdata.data() + pos + 1, sizeof(pkt_len));
+        memcpy(&num_recs, wdata.data() + pos + 3, sizeof(num_recs));
+        size_t rpos = pos + 5;
+        for (unsigned i = 0; i < num_recs; i++) {
+            unsigned char name_len = wdata[rpos + 4];
+            names.emplace_back(wdata.data() + rpos + rec_hdr_size, name_len);
+            rpos += rec_hdr_size + name_len;
+        }
+        assert(rpos == pos + pkt_len);
+        pos = rpos;
+        num_pkts++;
+    }
+    assert(wdata[pos] == DINIT_RP_LISTDONE2);
+    assert(pos + 5 == wdata.size());
+    memcpy(&cursor, wdata.data() + pos + 1, sizeof(cursor));
+    return num_pkts;
+}
+
+void cptest_listservices2()
+{
+    service_set sset;
+
+    const int NUM_SERVICES = 100;
+    for (int i = 0; i < NUM_SERVICES; i++) {
+        std::string name = ((i % 2) ? "odd-service-" : "even-service-") + std::to_string(i);
+        service_record *s = new service_record(&sset, name, service_type_t::INTERNAL, {});
+        sset.add_service(s);
+        if (i % 4 == 0) {
+            sset.start_service(s);
+        }
+    }
+
+    int fd = bp_sys::allocfd();
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    // No filter; several records per packet:
+    bp_sys::supply_read_data(fd, list2_request(0, 0, 0, service_state_t::STOPPED));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    std::vector<char> wdata;
+    std::vector<std::string> names;
+    uint32_t cursor;
+    bp_sys::extract_written_data(fd, wdata);
+    int num_pkts = parse_list2_reply(wdata, names, cursor);
+    assert(names.size() == NUM_SERVICES);
+    assert(num_pkts < NUM_SERVICES / 10);
+    assert(cursor == 0);
+
+    // Started services only, by pages of 10:
+    names.clear();
+    cursor = 0;
+    int pages = 0;
+    do {
+        bp_sys::supply_read_data(fd, list2_request(cursor, 10, 1, service_state_t::STARTED));
+        event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+        bp_sys::extract_written_data(fd, wdata);
+        parse_list2_reply(wdata, names, cursor);
+        pages++;
+    } while (cursor != 0);
+
+    assert(pages == 3);
+    assert(names.size() == NUM_SERVICES / 4);
+    for (auto &name : names) {
+        assert(sset.find_service(name)->get_state() == service_state_t::STARTED);
+    }
+    assert(std::set<std::string>(names.begin(), names.end()).size() == names.size());
+
+    // Name prefix and state:
+    names.clear();
+    bp_sys::supply_read_data(fd, list2_request(0, 0, 1 | 8, service_state_t::STOPPED, "odd-"));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+    bp_sys::extract_written_data(fd, wdata);
+    parse_list2_reply(wdata, names, cursor);
+    assert(names.size() == NUM_SERVICES / 2);
+    for (auto &name : names) {
+        assert(name.compare(0, 4, "odd-") == 0);
+    }
+
+    // Resuming after a service which has since been removed continues with the following service:
+    service_record *s10 = sset.find_service("even-service-10");
+    uint32_t s10_id = s10->get_id();
+    sset.remove_service(s10);
+    delete s10;
+
+    names.clear();
+    bp_sys::supply_read_data(fd, list2_request(s10_id, 2, 0, service_state_t::STOPPED));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+    bp_sys::extract_written_data(fd, wdata);
+    parse_list2_reply(wdata, names, cursor);
+    assert(names.size() == 2);
+    assert(names[0] == "odd-service-11" && names[1] == "even-service-12");
+    assert(cursor == sset.find_service("even-service-12")->get_id());
+
+    delete cc;
+}
+
+void cptest_subscribeall()
+{
+    service_set sset;
+
+    service_record *s1 = new service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    sset.add_service(s1);
+    service_record *s2 = new service_record(&sset, "test-service-2", service_type_t::INTERNAL, {});
+    sset.add_service(s2);
+
+    int fd = bp_sys::allocfd();
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    bp_sys::supply_read_data(fd, { DINIT_CP_SUBSCRIBEALL, 1 });
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    std::vector<char> wdata;
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == 1);
+    assert(wdata[0] == DINIT_RP_ACK);
+
+    // An event for a service with no handle on the connection is reported, with id, time and
+    // name:
+    time_val event_time;
+    event_loop.get_time(event_time, clock_type::SYSTEM);
+    sset.start_service(s2);
+
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == 19 + strlen("test-service-2"));
+    assert(wdata[0] == DINIT_IP_SERVICEEVENT2);
+    assert(wdata[1] == (char)wdata.size());
+    uint32_t id;
+    memcpy(&id, wdata.data() + 2, sizeof(id));
+    assert(id == s2->get_id());
+    assert(wdata[6] == (char)service_event_t::STARTED);
+    int64_t secs;
+    uint32_t nsecs;
+    memcpy(&secs, wdata.data() + 7, sizeof(secs));
+    memcpy(&nsecs, wdata.data() + 15, sizeof(nsecs));
+    assert(secs == event_time.seconds() && nsecs == (uint32_t)event_time.nseconds());
+    assert(std::string(wdata.data() + 19, wdata.size() - 19) == "test-service-2");
+
+    // After unsubscribing, no events are reported:
+    bp_sys::supply_read_data(fd, { DINIT_CP_SUBSCRIBEALL, 0 });
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == 1);
+    assert(wdata[0] == DINIT_RP_ACK);
+
+    sset.stop_service(s2);
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == 0);
+
+    // A subscribed connection, once closed, is no longer notified:
+    bp_sys::supply_read_data(fd, { DINIT_CP_SUBSCRIBEALL, 1 });
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == 1);
+
+    delete cc;
+
+    sset.start_service(s1);
+    sset.stop_service(s1);
+}
+
+// Check that several packets received together are all processed.
+void cptest_pipelined()
+{
+    service_set sset;
+    int fd = bp_sys::allocfd();
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    bp_sys::supply_read_data(fd, { DINIT_CP_QUERYVERSION, DINIT_CP_QUERYVERSION,
+            DINIT_CP_QUERYVERSION });
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    std::vector<char> wdata;
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == 3 * 5);
+    assert(wdata[0] == DINIT_RP_CPVERSION);
+    assert(wdata[5] == DINIT_RP_CPVERSION);
+    assert(wdata[10] == DINIT_RP_CPVERSION);
+
+    delete cc;
+}
+
+// Check the full status of a service reported via SERVICESTATUS.
+void cptest_servicestatus()
+{
+    service_set sset;
+
+    service_record *s1 = new service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    sset.add_service(s1);
+
+    int fd = bp_sys::allocfd();
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    control_conn_t::handle_t h = find_service_handle(fd, "test-service-1");
+
+    event_loop.advance_time(time_val(2, 0));
+    s1->start();
+    sset.process_queues();
+    event_loop.advance_time(time_val(3, 500000000));
+
+    // Discard the service event:
+    std::vector<char> wdata;
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() > 0 && wdata[0] == DINIT_IP_SERVICEEVENT);
+
+    std::vector<char> cmd = { DINIT_CP_SERVICESTATUS };
+    char *h_cptr = reinterpret_cast<char *>(&h);
+    cmd.insert(cmd.end(), h_cptr, h_cptr + sizeof(h));
+    bp_sys::supply_read_data(fd, std::move(cmd));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == 28 + 6 * sizeof(uint64_t));
+    assert(wdata[0] == DINIT_RP_SERVICESTATUS);
+    assert(wdata[1] == static_cast<char>(service_state_t::STARTED));
+    assert(wdata[2] == static_cast<char>(service_state_t::STARTED));
+    assert((wdata[3] & (16 | 32)) == 0);  // no process launched or failed
+    assert(wdata[6] == static_cast<char>(service_type_t::INTERNAL));
+
+    int32_t ivalues[4];
+    memcpy(ivalues, wdata.data() + 12, sizeof(ivalues));
+    assert(ivalues[0] == -1);
+    assert(ivalues[2] == 0 && ivalues[3] == 0);
+
+    uint64_t millis[6];
+    memcpy(millis, wdata.data() + 28, sizeof(millis));
+    assert(millis[1] == 3500);   // time in current state
+    assert(millis[2] == 2000);   // STOPPED
+    assert(millis[3] == 0);      // STARTING
+    assert(millis[4] == 3500);   // STARTED
+    assert(millis[5] == 0);      // STOPPING
+
+    // An invalid handle is a bad request (as for other commands which take a handle):
+    cmd = { DINIT_CP_SERVICESTATUS };
+    h++;
+    cmd.insert(cmd.end(), h_cptr, h_cptr + sizeof(h));
+    bp_sys::supply_read_data(fd, std::move(cmd));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == 1);
+    assert(wdata[0] == DINIT_RP_BADREQ);
+
+    delete cc;
+}
+
+static std::vector<char> timeline_request(uint64_t first_seq, uint32_t name_cursor)
+{
+    std::vector<char> cmd = { DINIT_CP_QUERYTIMELINE };
+    cmd.insert(cmd.end(), (char *)&first_seq, (char *)&first_seq + sizeof(first_seq));
+    cmd.insert(cmd.end(), (char *)&name_cursor, (char *)&name_cursor + sizeof(name_cursor));
+    return cmd;
+}
+
+void cptest_querytimeline()
+{
+    service_set sset;
+
+    service_record *s1 = new service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    sset.add_service(s1);
+
+    int fd = bp_sys::allocfd();
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    s1->start();
+    sset.process_queues();
+
+    bp_sys::supply_read_data(fd, timeline_request(0, 0));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    std::vector<char> wdata;
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() >= 48);
+    assert(wdata[0] == DINIT_RP_TIMELINE);
+    assert(wdata[1] == 1); // complete
+
+    uint32_t num_entries;
+    uint64_t first_seq;
+    uint32_t num_names;
+    uint32_t name_cursor;
+    memcpy(&num_entries, wdata.data() + 4, sizeof(num_entries));
+    memcpy(&first_seq, wdata.data() + 8, sizeof(first_seq));
+    memcpy(&num_names, wdata.data() + 40, sizeof(num_names));
+    memcpy(&name_cursor, wdata.data() + 44, sizeof(name_cursor));
+
+    // STARTING, DEPS_STARTED, STARTED:
+    assert(num_entries == 3);
+    assert(first_seq == 0);
+    assert(num_names == 1);
+    assert(name_cursor == s1->get_id());
+
+    std::string name = "test-service-1";
+    assert(wdata.size() == 48 + num_entries * timeline_entry_wire_size + 6 + name.length());
+
+    const char *entry = wdata.data() + 48;
+    uint32_t service_id;
+    memcpy(&service_id, entry + 12, sizeof(service_id));
+    assert(service_id == s1->get_id());
+    assert(entry[20] == (char)timeline_event_t::STARTING);
+    entry += 2 * timeline_entry_wire_size;
+    assert(entry[20] == (char)timeline_event_t::STARTED);
+
+    const char *name_rec = wdata.data() + 48 + num_entries * timeline_entry_wire_size;
+    uint16_t name_len;
+    memcpy(&service_id, name_rec, sizeof(service_id));
+    memcpy(&name_len, name_rec + 4, sizeof(name_len));
+    assert(service_id == s1->get_id());
+    assert(name_len == name.length());
+    assert(std::string(name_rec + 6, name_len) == name);
+
+    delete cc;
+}
+
+// Check that a large timeline is returned in parts, each limited in size.
+void cptest_querytimeline_parts()
+{
+    service_set sset;
+
+    service_record *s1 = new service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    sset.add_service(s1);
+    service_record *s2 = new service_record(&sset, "test-service-2", service_type_t::INTERNAL, {});
+    sset.add_service(s2);
+
+    int fd = bp_sys::allocfd();
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    for (int i = 0; i < 500; i++) {
+        s1->start();
+        sset.process_queues();
+        s1->stop(true);
+        sset.process_queues();
+    }
+
+    const service_timeline &timeline = sset.get_timeline();
+    assert(timeline.size() > 1000);
+
+    uint64_t next_seq = 0;
+    uint32_t name_cursor = 0;
+    uint64_t total_entries = 0;
+    std::vector<uint32_t> name_ids;
+    int num_parts = 0;
+    bool complete = false;
+
+    while (!complete) {
+        bp_sys::supply_read_data(fd, timeline_request(next_seq, name_cursor));
+        event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+        std::vector<char> wdata;
+        bp_sys::extract_written_data(fd, wdata);
+        assert(wdata.size() >= 48 && wdata.size() <= 16 * 1024);
+        assert(wdata[0] == DINIT_RP_TIMELINE);
+        complete = (wdata[1] != 0);
+
+        uint32_t num_entries;
+        uint64_t first_seq;
+        uint32_t num_names;
+        memcpy(&num_entries, wdata.data() + 4, sizeof(num_entries));
+        memcpy(&first_seq, wdata.data() + 8, sizeof(first_seq));
+        memcpy(&num_names, wdata.data() + 40, sizeof(num_names));
+        memcpy(&name_cursor, wdata.data() + 44, sizeof(name_cursor));
+        assert(first_seq == next_seq);
+
+        // names are only given once all entries have been given:
+        assert(num_names == 0 || first_seq + num_entries == timeline.get_dropped() + timeline.size());
+
+        const char *name_rec = wdata.data() + 48 + num_entries * timeline_entry_wire_size;
+        for (uint32_t i = 0; i < num_names; i++) {
+            uint32_t id;
+            uint16_t name_len;
+            memcpy(&id, name_rec, sizeof(id));
+            memcpy(&name_len, name_rec + 4, sizeof(name_len));
+            name_ids.push_back(id);
+            name_rec += 6 + name_len;
+        }
+        assert(name_rec == wdata.data() + wdata.size());
+
+        next_seq = first_seq + num_entries;
+        total_entries += num_entries;
+        ++num_parts;
+    }
+
+    assert(num_parts > 1);
+    assert(total_entries == timeline.size());
+    assert(name_ids.size() == 2);
+    assert(name_ids[0] == s1->get_id());
+    assert(name_ids[1] == s2->get_id());
+
+    delete cc;
+}
+
+void cptest_querystarthistory()
+{
+    service_set sset;
+
+    service_record *s1 = new service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    sset.add_service(s1);
+
+    int fd = bp_sys::allocfd();
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    // Without a start history, the reply lists no services:
+    std::vector<char> cmd = { DINIT_CP_QUERYSTARTHISTORY, 0, 0 };
+    bp_sys::supply_read_data(fd, std::vector<char>(cmd));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    std::vector<char> wdata;
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == 8);
+    assert(wdata[0] == DINIT_RP_STARTHISTORY);
+    assert(wdata[1] == 1); // complete
+    uint32_t num_services;
+    memcpy(&num_services, wdata.data() + 4, sizeof(num_services));
+    assert(num_services == 0);
+
+    start_history history;
+    history.record("test-service-1", 1500);
+    history.record("test-service-1", 500);
+    sset.set_start_history(&history);
+
+    bp_sys::supply_read_data(fd, std::move(cmd));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    std::string name = "test-service-1";
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == 8 + 4 + 2 * 4 + name.length());
+    assert(wdata[0] == DINIT_RP_STARTHISTORY);
+    assert(wdata[1] == 1);
+    memcpy(&num_services, wdata.data() + 4, sizeof(num_services));
+    assert(num_services == 1);
+
+    uint16_t name_len;
+    memcpy(&name_len, wdata.data() + 8, sizeof(name_len));
+    assert(name_len == name.length());
+    assert(wdata[10] == 2);  // durations
+    assert(wdata[11] == 2);  // durations recorded since loading
+    uint32_t durations[2];
+    memcpy(durations, wdata.data() + 12, sizeof(durations));
+    assert(durations[0] == 1500 && durations[1] == 500);
+    assert(std::string(wdata.data() + 20, name_len) == name);
+
+    sset.set_start_history(nullptr);
+    delete cc;
+}
+
+// Check that a large start history is returned in parts, each limited in size.
+void cptest_querystarthistory_parts()
+{
+    service_set sset;
+
+    int fd = bp_sys::allocfd();
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    constexpr int num_histories = 1000;
+    start_history history;
+    for (int i = 0; i < num_histories; i++) {
+        std::string name = "test-service-" + std::to_string(i);
+        for (unsigned j = 0; j < start_history::max_durations; j++) {
+            history.record(name, 100 + i);
+        }
+    }
+    sset.set_start_history(&history);
+
+    std::string cursor;
+    std::vector<std::string> names;
+    int num_parts = 0;
+    bool complete = false;
+
+    while (!complete) {
+        uint16_t cursor_len = cursor.length();
+        std::vector<char> cmd = { DINIT_CP_QUERYSTARTHISTORY };
+        cmd.insert(cmd.end(), (char *)&cursor_len, (char *)&cursor_len + sizeof(cursor_len));
+        cmd.insert(cmd.end(), cursor.begin(), cursor.end());
+        bp_sys::supply_read_data(fd, std::move(cmd));
+        event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+        std::vector<char> wdata;
+        bp_sys::extract_written_data(fd, wdata);
+        assert(wdata.size() >= 8 && wdata.size() <= 16 * 1024);
+        assert(wdata[0] == DINIT_RP_STARTHISTORY);
+        complete = (wdata[1] != 0);
+
+        uint32_t num_services;
+        memcpy(&num_services, wdata.data() + 4, sizeof(num_services));
+        assert(num_services != 0);
+
+        const char *rec = wdata.data() + 8;
+        for (uint32_t i = 0; i < num_services; i++) {
+            uint16_t name_len;
+            memcpy(&name_len, rec, sizeof(name_len));
+            assert((unsigned char)rec[2] == start_history::max_durations);
+            rec += 4 + start_history::max_durations * 4;
+            cursor = std::string(rec, name_len);
+            names.push_back(cursor);
+            rec += name_len;
+        }
+        assert(rec == wdata.data() + wdata.size());
+        ++num_parts;
+    }
+
+    assert(num_parts > 1);
+    assert(names.size() == num_histories);
+    assert(std::is_sorted(names.begin(), names.end()));
+    assert(std::adjacent_find(names.begin(), names.end()) == names.end());
+
+    sset.set_start_history(nullptr);
+    delete cc;
+}
 
 #define RUN_TEST(name, spacing) \
     std::cout << #name "..." spacing << std::flush; \
@@ -1185,5 +2228,20 @@ int main(int argc, char **argv)
     RUN_TEST(cptest_enableservice, "      ");
     RUN_TEST(cptest_restart, "            ");
     RUN_TEST(cptest_wake, "               ");
+    RUN_TEST(cptest_outqueue, "           ");
+    RUN_TEST(cptest_eventcoalesce, "      ");
+    RUN_TEST(cptest_handlereuse, "        ");
+    RUN_TEST(cptest_batch, "              ");
+    RUN_TEST(cptest_batch_pipelined, "    ");
+    RUN_TEST(cptest_listservices2, "      ");
+    RUN_TEST(cptest_subscribeall, "       ");
+    RUN_TEST(cptest_pipelined, "          ");
+    RUN_TEST(cptest_outputbudget, "       ");
+    RUN_TEST(cptest_outputoverrun, "      ");
+    RUN_TEST(cptest_servicestatus, "      ");
+    RUN_TEST(cptest_querytimeline, "      ");
+    RUN_TEST(cptest_querytimeline_parts, "");
+    RUN_TEST(cptest_querystarthistory, "  ");
+    RUN_TEST(cptest_querystarthistory_parts, "");
     return 0;
 }
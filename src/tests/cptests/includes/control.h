@@ -0,0 +1,381 @@
+#ifndef DINIT_CONTROL_H
+#define DINIT_CONTROL_H
+
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <limits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <unistd.h>
+
+#include "dinit.h"
+#include "dinit-log.h"
+#include "control-cmds.h"
+#include "service-listener.h"
+#include "cpbuffer.h"
+#include "output-queue.h"
+
+// Control connection for dinit
+
+class control_conn_t;
+class control_conn_watcher;
+
+// forward-declaration of callback:
+inline dasynq::rearm control_conn_cb(eventloop_t *loop, control_conn_watcher *watcher, int revents);
+
+// Pointer to the control connection that is listening for rollback completion
+extern control_conn_t * rollback_handler_conn;
+
+extern int active_control_conns;
+
+// Limits on the output queued (i.e. not yet written) for control connections, and accounting of
+// queued output. A connection whose queued output exceeds its budget (or which has queued output
+// while the total for all connections exceeds the total budget) stops processing requests until
+// the output has drained to half the budget. Output which cannot be deferred (service event
+// notifications) is discarded, and the connection closed, if it would exceed twice the budget.
+struct control_output_budget
+{
+    size_t conn_limit = 256 * 1024;         // per-connection budget
+    size_t total_limit = 4 * 1024 * 1024;   // budget for all connections together
+
+    size_t total_queued = 0;        // output currently queued, for all connections
+    unsigned paused_conns = 0;      // number of connections currently not processing requests
+    uint64_t pause_count = 0;       // number of times a connection exceeded its budget
+    uint64_t overrun_count = 0;     // number of connections closed due to exceeding the budget
+};
+
+extern control_output_budget cp_output_budget;
+
+// "packet" format:
+// (1 byte) packet type
+// (N bytes) additional data (service name, etc)
+//   for LOADSERVICE/FINDSERVICE:
+//      (2 bytes) service name length
+//      (M bytes) service name (without nul terminator)
+
+// Information packet:
+// (1 byte) packet type, >= 100
+// (1 byte) packet length (including all fields)
+//       N bytes: packet data (N = (length - 2))
+
+class service_set;
+class service_record;
+
+class control_conn_watcher : public eventloop_t::bidi_fd_watcher_impl<control_conn_watcher>
+{
+    inline rearm receive_event(eventloop_t &loop, int fd, int flags) noexcept
+    {
+        return control_conn_cb(&loop, this, flags);
+    }
+
+    eventloop_t * event_loop;
+
+    public:
+    control_conn_watcher(eventloop_t & event_loop_p) : event_loop(&event_loop_p)
+    {
+        // constructor
+    }
+
+    control_conn_watcher(const control_conn_watcher &) = delete;
+    void operator=(const control_conn_watcher &) = delete;
+
+    rearm read_ready(eventloop_t &loop, int fd) noexcept
+    {
+        return receive_event(loop, fd, dasynq::IN_EVENTS);
+    }
+    
+    rearm write_ready(eventloop_t &loop, int fd) noexcept
+    {
+        return receive_event(loop, fd, dasynq::OUT_EVENTS);
+    }
+
+    void set_watches(int flags)
+    {
+        eventloop_t::bidi_fd_watcher::set_watches(*event_loop, flags);
+    }
+};
+
+class control_conn_t : private service_listener, private service_set_listener
+{
+    friend rearm control_conn_cb(eventloop_t *loop, control_conn_watcher *watcher, int revents);
+    friend class control_conn_t_test;
+    
+    public:
+    // A mapping between service records and their associated numerical identifier used
+    // in communction
+    using handle_t = uint32_t;
+
+    private:
+    control_conn_watcher iob;
+    eventloop_t &loop;
+    service_set *services;
+    
+    bool bad_conn_close = false; // close when finished output?
+    bool oom_close = false;      // send final 'out of memory' indicator
+    bool subscribed_all = false; // subscribed to events for all services?
+    bool input_paused = false;   // not processing requests due to queued output exceeding budget
+
+    // Amount of queued output, as included in cp_output_budget.total_queued
+    size_t accounted_output = 0;
+
+    // The packet length before we need to re-check if the packet is complete.
+    // process_packet() will not be called until the packet reaches this size.
+    int chklen;
+    
+    // Receive buffer
+    cpbuffer<1024> rbuf;
+    
+    template <typename T> using list = std::list<T>;
+    template <typename T> using vector = std::vector<T>;
+    
+    // Service handles: a handle consists of an index into the handle table (the low bits) and the
+    // generation of the table slot (the high bits), which is incremented whenever the slot is
+    // freed so that a stale handle is not mistaken for a newer handle occupying the same slot.
+    // Free slots are kept in a list (linked via next_free).
+    static constexpr unsigned handle_index_bits = 24;
+    static constexpr handle_t handle_index_mask = (handle_t(1) << handle_index_bits) - 1;
+    static constexpr handle_t no_free_slot = handle_index_mask;
+
+    struct handle_slot
+    {
+        service_record *service = nullptr;  // nullptr if slot is free
+        handle_t generation = 0;
+        handle_t next_free = no_free_slot;
+    };
+
+    std::vector<handle_slot> handle_table;
+    handle_t first_free_slot = no_free_slot;
+
+    std::unordered_multimap<service_record *, handle_t> service_key_map;
+    
+    // Buffer for outgoing packets (not yet written).
+    output_queue outbuf;
+
+    // Service event information packets are fixed-size, and are queued (after any data in outbuf)
+    // in a preallocated ring. If the ring fills, a newer event for a service replaces an older
+    // queued event for the same service; i.e. a client which does not read events promptly may
+    // see only the latest event for each service.
+    static constexpr unsigned event_pkt_size = 3 + sizeof(handle_t);
+    static constexpr unsigned event_ring_pkts = 64;
+    packet_ring<event_pkt_size, event_ring_pkts> event_ring;
+
+    bool output_pending() const noexcept
+    {
+        return !outbuf.empty() || !event_ring.empty();
+    }
+
+    // Get the input watch flag appropriate for the connection state (IN_EVENTS, unless the
+    // connection is closing or input is paused).
+    int input_watch_flag() const noexcept
+    {
+        return (bad_conn_close || input_paused) ? 0 : dasynq::IN_EVENTS;
+    }
+
+    // Update accounting of queued output (after queueing or writing output), and pause input if
+    // the output budget is exceeded.
+    void account_output() noexcept;
+
+    // Check whether output of the given size, which cannot be deferred, would exceed twice the
+    // budget; if so the connection is marked to be closed (and true is returned).
+    bool check_output_overrun(size_t size) noexcept;
+
+    // Move queued event packets from the event ring to the output buffer (so that a subsequent
+    // packet may be queued after them). Throws std::bad_alloc (in which case the event ring is
+    // unchanged).
+    void spill_event_ring();
+
+    // Queue a packet to be sent
+    //  Returns:  false if the packet could not be queued and a suitable error packet
+    //              could not be sent/queued (the connection should be closed);
+    //            true (with bad_conn_close == false) if the packet was successfully
+    //              queued;
+    //            true (with bad_conn_close == true) if the packet was not successfully
+    //              queued (but a suitable error packet has been queued).
+    // The in/out watch enabled state will also be set appropriately.
+    bool queue_packet(const vector<char> &v) noexcept
+    {
+        return queue_packet(v.data(), v.size());
+    }
+    bool queue_packet(const char *pkt, unsigned size) noexcept;
+
+    // Queue a service event information packet (of size event_pkt_size) to be sent. Return value
+    // as for queue_packet.
+    bool queue_event_packet(const char *pkt) noexcept;
+
+    // Process a packet.
+    //  Returns:  true (with bad_conn_close == false) if successful
+    //            true (with bad_conn_close == true) if an error packet was queued
+    //            false if an error occurred but no error packet could be queued
+    //                (connection should be closed).
+    // Throws:
+    //    std::bad_alloc - if an out-of-memory condition prevents processing
+    bool process_packet();
+    
+    // Process a STARTSERVICE/STOPSERVICE packet. May throw std::bad_alloc.
+    bool process_start_stop(int pktType);
+
+    // Issue a start/stop/wake/release command (pktType) for a service, with the given flags,
+    // without processing the service queues. Returns DINIT_RP_ACK if the command was issued, or
+    // another reply code if not; DINIT_RP_DEPENDENTS indicates that a gentle stop was prevented
+    // by dependents.
+    int issue_start_stop(service_record *service, int pktType, int flags);
+
+    // Process a BATCH packet (several start/stop commands). May throw std::bad_alloc.
+    bool process_batch();
+    
+    // Process a FINDSERVICE/LOADSERVICE packet. May throw std::bad_alloc.
+    bool process_find_load(int pktType);
+
+    // Process an UNPINSERVICE packet. May throw std::bad_alloc.
+    bool process_unpin_service();
+    
+    // Process an UNLOADSERVICE packet.
+    bool process_unload_service();
+
+    // Process a RELOADSERVICE packet. May throw std::bad_alloc.
+    bool process_reload_service();
+
+    // Process a QUERYSERVICENAME packet.
+    bool process_query_name();
+
+    // List all loaded services and their state.
+    bool list_services();
+
+    // List loaded services matching a filter, several per packet (LISTSERVICES2). May throw
+    // std::bad_alloc.
+    bool list_services2();
+
+    // Process a SUBSCRIBEALL packet. May throw std::bad_alloc.
+    bool process_subscribe_all();
+
+    // Add a dependency between two services.
+    bool add_service_dep(bool do_start = false);
+
+    // Remove a dependency between two services.
+    bool rm_service_dep();
+
+    // Query service path / load mechanism.
+    bool query_load_mech();
+
+    // Load all services from the service directories (PRELOADSERVICES). May throw std::bad_alloc.
+    bool process_preload();
+
+    // Process a QUERYCONNSTATS packet.
+    bool process_query_conn_stats();
+
+    // Process a SERVICESTATUS packet.
+    bool process_service_status();
+
+    // Process a QUERYTIMELINE packet. May throw std::bad_alloc.
+    bool process_query_timeline();
+
+    // Process a QUERYSTARTHISTORY packet. May throw std::bad_alloc.
+    bool process_query_start_history();
+
+    // Notify that data is ready to be read from the socket. Returns true if the connection should
+    // be closed.
+    bool data_ready() noexcept;
+
+    // Process complete packets in the receive buffer (unless input is paused), and set watches
+    // appropriately. Returns true if the connection should be closed.
+    bool process_packets() noexcept;
+    
+    bool send_data() noexcept;
+    
+    // Check if any dependents will be affected by stopping a service, generate a response packet if so.
+    // had_dependents will be set true if the service should not be stopped, false otherwise.
+    // Returns false if the connection must be closed, true otherwise.
+    bool check_dependents(service_record *service, bool &had_dependents);
+
+    // Allocate a new handle for a service; may throw std::bad_alloc
+    handle_t allocate_service_handle(service_record *record);
+
+    // Release all handles for a service (and stop listening for its events).
+    void release_service_handles(service_record *record) noexcept;
+    
+    // Find the service corresponding to a service handle; returns nullptr if not found.
+    service_record *find_service_for_key(handle_t key) noexcept
+    {
+        handle_t index = key & handle_index_mask;
+        if (index >= handle_table.size()) {
+            return nullptr;
+        }
+        handle_slot &slot = handle_table[index];
+        if (slot.generation != (key >> handle_index_bits)) {
+            return nullptr;
+        }
+        return slot.service;
+    }
+    
+    // Close connection due to out-of-memory condition.
+    void do_oom_close() noexcept
+    {
+        bad_conn_close = true;
+        oom_close = true;
+        iob.set_watches(dasynq::OUT_EVENTS);
+    }
+    
+    // Process service event broadcast.
+    // Note that this can potentially be called during packet processing (upon issuing
+    // service start/stop orders etc).
+    void service_event(service_record * service, service_event_t event) noexcept final override
+    {
+        // For each service handle corresponding to the event, send an information packet.
+        auto range = service_key_map.equal_range(service);
+        for (auto i = range.first; i != range.second; ++i) {
+            handle_t key = i->second;
+            char pkt[event_pkt_size];
+            pkt[0] = DINIT_IP_SERVICEEVENT;
+            pkt[1] = event_pkt_size;
+            memcpy(pkt + 2, &key, sizeof(key));
+            pkt[2 + sizeof(key)] = static_cast<char>(event);
+            queue_event_packet(pkt);
+        }
+    }
+
+    // Process service event broadcast for all services (if subscribed via SUBSCRIBEALL).
+    void service_set_event(service_record * service, service_event_t event) noexcept final override;
+    
+    public:
+    control_conn_t(eventloop_t &loop, service_set * services_p, int fd)
+            : iob(loop), loop(loop), services(services_p), chklen(0)
+    {
+        iob.add_watch(loop, fd, dasynq::IN_EVENTS);
+        active_control_conns++;
+    }
+    
+    control_conn_t(const control_conn_t &) = delete;
+
+    virtual ~control_conn_t() noexcept;
+};
+
+
+inline dasynq::rearm control_conn_cb(eventloop_t * loop, control_conn_watcher * watcher, int revents)
+{
+    // Get the address of the containing control_connt_t object:
+    _Pragma ("GCC diagnostic push")
+    _Pragma ("GCC diagnostic ignored \"-Winvalid-offsetof\"")
+    uintptr_t cc_addr = reinterpret_cast<uintptr_t>(watcher) - offsetof(control_conn_t, iob);
+    control_conn_t *conn = reinterpret_cast<control_conn_t *>(cc_addr);
+    _Pragma ("GCC diagnostic pop")
+
+    if (revents & dasynq::IN_EVENTS) {
+        if (conn->data_ready()) {
+            delete conn;
+            return dasynq::rearm::REMOVED;
+        }
+    }
+    if (revents & dasynq::OUT_EVENTS) {
+        if (conn->send_data()) {
+            delete conn;
+            return dasynq::rearm::REMOVED;
+        }
+    }
+    
+    return dasynq::rearm::NOOP;
+}
+
+#endif
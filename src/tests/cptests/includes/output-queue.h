@@ -0,0 +1,309 @@
+#ifndef DINIT_OUTPUT_QUEUE_H
+#define DINIT_OUTPUT_QUEUE_H 1
+
+#include <new>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+
+#include <sys/uio.h>
+
+#include "baseproc-sys.h"
+
+// A queue of data to be written to a (non-blocking) file descriptor, such as the outgoing packets
+// for a control connection.
+//
+// Data is stored contiguously in a chain of blocks, so that queueing a (typically small) packet
+// normally requires no allocation. Queued data is written using a single writev call covering
+// several blocks. A block emptied by writing is retained for re-use (only one such block is
+// retained, so that memory use drops back once the queue has drained).
+class output_queue
+{
+    public:
+    // Maximum number of blocks written by a single write_to call:
+    static constexpr int max_iov = 16;
+
+    private:
+    // Normal block capacity (a larger block is allocated for data which doesn't otherwise fit):
+    static constexpr size_t block_capacity = 4096 - 32;
+
+    struct block
+    {
+        block *next;
+        size_t capacity;
+        size_t start;  // start of unwritten data
+        size_t end;    // end of data
+
+        char *data() noexcept
+        {
+            return reinterpret_cast<char *>(this + 1);
+        }
+    };
+
+    block *head = nullptr;
+    block *tail = nullptr;
+    block *spare = nullptr;
+    size_t length = 0;
+
+    // Allocate a block with at least the given capacity. Throws std::bad_alloc.
+    block *alloc_block(size_t min_capacity)
+    {
+        if (spare != nullptr && spare->capacity >= min_capacity) {
+            block *b = spare;
+            spare = nullptr;
+            return b;
+        }
+
+        size_t capacity = min_capacity;
+        if (capacity < block_capacity) {
+            capacity = block_capacity;
+        }
+        block *b = static_cast<block *>(::operator new(sizeof(block) + capacity));
+        b->capacity = capacity;
+        return b;
+    }
+
+    void release_block(block *b) noexcept
+    {
+        if (spare == nullptr && b->capacity == block_capacity) {
+            spare = b;
+        }
+        else {
+            ::operator delete(b);
+        }
+    }
+
+    public:
+    output_queue() noexcept { }
+
+    output_queue(const output_queue &) = delete;
+    output_queue &operator=(const output_queue &) = delete;
+
+    ~output_queue() noexcept
+    {
+        clear();
+        if (spare != nullptr) {
+            ::operator delete(spare);
+        }
+    }
+
+    bool empty() const noexcept
+    {
+        return length == 0;
+    }
+
+    // The amount of queued (unwritten) data, in bytes
+    size_t size() const noexcept
+    {
+        return length;
+    }
+
+    // Append data to the queue. Throws std::bad_alloc (in which case the queue is unchanged).
+    void append(const char *data, size_t len)
+    {
+        size_t tail_space = (tail == nullptr) ? 0 : (tail->capacity - tail->end);
+        block *new_block = nullptr;
+        if (len > tail_space) {
+            new_block = alloc_block(len - tail_space);
+            new_block->next = nullptr;
+            new_block->start = 0;
+            new_block->end = 0;
+        }
+
+        if (tail_space != 0) {
+            size_t tail_len = (len < tail_space) ? len : tail_space;
+            memcpy(tail->data() + tail->end, data, tail_len);
+            tail->end += tail_len;
+            data += tail_len;
+            len -= tail_len;
+            length += tail_len;
+        }
+
+        if (new_block != nullptr) {
+            memcpy(new_block->data(), data, len);
+            new_block->end = len;
+            length += len;
+            if (tail == nullptr) {
+                head = new_block;
+            }
+            else {
+                tail->next = new_block;
+            }
+            tail = new_block;
+        }
+    }
+
+    // Fill in (up to max_count) io vectors describing the queued data, from the front of the queue.
+    // Returns the number of vectors filled in; the total length they describe is stored in
+    // 'iov_len'.
+    int get_iov(struct iovec *iov, int max_count, size_t &iov_len) const noexcept
+    {
+        int iov_count = 0;
+        iov_len = 0;
+        for (block *b = head; b != nullptr && iov_count < max_count; b = b->next) {
+            iov[iov_count].iov_base = b->data() + b->start;
+            iov[iov_count].iov_len = b->end - b->start;
+            iov_len += b->end - b->start;
+            ++iov_count;
+        }
+        return iov_count;
+    }
+
+    // Write as much queued data as possible to the given file descriptor, and remove the written
+    // data from the queue. Returns the number of bytes written, or -1 (with errno set) on error.
+    ssize_t write_to(int fd) noexcept
+    {
+        struct iovec iov[max_iov];
+        size_t iov_len;
+        int iov_count = get_iov(iov, max_iov, iov_len);
+
+        if (iov_count == 0) {
+            return 0;
+        }
+
+        ssize_t written = bp_sys::writev(fd, iov, iov_count);
+        if (written > 0) {
+            consume(written);
+        }
+        return written;
+    }
+
+    // Remove the given number of bytes (no more than size()) from the front of the queue.
+    void consume(size_t amount) noexcept
+    {
+        length -= amount;
+        while (amount != 0) {
+            size_t block_len = head->end - head->start;
+            if (amount < block_len) {
+                head->start += amount;
+                return;
+            }
+            amount -= block_len;
+            block *b = head;
+            head = b->next;
+            if (head == nullptr) {
+                tail = nullptr;
+            }
+            release_block(b);
+        }
+    }
+
+    // Discard all queued data.
+    void clear() noexcept
+    {
+        while (head != nullptr) {
+            block *b = head;
+            head = b->next;
+            release_block(b);
+        }
+        tail = nullptr;
+        length = 0;
+    }
+};
+
+// A fixed-capacity ring buffer of fixed-size packets, which are queued for writing. No allocation
+// is performed; when the ring is full, the owner must either replace a queued packet (see
+// replace_matching) or move the queued packets elsewhere (see copy_to) before pushing another.
+//
+// The first packet may have been partially written (via consume()); such a packet is never
+// replaced.
+template <unsigned PKT_SIZE, unsigned NUM_PKTS>
+class packet_ring
+{
+    static constexpr unsigned buf_size = PKT_SIZE * NUM_PKTS;
+
+    char buf[buf_size];
+    unsigned start = 0;   // offset of first unwritten byte
+    unsigned length = 0;  // number of unwritten bytes
+
+    public:
+    packet_ring() noexcept { }
+
+    packet_ring(const packet_ring &) = delete;
+    packet_ring &operator=(const packet_ring &) = delete;
+
+    bool empty() const noexcept
+    {
+        return length == 0;
+    }
+
+    bool full() const noexcept
+    {
+        return length > buf_size - PKT_SIZE;
+    }
+
+    // The amount of queued (unwritten) data, in bytes
+    unsigned size() const noexcept
+    {
+        return length;
+    }
+
+    // Add a packet to the end of the ring, which must not be full.
+    void push(const char *pkt) noexcept
+    {
+        unsigned pos = (start + length) % buf_size;
+        memcpy(buf + pos, pkt, PKT_SIZE);
+        length += PKT_SIZE;
+    }
+
+    // If there is a (wholly unwritten) queued packet with the same key as the given packet, where
+    // the key is the 'key_len' bytes at 'key_offs', remove it, and add the given packet to the
+    // end of the ring. Returns true if a packet was replaced, false otherwise.
+    bool replace_matching(const char *pkt, unsigned key_offs, unsigned key_len) noexcept
+    {
+        // Packets are always aligned to PKT_SIZE within the buffer; skip any partial packet:
+        unsigned first = (start + PKT_SIZE - 1) / PKT_SIZE * PKT_SIZE;
+        unsigned end = start + length;
+        for (unsigned p = first; p < end; p += PKT_SIZE) {
+            char *qpkt = buf + (p % buf_size);
+            if (memcmp(qpkt + key_offs, pkt + key_offs, key_len) == 0) {
+                // Shift the following packets down over the matching one, and put the new packet
+                // at the end:
+                for (unsigned q = p + PKT_SIZE; q < end; q += PKT_SIZE) {
+                    memcpy(buf + ((q - PKT_SIZE) % buf_size), buf + (q % buf_size), PKT_SIZE);
+                }
+                memcpy(buf + ((end - PKT_SIZE) % buf_size), pkt, PKT_SIZE);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Fill in (at most 2) io vectors describing the queued data. Returns the number of vectors
+    // filled in.
+    int get_iov(struct iovec *iov) noexcept
+    {
+        if (length == 0) return 0;
+        unsigned first_len = std::min(length, buf_size - start);
+        iov[0].iov_base = buf + start;
+        iov[0].iov_len = first_len;
+        if (first_len == length) return 1;
+        iov[1].iov_base = buf;
+        iov[1].iov_len = length - first_len;
+        return 2;
+    }
+
+    // Copy all queued data into 'dest', which must have room for size() bytes.
+    void copy_to(char *dest) const noexcept
+    {
+        unsigned first_len = std::min(length, buf_size - start);
+        memcpy(dest, buf + start, first_len);
+        memcpy(dest + first_len, buf, length - first_len);
+    }
+
+    // Remove the given number of bytes (no more than size()) from the front of the ring.
+    void consume(unsigned amount) noexcept
+    {
+        length -= amount;
+        start = (length == 0) ? 0 : (start + amount) % buf_size;
+    }
+
+    // Discard all queued data.
+    void clear() noexcept
+    {
+        start = 0;
+        length = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef DINIT_SERVICE_DIR_H
+#define DINIT_SERVICE_DIR_H 1
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <new>
+
+#include <cerrno>
+
+#include <sys/types.h>
+#include <dirent.h>
+
+// Read the names of the entries in a directory (excluding "." and "..") into a sorted vector.
+// Returns false, with errno set, if the directory cannot be opened or read, or on memory allocation
+// failure (errno = ENOMEM).
+inline bool read_dir_listing(const char *path, std::vector<std::string> &names) noexcept
+{
+    names.clear();
+
+    DIR *dir = opendir(path);
+    if (dir == nullptr) {
+        return false;
+    }
+
+    try {
+        while (true) {
+            errno = 0;
+            dirent *dent = readdir(dir);
+            if (dent == nullptr) break;
+            const char *name = dent->d_name;
+            if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+                continue;
+            }
+            names.emplace_back(name);
+        }
+        if (errno != 0) {
+            int read_errno = errno;
+            closedir(dir);
+            names.clear();
+            errno = read_errno;
+            return false;
+        }
+        std::sort(names.begin(), names.end());
+    }
+    catch (std::bad_alloc &) {
+        closedir(dir);
+        names.clear();
+        errno = ENOMEM;
+        return false;
+    }
+
+    closedir(dir);
+    return true;
+}
+
+// A service directory entry, tracking the directory as a nul-terminated string, which may either
+// be static or dynamically allocated (via new char[...]).
+//
+// A snapshot of the directory contents can be taken, so that names not present in the directory can
+// be ruled out without accessing the filesystem. The snapshot is not updated automatically.
+class dir_entry
+{
+    const char *dir;
+    bool dir_dyn_allocd;  // dynamically allocated?
+
+    std::vector<std::string> listing; // sorted names in the directory (if have_listing)
+    bool have_listing = false;
+
+    public:
+    dir_entry(const char *dir_p, bool dir_dyn_allocd_p) :
+        dir(dir_p), dir_dyn_allocd(dir_dyn_allocd_p)
+    { }
+
+    dir_entry(dir_entry &&other) : listing(std::move(other.listing)), have_listing(other.have_listing)
+    {
+        dir = other.dir;
+        dir_dyn_allocd = other.dir_dyn_allocd;
+        other.dir_dyn_allocd = false;
+        other.have_listing = false;
+    }
+
+    dir_entry(const dir_entry &other) = delete;
+
+    ~dir_entry()
+    {
+        if (dir_dyn_allocd) {
+            delete[] dir;
+        }
+    }
+
+    const char *get_dir() const
+    {
+        return dir;
+    }
+
+    // Take a snapshot of the directory contents, replacing any previous snapshot. A directory which
+    // does not exist is treated as empty. If the directory cannot be read for some other reason, no
+    // snapshot is kept, and may_contain() will return true for any name.
+    void take_listing() noexcept
+    {
+        have_listing = read_dir_listing(dir, listing) || errno == ENOENT || errno == ENOTDIR;
+    }
+
+    bool has_listing() const noexcept
+    {
+        return have_listing;
+    }
+
+    // Get the (sorted) names in the snapshot of the directory contents.
+    const std::vector<std::string> &get_listing() const noexcept
+    {
+        return listing;
+    }
+
+    // Discard the snapshot of the directory contents.
+    void clear_listing() noexcept
+    {
+        listing.clear();
+        have_listing = false;
+    }
+
+    // Check whether the directory may contain an entry with the given name, according to the
+    // snapshot. Returns true if no snapshot has been taken.
+    bool may_contain(const char *name) const noexcept
+    {
+        return !have_listing || std::binary_search(listing.begin(), listing.end(), name);
+    }
+};
+
+using service_dir_pathlist = std::vector<dir_entry>;
+
+#endif
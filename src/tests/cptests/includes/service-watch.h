@@ -0,0 +1,17 @@
+#ifndef DINIT_SERVICE_WATCH_H
+#define DINIT_SERVICE_WATCH_H 1
+
+class dirload_service_set;
+
+// Automatic reloading of services whose description files change.
+//
+// The service directories are watched for changes (via inotify; this is only supported on Linux).
+// Changes are collected until none have occurred for a short period, and then each loaded service
+// whose description file was written or replaced is reloaded, exactly as for an explicit reload
+// request. Changes within dependency directories (waits-for.d) are not detected.
+
+// Begin watching the service directories of the given service set. Returns false, with errno set,
+// if no service directory could be watched.
+bool start_service_dir_watch(dirload_service_set *services) noexcept;
+
+#endif
@@ -0,0 +1,1612 @@
+#ifndef SERVICE_H
+#define SERVICE_H
+
+#include <string>
+#include <list>
+#include <vector>
+#include <csignal>
+#include <unordered_set>
+#include <unordered_map>
+#include <map>
+#include <algorithm>
+#include <iterator>
+#include <cstddef>
+
+#include "dasynq.h"
+
+#include "dinit.h"
+#include "control.h"
+#include "service-listener.h"
+#include "service-constants.h"
+#include "load-service.h"
+#include "dinit-ll.h"
+#include "dinit-log.h"
+#include "service-dir.h"
+#include "status-page.h"
+#include "service-timeline.h"
+#include "start-history.h"
+
+/*
+ * This header defines service_record, a data record maintaining information about a service,
+ * and service_set, a set of interdependent service records. It also defines some associated
+ * types and exceptions.
+ *
+ * Service states
+ * --------------
+ * Services have both a current state and a desired state. The desired state can be
+ * either STARTED or STOPPED. The current state can also be STARTING or STOPPING.
+ * A service can be "pinned" in either the STARTED or STOPPED states to prevent it
+ * from leaving that state until it is unpinned.
+ *
+ * The total state is a combination of the two, current and desired:
+ *      STOPPED/STOPPED  : stopped and will remain stopped
+ *      STOPPED/STARTED  : stopped (pinned), must be unpinned to start
+ *      STARTING/STARTED : starting, but not yet started. Dependencies may also be starting.
+ *      STARTING/STOPPED : as above, but the service will be stopped again as soon as it has
+ *                         completed startup.
+ *      STARTED/STARTED  : running and will continue running.
+ *      STARTED/STOPPED  : started (pinned), must be unpinned to stop
+ *      STOPPING/STOPPED : stopping and will stop. Dependents may be stopping.
+ *      STOPPING/STARTED : as above, but the service will be re-started again once it stops.
+ *
+ * A scripted service is in the STARTING/STOPPING states during the script execution.
+ * A process service is in the STOPPING state when it has been signalled to stop, and is
+ * in the STARTING state when waiting for dependencies to start or for the exec() call in
+ * the forked child to complete and return a status.
+ *
+ * Interrupted transitions
+ * -----------------------
+ * A service that is STOPPING may be issued a start order, or a service that is STARTING may be
+ * issued a stop. In some cases a STOPPING or STARTING transition can be interrupted and immediately
+ * switch to the other kind of transition. We don't normally want to do this if we're waiting on an
+ * external process, since simply killing that process might leave a mess. However, if a service is
+ * waiting for its dependencies or dependents, its start or stop can usually be interrupted.
+ *
+ * Acquisition/release:
+ * ------------------
+ * Each service has a dependent-count ("required_by"). This starts at 0, adds 1 if the service has
+ * explicitly been started (i.e. "start_explicit" is true), and adds 1 for each dependent service
+ * which is not STOPPED/STOPPING (including dependents via a "soft" dependency relationship).
+ * When required_by transitions to 0, the service is stopped and it will release its own dependencies
+ * (unless it is pinned started). Conversely, when required_by transitions from 0 to 1, the service is
+ * started and dependencies will be required (unless pinned stopped).
+ *
+ * In general, therefore, the dependent-count determines the target state (STARTED if the count is greater
+ * than 0, otherwise STOPPED). Explicit activation counts effectively increments the count and sets the
+ * target state as STARTED.
+ *
+ * An exception is that setting the target state to STOPPED is used to inhibit restart. This is propagated
+ * to dependent services (i.e. their target state will also be set to STOPPED). The required_by count for a
+ * service in this scenario will settle to 0 anyway (because dependents will be stopped).
+ *
+ * Another exception is that a service may become STOPPED while it is still required (for example if a
+ * process terminates unexpectedly). This will force hard dependents to stop also, so again, the required_by
+ * count will settle to 0, unless the service is active and set to auto-restart (or a dependent is).
+ *
+ * When a service stops, any soft dependency links to its dependents must be broken, or otherwise the
+ * target state will remain as STARTED and the service will always restart. If the auto-restart option is
+ * enabled for the service, or if the service is explicitly being restarted (restart == true), this is
+ * actually the desired behaviour, and so in these cases the dependency links are not broken.
+ *
+ * Force stop
+ * ----------
+ * A service can be issued a stop-and-take down order (via `stop(true)'); this will first stop
+ * dependent services, which may restart and cancel the stop of the former service. However, a
+ * service can be force-stopped, which means that its stop process cannot be cancelled (though
+ * it may still be put in a desired state of STARTED, meaning it will start immediately upon
+ * stopping). Force-stop is achieved via a flag in the service record which is checked before
+ * interrupting a stop operation.
+ *
+ * Pinning
+ * -------
+ * A service may be "pinned" in either STARTED or STOPPED states (or even both). Once it
+ * reaches a pinned state, a service will not leave that state. A service that is pinned
+ * STOPPED cannot be started or marked active and any attempt to start it will fail. A service
+ * that is pinned STARTED remains started even if the service is not marked active and no other
+ * active service depends on it; this is the only scenario in which a service with a required_by
+ * count of 0 will remain started. Once unpinned the service will stop.
+ *
+ * (Note that pinning prevents, but never causes, state transition).
+ *
+ * The priority of the different state deciders is:
+ *  - pins
+ *  - force stop flag
+ *  - desired state (which is manipulated by require/release operations)
+ *
+ * So a forced stop cannot occur until the service is not pinned started, for instance. (if
+ * pinned, the forced stop remains pending until the pin is released).
+ *
+ * Two-phase transition
+ * --------------------
+ * Transition between states occurs in two phases: propagation and execution. In both phases
+ * a linked-list queue is used to keep track of which services need processing; this avoids
+ * recursion (which would be of unknown depth and therefore liable to cause stack overflow).
+ *
+ * In the propagation phase, acquisition/release messages are processed, and desired state may be
+ * altered accordingly. Start and stop requests are also propagated in this phase. The state may
+ * be set to STARTING or STOPPING to reflect the desired state, but will never be set to STARTED
+ * or STOPPED (that happens in the execution phase).
+ *
+ * The two-phase transition is needed to avoid problem where a service that becomes STOPPED has
+ * an incorrect acquisition count, which may cause it to restart when it should not. The
+ * propagation phase allows the acquisition count to settle before the transition to the STOPPED
+ * state occurs, and the decision whether to restart can then be made based on the (correct)
+ * acquisition count. See "acquisition/release" above for details of when this can occur.
+ *
+ * Propagation variables:
+ *   prop_acquire:  the service has transitioned to an acquired state and must issue an acquire
+ *                  on its dependencies
+ *   prop_release:  the service has transitioned to a released state and must issue a release on
+ *                  its dependencies.
+ *
+ *   prop_start:    the service should start
+ *   prop_stop:     the service should stop
+ *
+ * Note that "prop_acquire"/"prop_release" form a pair which cannot both be set at the same time
+ * which is enforced via explicit checks. For "prop_start"/"prop_stop" this occurs implicitly.
+ *
+ * In the execution phase, actions are taken to achieve the desired state. Actual state may
+ * transition according to the current and desired states. Processes can be sent signals, etc
+ * in order to stop them.
+ */
+
+class service_record;
+class service_set;
+class base_process_service;
+class service_cache;
+
+/* Service dependency record */
+class service_dep
+{
+    service_record * from;
+    service_record * to;
+
+    public:
+    /* Whether the 'from' service is waiting for the 'to' service to start */
+    bool waiting_on;
+    /* Whether the 'from' service is holding an acquire on the 'to' service */
+    bool holding_acq;
+
+    const dependency_type dep_type;
+
+    // Check if the dependency is a hard dependency (including milestone still waiting).
+    bool is_hard()
+    {
+        return dep_type == dependency_type::REGULAR
+                || (dep_type == dependency_type::MILESTONE && waiting_on);
+    }
+
+    service_dep(service_record * from, service_record * to, dependency_type dep_type_p) noexcept
+            : from(from), to(to), waiting_on(false), holding_acq(false), dep_type(dep_type_p)
+    {  }
+
+    service_dep(const service_dep &) = delete;
+    void operator=(const service_dep &) = delete;
+
+    service_record * get_from() const noexcept
+    {
+        return from;
+    }
+
+    service_record * get_to() const noexcept
+    {
+        return to;
+    }
+
+    void set_to(service_record *new_to) noexcept
+    {
+        to = new_to;
+    }
+
+    // Records are allocated from a pool (see service.cc). May throw std::bad_alloc.
+    static void *operator new(std::size_t size);
+    static void operator delete(void *p) noexcept;
+};
+
+// The dependencies of a service: an array of pointers to service_dep records, iterated as if it
+// held the records themselves. Each record is allocated separately (from a pool, so that the
+// dependencies of a service are normally adjacent in memory) and is owned by the list; records
+// keep their address when other dependencies are added or removed, since dependents refer to
+// them. Inserting or removing a dependency invalidates iterators.
+class service_dep_list
+{
+    using ptr_vector = std::vector<service_dep *>;
+    ptr_vector deps;
+
+    public:
+    class iterator
+    {
+        friend class service_dep_list;
+        ptr_vector::iterator i;
+
+        public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = service_dep;
+        using difference_type = std::ptrdiff_t;
+        using pointer = service_dep *;
+        using reference = service_dep &;
+
+        iterator() noexcept { }
+        iterator(ptr_vector::iterator i_p) noexcept : i(i_p) { }
+
+        service_dep &operator*() const noexcept { return **i; }
+        service_dep *operator->() const noexcept { return *i; }
+        iterator &operator++() noexcept { ++i; return *this; }
+        iterator operator++(int) noexcept { return iterator(i++); }
+        iterator operator+(difference_type n) const noexcept { return iterator(i + n); }
+        bool operator==(const iterator &other) const noexcept { return i == other.i; }
+        bool operator!=(const iterator &other) const noexcept { return i != other.i; }
+    };
+
+    service_dep_list() noexcept { }
+    service_dep_list(const service_dep_list &) = delete;
+    void operator=(const service_dep_list &) = delete;
+
+    ~service_dep_list() noexcept
+    {
+        clear();
+    }
+
+    iterator begin() noexcept { return iterator(deps.begin()); }
+    iterator end() noexcept { return iterator(deps.end()); }
+    size_t size() const noexcept { return deps.size(); }
+    bool empty() const noexcept { return deps.empty(); }
+    service_dep &front() noexcept { return *deps.front(); }
+
+    // Reserve space for the given total number of dependencies. May throw std::bad_alloc.
+    void reserve(size_t n)
+    {
+        deps.reserve(n);
+    }
+
+    // Create a dependency record and insert it before the given position. May throw std::bad_alloc.
+    iterator emplace(iterator pos, service_record *from, service_record *to, dependency_type dep_type)
+    {
+        service_dep *dep = new service_dep(from, to, dep_type);
+        try {
+            return iterator(deps.insert(pos.i, dep));
+        }
+        catch (...) {
+            delete dep;
+            throw;
+        }
+    }
+
+    // Remove and destroy the dependency record at the given position, returning the position of
+    // the following record.
+    iterator erase(iterator pos) noexcept
+    {
+        delete *pos.i;
+        return iterator(deps.erase(pos.i));
+    }
+
+    void pop_back() noexcept
+    {
+        delete deps.back();
+        deps.pop_back();
+    }
+
+    void clear() noexcept
+    {
+        for (service_dep *dep : deps) {
+            delete dep;
+        }
+        deps.clear();
+    }
+};
+
+/* preliminary service dependency information */
+class prelim_dep
+{
+    public:
+    service_record * const to;
+    dependency_type const dep_type;
+
+    prelim_dep(service_record *to_p, dependency_type dep_type_p) : to(to_p), dep_type(dep_type_p)
+    {
+        // (constructor)
+    }
+};
+
+// service_record: base class for service record containing static information
+// and current state of each service.
+//
+// This abstract base class defines the dependency behaviour of services. The actions to actually bring a
+// service up or down are specified by subclasses in the virtual methods (see especially bring_up() and
+// bring_down()).
+//
+class service_record
+{
+    protected:
+    using string = std::string;
+    using time_val = dasynq::time_val;
+    
+    private:
+    string service_name;
+    service_type_t record_type;  // service_type_t::DUMMY, PROCESS, SCRIPTED, or INTERNAL
+    uint32_t service_id = 0;     // identifier assigned by the service set (0 if not yet assigned)
+
+    // 'service_state' can be any valid state: STARTED, STARTING, STOPPING, STOPPED.
+    // 'desired_state' is only set to final states: STARTED or STOPPED.
+    service_state_t service_state = service_state_t::STOPPED;
+    service_state_t desired_state = service_state_t::STOPPED;
+
+    // Time (monotonic clock) at which the service entered its current state, and the total time
+    // spent in each state, not counting the time since the current state was entered:
+    time_val state_entered_time;
+    time_val state_durations[4] = { {0, 0}, {0, 0}, {0, 0}, {0, 0} };
+
+    // Time (monotonic clock) at which the service itself began starting (its dependencies having
+    // started), used to record the duration of the start in the start history:
+    time_val bring_up_time;
+
+    // Record a change of state: add the time spent in the current state to its total, and add the
+    // transition to the service timeline.
+    void record_state_change(service_state_t new_state) noexcept;
+
+    protected:
+    service_flags_t onstart_flags;
+
+    string logfile;           // log file name, empty string specifies /dev/null
+    
+    bool auto_restart : 1;    // whether to restart this (process) if it dies unexpectedly
+    bool smooth_recovery : 1; // whether the service process can restart without bringing down service
+    
+    bool pinned_stopped : 1;
+    bool pinned_started : 1;
+    bool waiting_for_deps : 1;  // if STARTING, whether we are waiting for dependencies/console
+                                // if STOPPING, whether we are waiting for dependents to stop
+    bool waiting_for_console : 1;   // waiting for exclusive console access (while STARTING)
+    bool have_console : 1;      // whether we have exclusive console access (STARTING/STARTED)
+    bool waiting_for_start_slot : 1;  // waiting for a start slot (while STARTING)
+    bool have_start_slot : 1;   // whether we hold a start slot (STARTING)
+    bool waiting_for_execstat : 1;  // if we are waiting for exec status after fork()
+    bool start_explicit : 1;    // whether we are are explicitly required to be started
+
+    bool prop_require : 1;      // require must be propagated
+    bool prop_release : 1;      // release must be propagated
+    bool prop_failure : 1;      // failure to start must be propagated
+    bool prop_start   : 1;
+    bool prop_stop    : 1;
+
+    bool start_failed : 1;      // failed to start (reset when begins starting)
+    bool start_skipped : 1;     // start was skipped by interrupt
+    
+    bool in_auto_restart : 1;
+
+    int required_by = 0;        // number of dependents wanting this service to be started
+
+    uint32_t restart_count = 0; // number of times the service has restarted (incl. smooth recovery)
+
+    // list of dependencies
+    typedef service_dep_list dep_list;
+    
+    // list of dependents
+    typedef std::vector<service_dep *> dpt_list;
+    
+    dep_list depends_on;  // services this one depends on
+    dpt_list dependents;  // services depending on this one
+    
+    service_set *services; // the set this service belongs to
+    
+    std::unordered_set<service_listener *> listeners;
+    
+    // Process services:
+    bool force_stop; // true if the service must actually stop. This is the
+                     // case if for example the process dies; the service,
+                     // and all its dependencies, MUST be stopped.
+    
+    int term_signal = SIGTERM;  // signal to use for process termination
+    
+    string socket_path; // path to the socket for socket-activation service
+    int socket_perms;   // socket permissions ("mode")
+    uid_t socket_uid = -1;  // socket user id or -1
+    gid_t socket_gid = -1;  // socket group id or -1
+
+    stopped_reason_t stop_reason = stopped_reason_t::NORMAL;  // reason why stopped
+
+    string start_on_completion;  // service to start when this one completes
+
+    // Data for use by service_set
+    public:
+    
+    // Console queue.
+    lld_node<service_record> console_queue_node;
+
+    // Start slot queue, and priority within it (see service_set::append_start_slot_queue)
+    lld_node<service_record> start_slot_queue_node;
+    uint64_t start_priority = 0;
+    
+    // Propagation and start/stop queues
+    lls_node<service_record> prop_queue_node;
+    lls_node<service_record> stop_queue_node;
+
+    // Slot in the status page (if any)
+    uint32_t status_slot = status_page::no_slot;
+    
+    protected:
+
+    // Service has actually stopped (includes having all dependents
+    // reaching STOPPED state).
+    void stopped() noexcept;
+    
+    // Service has successfully started
+    void started() noexcept;
+    
+    // Service failed to start (only called when in STARTING state).
+    //   dep_failed: whether failure is recorded due to a dependency failing
+    //   immediate_stop: whether to set state as STOPPED and handle complete stop.
+    void failed_to_start(bool dep_failed = false, bool immediate_stop = true) noexcept;
+    
+    // Service stopped (failed), unrecoverably; dependents should not auto-restart
+    void unrecoverable_stop() noexcept;
+
+    // A dependency has reached STARTED state
+    void dependency_started() noexcept;
+    
+    void all_deps_started() noexcept;
+
+    // Start all dependencies, return true if all have started
+    bool start_check_dependencies() noexcept;
+
+    // Check whether all dependencies have started (i.e. whether we can start now)
+    bool check_deps_started() noexcept;
+
+    // Whether a STOPPING service can immediately transition to STARTED.
+    bool can_interrupt_stop() noexcept
+    {
+        return waiting_for_deps && ! force_stop;
+    }
+
+    // A dependent has reached STOPPED state
+    void dependent_stopped() noexcept;
+
+    // check if all dependents have stopped
+    bool stop_check_dependents() noexcept;
+    
+    // issue a stop to all dependents, return true if they are all already stopped
+    bool stop_dependents(bool for_restart) noexcept;
+    
+    void require() noexcept;
+    void release(bool issue_stop = true) noexcept;
+    void release_dependencies() noexcept;
+    
+    // Check if service is, fundamentally, stopped. It is either in the stopped state, or
+    // starting but waiting for dependents, i.e. it can be trivially set to stopped state.
+    bool is_fundamentally_stopped() noexcept
+    {
+        return service_state == service_state_t::STOPPED
+            || (service_state == service_state_t::STARTING && waiting_for_deps);
+    }
+    
+    // Notify listeners for this service, and for all services in the set, of an event.
+    inline void notify_listeners(service_event_t event) noexcept;
+    
+    // Queue to run on the console. 'acquired_console()' will be called when the console is available.
+    // Has no effect if the service has already queued for console.
+    void queue_for_console() noexcept;
+    
+    // Release console (console must be currently held by this service)
+    void release_console() noexcept;
+
+    // Queue for a start slot. 'acquired_start_slot()' will be called when a slot is available.
+    // Has no effect if the service has already queued for a start slot.
+    void queue_for_start_slot() noexcept;
+
+    // Release start slot (must be currently held by this service)
+    void release_start_slot() noexcept;
+    
+    // Started state reached
+    bool process_started() noexcept;
+
+    // Initiate definite startup
+    void initiate_start() noexcept;
+
+    // Called on transition of desired state from stopped to started (or unpinned stop)
+    void do_start() noexcept;
+
+    // Begin stopping, release activation.
+    void do_stop(bool with_restart = false) noexcept;
+
+    // Set the service state
+    void set_state(service_state_t new_state) noexcept
+    {
+        if (new_state != service_state) {
+            record_state_change(new_state);
+        }
+        service_state = new_state;
+        status_changed();
+    }
+
+    // Set the target (desired) state
+    void set_target_state(service_state_t new_state) noexcept
+    {
+        desired_state = new_state;
+        status_changed();
+    }
+
+    // Virtual functions, to be implemented by service implementations:
+
+    // Do any post-dependency startup; return false on failure. Should return true if service
+    // has started or is in the process of starting. Will only be called once can_proceed_to_start()
+    // returns true.
+    virtual bool bring_up() noexcept;
+
+    // All dependents have stopped, and this service should proceed to stop.
+    virtual void bring_down() noexcept;
+
+    // Whether starting the service requires a start slot (i.e. whether starting is subject to the
+    // limit on the number of services starting concurrently).
+    virtual bool uses_start_slot() noexcept
+    {
+        return false;
+    }
+
+    // Whether a STARTING service can immediately transition to STOPPED (as opposed to
+    // having to wait for it reach STARTED and then go through STOPPING). Note that the
+    // waiting_for_deps flag being set may override this check.
+    virtual bool can_interrupt_start() noexcept
+    {
+        return waiting_for_deps;
+    }
+
+    // Interrupt startup. Returns true if service start is fully cancelled; returns false if cancel order
+    // issued but service has not yet responded (state will be set to STOPPING).
+    virtual bool interrupt_start() noexcept;
+
+    // The service is becoming inactive - i.e. it has stopped and will not be immediately restarted. Perform
+    // any appropriate cleanup.
+    virtual void becoming_inactive() noexcept { }
+
+    public:
+
+    service_record(service_set *set, const string &name)
+        : service_name(name), service_state(service_state_t::STOPPED),
+            desired_state(service_state_t::STOPPED), auto_restart(false), smooth_recovery(false),
+            pinned_stopped(false), pinned_started(false), waiting_for_deps(false),
+            waiting_for_console(false), have_console(false), waiting_for_start_slot(false),
+            have_start_slot(false), waiting_for_execstat(false),
+            start_explicit(false), prop_require(false), prop_release(false), prop_failure(false),
+            prop_start(false), prop_stop(false), start_failed(false), start_skipped(false),
+            in_auto_restart(false), force_stop(false)
+    {
+        services = set;
+        record_type = service_type_t::DUMMY;
+        socket_perms = 0;
+        event_loop.get_time(state_entered_time, clock_type::MONOTONIC);
+    }
+
+    service_record(service_set *set, const string &name, service_type_t record_type_p,
+            const std::list<prelim_dep> &deplist_p)
+        : service_record(set, name)
+    {
+        services = set;
+        service_name = name;
+        this->record_type = record_type_p;
+
+        try {
+            depends_on.reserve(deplist_p.size());
+            for (auto & pdep : deplist_p) {
+                auto b = depends_on.emplace(depends_on.end(), this, pdep.to, pdep.dep_type);
+                try {
+                    pdep.to->dependents.push_back(&(*b));
+                }
+                catch (...) {
+                    // we'll roll back one now and re-throw:
+                    depends_on.pop_back();
+                    throw;
+                }
+            }
+        }
+        catch (...) {
+            for (auto & dep : depends_on) {
+                dep.get_to()->dependents.pop_back();
+            }
+            throw;
+        }
+    }
+
+    service_record(const service_record &) = delete;
+    void operator=(const service_record &) = delete;
+
+    virtual ~service_record() noexcept
+    {
+    }
+    
+    // Get the type of this service record
+    service_type_t get_type() noexcept
+    {
+        return record_type;
+    }
+
+    // Get the identifier of this service record within its service set. Identifiers are assigned
+    // in increasing order as services are added to the set and are not re-used (a reloaded
+    // service which replaces the original record retains its identifier).
+    uint32_t get_id() noexcept
+    {
+        return service_id;
+    }
+
+    void set_id(uint32_t id) noexcept
+    {
+        service_id = id;
+    }
+
+    // begin transition from stopped to started state or vice versa depending on current and desired state
+    void execute_transition() noexcept;
+    
+    void do_propagation() noexcept;
+
+    // Console is available.
+    void acquired_console() noexcept;
+
+    // Start slot is available.
+    void acquired_start_slot() noexcept;
+
+    // Get the length of the critical path from the start of this service: the longest chain of
+    // services which are waiting (directly or indirectly) for this service to start, including
+    // this service, where the length of each service is its expected start duration in
+    // milliseconds (at least 1). The lengths found for this and other services are recorded in
+    // 'lengths' (and those already recorded are used). May throw std::bad_alloc.
+    uint64_t get_critical_path_length(std::unordered_map<service_record *, uint64_t> &lengths);
+    
+    // Get the target (aka desired) state.
+    service_state_t get_target_state() noexcept
+    {
+        return desired_state;
+    }
+
+    // Is the service explicitly marked active?
+    bool is_marked_active() noexcept
+    {
+        return start_explicit;
+    }
+
+    // Set logfile, should be done before service is started
+    void set_log_file(const string &logfile)
+    {
+        this->logfile = logfile;
+    }
+    
+    void set_log_file(std::string &&logfile) noexcept
+    {
+        this->logfile = std::move(logfile);
+    }
+
+    // Set whether this service should automatically restart when it dies
+    void set_auto_restart(bool auto_restart) noexcept
+    {
+        this->auto_restart = auto_restart;
+    }
+    
+    void set_smooth_recovery(bool smooth_recovery) noexcept
+    {
+        this->smooth_recovery = smooth_recovery;
+    }
+    
+    // Set "on start" flags (commands)
+    void set_flags(service_flags_t flags) noexcept
+    {
+        this->onstart_flags = flags;
+    }
+
+    service_flags_t get_flags() noexcept
+    {
+        return onstart_flags;
+    }
+
+    void set_socket_details(string &&socket_path, int socket_perms, uid_t socket_uid, uid_t socket_gid)
+            noexcept
+    {
+        this->socket_path = std::move(socket_path);
+        this->socket_perms = socket_perms;
+        this->socket_uid = socket_uid;
+        this->socket_gid = socket_gid;
+    }
+
+    // Set the service that this one "chains" to. When this service completes, the named service is started.
+    void set_chain_to(string &&chain_to) noexcept
+    {
+        start_on_completion = std::move(chain_to);
+    }
+
+    const std::string &get_name() const noexcept { return service_name; }
+    service_state_t get_state() const noexcept { return service_state; }
+    
+    void start() noexcept;  // start the service
+    void stop(bool bring_down = true) noexcept;   // stop the service
+    bool restart() noexcept; // restart the service, returns true iff restart issued
+    
+    void forced_stop() noexcept; // force-stop this service and all dependents
+    
+    // Pin the service in "started" state (when it reaches the state)
+    void pin_start() noexcept
+    {
+        pinned_started = true;
+    }
+    
+    // Pin the service in "stopped" state (when it reaches the state)
+    void pin_stop() noexcept
+    {
+        pinned_stopped = true;
+    }
+    
+    // Remove both "started" and "stopped" pins. If the service is currently pinned
+    // in either state but would naturally be in the opposite state, it will immediately
+    // commence starting/stopping.
+    void unpin() noexcept;
+    
+    bool is_start_pinned() noexcept
+    {
+        return pinned_started;
+    }
+
+    bool is_stop_pinned() noexcept
+    {
+        return pinned_stopped;
+    }
+
+    // Is this a dummy service (used only when loading a new service)?
+    bool is_dummy() noexcept
+    {
+        return record_type == service_type_t::DUMMY;
+    }
+    
+    bool did_start_fail() noexcept
+    {
+        return start_failed;
+    }
+
+    bool was_start_skipped() noexcept
+    {
+        return start_skipped;
+    }
+
+    // Add a listener. A listener must only be added once. May throw std::bad_alloc.
+    void add_listener(service_listener * listener)
+    {
+        listeners.insert(listener);
+    }
+    
+    // Remove a listener.    
+    void remove_listener(service_listener * listener) noexcept
+    {
+        listeners.erase(listener);
+    }
+    
+    // Check whether there are any listeners (such as control connections holding a handle to the
+    // service).
+    bool has_listeners() noexcept
+    {
+        return !listeners.empty();
+    }
+
+    // Assuming there is one reference (from a control link), return true if this is the only reference,
+    // or false if there are others (including dependents).
+    bool has_lone_ref(bool check_deps = true) noexcept
+    {
+        if (check_deps && ! dependents.empty()) return false;
+        auto i = listeners.begin();
+        return (++i == listeners.end());
+    }
+
+    // Prepare this service to be unloaded.
+    void prepare_for_unload() noexcept
+    {
+        // Remove all dependencies:
+        for (auto &dep : depends_on) {
+            auto &dep_dpts = dep.get_to()->dependents;
+            dep_dpts.erase(std::find(dep_dpts.begin(), dep_dpts.end(), &dep));
+        }
+        depends_on.clear();
+    }
+
+    // Publish the current status of the service to the status page (if there is one). To be called
+    // when the state, target state, process or restart count changes.
+    inline void status_changed() noexcept;
+
+    // Get the number of times the service has been restarted (including smooth recovery).
+    uint32_t get_restart_count() noexcept
+    {
+        return restart_count;
+    }
+
+    // Get the total time spent in the given state, including the time spent so far if it is the
+    // current state.
+    time_val get_state_duration(service_state_t state) noexcept;
+
+    // Get the time since the service entered its current state.
+    time_val get_time_in_state() noexcept
+    {
+        time_val now;
+        event_loop.get_time(now, clock_type::MONOTONIC);
+        return now - state_entered_time;
+    }
+
+    // Why did the service stop?
+    stopped_reason_t get_stop_reason()
+    {
+        return stop_reason;
+    }
+
+    bool is_waiting_for_console()
+    {
+        return waiting_for_console;
+    }
+
+    bool has_console()
+    {
+        return have_console;
+    }
+
+    virtual pid_t get_pid()
+    {
+        return -1;
+    }
+
+    virtual int get_exit_status()
+    {
+        return 0;
+    }
+
+    // Get the time (monotonic clock) at which a process for the service was most recently launched.
+    // Returns false if no process has been launched (or the service has no process).
+    virtual bool get_process_start_time(time_val &start_time)
+    {
+        return false;
+    }
+
+    // Get the number of automatic restarts within the current restart interval.
+    virtual int get_restart_interval_count()
+    {
+        return 0;
+    }
+
+    // Get details of the most recent failure to execute a process for the service. Returns false if
+    // there has been no such failure.
+    virtual bool get_exec_error(exec_stage &stage, int &st_errno)
+    {
+        return false;
+    }
+
+    dep_list & get_dependencies()
+    {
+        return depends_on;
+    }
+
+    dpt_list & get_dependents()
+    {
+        return dependents;
+    }
+
+    // Add a dependency. Caller must ensure that the services are in an appropriate state and that
+    // a circular dependency chain is not created. Propagation queues should be processed after
+    // calling this. May throw std::bad_alloc.
+    service_dep & add_dep(service_record *to, dependency_type dep_type)
+    {
+        return add_dep(to, dep_type, depends_on.end(), false);
+    }
+
+    // Add a dependency. Caller must ensure that the services are in an appropriate state and that
+    // a circular dependency chain is not created. Propagation queues should be processed after
+    // calling this. May throw std::bad_alloc.
+    //   i - where to insert the dependency (in dependencies list)
+    //   reattach - whether to acquire the required service if it and the dependent are started.
+    //             (if false, only REGULAR dependencies will cause acquire if the dependent is started,
+    //              doing so regardless of required service's state).
+    service_dep & add_dep(service_record *to, dependency_type dep_type, dep_list::iterator i, bool reattach)
+    {
+        auto pre_i = depends_on.emplace(i, this, to, dep_type);
+        try {
+            to->dependents.push_back(&(*pre_i));
+        }
+        catch (...) {
+            depends_on.erase(pre_i);
+            throw;
+        }
+
+        if (dep_type == dependency_type::REGULAR
+                || (reattach && to->get_state() == service_state_t::STARTED)) {
+            if (service_state == service_state_t::STARTING || service_state == service_state_t::STARTED) {
+                to->require();
+                pre_i->holding_acq = true;
+            }
+        }
+
+        return *pre_i;
+    }
+
+    // Remove a dependency, of the given type, to the given service. Propagation queues should be processed
+    // after calling.
+    void rm_dep(service_record *to, dependency_type dep_type) noexcept
+    {
+        for (auto i = depends_on.begin(); i != depends_on.end(); i++) {
+            auto & dep = *i;
+            if (dep.get_to() == to && dep.dep_type == dep_type) {
+                rm_dep(i);
+                break;
+            }
+        }
+    }
+
+    dep_list::iterator rm_dep(dep_list::iterator i) noexcept
+    {
+        auto to = i->get_to();
+        for (auto j = to->dependents.begin(); ; j++) {
+            if (*j == &(*i)) {
+                to->dependents.erase(j);
+                break;
+            }
+        }
+        if (i->holding_acq) {
+            to->release();
+        }
+        return depends_on.erase(i);
+    }
+
+    // Start a speficic dependency of this service. Should only be called if this service is in an
+    // appropriate state (started, starting). The dependency is marked as holding acquired; when
+    // this service stops, the dependency will be released and may also stop.
+    void start_dep(service_dep &dep)
+    {
+        if (! dep.holding_acq) {
+            dep.get_to()->require();
+            dep.holding_acq = true;
+        }
+    }
+};
+
+inline auto extract_prop_queue(service_record *sr) -> decltype(sr->prop_queue_node) &
+{
+    return sr->prop_queue_node;
+}
+
+inline auto extract_stop_queue(service_record *sr) -> decltype(sr->stop_queue_node) &
+{
+    return sr->stop_queue_node;
+}
+
+inline auto extract_console_queue(service_record *sr) -> decltype(sr->console_queue_node) &
+{
+    return sr->console_queue_node;
+}
+
+inline auto extract_start_slot_queue(service_record *sr) -> decltype(sr->start_slot_queue_node) &
+{
+    return sr->start_slot_queue_node;
+}
+
+/*
+ * A service_set, as the name suggests, manages a set of services.
+ *
+ * Other than the ability to find services by name, the service set manages various queues.
+ * One is the queue for processes wishing to acquire the console. There is also a set of
+ * processes that want to start, and another set of those that want to stop. These latter
+ * two "queues" (not really queues since their order is not important) are used to prevent too
+ * much recursion and to prevent service states from "bouncing" too rapidly.
+ * 
+ * A service that wishes to start or stop puts itself on the start/stop queue; a service that
+ * needs to propagate changes to dependent services or dependencies puts itself on the
+ * propagation queue. Any operation that potentially manipulates the queues must be followed
+ * by a "process queues" order (processQueues() method).
+ *
+ * Note that processQueues always repeatedly processes both queues until they are empty. The
+ * process is finite because starting a service can never cause services to stop, unless they
+ * fail to start, which should cause them to stop semi-permanently.
+ */
+class service_set
+{
+    protected:
+    int active_services;
+    std::list<service_record *> records;
+
+    // Index of records by service name, mapping each name to the position of its record within
+    // 'records'. Kept in sync by add_service(), remove_service() and replace_service().
+    std::unordered_map<std::string, std::list<service_record *>::iterator> records_by_name;
+
+    // Index of records by service id, mapping each id to the position of its record within
+    // 'records' (so that a listing can resume after a given service without scanning from the
+    // start). Kept in sync by add_service() and remove_service().
+    std::map<uint32_t, std::list<service_record *>::iterator> records_by_id;
+
+    // Identifier to be assigned to the next service added (ids of services in 'records' are in
+    // increasing order):
+    uint32_t next_service_id = 1;
+    bool restart_enabled; // whether automatic restart is enabled (allowed)
+    
+    shutdown_type_t shutdown_type = shutdown_type_t::NONE;  // Shutdown type, if stopping
+    
+    // Listeners for events on all services in the set
+    std::vector<service_set_listener *> set_listeners;
+
+    // Status page to which service status is published (may be null)
+    status_page *status_pg = nullptr;
+
+    // History of service start durations (may be null)
+    start_history *start_hist = nullptr;
+
+    // Record of service state transitions, and the time (monotonic clock) at which recording began
+    service_timeline timeline;
+    time_val timeline_origin;
+
+    // Services waiting for exclusive access to the console
+    dlist<service_record, extract_console_queue> console_queue;
+
+    // Limit on the number of services which may hold a start slot at once (0 = no limit), the
+    // number of slots currently held, and services waiting for a slot (highest priority first)
+    unsigned start_slot_limit = 0;
+    unsigned start_slots_held = 0;
+    dlist<service_record, extract_start_slot_queue> start_slot_queue;
+    bool start_slot_queue_ordered = true;  // whether queue is in priority order (see below)
+
+    // Compute the priority of each service in the start slot queue, and put the queue in order.
+    void order_start_slot_queue() noexcept;
+
+    // Propagation and start/stop "queues" - list of services waiting for processing
+    slist<service_record, extract_prop_queue> prop_queue;
+    slist<service_record, extract_stop_queue> stop_queue;
+    
+    public:
+    service_set()
+    {
+        active_services = 0;
+        restart_enabled = true;
+        event_loop.get_time(timeline_origin, clock_type::MONOTONIC);
+    }
+    
+    virtual ~service_set()
+    {
+        for (auto * s : records) {
+            delete s;
+        }
+    }
+
+    // Start the specified service. The service will be marked active.
+    void start_service(service_record *svc)
+    {
+        svc->start();
+        process_queues();
+    }
+
+    // Stop the specified service. Its active mark will be cleared.
+    void stop_service(service_record *svc)
+    {
+        svc->stop(true);
+        process_queues();
+    }
+
+    // Locate an existing service record.
+    service_record *find_service(const std::string &name) noexcept;
+
+    // Load a service description, and dependencies, if there is no existing
+    // record for the given name.
+    // Throws:
+    //   service_load_exc (or subclass) on problem with service description
+    //   std::bad_alloc on out-of-memory condition
+    virtual service_record *load_service(const char *name)
+    {
+        auto r = find_service(name);
+        if (r == nullptr) {
+            throw service_not_found(name);
+        }
+        return r;
+    }
+
+    // Re-load a service description from file. If the service type changes then this returns
+    // a new service instead (the old one should be removed and deleted by the caller).
+    // Throws:
+    //   service_load_exc (or subclass) on problem with service description
+    //   std::bad_alloc on out-of-memory condition
+    virtual service_record *reload_service(service_record *service)
+    {
+        return service;
+    }
+
+    // Start the service with the given name. The named service will begin
+    // transition to the 'started' state.
+    //
+    // Throws a service_load_exc (or subclass) if the service description
+    // cannot be loaded or is invalid;
+    // Throws std::bad_alloc if out of memory.
+    void start_service(const char *name)
+    {
+        using namespace std;
+        service_record *record = load_service(name);
+        service_set::start_service(record);
+    }
+    
+    // Add a service record to the set. May throw std::bad_alloc.
+    void add_service(service_record *svc)
+    {
+        auto i = records.insert(records.end(), svc);
+        try {
+            auto j = records_by_id.emplace_hint(records_by_id.end(), next_service_id, i);
+            try {
+                records_by_name.emplace(svc->get_name(), i);
+            }
+            catch (...) {
+                records_by_id.erase(j);
+                throw;
+            }
+        }
+        catch (...) {
+            records.erase(i);
+            throw;
+        }
+        svc->set_id(next_service_id++);
+        if (status_pg != nullptr) {
+            svc->status_slot = status_pg->allocate_slot();
+            svc->status_changed();
+        }
+    }
+
+    // Remove a service record from the set (the record is not deleted).
+    void remove_service(service_record *svc) noexcept
+    {
+        if (svc->status_slot != status_page::no_slot) {
+            status_pg->release_slot(svc->status_slot);
+            svc->status_slot = status_page::no_slot;
+        }
+        auto i = records_by_id.find(svc->get_id());
+        auto n = records_by_name.find(svc->get_name());
+        if (n != records_by_name.end() && n->second == i->second) {
+            records_by_name.erase(n);
+        }
+        records.erase(i->second);
+        records_by_id.erase(i);
+    }
+
+    // Replace a service record with another of the same name (the original is not deleted).
+    void replace_service(service_record *orig, service_record *replacement) noexcept
+    {
+        replacement->set_id(orig->get_id());
+        replacement->status_slot = orig->status_slot;
+        orig->status_slot = status_page::no_slot;
+        replacement->status_changed();
+        // (the position of the record in 'records' is unchanged, so the indexes remain valid)
+        *(records_by_id.find(orig->get_id())->second) = replacement;
+    }
+
+    // Add a listener for events on all services. A listener must only be added once. May throw
+    // std::bad_alloc.
+    void add_set_listener(service_set_listener *listener)
+    {
+        set_listeners.push_back(listener);
+    }
+
+    // Remove a listener for events on all services.
+    void remove_set_listener(service_set_listener *listener) noexcept
+    {
+        auto i = std::find(set_listeners.begin(), set_listeners.end(), listener);
+        if (i != set_listeners.end()) {
+            set_listeners.erase(i);
+        }
+    }
+
+    // Notify the listeners for all services of an event on a particular service.
+    void notify_set_listeners(service_record *service, service_event_t event) noexcept
+    {
+        for (auto l : set_listeners) {
+            l->service_set_event(service, event);
+        }
+    }
+
+    // Set the start duration history, in which the duration of each service start is recorded.
+    void set_start_history(start_history *history) noexcept
+    {
+        start_hist = history;
+    }
+
+    start_history *get_start_history() noexcept
+    {
+        return start_hist;
+    }
+
+    // Record the duration of a start of a service (in the start history, if there is one).
+    void record_start_duration(service_record *svc, time_val duration) noexcept
+    {
+        if (start_hist != nullptr) {
+            uint64_t millis = duration.seconds() * 1000 + duration.nseconds() / 1000000;
+            start_hist->record(svc->get_name(), std::min(millis, (uint64_t)UINT32_MAX));
+        }
+    }
+
+    // Get the expected duration of a start of a service, in milliseconds (0 if unknown).
+    uint32_t get_expected_start_duration(service_record *svc) noexcept
+    {
+        return (start_hist != nullptr) ? start_hist->get_expected(svc->get_name()) : 0;
+    }
+
+    // Set the status page to which service status is published (or nullptr for none). The status
+    // of all services is published immediately.
+    void set_status_page(status_page *page) noexcept
+    {
+        for (auto *svc : records) {
+            svc->status_slot = status_page::no_slot;
+        }
+        status_pg = page;
+        if (page != nullptr) {
+            for (auto *svc : records) {
+                svc->status_slot = page->allocate_slot();
+                svc->status_changed();
+            }
+        }
+    }
+
+    // Publish the status of a service to the status page.
+    void update_status_page(service_record *svc) noexcept
+    {
+        if (svc->status_slot != status_page::no_slot) {
+            status_pg->update(svc->status_slot, svc);
+        }
+    }
+
+    // Record an event for a service in the service timeline.
+    void record_timeline(service_record *svc, timeline_event_t event, uint32_t related_id = 0,
+            uint8_t detail = 0) noexcept
+    {
+        time_val now;
+        event_loop.get_time(now, clock_type::MONOTONIC);
+        timeline.record(now.seconds(), now.nseconds(), svc->get_id(), event, related_id, detail);
+    }
+
+    const service_timeline &get_timeline() noexcept
+    {
+        return timeline;
+    }
+
+    // Get the time (monotonic clock) at which recording of the service timeline began.
+    time_val get_timeline_origin() noexcept
+    {
+        return timeline_origin;
+    }
+
+    // Get the list of all loaded services.
+    const std::list<service_record *> &list_services() noexcept
+    {
+        return records;
+    }
+
+    // Get the position, in the list of all loaded services (list_services()), of the first service
+    // with an identifier greater than the given identifier. (Services are listed in order of
+    // identifier).
+    std::list<service_record *>::const_iterator list_services_after(uint32_t id) noexcept
+    {
+        auto i = records_by_id.upper_bound(id);
+        if (i == records_by_id.end()) {
+            return records.end();
+        }
+        return i->second;
+    }
+    
+    // Add a service record to the state propagation queue. The service record will have its
+    // do_propagation() method called when the queue is processed.
+    void add_prop_queue(service_record *service) noexcept
+    {
+        if (! prop_queue.is_queued(service)) {
+            prop_queue.insert(service);
+        }
+    }
+    
+    // Add a service record to the stop queue. The service record will have its
+    // execute_transition() method called when the queue is processed.
+    void add_transition_queue(service_record *service) noexcept
+    {
+        if (! stop_queue.is_queued(service)) {
+            stop_queue.insert(service);
+        }
+    }
+    
+    // Process state propagation and start/stop queues, until they are empty. Start slots released
+    // meanwhile are then dispatched to waiting services (which may queue further propagation).
+    void process_queues() noexcept
+    {
+        do {
+            while (! stop_queue.is_empty() || ! prop_queue.is_empty()) {
+                while (! prop_queue.is_empty()) {
+                    auto next = prop_queue.pop_front();
+                    next->do_propagation();
+                }
+                if (! stop_queue.is_empty()) {
+                    auto next = stop_queue.pop_front();
+                    next->execute_transition();
+                }
+            }
+        } while (pull_start_slot_queue());
+    }
+    
+    // Set the console queue tail (returns previous tail)
+    void append_console_queue(service_record * newTail) noexcept
+    {
+        bool was_empty = console_queue.is_empty();
+        console_queue.append(newTail);
+        if (was_empty) {
+            enable_console_log(false);
+        }
+    }
+    
+    // Pull and dispatch a waiter from the console queue
+    void pull_console_queue() noexcept
+    {
+        if (console_queue.is_empty()) {
+            // Discard the log buffer now, because we've potentially blocked output for a while
+            // and allowed it to fill with stale messages. (If not much time has passed, the
+            // request to discard will be ignored anyway).
+            discard_console_log_buffer();
+            enable_console_log(true);
+        }
+        else {
+            service_record * front = console_queue.pop_front();
+            front->acquired_console();
+        }
+    }
+    
+    void unqueue_console(service_record * service) noexcept
+    {
+        if (console_queue.is_queued(service)) {
+            console_queue.unlink(service);
+        }
+    }
+
+    // Check if console queue is empty (possibly due to console already having
+    // been assigned to the only queueing service)
+    bool is_console_queue_empty() noexcept
+    {
+        return console_queue.is_empty();
+    }
+
+    // Check whether a service is queued for the console
+    bool is_queued_for_console(service_record * service) noexcept
+    {
+        return console_queue.is_queued(service);
+    }
+
+    // Set the limit on the number of services which may be starting a process (i.e. which hold a
+    // start slot) at once; 0 for no limit. A service requires a start slot once its dependencies
+    // have started, and holds it until it has started (or stopped).
+    void set_start_slot_limit(unsigned limit) noexcept
+    {
+        start_slot_limit = limit;
+        pull_start_slot_queue();
+    }
+
+    unsigned get_start_slot_limit() noexcept
+    {
+        return start_slot_limit;
+    }
+
+    // Try to acquire a start slot. Returns false if no slot is available, in which case the
+    // service should queue for a slot (service_record::queue_for_start_slot()).
+    bool try_acquire_start_slot() noexcept
+    {
+        if (start_slot_limit != 0 && start_slots_held >= start_slot_limit) {
+            return false;
+        }
+        ++start_slots_held;
+        return true;
+    }
+
+    // Queue a service to receive a start slot. Slots are given in order of priority: services
+    // with the longest critical path (see service_record::get_critical_path_length()) first.
+    // Priorities are computed, for all waiting services at once, only when a slot is to be given
+    // out (since they require a traversal of the dependents graph).
+    void append_start_slot_queue(service_record *service) noexcept
+    {
+        start_slot_queue.append(service);
+        start_slot_queue_ordered = false;
+    }
+
+    // Release a start slot. It is dispatched to a waiting service (if there is one) when the queues
+    // are next processed, rather than immediately, since the releasing service may be part-way
+    // through a state transition.
+    void release_start_slot() noexcept
+    {
+        --start_slots_held;
+    }
+
+    // Dispatch start slots (as available) to waiting services. Returns true if any were dispatched.
+    bool pull_start_slot_queue() noexcept
+    {
+        bool dispatched = false;
+        while (! start_slot_queue.is_empty()
+                && (start_slot_limit == 0 || start_slots_held < start_slot_limit)) {
+            if (! start_slot_queue_ordered) {
+                order_start_slot_queue();
+            }
+            service_record *front = start_slot_queue.pop_front();
+            ++start_slots_held;
+            front->acquired_start_slot();
+            dispatched = true;
+        }
+        return dispatched;
+    }
+
+    void unqueue_start_slot(service_record *service) noexcept
+    {
+        if (start_slot_queue.is_queued(service)) {
+            start_slot_queue.unlink(service);
+        }
+    }
+
+    // Get the number of start slots currently held
+    unsigned get_start_slots_held() noexcept
+    {
+        return start_slots_held;
+    }
+
+    // Notification from service that it is active (state != STOPPED)
+    // Only to be called on the transition from inactive to active.
+    void service_active(service_record *) noexcept;
+    
+    // Notification from service that it is inactive (STOPPED)
+    // Only to be called on the transition from active to inactive.
+    void service_inactive(service_record *) noexcept;
+    
+    // Find out how many services are active (starting, running or stopping,
+    // but not stopped).
+    int count_active_services() noexcept
+    {
+        return active_services;
+    }
+    
+    void stop_all_services(shutdown_type_t type = shutdown_type_t::HALT) noexcept
+    {
+        restart_enabled = false;
+        shutdown_type = type;
+        for (std::list<service_record *>::iterator i = records.begin(); i != records.end(); ++i) {
+            (*i)->stop(false);
+            (*i)->unpin();
+        }
+        process_queues();
+    }
+    
+    bool is_shutting_down() noexcept
+    {
+        return !restart_enabled;
+    }
+
+    shutdown_type_t get_shutdown_type() noexcept
+    {
+        return shutdown_type;
+    }
+
+    // Get an identifier for the run-time type of the service set (similar to typeid, but without
+    // requiring RTTI to be enabled during compilation).
+    virtual int get_set_type_id()
+    {
+        return SSET_TYPE_NONE;
+    }
+};
+
+inline void service_record::notify_listeners(service_event_t event) noexcept
+{
+    for (auto l : listeners) {
+        l->service_event(this, event);
+    }
+    services->notify_set_listeners(this, event);
+}
+
+inline void service_record::status_changed() noexcept
+{
+    services->update_status_page(this);
+}
+
+// A service set which loads services from one of several service directories.
+class dirload_service_set : public service_set
+{
+    service_dir_pathlist service_dirs;
+
+    // Cache of pre-parsed service descriptions (may be null)
+    const service_cache *svc_cache = nullptr;
+
+    // Snapshots of the contents of dependency directories (waits-for.d), by path. Along with the
+    // snapshots of the service directories themselves, these are kept until explicitly invalidated.
+    std::unordered_map<std::string, std::vector<std::string>> dep_dir_listings;
+
+    // Implementation of service load/reload.
+    // Find a service record, or load it from file. If the service has dependencies, load those also.
+    //
+    // If reload_svc != nullptr, then reload the specified service (with name specified by name). The return
+    // points to the new service, which may be a new service record, in which case the caller must remove
+    // the original record.
+    //
+    // If avoid_circular != nullptr (but reload_svc == nullptr), and if the service name refers to the
+    // service referred to by avoid_circular, a circular dependency is recognised. (A circular dependency
+    // is otherwise recognised on services as they are loading; this mechanism should be used when
+    // reloading a service, to prevent new dependencies forming on the original service).
+    //
+    // Throws service_load_exc (or subclass) if a dependency cycle is found or if another
+    // problem occurs (I/O error, service description not found etc). Throws std::bad_alloc
+    // if a memory allocation failure occurs.
+    //
+    service_record *load_reload_service(const char *name, service_record *reload_svc,
+            const service_record *avoid_circular);
+
+    public:
+    dirload_service_set() : service_set()
+    {
+        // nothing to do.
+    }
+
+    dirload_service_set(service_dir_pathlist &&pathlist) : service_set(), service_dirs(std::move(pathlist))
+    {
+        // nothing to do.
+    }
+
+    dirload_service_set(const char *path, bool dyn_alloc = false)
+    {
+        service_dirs.emplace_back(path, dyn_alloc);
+    }
+
+    dirload_service_set(const dirload_service_set &) = delete;
+
+    int get_service_dir_count()
+    {
+        return service_dirs.size();
+    }
+
+    const char * get_service_dir(int n)
+    {
+        return service_dirs[n].get_dir();
+    }
+
+    const service_dir_pathlist &get_service_dirs() noexcept
+    {
+        return service_dirs;
+    }
+
+    // Set the cache of service descriptions to use when loading services (null for none). Cached
+    // descriptions are used only if they are current.
+    void set_service_cache(const service_cache *cache) noexcept
+    {
+        svc_cache = cache;
+    }
+
+    // Get the (sorted) names in a dependency directory, reading the directory only if it has not
+    // been read since directory listings were last invalidated. Returns null, with errno set, if the
+    // directory cannot be read. May throw std::bad_alloc.
+    const std::vector<std::string> *get_dep_dir_listing(const std::string &path);
+
+    // Discard the snapshots of service and dependency directory contents, so that they are read
+    // again when next needed (i.e. changes in the directories will be seen).
+    void invalidate_dir_listings() noexcept
+    {
+        for (auto &service_dir : service_dirs) {
+            service_dir.clear_listing();
+        }
+        dep_dir_listings.clear();
+    }
+
+    service_record *load_service(const char *name) override
+    {
+        return load_service(name, nullptr);
+    }
+
+    service_record *load_service(const char *name, const service_record *avoid_circular);
+
+    // Load all services described in the service directories, in a single pass. Failure to load a
+    // service (or one of its dependencies) does not prevent loading the others; each failure is
+    // recorded in 'errors' as a (service name, description) pair. Returns the number of services
+    // which are loaded (including any that were loaded already). May throw std::bad_alloc.
+    unsigned preload_services(std::list<std::pair<std::string, std::string>> &errors);
+
+    service_record *reload_service(service_record *service) override;
+
+    int get_set_type_id() override
+    {
+        return SSET_TYPE_DIRLOAD;
+    }
+};
+
+// Discard the snapshots of service directory contents held by a service set (if it loads services
+// from directories), so that changes made since they were taken are seen. Snapshots are not
+// refreshed when a lookup misses, so this must be done before loading a service which may have been
+// added since (and wherever a dependency directory may have been altered).
+inline void invalidate_dir_listings(service_set *services) noexcept
+{
+    if (services->get_set_type_id() == SSET_TYPE_DIRLOAD) {
+        static_cast<dirload_service_set *>(services)->invalidate_dir_listings();
+    }
+}
+
+#endif
@@ -0,0 +1,169 @@
+#include <cassert>
+#include <iostream>
+#include <cerrno>
+#include <csignal>
+
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/wait.h>
+
+#include <dasynq.h>
+
+// Tests of child process watching in dasynq, using the real event loop (rather than the mock used
+// by the other tests). Where pidfds are supported, each watched child is tracked via a pidfd (see
+// dasynq/childproc.h).
+
+using loop_t = dasynq::event_loop_n;
+using rearm = dasynq::rearm;
+
+class test_child_watcher : public loop_t::child_proc_watcher_impl<test_child_watcher>
+{
+    public:
+    bool terminated = false;
+    pid_t term_pid = -1;
+    int term_status = 0;
+
+    rearm status_change(loop_t &loop, pid_t child, int status)
+    {
+        terminated = true;
+        term_pid = child;
+        term_status = status;
+        return rearm::REMOVE;
+    }
+};
+
+// Count the open file descriptors of this process.
+static int count_open_fds()
+{
+    DIR *dir = opendir("/proc/self/fd");
+    assert(dir != nullptr);
+    int count = 0;
+    while (readdir(dir) != nullptr) {
+        ++count;
+    }
+    closedir(dir);
+    return count;
+}
+
+// Check whether the kernel supports pidfds.
+static bool have_pidfds()
+{
+#if DASYNQ_HAVE_PIDFD
+    int fd = syscall(SYS_pidfd_open, getpid(), 0);
+    if (fd != -1) {
+        close(fd);
+        return true;
+    }
+#endif
+    return false;
+}
+
+// A watched child is reaped when it terminates, its status reported, and (if it had one) its pidfd
+// closed. A signal cannot then be sent via the watcher.
+void test_child_reap()
+{
+    loop_t loop;
+    test_child_watcher watcher;
+
+    int fds_before = count_open_fds();
+
+    pid_t child = watcher.fork(loop);
+    if (child == 0) {
+        _exit(3);
+    }
+    assert(child != -1);
+
+    // While the child is watched, it has a pidfd (if supported):
+    assert(count_open_fds() == fds_before + (have_pidfds() ? 1 : 0));
+
+    while (!watcher.terminated) {
+        loop.run();
+    }
+
+    assert(watcher.term_pid == child);
+    assert(WIFEXITED(watcher.term_status) && WEXITSTATUS(watcher.term_status) == 3);
+    assert(count_open_fds() == fds_before);
+
+    // The child has been reaped:
+    assert(waitpid(child, nullptr, WNOHANG) == -1 && errno == ECHILD);
+
+    // Signalling fails cleanly:
+    errno = 0;
+    assert(watcher.send_signal(loop, SIGTERM) == -1);
+    assert(errno == ESRCH);
+}
+
+// A signal can be sent to a running watched child via the watcher.
+void test_child_signal()
+{
+    loop_t loop;
+    test_child_watcher watcher;
+
+    pid_t child = watcher.fork(loop);
+    if (child == 0) {
+        while (true) pause();
+    }
+    assert(child != -1);
+
+    assert(watcher.send_signal(loop, SIGTERM) == 0);
+
+    while (!watcher.terminated) {
+        loop.run();
+    }
+
+    assert(watcher.term_pid == child);
+    assert(WIFSIGNALED(watcher.term_status) && WTERMSIG(watcher.term_status) == SIGTERM);
+}
+
+// Terminated children which are not watched are also reaped, without preventing the status of
+// watched children from being reported.
+void test_unwatched_child_reap()
+{
+    loop_t loop;
+    test_child_watcher watcher;
+
+    pid_t unwatched = fork();
+    if (unwatched == 0) {
+        _exit(0);
+    }
+    assert(unwatched != -1);
+
+    // Wait until the unwatched child has terminated (without reaping it):
+    siginfo_t info;
+    assert(waitid(P_PID, unwatched, &info, WEXITED | WNOWAIT) == 0);
+
+    pid_t child = watcher.fork(loop);
+    if (child == 0) {
+        _exit(5);
+    }
+    assert(child != -1);
+
+    while (!watcher.terminated) {
+        loop.run();
+    }
+
+    assert(watcher.term_pid == child);
+    assert(WIFEXITED(watcher.term_status) && WEXITSTATUS(watcher.term_status) == 5);
+
+    // The unwatched child is reaped once SIGCHLD is processed (which, if the watched child was
+    // reaped via its pidfd, may not yet have happened):
+    kill(getpid(), SIGCHLD);
+    loop.poll();
+    assert(waitpid(unwatched, nullptr, WNOHANG) == -1 && errno == ECHILD);
+}
+
+#define RUN_TEST(name, spacing) \
+    std::cout << #name "..." spacing << std::flush; \
+    name(); \
+    std::cout << "PASSED" << std::endl;
+
+int main(int argc, char **argv)
+{
+    // Don't wait forever if a child's termination is not reported:
+    alarm(30);
+
+    RUN_TEST(test_child_reap, "              ");
+    RUN_TEST(test_child_signal, "            ");
+    RUN_TEST(test_unwatched_child_reap, "    ");
+    return 0;
+}
@@ -0,0 +1,157 @@
+// Dinit control command packet types
+
+// Requests:
+
+// Query protocol version:
+constexpr static int DINIT_CP_QUERYVERSION = 0;
+
+// Find (but don't load) a service:
+constexpr static int DINIT_CP_FINDSERVICE = 1;
+
+// Find or load a service:
+constexpr static int DINIT_CP_LOADSERVICE = 2;
+
+// Start or stop a service:
+constexpr static int DINIT_CP_STARTSERVICE = 3;
+constexpr static int DINIT_CP_STOPSERVICE  = 4;
+constexpr static int DINIT_CP_WAKESERVICE = 5;
+constexpr static int DINIT_CP_RELEASESERVICE = 6;
+
+constexpr static int DINIT_CP_UNPINSERVICE = 7;
+
+// List services:
+constexpr static int DINIT_CP_LISTSERVICES = 8;
+
+// Unload a service:
+constexpr static int DINIT_CP_UNLOADSERVICE = 9;
+
+// Shutdown:
+constexpr static int DINIT_CP_SHUTDOWN = 10;
+ // followed by 1-byte shutdown type
+
+// Add/remove dependency to existing service:
+constexpr static int DINIT_CP_ADD_DEP = 11;
+constexpr static int DINIT_CP_REM_DEP = 12;
+
+// Query service load path / mechanism:
+constexpr static int DINIT_CP_QUERY_LOAD_MECH = 13;
+
+// Add a waits for dependency from one service to another, and start the dependency:
+constexpr static int DINIT_CP_ENABLESERVICE = 14;
+
+// Find the name of a service (from a handle)
+constexpr static int DINIT_CP_QUERYSERVICENAME = 15;
+
+// Reload a service:
+constexpr static int DINIT_CP_RELOADSERVICE = 16;
+
+// Load all services from the service directories:
+constexpr static int DINIT_CP_PRELOADSERVICES = 17;
+
+// Find/load several services and issue a start/stop/wake/release command for each:
+constexpr static int DINIT_CP_BATCH = 18;
+
+// List services, with filtering and pagination:
+constexpr static int DINIT_CP_LISTSERVICES2 = 19;
+
+// Subscribe to (or unsubscribe from) events for all services:
+constexpr static int DINIT_CP_SUBSCRIBEALL = 20;
+ // followed by 1-byte flag: 1 = subscribe, 0 = unsubscribe
+
+// Query control connection output statistics:
+constexpr static int DINIT_CP_QUERYCONNSTATS = 21;
+
+// Query full status of a service:
+constexpr static int DINIT_CP_SERVICESTATUS = 22;
+
+// Query the service timeline (record of service state transitions):
+constexpr static int DINIT_CP_QUERYTIMELINE = 23;
+
+// Query the service start duration history:
+constexpr static int DINIT_CP_QUERYSTARTHISTORY = 24;
+
+// Replies:
+
+// Reply: ACK/NAK to request
+constexpr static int DINIT_RP_ACK = 50;
+constexpr static int DINIT_RP_NAK = 51;
+
+// Request was bad (connection will be closed)
+constexpr static int DINIT_RP_BADREQ = 52;
+
+// Connection being closed due to out-of-memory condition
+constexpr static int DINIT_RP_OOM = 53;
+
+// Start service replies:
+constexpr static int DINIT_RP_SERVICELOADERR = 54;
+constexpr static int DINIT_RP_SERVICEOOM = 55; // couldn't start due to out-of-memory
+
+// Not (any longer?) used
+//constexpr static int DINIT_RP_SSISSUED = 56;  // service start/stop was issued (includes 4-byte service handle)
+//constexpr static int DINIT_RP_SSREDUNDANT = 57;  // service was already started/stopped (or for stop, not loaded)
+
+// Query version response:
+constexpr static int DINIT_RP_CPVERSION = 58;
+
+// Service record loaded/found
+constexpr static int DINIT_RP_SERVICERECORD = 59;
+//     followed by 4-byte service handle, 1-byte service state
+
+// Couldn't find/load service
+constexpr static int DINIT_RP_NOSERVICE = 60;
+
+// Service is already started/stopped
+constexpr static int DINIT_RP_ALREADYSS = 61;
+
+// Information on a service / list complete:
+constexpr static int DINIT_RP_SVCINFO = 62;
+constexpr static int DINIT_RP_LISTDONE = 63;
+
+// Service loader information:
+constexpr static int DINIT_RP_LOADER_MECH = 64;
+
+// Dependent services prevent stopping/restarting. Includes size_t count, handle_t * N handles.
+constexpr static int DINIT_RP_DEPENDENTS = 65;
+
+// Service name:
+constexpr static int DINIT_RP_SERVICENAME = 66;
+
+// Service is pinned stopped/started:
+constexpr static int DINIT_RP_PINNEDSTOPPED = 67;
+constexpr static int DINIT_RP_PINNEDSTARTED = 68;
+
+// Shutdown is in progress, can't start/restart/wake service:
+constexpr static int DINIT_RP_SHUTTINGDOWN = 69;
+
+// Preload complete: 4-byte # services loaded, 4-byte # failures, 4-byte elapsed time (milliseconds)
+constexpr static int DINIT_RP_PRELOADINFO = 70;
+
+// Batch results: 2-byte count N, N * (1-byte reply code, 4-byte service handle)
+constexpr static int DINIT_RP_BATCH = 71;
+
+// Information on several services (LISTSERVICES2) / list complete (4-byte continuation cursor):
+constexpr static int DINIT_RP_SVCINFO2 = 72;
+constexpr static int DINIT_RP_LISTDONE2 = 73;
+
+// Control connection statistics: 4-byte # connections, 4-byte # connections paused, 8-byte total
+// queued output, 8-byte connection budget, 8-byte total budget, 8-byte # times paused, 8-byte #
+// connections closed due to overrun
+constexpr static int DINIT_RP_CONNSTATS = 74;
+
+// Full status of a service (see control.cc, process_service_status, for the layout):
+constexpr static int DINIT_RP_SERVICESTATUS = 75;
+
+// Service timeline (see control.cc, process_query_timeline, for the layout):
+constexpr static int DINIT_RP_TIMELINE = 76;
+
+// Service start duration history (see control.cc, process_query_start_history, for the layout):
+constexpr static int DINIT_RP_STARTHISTORY = 77;
+
+// Information:
+
+// Service event occurred (4-byte service handle, 1 byte event code)
+constexpr static int DINIT_IP_SERVICEEVENT = 100;
+
+// Service event occurred, for connections subscribed to all services (1-byte packet length,
+// 4-byte service id, 1 byte event code, 8-byte seconds + 4-byte nanoseconds system time, name)
+constexpr static int DINIT_IP_SERVICEEVENT2 = 101;
@@ -0,0 +1,437 @@
+#ifndef DINIT_SERVICE_CACHE_H
+#define DINIT_SERVICE_CACHE_H 1
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+#include <cstdint>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "load-service.h"
+#include "service-dir.h"
+
+/*
+ * Service description cache.
+ *
+ * The cache is a single file holding one record per service, each containing the settings read from
+ * the service description, already parsed (but not "finalised", so that environment-dependent
+ * substitutions are still performed at load time). User and group names are stored already
+ * resolved to numeric ids. Dependencies are stored by name; dependency directories (waits-for.d)
+ * are stored as the directory name, and are read again when the service is loaded.
+ *
+ * The cache is written by dinitcheck and read (via mmap) by dinit. A cache file is only used if it
+ * was generated for the same list of service directories, and the user/group databases have not
+ * been modified since. Each record is used only if the identity of the service description file
+ * (device, inode, size and modification time) matches that recorded in the cache; otherwise, the
+ * file is parsed as normal.
+ *
+ * File layout (all values in native byte order):
+ *   header:  magic (8 bytes), version (u32), byte order marker (u32), record count (u32),
+ *            service directory count (u32) followed by each directory (string),
+ *            identity of /etc/passwd and /etc/group (file id)
+ *   records: record length (u32), service name (string), file path (string), file id, settings
+ *
+ * A string is a u32 length followed by the (non-nul-terminated) characters. A file id is five
+ * 64-bit values: device, inode, modification time (seconds, nanoseconds), size.
+ */
+
+// A dependency as recorded in the cache: either a named service, or a dependency directory whose
+// contents name the dependencies.
+class cached_dep
+{
+    public:
+    std::string name;
+    dependency_type dep_type;
+    bool is_dir;
+
+    cached_dep(const std::string &name_p, dependency_type dep_type_p, bool is_dir_p = false)
+        : name(name_p), dep_type(dep_type_p), is_dir(is_dir_p) { }
+    cached_dep(std::string &&name_p, dependency_type dep_type_p, bool is_dir_p = false)
+        : name(std::move(name_p)), dep_type(dep_type_p), is_dir(is_dir_p) { }
+};
+
+// Identity of a file, used to determine whether a cache record is current.
+struct cached_file_id
+{
+    uint64_t dev = 0;
+    uint64_t ino = 0;
+    int64_t mtime_sec = 0;
+    int64_t mtime_nsec = 0;
+    int64_t size = 0;
+
+    cached_file_id() noexcept { }
+    cached_file_id(const struct stat &st) noexcept;
+
+    bool operator==(const cached_file_id &other) const noexcept
+    {
+        return dev == other.dev && ino == other.ino && mtime_sec == other.mtime_sec
+                && mtime_nsec == other.mtime_nsec && size == other.size;
+    }
+
+    bool operator!=(const cached_file_id &other) const noexcept
+    {
+        return !(*this == other);
+    }
+};
+
+// Buffer for writing cache data.
+class cache_writer
+{
+    std::vector<char> buf;
+
+    public:
+    template <typename T> void write_num(T val)
+    {
+        const char *valp = reinterpret_cast<const char *>(&val);
+        buf.insert(buf.end(), valp, valp + sizeof(T));
+    }
+
+    void write_str(const char *str, size_t len)
+    {
+        write_num<uint32_t>(len);
+        buf.insert(buf.end(), str, str + len);
+    }
+
+    void write_str(const std::string &str)
+    {
+        write_str(str.data(), str.length());
+    }
+
+    void write_file_id(const cached_file_id &id)
+    {
+        write_num(id.dev);
+        write_num(id.ino);
+        write_num(id.mtime_sec);
+        write_num(id.mtime_nsec);
+        write_num(id.size);
+    }
+
+    void write_bytes(const char *bytes, size_t len)
+    {
+        buf.insert(buf.end(), bytes, bytes + len);
+    }
+
+    std::vector<char> &get_buffer() noexcept
+    {
+        return buf;
+    }
+};
+
+// Reader for cache data, with bounds checking. If an attempt is made to read beyond the end of
+// the data, the reader is marked bad and all subsequent reads return zero/empty values.
+class cache_reader
+{
+    const char *pos = nullptr;
+    const char *end = nullptr;
+    bool good = true;
+
+    public:
+    cache_reader() noexcept { }
+    cache_reader(const char *begin_p, const char *end_p) noexcept : pos(begin_p), end(end_p) { }
+
+    template <typename T> T read_num() noexcept
+    {
+        T val = 0;
+        if ((size_t)(end - pos) < sizeof(T)) {
+            good = false;
+            pos = end;
+            return val;
+        }
+        memcpy(&val, pos, sizeof(T));
+        pos += sizeof(T);
+        return val;
+    }
+
+    // Read a string, returning a pointer to its characters (not nul-terminated) and setting len.
+    const char *read_str(uint32_t &len) noexcept
+    {
+        len = read_num<uint32_t>();
+        if ((size_t)(end - pos) < len) {
+            good = false;
+            pos = end;
+            len = 0;
+        }
+        const char *r = pos;
+        pos += len;
+        return r;
+    }
+
+    std::string read_str()
+    {
+        uint32_t len;
+        const char *s = read_str(len);
+        return std::string(s, len);
+    }
+
+    cached_file_id read_file_id() noexcept
+    {
+        cached_file_id id;
+        id.dev = read_num<uint64_t>();
+        id.ino = read_num<uint64_t>();
+        id.mtime_sec = read_num<int64_t>();
+        id.mtime_nsec = read_num<int64_t>();
+        id.size = read_num<int64_t>();
+        return id;
+    }
+
+    bool is_good() const noexcept { return good; }
+    bool at_end() const noexcept { return pos == end; }
+
+    const char *get_pos() const noexcept { return pos; }
+    size_t remaining() const noexcept { return end - pos; }
+};
+
+namespace dinit_load {
+
+inline uint32_t service_flags_to_bits(const service_flags_t &flags) noexcept
+{
+    return (flags.rw_ready << 0) | (flags.log_ready << 1) | (flags.runs_on_console << 2)
+            | (flags.starts_on_console << 3) | (flags.shares_console << 4) | (flags.pass_cs_fd << 5)
+            | (flags.start_interruptible << 6) | (flags.skippable << 7) | (flags.signal_process_only << 8)
+            | (flags.always_chain << 9);
+}
+
+inline service_flags_t bits_to_service_flags(uint32_t bits) noexcept
+{
+    service_flags_t flags;
+    flags.rw_ready = bits & (1 << 0);
+    flags.log_ready = bits & (1 << 1);
+    flags.runs_on_console = bits & (1 << 2);
+    flags.starts_on_console = bits & (1 << 3);
+    flags.shares_console = bits & (1 << 4);
+    flags.pass_cs_fd = bits & (1 << 5);
+    flags.start_interruptible = bits & (1 << 6);
+    flags.skippable = bits & (1 << 7);
+    flags.signal_process_only = bits & (1 << 8);
+    flags.always_chain = bits & (1 << 9);
+    return flags;
+}
+
+inline void write_offsets(cache_writer &w, const std::list<std::pair<unsigned,unsigned>> &offsets)
+{
+    w.write_num<uint32_t>(offsets.size());
+    for (auto &offs : offsets) {
+        w.write_num<uint32_t>(offs.first);
+        w.write_num<uint32_t>(offs.second);
+    }
+}
+
+inline void read_offsets(cache_reader &r, std::list<std::pair<unsigned,unsigned>> &offsets)
+{
+    uint32_t count = r.read_num<uint32_t>();
+    for (uint32_t i = 0; i < count && r.is_good(); ++i) {
+        unsigned first = r.read_num<uint32_t>();
+        unsigned second = r.read_num<uint32_t>();
+        offsets.emplace_back(first, second);
+    }
+}
+
+inline void write_timespec(cache_writer &w, const timespec &ts)
+{
+    w.write_num<int64_t>(ts.tv_sec);
+    w.write_num<int64_t>(ts.tv_nsec);
+}
+
+inline void read_timespec(cache_reader &r, timespec &ts) noexcept
+{
+    ts.tv_sec = r.read_num<int64_t>();
+    ts.tv_nsec = r.read_num<int64_t>();
+}
+
+// Write the (un-finalised) settings for a service, with the specified dependencies, to a cache
+// record. May throw std::bad_alloc.
+template <typename settings_wrapper>
+void write_cached_settings(cache_writer &w, const settings_wrapper &settings,
+        const std::list<cached_dep> &deps)
+{
+    w.write_str(settings.command);
+    write_offsets(w, settings.command_offsets);
+    w.write_str(settings.stop_command);
+    write_offsets(w, settings.stop_command_offsets);
+    w.write_str(settings.working_dir);
+    w.write_str(settings.pid_file);
+    w.write_str(settings.env_file);
+    w.write_num<uint8_t>(settings.do_sub_vars);
+    w.write_num<uint32_t>(static_cast<uint32_t>(settings.service_type));
+
+    w.write_num<uint32_t>(deps.size());
+    for (auto &dep : deps) {
+        w.write_str(dep.name);
+        w.write_num<uint32_t>(static_cast<uint32_t>(dep.dep_type));
+        w.write_num<uint8_t>(dep.is_dir);
+    }
+
+    w.write_str(settings.logfile);
+    w.write_num<uint32_t>(service_flags_to_bits(settings.onstart_flags));
+    w.write_num<int32_t>(settings.term_signal);
+    w.write_num<uint8_t>(settings.auto_restart);
+    w.write_num<uint8_t>(settings.smooth_recovery);
+    w.write_str(settings.socket_path);
+    w.write_num<int32_t>(settings.socket_perms);
+    w.write_num<uint64_t>(settings.socket_uid);
+    w.write_num<uint64_t>(settings.socket_uid_gid);
+    w.write_num<uint64_t>(settings.socket_gid);
+    write_timespec(w, settings.restart_interval);
+    w.write_num<int32_t>(settings.max_restarts);
+    write_timespec(w, settings.restart_delay);
+    write_timespec(w, settings.stop_timeout);
+    write_timespec(w, settings.start_timeout);
+
+    w.write_num<uint32_t>(settings.rlimits.size());
+    for (auto &limits : settings.rlimits) {
+        w.write_num<int32_t>(limits.resource_id);
+        w.write_num<uint8_t>(limits.soft_set);
+        w.write_num<uint8_t>(limits.hard_set);
+        w.write_num<uint64_t>(limits.limits.rlim_cur);
+        w.write_num<uint64_t>(limits.limits.rlim_max);
+    }
+
+    w.write_num<int32_t>(settings.readiness_fd);
+    w.write_str(settings.readiness_var);
+    w.write_num<uint64_t>(settings.run_as_uid);
+    w.write_num<uint64_t>(settings.run_as_uid_gid);
+    w.write_num<uint64_t>(settings.run_as_gid);
+    w.write_str(settings.chain_to_name);
+
+    #if USE_UTMPX
+    w.write_str(settings.inittab_id, sizeof(settings.inittab_id));
+    w.write_str(settings.inittab_line, sizeof(settings.inittab_line));
+    #else
+    w.write_str("", 0);
+    w.write_str("", 0);
+    #endif
+}
+
+// Read settings for a service from a cache record, as written by write_cached_settings(). The
+// dependencies are stored into 'deps'. Returns false if the record is malformed (in which case
+// the settings may have been partially read). May throw std::bad_alloc.
+template <typename settings_wrapper>
+bool read_cached_settings(cache_reader &r, settings_wrapper &settings, std::list<cached_dep> &deps)
+{
+    settings.command = r.read_str();
+    read_offsets(r, settings.command_offsets);
+    settings.stop_command = r.read_str();
+    read_offsets(r, settings.stop_command_offsets);
+    settings.working_dir = r.read_str();
+    settings.pid_file = r.read_str();
+    settings.env_file = r.read_str();
+    settings.do_sub_vars = r.read_num<uint8_t>();
+    settings.service_type = static_cast<service_type_t>(r.read_num<uint32_t>());
+
+    uint32_t num_deps = r.read_num<uint32_t>();
+    for (uint32_t i = 0; i < num_deps && r.is_good(); ++i) {
+        std::string dep_name = r.read_str();
+        dependency_type dep_type = static_cast<dependency_type>(r.read_num<uint32_t>());
+        bool is_dir = r.read_num<uint8_t>();
+        deps.emplace_back(std::move(dep_name), dep_type, is_dir);
+    }
+
+    settings.logfile = r.read_str();
+    settings.onstart_flags = bits_to_service_flags(r.read_num<uint32_t>());
+    settings.term_signal = r.read_num<int32_t>();
+    settings.auto_restart = r.read_num<uint8_t>();
+    settings.smooth_recovery = r.read_num<uint8_t>();
+    settings.socket_path = r.read_str();
+    settings.socket_perms = r.read_num<int32_t>();
+    settings.socket_uid = r.read_num<uint64_t>();
+    settings.socket_uid_gid = r.read_num<uint64_t>();
+    settings.socket_gid = r.read_num<uint64_t>();
+    read_timespec(r, settings.restart_interval);
+    settings.max_restarts = r.read_num<int32_t>();
+    read_timespec(r, settings.restart_delay);
+    read_timespec(r, settings.stop_timeout);
+    read_timespec(r, settings.start_timeout);
+
+    uint32_t num_rlimits = r.read_num<uint32_t>();
+    for (uint32_t i = 0; i < num_rlimits && r.is_good(); ++i) {
+        settings.rlimits.emplace_back(r.read_num<int32_t>());
+        service_rlimits &limits = settings.rlimits.back();
+        limits.soft_set = r.read_num<uint8_t>();
+        limits.hard_set = r.read_num<uint8_t>();
+        limits.limits.rlim_cur = r.read_num<uint64_t>();
+        limits.limits.rlim_max = r.read_num<uint64_t>();
+    }
+
+    settings.readiness_fd = r.read_num<int32_t>();
+    settings.readiness_var = r.read_str();
+    settings.run_as_uid = r.read_num<uint64_t>();
+    settings.run_as_uid_gid = r.read_num<uint64_t>();
+    settings.run_as_gid = r.read_num<uint64_t>();
+    settings.chain_to_name = r.read_str();
+
+    uint32_t id_len, line_len;
+    const char *inittab_id = r.read_str(id_len);
+    const char *inittab_line = r.read_str(line_len);
+    #if USE_UTMPX
+    if (id_len != sizeof(settings.inittab_id) || line_len != sizeof(settings.inittab_line)) {
+        return false;
+    }
+    memcpy(settings.inittab_id, inittab_id, id_len);
+    memcpy(settings.inittab_line, inittab_line, line_len);
+    #else
+    (void)inittab_id; (void)inittab_line;
+    #endif
+
+    return r.is_good() && r.at_end();
+}
+
+} // namespace dinit_load
+
+// Builder for a cache file.
+class service_cache_builder
+{
+    cache_writer records;
+    uint32_t num_records = 0;
+
+    public:
+    // Add a record for a service, whose description was read from the file at 'path' (which must
+    // not have been modified since). The settings data should have been produced by
+    // dinit_load::write_cached_settings(). Returns false (with errno set) if the file cannot be
+    // examined. May throw std::bad_alloc.
+    bool add_record(const std::string &name, const std::string &path, const std::vector<char> &settings_data);
+
+    // Write the cache file. The file is first written under a temporary name, and then renamed,
+    // so that a running dinit process which has the previous file mapped is not affected. Returns
+    // false (with errno set) on failure. May throw std::bad_alloc.
+    bool write(const char *path, const service_dir_pathlist &service_dirs);
+};
+
+// A cache file, mapped into memory.
+class service_cache
+{
+    const char *map_base = nullptr;
+    size_t map_size = 0;
+
+    // Map of service name to record (beginning with the file path)
+    std::unordered_map<std::string, cache_reader> index;
+
+    public:
+    service_cache() noexcept { }
+    service_cache(const service_cache &) = delete;
+    void operator=(const service_cache &) = delete;
+
+    ~service_cache();
+
+    // Open and map a cache file. The file must have been generated for the specified service
+    // directories. Returns false on failure, with 'err' set to a description of the problem.
+    // May throw std::bad_alloc.
+    bool open(const char *path, const service_dir_pathlist &service_dirs, std::string &err);
+
+    // Find the cache record for the named service, and check that it is current with respect to
+    // the service description file at 'path'. If so, return true and set 'settings_r' to read the
+    // service settings.
+    bool lookup(const std::string &name, const std::string &path, cache_reader &settings_r) const noexcept;
+
+    size_t size() const noexcept
+    {
+        return index.size();
+    }
+};
+
+#endif
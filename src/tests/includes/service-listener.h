@@ -0,0 +1,29 @@
+#ifndef SERVICE_LISTENER_H
+#define SERVICE_LISTENER_H
+
+#include "service-constants.h"
+
+class service_record;
+
+// Interface for listening to services
+class service_listener
+{
+    public:
+    
+    // An event occurred on the service being observed.
+    // Listeners must not be added or removed during event notification.
+    virtual void service_event(service_record * service, service_event_t event) noexcept = 0;
+};
+
+// Interface for listening to all services in a service set
+class service_set_listener
+{
+    public:
+
+    // An event occurred on a service in the set. This is called after the listeners for the
+    // individual service have been notified.
+    // Listeners must not be added or removed during event notification.
+    virtual void service_set_event(service_record * service, service_event_t event) noexcept = 0;
+};
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef DINIT_START_HISTORY_H
+#define DINIT_START_HISTORY_H 1
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include <cstdint>
+
+/*
+ * Start duration history.
+ *
+ * For each service, the history holds the durations of its most recent starts: the time from when
+ * the service itself began starting (its dependencies having started) until it reached the STARTED
+ * state. The history is loaded from a file when dinit starts, and written back (replacing the
+ * file) after it is updated, once the root filesystem is writable. The durations are used to order
+ * services waiting for a start slot (see service_set::set_start_slot_limit), and are reported to
+ * clients (DINIT_CP_QUERYSTARTHISTORY) so that start times can be compared with those of previous
+ * boots.
+ *
+ * The history of a service which has not started during the last few boots (more precisely, the
+ * last few times the history was loaded and then saved) is discarded, so that the history does not
+ * grow without bound as services are removed or renamed.
+ *
+ * File layout (all values in native byte order):
+ *   header:  magic (8 bytes), version (u32), byte order marker (u32), record count (u32)
+ *   records: service name (string), boots since last start (u32), duration count (u32),
+ *            durations (u32 each, in milliseconds, oldest first)
+ *
+ * A string is a u32 length followed by the (non-nul-terminated) characters.
+ */
+
+class start_history
+{
+    public:
+    // Maximum number of durations retained for each service
+    static constexpr unsigned max_durations = 8;
+
+    // Number of boots without a start after which a service's history is discarded
+    static constexpr unsigned max_unstarted_boots = 5;
+
+    struct service_history
+    {
+        std::vector<uint32_t> durations;  // in milliseconds, oldest first
+        unsigned new_count = 0;  // number of durations recorded since the history was loaded
+        uint32_t unstarted_boots = 0;  // number of boots since the service last started
+    };
+
+    private:
+    // (ordered by name, so that the history can be listed in parts; see DINIT_CP_QUERYSTARTHISTORY)
+    std::map<std::string, service_history> histories;
+    std::string path;
+    bool dirty = false;
+
+    public:
+    // Set the path of the history file, and load the history from it (this counts as a boot, for
+    // the purpose of discarding the history of services which no longer start). Returns false on
+    // failure, with errno set (ENOENT if the file does not exist) or, if the file is not a valid
+    // history file, with 'err' set to a description of the problem and errno set to 0. The path is
+    // retained even on failure.
+    bool load(const char *path_p, std::string &err);
+
+    // Write the history to the file (from which it was loaded). The file is replaced, but is not
+    // synced to disk: the history is only advisory, and losing the most recent update (or, after a
+    // crash, the whole history) is preferable to stalling dinit. Returns false on failure, with
+    // errno set.
+    bool save();
+
+    // Record a start duration for a service.
+    void record(const std::string &name, uint32_t millis) noexcept;
+
+    // Get the expected duration of a start for a service: the median of its recorded durations,
+    // or 0 if there are none.
+    uint32_t get_expected(const std::string &name) const noexcept;
+
+    // Whether there are durations which have not been saved
+    bool is_dirty() const noexcept
+    {
+        return dirty;
+    }
+
+    const std::map<std::string, service_history> &get_histories() const noexcept
+    {
+        return histories;
+    }
+};
+
+#endif
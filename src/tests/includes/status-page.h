@@ -0,0 +1,155 @@
+#ifndef DINIT_STATUS_PAGE_H
+#define DINIT_STATUS_PAGE_H 1
+
+#include <string>
+#include <vector>
+#include <atomic>
+
+#include <cstdint>
+#include <cstring>
+
+/*
+ * Service status page.
+ *
+ * The status page is a file, created alongside the control socket (with ".status" appended to the
+ * socket path), which dinit maps into memory and updates whenever the status of a service changes.
+ * Other processes can map the file (read-only) and read the status of all loaded services without
+ * communicating with dinit at all. The status page is for monitoring only; the control socket
+ * remains authoritative.
+ *
+ * File layout (all values in native byte order):
+ *   header:  magic (8 bytes), version (u32), header size (u32), slot size (u32), slot count (u32),
+ *            dinit process id (i32), reserved (u32)
+ *   slots:   an array of fixed-size slots, each holding the status of one service (or unused)
+ *
+ * Each slot is protected by a sequence counter ("seqlock"): dinit increments the counter (to an
+ * odd value) before modifying the slot, and again (to an even value) once the modification is
+ * complete. A reader copies the slot contents and then re-checks the counter; if the counter was
+ * odd, or has changed, the copy may be inconsistent and must be retried (a bounded number of times,
+ * since the counter stays odd if dinit terminates part-way through an update). A slot whose
+ * service id is 0 is unused.
+ *
+ * The file is extended (and the slot count in the header increased) as more slots are required;
+ * it never shrinks while dinit is running. Slots are re-used after a service is unloaded.
+ */
+
+constexpr char status_page_magic[8] = { 'D', 'I', 'N', 'I', 'T', 'S', 'T', 'P' };
+constexpr uint32_t status_page_version = 1;
+
+struct status_page_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t slot_size;
+    std::atomic<uint32_t> num_slots;
+    int32_t dinit_pid;
+    uint32_t reserved;
+};
+
+// The status of a single service.
+struct status_page_record
+{
+    int64_t transition_secs;    // system time of last change of state or target state
+    uint32_t transition_nsecs;
+    uint32_t service_id;        // identifier of service (0 = unused slot)
+    int32_t pid;                // process id (-1 if none)
+    int32_t exit_status;        // exit status (as for waitpid) of last process
+    uint32_t restart_count;     // number of times the service has been restarted
+    uint8_t state;              // service_state_t
+    uint8_t target_state;       // service_state_t
+    uint8_t type;               // service_type_t
+    uint8_t flags;              // as for DINIT_RP_SVCINFO
+    uint8_t stop_reason;        // stopped_reason_t
+    uint8_t name_len;           // length of name (truncated to fit if necessary)
+    uint8_t reserved[2];
+    char name[84];
+};
+
+struct status_page_slot
+{
+    std::atomic<uint32_t> seq;
+    uint32_t reserved;
+    status_page_record rec;
+};
+
+static_assert(sizeof(status_page_header) == 32, "unexpected status page header size");
+static_assert(sizeof(status_page_slot) == 128, "unexpected status page slot size");
+
+// Maximum number of attempts to read a consistent copy of a slot
+constexpr unsigned status_slot_read_attempts = 1000;
+
+// Read a consistent copy of a slot (the service id of the copy is 0 if the slot is unused).
+// Returns false if a consistent copy could not be read within a bounded number of attempts (which
+// may happen if dinit was terminated while updating the slot).
+inline bool read_status_slot(const status_page_slot &slot, status_page_record &rec) noexcept
+{
+    for (unsigned i = 0; i < status_slot_read_attempts; i++) {
+        uint32_t seq = slot.seq.load(std::memory_order_acquire);
+        if ((seq & 1) == 0) {
+            memcpy(&rec, &slot.rec, sizeof(rec));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) == seq) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+class service_record;
+
+// The status page as maintained by dinit.
+class status_page
+{
+    int fd = -1;
+    char *map_base = nullptr;
+    size_t map_size = 0;
+    std::string path;
+
+    uint32_t num_slots = 0;          // slots in the mapped file
+    uint32_t next_unused_slot = 0;   // slots at and beyond this index have never been used
+    std::vector<uint32_t> free_slots;
+
+    status_page_slot *get_slot(uint32_t slot) noexcept
+    {
+        return reinterpret_cast<status_page_slot *>(map_base + sizeof(status_page_header)) + slot;
+    }
+
+    // Extend the file to accommodate (at least) the given number of slots, and re-map it.
+    bool extend(uint32_t min_slots) noexcept;
+
+    public:
+    static constexpr uint32_t no_slot = -1;
+
+    status_page() noexcept { }
+    status_page(const status_page &) = delete;
+
+    ~status_page()
+    {
+        close();
+    }
+
+    // Create the status page file (replacing any existing file) and map it. On failure, returns
+    // false and sets 'err' to an error message.
+    bool open(const char *path, std::string &err);
+
+    // Unmap and remove the status page file.
+    void close() noexcept;
+
+    bool is_open() const noexcept
+    {
+        return map_base != nullptr;
+    }
+
+    // Allocate a slot for a service. Returns no_slot on failure.
+    uint32_t allocate_slot() noexcept;
+
+    // Mark a slot unused, and make it available for re-use.
+    void release_slot(uint32_t slot) noexcept;
+
+    // Write the current status of a service into its slot.
+    void update(uint32_t slot, service_record *service) noexcept;
+};
+
+#endif
@@ -1,12 +1,18 @@
 #include <string>
 #include <iostream>
 #include <sstream>
+#include <fstream>
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
 
+#include <unistd.h>
+#include <sys/stat.h>
+
 #include "service.h"
 #include "proc-service.h"
+#include "service-cache.h"
+#include "env-file.h"
 //#include "load-service.h"
 
 std::string test_service_dir;
@@ -211,6 +217,273 @@ void test_path_env_subst()
     assert(settings.logfile == "/some/testsuccess/dir");
 }
 
+// Check that services added to a service directory after its contents were first read are not
+// found until the snapshot of the directory contents is invalidated (and that names not present at
+// all are reported as not found).
+void test_dir_listing()
+{
+    char dir_template[] = "/tmp/dinit-test-svcdir.XXXXXX";
+    assert(mkdtemp(dir_template) != nullptr);
+    std::string dir = dir_template;
+
+    std::ofstream(dir + "/s1") << "type = internal\n";
+
+    dirload_service_set sset(dir.c_str());
+    assert(sset.load_service("s1") != nullptr);
+
+    // The directory is not read again when a service is not in the snapshot:
+    std::ofstream(dir + "/s2") << "type = internal\n";
+    bool got_service_not_found = false;
+    try {
+        sset.load_service("s2");
+    }
+    catch (service_not_found &) {
+        got_service_not_found = true;
+    }
+    assert(got_service_not_found);
+
+    sset.invalidate_dir_listings();
+    assert(sset.load_service("s2") != nullptr);
+
+    unlink((dir + "/s2").c_str());
+    std::ofstream(dir + "/s3") << "type = internal\n";
+    sset.invalidate_dir_listings();
+    assert(sset.load_service("s3") != nullptr);
+
+    got_service_not_found = false;
+    try {
+        sset.load_service("s4");
+    }
+    catch (service_not_found &) {
+        got_service_not_found = true;
+    }
+    assert(got_service_not_found);
+
+    // A dependency directory is read when first used:
+    mkdir((dir + "/s5.d").c_str(), 0755);
+    std::ofstream(dir + "/s5.d/s1");
+    std::ofstream(dir + "/s5.d/s3");
+    std::ofstream(dir + "/s5") << "type = internal\nwaits-for.d = s5.d\n";
+    sset.invalidate_dir_listings();
+    service_record *s5 = sset.load_service("s5");
+    assert(s5->get_dependencies().size() == 2);
+    assert(s5->get_dependencies().front().get_to()->get_name() == "s1");
+
+    unlink((dir + "/s5.d/s1").c_str());
+    unlink((dir + "/s5.d/s3").c_str());
+    rmdir((dir + "/s5.d").c_str());
+    unlink((dir + "/s5").c_str());
+    unlink((dir + "/s3").c_str());
+    unlink((dir + "/s1").c_str());
+    rmdir(dir.c_str());
+}
+
+// Check that all services in a directory are loaded by preload_services(), and that each failure
+// is reported once.
+void test_preload()
+{
+    char dir_template[] = "/tmp/dinit-test-svcdir.XXXXXX";
+    assert(mkdtemp(dir_template) != nullptr);
+    std::string dir = dir_template;
+
+    std::ofstream(dir + "/good1") << "type = internal\ndepends-on = good2\n";
+    std::ofstream(dir + "/good2") << "type = internal\n";
+    std::ofstream(dir + "/bad") << "type = internal\nno-such-setting = 1\n";
+    std::ofstream(dir + "/needs-bad") << "type = internal\ndepends-on = bad\n";
+    std::ofstream(dir + "/cycle1") << "type = internal\ndepends-on = cycle2\n";
+    std::ofstream(dir + "/cycle2") << "type = internal\ndepends-on = cycle1\n";
+    std::ofstream(dir + "/script.sh") << "#!/bin/sh\n";
+    chmod((dir + "/script.sh").c_str(), 0755);
+
+    dirload_service_set sset(dir.c_str());
+    std::list<std::pair<std::string, std::string>> errors;
+    unsigned num_loaded = sset.preload_services(errors);
+
+    assert(num_loaded == 2);
+    assert(sset.find_service("good1") != nullptr);
+    assert(sset.find_service("good2") != nullptr);
+    assert(sset.find_service("needs-bad") == nullptr);
+    assert(sset.find_service("script.sh") == nullptr);
+
+    // "bad" is reported once (although it fails to load both directly and as a dependency of
+    // needs-bad), and both cycle1 and cycle2 fail due to the dependency cycle:
+    assert(errors.size() == 3);
+    auto error_i = errors.begin();
+    assert((error_i++)->first == "bad");
+    assert((error_i++)->first == "cycle1");
+    assert(error_i->first == "cycle2");
+
+    for (const char *name : {"good1", "good2", "bad", "needs-bad", "cycle1", "cycle2", "script.sh"}) {
+        unlink((dir + "/" + name).c_str());
+    }
+    rmdir(dir.c_str());
+}
+
+void test_setting_lookup()
+{
+    using dinit_load::setting_id;
+    using dinit_load::lookup_setting_id;
+
+    assert(lookup_setting_id("command") == setting_id::COMMAND);
+    assert(lookup_setting_id("waits-for.d") == setting_id::WAITS_FOR_D);
+    assert(lookup_setting_id("termsignal") == setting_id::TERMSIGNAL);
+    assert(lookup_setting_id("rlimit-addrspace") == setting_id::RLIMIT_ADDRSPACE);
+
+    assert(lookup_setting_id("") == setting_id::NONE);
+    assert(lookup_setting_id("Command") == setting_id::NONE);
+    assert(lookup_setting_id("commands") == setting_id::NONE);
+    assert(lookup_setting_id("waits-for.") == setting_id::NONE);
+
+    // Unknown settings are still reported:
+    std::stringstream ss;
+    ss << "type = internal\n"
+            "no-such-setting = 1\n";
+
+    dinit_load::service_settings_wrapper<test_prelim_dep> settings;
+    bool got_exception = false;
+    try {
+        process_service_file("test-service", ss,
+                [&](std::string &line, std::string &setting, std::string::iterator &i,
+                        std::string::iterator &end) -> void {
+            auto process_dep_dir_n = [](std::list<test_prelim_dep> &deplist, const std::string &waitsford,
+                    dependency_type dep_type) -> void { };
+            auto load_service_n = [](const std::string &dep_name) -> const std::string & {
+                return dep_name;
+            };
+            process_service_line(settings, "test-service", line, setting, i, end, load_service_n,
+                    process_dep_dir_n);
+        });
+    }
+    catch (service_description_exc &exc) {
+        got_exception = true;
+    }
+    assert(got_exception);
+    assert(settings.service_type == service_type_t::INTERNAL);
+}
+
+// Check that service settings are loaded from the service cache, if it has a record for the service.
+void test_service_cache()
+{
+    using string = std::string;
+    using string_iterator = std::string::iterator;
+
+    // Produce a cache record for t2 which differs from the description file, so that we can tell
+    // whether the cache was used:
+    dinit_load::service_settings_wrapper<cached_dep> settings;
+    std::stringstream ss;
+    ss << "type = process\n"
+            "load-options = sub-vars\n"
+            "command = echo $ONEVAR cached\n"
+            "depends-on = t1\n";
+
+    process_service_file("t2", ss,
+            [&](string &line, string &setting, string_iterator &i, string_iterator &end) -> void {
+
+        auto process_dep_dir_n = [&](std::list<cached_dep> &deplist, const std::string &waitsford,
+                dependency_type dep_type) -> void {
+            deplist.emplace_back(waitsford, dep_type, true);
+        };
+
+        auto load_service_n = [&](const string &dep_name) -> const string & {
+            return dep_name;
+        };
+
+        process_service_line(settings, "t2", line, setting, i, end, load_service_n, process_dep_dir_n);
+    });
+
+    cache_writer w;
+    dinit_load::write_cached_settings(w, settings, settings.depends);
+
+    dirload_service_set sset(test_service_dir.c_str());
+
+    char cache_path[] = "/tmp/dinit-test-cache.XXXXXX";
+    int fd = mkstemp(cache_path);
+    assert(fd != -1);
+    close(fd);
+
+    service_cache_builder builder;
+    assert(builder.add_record("t2", test_service_dir + "/t2", w.get_buffer()));
+    assert(builder.write(cache_path, sset.get_service_dirs()));
+
+    service_cache cache;
+    std::string err;
+    assert(cache.open(cache_path, sset.get_service_dirs(), err));
+    unlink(cache_path);
+    sset.set_service_cache(&cache);
+
+    setenv("ONEVAR", "a", true);
+    auto t2 = static_cast<base_process_service *>(sset.load_service("t2"));
+    auto exec_parts = t2->get_exec_arg_parts();
+    assert(strcmp("echo", exec_parts[0]) == 0);
+    assert(strcmp("a", exec_parts[1]) == 0);
+    assert(strcmp("cached", exec_parts[2]) == 0);
+
+    assert(t2->get_dependencies().size() == 1);
+    assert(t2->get_dependencies().front().get_to()->get_name() == "t1");
+
+    // t1 has no cache record, and so is loaded from its description file:
+    assert(sset.find_service("t1")->get_type() == service_type_t::INTERNAL);
+}
+
+// Check reading (and caching) of environment files, and preparation of a child environment block.
+void test_env_file()
+{
+    char file_template[] = "/tmp/dinit-test-envfile.XXXXXX";
+    int fd = mkstemp(file_template);
+    assert(fd != -1);
+    close(fd);
+
+    std::ofstream(file_template) << "DINIT_TEST_A=1\n# comment\n\nDINIT_TEST_B=two\n=bad\nDINIT_TEST_A=3\n";
+
+    const std::vector<std::string> &vars = get_env_file_vars(file_template);
+    assert(vars.size() == 2);
+    assert(vars[0] == "DINIT_TEST_A=3");
+    assert(vars[1] == "DINIT_TEST_B=two");
+
+    // Unchanged file: cached settings are returned
+    assert(&get_env_file_vars(file_template) == &vars);
+
+    setenv("DINIT_TEST_A", "original", true);
+    setenv("DINIT_TEST_AB", "unaffected", true);
+
+    std::vector<const char *> envp;
+    build_child_env(envp, &vars, 2);
+    assert(envp.back() == nullptr);
+
+    auto count_setting = [&](const char *setting) {
+        int count = 0;
+        for (const char *env : envp) {
+            if (env != nullptr && strcmp(env, setting) == 0) ++count;
+        }
+        return count;
+    };
+
+    assert(count_setting("DINIT_TEST_A=3") == 1);
+    assert(count_setting("DINIT_TEST_A=original") == 0);
+    assert(count_setting("DINIT_TEST_AB=unaffected") == 1);
+
+    // Setting an existing variable replaces it; new variables use spare slots:
+    assert(set_child_env_var(envp, "DINIT_TEST_B=replaced"));
+    assert(count_setting("DINIT_TEST_B=two") == 0);
+    assert(count_setting("DINIT_TEST_B=replaced") == 1);
+    assert(set_child_env_var(envp, "DINIT_TEST_C=1"));
+    assert(set_child_env_var(envp, "DINIT_TEST_D=1"));
+    assert(!set_child_env_var(envp, "DINIT_TEST_E=1"));
+    assert(envp.back() == nullptr);
+
+    // A changed file is re-read:
+    std::ofstream(file_template) << "DINIT_TEST_C=changed\n";
+    const std::vector<std::string> &vars2 = get_env_file_vars(file_template);
+    assert(vars2.size() == 1);
+    assert(vars2[0] == "DINIT_TEST_C=changed");
+
+    unlink(file_template);
+    assert(get_env_file_vars(file_template).empty());
+
+    unsetenv("DINIT_TEST_A");
+    unsetenv("DINIT_TEST_AB");
+}
+
 #define RUN_TEST(name, spacing) \
     std::cout << #name "..." spacing << std::flush; \
     name(); \
@@ -225,5 +498,10 @@ int main(int argc, char **argv)
     RUN_TEST(test_nonexistent, "          ");
     RUN_TEST(test_settings, "             ");
     RUN_TEST(test_path_env_subst, "       ");
+    RUN_TEST(test_dir_listing, "          ");
+    RUN_TEST(test_preload, "              ");
+    RUN_TEST(test_setting_lookup, "       ");
+    RUN_TEST(test_service_cache, "        ");
+    RUN_TEST(test_env_file, "             ");
     return 0;
 }
@@ -4,6 +4,7 @@
 #include <utility>
 #include <string>
 #include <sstream>
+#include <vector>
 
 #include "service.h"
 #include "proc-service.h"
@@ -25,6 +26,7 @@ class base_process_service_test
     static void exec_succeeded(base_process_service *bsp)
     {
         bsp->waiting_for_execstat = false;
+        bsp->services->record_timeline(bsp, timeline_event_t::EXEC_SUCCEEDED);
         bsp->exec_succeeded();
     }
 
@@ -35,6 +37,8 @@ class base_process_service_test
         err.st_errno = errcode;
     	bsp->waiting_for_execstat = false;
     	bsp->pid = -1;
+        bsp->exec_err_info = err;
+        bsp->have_exec_err = true;
     	bsp->exec_failed(err);
     }
 
@@ -54,12 +58,19 @@ class base_process_service_test
     {
         return bsp->notification_fd;
     }
+
+    static int get_exec_status_fd(base_process_service *bsp)
+    {
+        return bsp->child_status_listener.get_watched_fd();
+    }
 };
 
 namespace bp_sys {
     // last signal sent:
     extern int last_sig_sent;
+    extern pid_t last_sig_pid;
     extern pid_t last_forked_pid;
+    extern pid_t last_vfork_spawn_pid;
 }
 
 static void init_service_defaults(base_process_service &ps)
@@ -96,6 +107,16 @@ void test_proc_service_start()
     assert(p.get_state() == service_state_t::STARTED);
     assert(event_loop.active_timers.size() == 0);
 
+    // The launch of the process is recorded in the timeline:
+    const service_timeline &timeline = sset.get_timeline();
+    assert(timeline.size() == 5);
+    assert(timeline[0].event == timeline_event_t::STARTING);
+    assert(timeline[1].event == timeline_event_t::DEPS_STARTED);
+    assert(timeline[2].event == timeline_event_t::EXEC);
+    assert(timeline[3].event == timeline_event_t::EXEC_SUCCEEDED);
+    assert(timeline[4].event == timeline_event_t::STARTED);
+    assert(timeline[2].service_id == p.get_id());
+
     sset.remove_service(&p);
 }
 
@@ -571,6 +592,147 @@ void test_proc_start_execfail()
     sset.remove_service(&p);
 }
 
+// Test that failure to read the environment file (which is read before launching the process) is
+// reported as a launch failure.
+void test_proc_envfile_fail()
+{
+    using namespace std;
+
+    service_set sset;
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    process_service p {&sset, "testproc", std::move(command), command_offsets, depends};
+    init_service_defaults(p);
+    p.set_env_file("."); // a directory, which can't be read as a file
+    sset.add_service(&p);
+
+    pid_t last_pid = bp_sys::last_forked_pid;
+    p.start();
+    sset.process_queues();
+
+    assert(bp_sys::last_forked_pid == last_pid);
+    assert(p.get_state() == service_state_t::STOPPED);
+    assert(p.get_stop_reason() == stopped_reason_t::EXECFAILED);
+
+    exec_stage stage;
+    int st_errno;
+    assert(p.get_exec_error(stage, st_errno));
+    assert(stage == exec_stage::READ_ENV_FILE);
+    assert(st_errno == EIO);
+
+    sset.remove_service(&p);
+}
+
+// Supply an exec() failure status on the status pipe of a process which is being launched, as the
+// child would after failing to exec.
+static void supply_exec_failure(base_process_service *bsp, exec_stage stage, int errcode)
+{
+    int status_fd = base_process_service_test::get_exec_status_fd(bsp);
+    run_proc_err err;
+    err.stage = stage;
+    err.st_errno = errcode;
+    std::vector<char> err_data((char *)&err, (char *)&err + sizeof(err));
+    bp_sys::supply_read_data(status_fd, std::move(err_data));
+    event_loop.send_fd_event(status_fd, dasynq::IN_EVENTS);
+}
+
+// Test that a process is launched via vfork_spawn when possible, and exec() failure reported via
+// the status pipe.
+void test_proc_vfork_execfail()
+{
+    using namespace std;
+
+    service_set sset;
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    process_service p {&sset, "testproc", std::move(command), command_offsets, depends};
+    init_service_defaults(p);
+    sset.add_service(&p);
+
+    p.start();
+    sset.process_queues();
+
+    assert(p.get_state() == service_state_t::STARTING);
+    assert(p.get_pid() == bp_sys::last_forked_pid);
+    assert(bp_sys::last_vfork_spawn_pid == bp_sys::last_forked_pid);
+
+    supply_exec_failure(&p, exec_stage::DO_EXEC, ENOENT);
+
+    assert(p.get_state() == service_state_t::STOPPED);
+    assert(p.get_stop_reason() == stopped_reason_t::EXECFAILED);
+    assert(p.get_pid() == -1);
+    assert(event_loop.active_timers.size() == 0);
+
+    sset.remove_service(&p);
+}
+
+// Test that a process which runs on the console, as another user, or with a utmp entry is launched
+// via fork rather than vfork_spawn, and that exec() failure is reported via the status pipe.
+void test_proc_fork_fallback()
+{
+    using namespace std;
+
+    service_set sset;
+
+    auto make_service = [&](const char *name) {
+        string command = "test-command";
+        list<pair<unsigned,unsigned>> command_offsets;
+        command_offsets.emplace_back(0, command.length());
+        std::list<prelim_dep> depends;
+        process_service *p = new process_service(&sset, name, std::move(command), command_offsets,
+                depends);
+        init_service_defaults(*p);
+        sset.add_service(p);
+        return p;
+    };
+
+    process_service *p_console = make_service("testproc-console");
+    service_flags_t flags;
+    flags.shares_console = true;
+    p_console->set_flags(flags);
+
+    process_service *p_runas = make_service("testproc-runas");
+    p_runas->set_run_as_uid_gid(1000, 1000);
+
+    std::vector<process_service *> services { p_console, p_runas };
+
+#if USE_UTMPX
+    process_service *p_utmp = make_service("testproc-utmp");
+    p_utmp->set_utmp_id("t1");
+    services.push_back(p_utmp);
+#endif
+
+    for (process_service *p : services) {
+        pid_t vfork_pid = bp_sys::last_vfork_spawn_pid;
+
+        p->start();
+        sset.process_queues();
+
+        assert(p->get_state() == service_state_t::STARTING);
+        assert(p->get_pid() == bp_sys::last_forked_pid);
+        assert(bp_sys::last_vfork_spawn_pid == vfork_pid);
+
+        supply_exec_failure(p, exec_stage::SET_UIDGID, EPERM);
+
+        assert(p->get_state() == service_state_t::STOPPED);
+        assert(p->get_stop_reason() == stopped_reason_t::EXECFAILED);
+        assert(p->get_pid() == -1);
+
+        sset.remove_service(p);
+        delete p;
+    }
+
+    assert(event_loop.active_timers.size() == 0);
+}
+
 // Test no ready notification before process terminates
 void test_proc_notify_fail()
 {
@@ -666,6 +828,50 @@ void test_proc_stop_timeout()
     sset.remove_service(&p);
 }
 
+// Test that a service which signals only its process (not the process group) signals its own
+// process via the child watcher, even once other processes have been launched
+void test_proc_sig_proc_only()
+{
+    using namespace std;
+
+    service_set sset;
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    process_service p {&sset, "testproc", std::move(command), command_offsets, depends};
+    init_service_defaults(p);
+    service_flags_t sflags;
+    sflags.signal_process_only = true;
+    p.set_flags(sflags);
+    sset.add_service(&p);
+
+    p.start();
+    sset.process_queues();
+    base_process_service_test::exec_succeeded(&p);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STARTED);
+
+    pid_t service_pid = p.get_pid();
+    ++bp_sys::last_forked_pid; // some other process is launched
+
+    p.stop(true);
+    sset.process_queues();
+
+    assert(p.get_state() == service_state_t::STOPPING);
+    assert(bp_sys::last_sig_sent == SIGTERM);
+    assert(bp_sys::last_sig_pid == service_pid);
+
+    base_process_service_test::handle_exit(&p, 0);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STOPPED);
+
+    event_loop.active_timers.clear();
+    sset.remove_service(&p);
+}
+
 // Smooth recovery
 void test_proc_smooth_recovery1()
 {
@@ -1798,6 +2004,202 @@ void test_waitsfor_restart()
 }
 
 
+// Test that the start slot limit restricts the number of services starting at once, and that
+// waiting services are started in order of the number of services waiting for them.
+void test_start_slot_limit()
+{
+    using namespace std;
+
+    service_set sset;
+    sset.set_start_slot_limit(1);
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    process_service p1 {&sset, "testproc-1", string(command), command_offsets, depends};
+    init_service_defaults(p1);
+    sset.add_service(&p1);
+    process_service p2 {&sset, "testproc-2", string(command), command_offsets, depends};
+    init_service_defaults(p2);
+    sset.add_service(&p2);
+    process_service p3 {&sset, "testproc-3", string(command), command_offsets, depends};
+    init_service_defaults(p3);
+    sset.add_service(&p3);
+
+    service_record tp {&sset, "test-service", service_type_t::INTERNAL, {{&p2, REG}}};
+    sset.add_service(&tp);
+
+    // p1 takes the only slot:
+    sset.start_service(&p1);
+    assert(p1.get_state() == service_state_t::STARTING);
+    assert(p1.get_pid() != -1);
+    assert(sset.get_start_slots_held() == 1);
+
+    // p3 and then p2 must wait; p2 (which tp is waiting for) is queued ahead of p3:
+    sset.start_service(&p3);
+    sset.start_service(&tp);
+    assert(p3.get_state() == service_state_t::STARTING);
+    assert(p3.get_pid() == -1);
+    assert(p2.get_state() == service_state_t::STARTING);
+    assert(p2.get_pid() == -1);
+
+    // The slot released by p1 is passed on only once queues are processed (not during p1's
+    // transition to STARTED):
+    base_process_service_test::exec_succeeded(&p1);
+    assert(p1.get_state() == service_state_t::STARTED);
+    assert(p2.get_pid() == -1);
+    sset.process_queues();
+    assert(p2.get_pid() != -1);
+    assert(p3.get_pid() == -1);
+    assert(sset.get_start_slots_held() == 1);
+
+    // A waiting service can be stopped, and no longer waits:
+    sset.stop_service(&p3);
+    assert(p3.get_state() == service_state_t::STOPPED);
+
+    base_process_service_test::exec_succeeded(&p2);
+    sset.process_queues();
+    assert(p2.get_state() == service_state_t::STARTED);
+    assert(tp.get_state() == service_state_t::STARTED);
+    assert(sset.get_start_slots_held() == 0);
+
+    // A failure to start releases the slot:
+    sset.start_service(&p3);
+    assert(p3.get_pid() != -1);
+    assert(sset.get_start_slots_held() == 1);
+    base_process_service_test::exec_failed(&p3, ENOENT);
+    sset.process_queues();
+    assert(p3.get_state() == service_state_t::STOPPED);
+    assert(sset.get_start_slots_held() == 0);
+
+    sset.remove_service(&tp);
+    sset.remove_service(&p1);
+    sset.remove_service(&p2);
+    sset.remove_service(&p3);
+}
+
+// Test that services waiting for a start slot are ordered by the expected duration of the start of
+// the service and the services waiting for it, as recorded in the start history.
+void test_start_slot_history()
+{
+    using namespace std;
+
+    service_set sset;
+    sset.set_start_slot_limit(1);
+
+    start_history history;
+    history.record("testproc-3", 5000);
+    history.record("test-service", 10);
+    sset.set_start_history(&history);
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    process_service p1 {&sset, "testproc-1", string(command), command_offsets, depends};
+    init_service_defaults(p1);
+    sset.add_service(&p1);
+    process_service p2 {&sset, "testproc-2", string(command), command_offsets, depends};
+    init_service_defaults(p2);
+    sset.add_service(&p2);
+    process_service p3 {&sset, "testproc-3", string(command), command_offsets, depends};
+    init_service_defaults(p3);
+    sset.add_service(&p3);
+
+    service_record tp {&sset, "test-service", service_type_t::INTERNAL, {{&p2, REG}}};
+    sset.add_service(&tp);
+
+    sset.start_service(&p1);
+    sset.start_service(&tp);
+    sset.start_service(&p3);
+    assert(p2.get_pid() == -1);
+    assert(p3.get_pid() == -1);
+
+    // p3 is expected to take longer to start than p2 and tp together:
+    base_process_service_test::exec_succeeded(&p1);
+    sset.process_queues();
+    assert(p3.get_pid() != -1);
+    assert(p2.get_pid() == -1);
+
+    base_process_service_test::exec_succeeded(&p3);
+    sset.process_queues();
+    assert(p2.get_pid() != -1);
+    base_process_service_test::exec_succeeded(&p2);
+    sset.process_queues();
+    assert(tp.get_state() == service_state_t::STARTED);
+    assert(sset.get_start_slots_held() == 0);
+
+    sset.set_start_history(nullptr);
+    sset.remove_service(&tp);
+    sset.remove_service(&p1);
+    sset.remove_service(&p2);
+    sset.remove_service(&p3);
+}
+
+// Test that the priority of a service waiting for a start slot reflects services which began
+// waiting for it after it was queued.
+void test_start_slot_reorder()
+{
+    using namespace std;
+
+    service_set sset;
+    sset.set_start_slot_limit(1);
+
+    start_history history;
+    history.record("testproc-3", 5000);
+    history.record("test-service", 10000);
+    sset.set_start_history(&history);
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    process_service p1 {&sset, "testproc-1", string(command), command_offsets, depends};
+    init_service_defaults(p1);
+    sset.add_service(&p1);
+    process_service p2 {&sset, "testproc-2", string(command), command_offsets, depends};
+    init_service_defaults(p2);
+    sset.add_service(&p2);
+    process_service p3 {&sset, "testproc-3", string(command), command_offsets, depends};
+    init_service_defaults(p3);
+    sset.add_service(&p3);
+
+    service_record tp {&sset, "test-service", service_type_t::INTERNAL, {{&p2, REG}}};
+    sset.add_service(&tp);
+
+    sset.start_service(&p1);
+    sset.start_service(&p2);
+    sset.start_service(&p3);
+    assert(p2.get_pid() == -1);
+    assert(p3.get_pid() == -1);
+
+    // p2 was queued before tp began waiting for it; p2 and tp together are now expected to take
+    // longer to start than p3:
+    sset.start_service(&tp);
+    base_process_service_test::exec_succeeded(&p1);
+    sset.process_queues();
+    assert(p2.get_pid() != -1);
+    assert(p3.get_pid() == -1);
+
+    base_process_service_test::exec_succeeded(&p2);
+    sset.process_queues();
+    assert(p3.get_pid() != -1);
+    base_process_service_test::exec_succeeded(&p3);
+    sset.process_queues();
+    assert(tp.get_state() == service_state_t::STARTED);
+    assert(sset.get_start_slots_held() == 0);
+
+    sset.set_start_history(nullptr);
+    sset.remove_service(&tp);
+    sset.remove_service(&p1);
+    sset.remove_service(&p2);
+    sset.remove_service(&p3);
+}
+
 #define RUN_TEST(name, spacing) \
     std::cout << #name "..." spacing << std::flush; \
     name(); \
@@ -1816,8 +2218,12 @@ int main(int argc, char **argv)
     RUN_TEST(test_proc_start_timeout, "    ");
     RUN_TEST(test_proc_start_timeout2, "   ");
     RUN_TEST(test_proc_start_execfail, "   ");
+    RUN_TEST(test_proc_envfile_fail, "     ");
+    RUN_TEST(test_proc_vfork_execfail, "   ");
+    RUN_TEST(test_proc_fork_fallback, "    ");
     RUN_TEST(test_proc_notify_fail, "      ");
     RUN_TEST(test_proc_stop_timeout, "     ");
+    RUN_TEST(test_proc_sig_proc_only, "    ");
     RUN_TEST(test_proc_smooth_recovery1, " ");
     RUN_TEST(test_proc_smooth_recovery2, " ");
     RUN_TEST(test_proc_smooth_recovery3, " ");
@@ -1838,4 +2244,7 @@ int main(int argc, char **argv)
     RUN_TEST(test_scripted_start_skip, "   ");
     RUN_TEST(test_scripted_start_skip2, "  ");
     RUN_TEST(test_waitsfor_restart, "      ");
+    RUN_TEST(test_start_slot_limit, "      ");
+    RUN_TEST(test_start_slot_history, "    ");
+    RUN_TEST(test_start_slot_reorder, "    ");
 }
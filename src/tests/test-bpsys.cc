@@ -47,7 +47,9 @@ std::map<std::string, std::vector<char>> file_content_map;
 namespace bp_sys {
 
 int last_sig_sent = -1; // last signal number sent, accessible for tests.
+pid_t last_sig_pid = 0;  // process (or negated process group) id to which last signal was sent
 pid_t last_forked_pid = 1;  // last forked process id (incremented each 'fork')
+pid_t last_vfork_spawn_pid = 0;  // last process id returned by 'vfork_spawn'
 
 // Test helper methods:
 
@@ -151,6 +153,7 @@ int close(int fd)
 int kill(pid_t pid, int sig)
 {
     last_sig_sent = sig;
+    last_sig_pid = pid;
     return 0;
 }
 
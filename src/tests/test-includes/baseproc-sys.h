@@ -133,6 +133,18 @@ inline pid_t waitpid(pid_t p, exit_status *statusp, int flags)
     return 0; // TODO complete mock
 }
 
+extern pid_t last_forked_pid;
+extern pid_t last_vfork_spawn_pid;
+
+constexpr bool have_vfork_spawn = true;
+
+// Like the mock fork, this doesn't run the child function
+inline pid_t vfork_spawn(int (*func)(void *), void *arg, char *stack, size_t stack_size)
+{
+    last_vfork_spawn_pid = ++last_forked_pid;
+    return last_forked_pid;
+}
+
 ssize_t read(int fd, void *buf, size_t count);
 ssize_t write(int fd, const void *buf, size_t count);
 ssize_t writev (int fd, const struct iovec *iovec, int count);
@@ -7,6 +7,7 @@
 #include <map>
 #include <string>
 #include <cassert>
+#include <cerrno>
 
 #include <dasynq.h>
 
@@ -16,6 +17,7 @@ using time_val = dasynq::time_val;
 
 namespace bp_sys {
     extern pid_t last_forked_pid;
+    int kill(pid_t pid, int sig);
 }
 
 // This is a mock for a Dasynq-based event loop
@@ -57,32 +59,49 @@ class eventloop_t
 
     class child_proc_watcher
     {
+        pid_t watched_pid = -1;
+
         public:
         pid_t fork(eventloop_t &loop, bool reserved_child_watcher, int priority = dasynq::DEFAULT_PRIORITY)
         {
             bp_sys::last_forked_pid++;
+            watched_pid = bp_sys::last_forked_pid;
             return bp_sys::last_forked_pid;
         }
 
-        void add_reserved(eventloop_t &eloop, pid_t child, int prio = dasynq::DEFAULT_PRIORITY) noexcept
+        void reserve_watch(eventloop_t &eloop)
         {
 
         }
 
-        void stop_watch(eventloop_t &eloop) noexcept
+        void add_reserved(eventloop_t &eloop, pid_t child, int prio = dasynq::DEFAULT_PRIORITY) noexcept
         {
+            watched_pid = child;
+        }
 
+        void stop_watch(eventloop_t &eloop) noexcept
+        {
+            watched_pid = -1;
         }
 
         void deregister(eventloop_t &loop, pid_t pid) noexcept
         {
-
+            watched_pid = -1;
         }
 
         void unreserve(eventloop_t &loop) noexcept
         {
 
         }
+
+        int send_signal(eventloop_t &loop, int signo) noexcept
+        {
+            if (watched_pid == -1) {
+                errno = ESRCH;
+                return -1;
+            }
+            return bp_sys::kill(watched_pid, signo);
+        }
     };
 
     template <typename Derived> class child_proc_watcher_impl : public child_proc_watcher
@@ -3,7 +3,13 @@
 #include <cerrno>
 #include <cassert>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "service.h"
+#include "service-cache.h"
 #include "test_service.h"
 #include "baseproc-sys.h"
 
@@ -389,6 +395,36 @@ void basic_test8()
     assert(sset.count_active_services() == 0);
 }
 
+// Service lookup by name remains correct as records are removed and replaced.
+void basic_test9()
+{
+    service_set sset;
+
+    service_record *s1 = new service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    service_record *s2 = new service_record(&sset, "test-service-2", service_type_t::INTERNAL, {});
+    sset.add_service(s1);
+    sset.add_service(s2);
+
+    assert(sset.find_service("test-service-1") == s1);
+    assert(sset.find_service("test-service-2") == s2);
+    assert(sset.find_service("test-service-3") == nullptr);
+
+    service_record *s1a = new service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    sset.replace_service(s1, s1a);
+    delete s1;
+
+    assert(sset.find_service("test-service-1") == s1a);
+    assert(sset.list_services().size() == 2);
+    assert(sset.list_services().front() == s1a);
+
+    sset.remove_service(s2);
+    delete s2;
+
+    assert(sset.find_service("test-service-2") == nullptr);
+    assert(sset.find_service("test-service-1") == s1a);
+    assert(sset.list_services().size() == 1);
+}
+
 // Test that service pinned in start state is not stopped when its dependency stops.
 void test_pin1()
 {
@@ -1284,6 +1320,167 @@ void test_other6()
     assert(sset.count_active_services() == 0);
 }
 
+// Check that dependency records keep their identity (and remain linked to their dependents) when
+// other dependencies are added or removed.
+void test_dep_records()
+{
+    service_set sset;
+
+    test_service *s1 = new test_service(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    test_service *s2 = new test_service(&sset, "test-service-2", service_type_t::INTERNAL, {});
+    test_service *s3 = new test_service(&sset, "test-service-3", service_type_t::INTERNAL, {});
+    test_service *s4 = new test_service(&sset, "test-service-4", service_type_t::INTERNAL,
+            {{s1, REG}, {s2, WAITS}});
+
+    sset.add_service(s1);
+    sset.add_service(s2);
+    sset.add_service(s3);
+    sset.add_service(s4);
+
+    service_dep *d1 = &s4->get_dependencies().front();
+    service_dep *d3 = &s4->add_dep(s3, REG);
+    assert(s4->get_dependencies().size() == 3);
+
+    s4->rm_dep(s2, WAITS);
+    assert(s4->get_dependencies().size() == 2);
+    assert(s2->get_dependents().empty());
+
+    auto i = s4->get_dependencies().begin();
+    assert(&*i == d1 && d1->get_to() == s1);
+    ++i;
+    assert(&*i == d3 && d3->get_to() == s3);
+    assert(s1->get_dependents().size() == 1 && s1->get_dependents().front() == d1);
+    assert(s3->get_dependents().size() == 1 && s3->get_dependents().front() == d3);
+
+    sset.start_service(s4);
+    assert(s1->get_state() == service_state_t::STARTING);
+    assert(s2->get_state() == service_state_t::STOPPED);
+    assert(s3->get_state() == service_state_t::STARTING);
+
+    s1->started();
+    s3->started();
+    sset.process_queues();
+    assert(s4->get_state() == service_state_t::STARTING);
+    s4->started();
+    sset.process_queues();
+    assert(s4->get_state() == service_state_t::STARTED);
+
+    sset.stop_service(s4);
+    assert(s1->get_state() == service_state_t::STOPPED);
+    assert(s3->get_state() == service_state_t::STOPPED);
+    assert(sset.count_active_services() == 0);
+}
+
+// Read the status page record for the service with the given id (by mapping the status page file,
+// as a monitoring process would). Returns false if there is no record for the service.
+static bool read_status_record(const char *path, uint32_t id, status_page_record &rec)
+{
+    int fd = open(path, O_RDONLY);
+    assert(fd != -1);
+    struct stat st;
+    assert(fstat(fd, &st) == 0);
+    void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    assert(mapping != MAP_FAILED);
+    close(fd);
+
+    const status_page_header *header = static_cast<const status_page_header *>(mapping);
+    assert(memcmp(header->magic, status_page_magic, sizeof(status_page_magic)) == 0);
+    assert(header->slot_size == sizeof(status_page_slot));
+    assert(sizeof(status_page_header) + header->num_slots * sizeof(status_page_slot) <= (size_t)st.st_size);
+
+    const status_page_slot *slots = reinterpret_cast<const status_page_slot *>(header + 1);
+    bool found = false;
+    for (uint32_t i = 0; i < header->num_slots && !found; i++) {
+        found = read_status_slot(slots[i], rec) && rec.service_id == id;
+    }
+
+    munmap(mapping, st.st_size);
+    return found;
+}
+
+// Check that service status is published to the status page.
+void test_status_page()
+{
+    const char *path = "status-page-test.tmp";
+
+    status_page page;
+    service_set sset;
+
+    test_service *s1 = new test_service(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    sset.add_service(s1);
+
+    std::string err;
+    assert(page.open(path, err));
+    sset.set_status_page(&page);
+
+    // The status page is accessible only to the owner:
+    struct stat st;
+    assert(stat(path, &st) == 0);
+    assert((st.st_mode & 0777) == 0600);
+
+    // Services added after the status page is set are also published:
+    test_service *s2 = new test_service(&sset, "test-service-2", service_type_t::INTERNAL, {{s1, REG}});
+    sset.add_service(s2);
+
+    status_page_record rec;
+    assert(read_status_record(path, s1->get_id(), rec));
+    assert(rec.state == (uint8_t)service_state_t::STOPPED);
+    assert(std::string(rec.name, rec.name_len) == "test-service-1");
+
+    event_loop.advance_time(time_val(5, 0));
+    sset.start_service(s2);
+    assert(read_status_record(path, s1->get_id(), rec));
+    assert(rec.state == (uint8_t)service_state_t::STARTING);
+    assert(rec.target_state == (uint8_t)service_state_t::STARTED);
+    assert(rec.transition_secs == 5);
+
+    s1->started();
+    sset.process_queues();
+    s2->started();
+    sset.process_queues();
+    assert(read_status_record(path, s1->get_id(), rec));
+    assert(rec.state == (uint8_t)service_state_t::STARTED);
+    assert(read_status_record(path, s2->get_id(), rec));
+    assert(rec.state == (uint8_t)service_state_t::STARTED);
+    assert(rec.flags == 8 /* marked active */);
+
+    // Restart counts:
+    s2->restart();
+    sset.process_queues();
+    s2->started();
+    sset.process_queues();
+    assert(read_status_record(path, s2->get_id(), rec));
+    assert(rec.state == (uint8_t)service_state_t::STARTED);
+    assert(rec.restart_count == 1);
+
+    sset.stop_service(s2);
+    assert(read_status_record(path, s2->get_id(), rec));
+    assert(rec.state == (uint8_t)service_state_t::STOPPED);
+
+    // A removed service is no longer published, and its slot is re-used:
+    uint32_t s2_slot = s2->status_slot;
+    s2->prepare_for_unload();
+    sset.remove_service(s2);
+    assert(!read_status_record(path, s2->get_id(), rec));
+    delete s2;
+    test_service *s3 = new test_service(&sset, "test-service-3", service_type_t::INTERNAL, {});
+    sset.add_service(s3);
+    assert(s3->status_slot == s2_slot);
+    assert(read_status_record(path, s3->get_id(), rec));
+
+    sset.set_status_page(nullptr);
+    page.close();
+    assert(access(path, F_OK) == -1);
+
+    // A slot left mid-update (odd sequence number) is reported as unreadable, rather than being
+    // retried forever:
+    status_page_slot slot {};
+    assert(read_status_slot(slot, rec));
+    assert(rec.service_id == 0);
+    slot.seq = 1;
+    assert(!read_status_slot(slot, rec));
+}
+
 static void flush_log(int fd)
 {
     while (! is_log_flushed()) {
@@ -1296,6 +1493,245 @@ static void flush_log(int fd)
     bp_sys::extract_written_data(0, wdata);
 }
 
+// Check that service start durations are recorded in the start history, which can be saved and
+// loaded again.
+void test_start_history()
+{
+    const char *path = "start-history-test.tmp";
+    unlink(path);
+
+    start_history history;
+    std::string err;
+    assert(!history.load(path, err) && errno == ENOENT);
+
+    service_set sset;
+    sset.set_start_history(&history);
+
+    test_service *s1 = new test_service(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    test_service *s2 = new test_service(&sset, "test-service-2", service_type_t::INTERNAL, {{s1, REG}});
+    sset.add_service(s1);
+    sset.add_service(s2);
+
+    // The time spent waiting for dependencies is not included:
+    sset.start_service(s2);
+    event_loop.advance_time(time_val(1, 0));
+    s1->started();
+    sset.process_queues();
+    event_loop.advance_time(time_val(0, 250000000));
+    s2->started();
+    sset.process_queues();
+    assert(s2->get_state() == service_state_t::STARTED);
+
+    assert(history.is_dirty());
+    assert(history.get_expected("test-service-1") == 1000);
+    assert(history.get_expected("test-service-2") == 250);
+    assert(history.get_expected("test-service-3") == 0);
+
+    // The expected duration is the median:
+    history.record("test-service-2", 100);
+    history.record("test-service-2", 900);
+    assert(history.get_expected("test-service-2") == 250);
+
+    // Only the most recent durations are kept:
+    for (unsigned i = 0; i < start_history::max_durations; i++) {
+        history.record("test-service-1", 10);
+    }
+    assert(history.get_histories().at("test-service-1").durations.size() == start_history::max_durations);
+    assert(history.get_expected("test-service-1") == 10);
+
+    assert(history.save());
+    assert(!history.is_dirty());
+
+    start_history loaded;
+    assert(loaded.load(path, err));
+    assert(loaded.get_expected("test-service-1") == 10);
+    assert(loaded.get_expected("test-service-2") == 250);
+    const start_history::service_history &hist = loaded.get_histories().at("test-service-2");
+    assert(hist.durations.size() == 3);
+    assert(hist.durations[0] == 250 && hist.durations[2] == 900);
+    assert(hist.new_count == 0);
+    assert(hist.unstarted_boots == 1);
+
+    sset.set_start_history(nullptr);
+    unlink(path);
+}
+
+// Write a start history file containing the given records (name and durations), with the given
+// number of boots since each service last started.
+static void write_start_history(const char *path,
+        const std::vector<std::pair<std::string, std::vector<uint32_t>>> &records,
+        uint32_t unstarted_boots = 0)
+{
+    cache_writer w;
+    w.write_bytes("DINITSH", 8);
+    w.write_num<uint32_t>(2);
+    w.write_num<uint32_t>(0x01020304);
+    w.write_num<uint32_t>(records.size());
+    for (auto &rec : records) {
+        w.write_str(rec.first);
+        w.write_num(unstarted_boots);
+        w.write_num<uint32_t>(rec.second.size());
+        for (uint32_t d : rec.second) {
+            w.write_num(d);
+        }
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    assert(fd != -1);
+    std::vector<char> &buf = w.get_buffer();
+    assert(write(fd, buf.data(), buf.size()) == (ssize_t)buf.size());
+    close(fd);
+}
+
+// Check that a start history file which lists a service more than once, or with too many durations,
+// is rejected, and that a service's durations are kept to max_durations.
+void test_start_history_corrupt()
+{
+    const char *path = "start-history-test.tmp";
+    std::string err;
+    std::vector<uint32_t> full(start_history::max_durations, 100);
+
+    start_history history;
+    write_start_history(path, {{"test-service-1", full}, {"test-service-2", {200}}});
+    assert(history.load(path, err));
+    assert(history.get_expected("test-service-1") == 100);
+
+    // A service which appears twice would otherwise have twice max_durations durations:
+    write_start_history(path, {{"test-service-1", full}, {"test-service-1", full}});
+    assert(!history.load(path, err) && errno == 0);
+    assert(history.get_histories().empty());
+    assert(history.get_expected("test-service-1") == 0);
+
+    // More than max_durations durations, as the last record:
+    std::vector<uint32_t> too_many(start_history::max_durations + 1, 100);
+    write_start_history(path, {{"test-service-2", {200}}, {"test-service-1", too_many}});
+    assert(!history.load(path, err) && errno == 0);
+    assert(history.get_histories().empty());
+
+    // Recording keeps only the most recent durations:
+    for (unsigned i = 0; i < start_history::max_durations * 2; i++) {
+        history.record("test-service-1", i);
+    }
+    const std::vector<uint32_t> &durations = history.get_histories().at("test-service-1").durations;
+    assert(durations.size() == start_history::max_durations);
+    assert(durations.back() == start_history::max_durations * 2 - 1);
+
+    unlink(path);
+}
+
+// Check that the history of a service which has not started for several boots is discarded.
+void test_start_history_prune()
+{
+    const char *path = "start-history-test.tmp";
+    std::string err;
+
+    start_history history;
+    write_start_history(path, {{"test-service-1", {100}}, {"test-service-2", {200}}});
+    assert(history.load(path, err));
+    assert(history.is_dirty());
+
+    // Only test-service-1 starts in each subsequent boot:
+    for (unsigned i = 0; i < start_history::max_unstarted_boots; i++) {
+        assert(history.get_expected("test-service-2") == 200);
+        history.record("test-service-1", 100);
+        assert(history.save());
+        assert(history.load(path, err));
+    }
+
+    assert(history.get_expected("test-service-1") == 100);
+    assert(history.get_expected("test-service-2") == 0);
+    assert(history.get_histories().count("test-service-2") == 0);
+
+    // The count is bounded even in a file which has not been pruned:
+    write_start_history(path, {{"test-service-2", {200}}}, UINT32_MAX);
+    assert(history.load(path, err));
+    assert(history.get_histories().empty());
+    assert(history.is_dirty());
+
+    unlink(path);
+}
+
+// Find the first timeline entry for the given service and event, at or after the given position.
+static size_t find_timeline_entry(const service_timeline &timeline, uint32_t id, timeline_event_t event,
+        size_t pos = 0)
+{
+    for (size_t i = pos; i < timeline.size(); i++) {
+        if (timeline[i].service_id == id && timeline[i].event == event) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Check that service state transitions are recorded in the timeline, including the dependency which
+// was last to start.
+void test_timeline()
+{
+    service_set sset;
+
+    test_service *s1 = new test_service(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    test_service *s2 = new test_service(&sset, "test-service-2", service_type_t::INTERNAL, {});
+    test_service *s3 = new test_service(&sset, "test-service-3", service_type_t::INTERNAL,
+            {{s1, REG}, {s2, REG}});
+    sset.add_service(s1);
+    sset.add_service(s2);
+    sset.add_service(s3);
+
+    const service_timeline &timeline = sset.get_timeline();
+    assert(timeline.size() == 0);
+
+    time_val start_time;
+    event_loop.get_time(start_time, clock_type::MONOTONIC);
+
+    sset.start_service(s3);
+    event_loop.advance_time(time_val(2, 0));
+    s2->started();
+    sset.process_queues();
+    event_loop.advance_time(time_val(1, 0));
+    s1->started();
+    sset.process_queues();
+    event_loop.advance_time(time_val(0, 500000000));
+    s3->started();
+    sset.process_queues();
+    assert(s3->get_state() == service_state_t::STARTED);
+
+    size_t i = find_timeline_entry(timeline, s3->get_id(), timeline_event_t::STARTING);
+    assert(i != (size_t)-1);
+    assert(timeline[i].secs == start_time.seconds());
+
+    // s1 was the last dependency to start:
+    i = find_timeline_entry(timeline, s3->get_id(), timeline_event_t::DEPS_STARTED, i);
+    assert(i != (size_t)-1);
+    assert(timeline[i].related_id == s1->get_id());
+    assert(timeline[i].secs == start_time.seconds() + 3);
+
+    i = find_timeline_entry(timeline, s3->get_id(), timeline_event_t::STARTED, i);
+    assert(i != (size_t)-1);
+    assert(timeline[i].secs * 1000000000 + timeline[i].nsecs
+            == start_time.seconds() * 1000000000 + start_time.nseconds() + 3500000000);
+
+    i = find_timeline_entry(timeline, s2->get_id(), timeline_event_t::STARTED);
+    assert(i != (size_t)-1);
+    assert(timeline[i].secs == start_time.seconds() + 2);
+
+    sset.stop_service(s3);
+    sset.process_queues();
+    i = find_timeline_entry(timeline, s3->get_id(), timeline_event_t::STOPPED);
+    assert(i != (size_t)-1);
+    assert(timeline[i].detail == (uint8_t)stopped_reason_t::NORMAL);
+    assert(timeline.get_dropped() == 0);
+
+    // Once full, the oldest entries are overwritten:
+    service_timeline small_timeline(3);
+    for (uint32_t id = 1; id <= 5; id++) {
+        small_timeline.record(id, 0, id, timeline_event_t::STARTED);
+    }
+    assert(small_timeline.size() == 3);
+    assert(small_timeline.get_dropped() == 2);
+    assert(small_timeline[0].service_id == 3);
+    assert(small_timeline[2].service_id == 5);
+}
+
 void test_log1()
 {
     // Basic test that output to log is written to log file
@@ -1384,6 +1820,7 @@ int main(int argc, char **argv)
     RUN_TEST(basic_test6, "               ");
     RUN_TEST(basic_test7, "               ");
     RUN_TEST(basic_test8, "               ");
+    RUN_TEST(basic_test9, "               ");
     RUN_TEST(test_pin1, "                 ");
     RUN_TEST(test_pin2, "                 ");
     RUN_TEST(test_pin3, "                 ");
@@ -1408,6 +1845,12 @@ int main(int argc, char **argv)
     RUN_TEST(test_other4, "               ");
     RUN_TEST(test_other5, "               ");
     RUN_TEST(test_other6, "               ");
+    RUN_TEST(test_dep_records, "          ");
+    RUN_TEST(test_status_page, "          ");
+    RUN_TEST(test_timeline, "             ");
+    RUN_TEST(test_start_history, "        ");
+    RUN_TEST(test_start_history_corrupt, "");
+    RUN_TEST(test_start_history_prune, "  ");
     RUN_TEST(test_log1, "                 ");
     RUN_TEST(test_log2, "                 ");
 }